@@ -0,0 +1,174 @@
+#include "arena.h"
+
+/**
+ * @brief Allocates the memory of the arena, called once at startup
+ *
+ * @param arena
+ * @param size capacity in bytes
+ * @return int 1 if an allocation error occurred, 0 otherwise
+ */
+int arena_init(ipk_arena *arena, size_t size)
+{
+    arena->base = (char *) malloc(size);
+    arena->size = size;
+    arena->used = 0;
+
+    if (arena->base == NULL)
+    {
+        fprintf(stderr, "ERR: Memory allocation failed!\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Takes the next piece of the arena
+ *
+ * @param arena
+ * @param size number of bytes
+ * @return void* NULL if the arena is full
+ */
+void *arena_alloc(ipk_arena *arena, size_t size)
+{
+    size_t start = (arena->used + 7) & ~(size_t) 7;
+
+    if (start + size > arena->size) return NULL;
+
+    arena->used = start + size;
+    return arena->base + start;
+}
+
+/**
+ * @brief strdup into the arena
+ *
+ * @param arena
+ * @param s
+ * @return char* NULL if the arena is full
+ */
+char *arena_strdup(ipk_arena *arena, const char *s)
+{
+    size_t length = strlen(s) + 1;
+    char *copy = (char *) arena_alloc(arena, length);
+
+    if (copy != NULL) memcpy(copy, s, length);
+    return copy;
+}
+
+/**
+ * @brief Releases everything allocated from the arena
+ *
+ * @param arena
+ */
+void arena_reset(ipk_arena *arena)
+{
+    arena->used = 0;
+}
+
+/**
+ * @brief Free memmory
+ *
+ * @param arena
+ */
+void arena_free(ipk_arena *arena)
+{
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = arena->used = 0;
+}
+
+/**
+ * @brief All slots are free
+ *
+ * @param pool
+ */
+void pool_init(ipk_pool *pool)
+{
+    pool->used = 0;
+}
+
+/**
+ * @brief Copies the string into a free slot
+ *
+ * @param pool
+ * @param s
+ * @return char* NULL if there is no free slot or the string is too long
+ */
+char *pool_strdup(ipk_pool *pool, const char *s)
+{
+    size_t length = strlen(s) + 1;
+
+    for (int i = 0; i < POOL_SLOTS && length <= POOL_SLOT_SIZE; i++)
+    {
+        if (pool->used & (1u << i)) continue;
+
+        pool->used |= 1u << i;
+        memcpy(pool->slots[i], s, length);
+        return pool->slots[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns the slot of the string, NULL is ignored
+ *
+ * @param pool
+ * @param s string from pool_strdup
+ */
+void pool_free(ipk_pool *pool, char *s)
+{
+    if (s == NULL) return;
+
+    int i = (int) ((s - pool->slots[0]) / POOL_SLOT_SIZE);
+    if (i >= 0 && i < POOL_SLOTS) pool->used &= ~(1u << i);
+}
+
+#ifdef IPK_MALLOC_GUARD
+// verification build (make MALLOC_GUARD=1), the heap may only be used during startup
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static int malloc_sealed = 0;
+
+static void malloc_guard_abort()
+{
+    static const char message[] = "ERR: malloc called after startup!\n";
+    write(STDERR_FILENO, message, sizeof(message) - 1);
+    abort();
+}
+
+void *malloc(size_t size)
+{
+    if (malloc_sealed) malloc_guard_abort();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    if (malloc_sealed) malloc_guard_abort();
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (malloc_sealed) malloc_guard_abort();
+    return __libc_realloc(ptr, size);
+}
+
+/**
+ * @brief Startup is over, any further malloc aborts the program
+ *
+ */
+void arena_seal()
+{
+    malloc_sealed = 1;
+}
+#else
+/**
+ * @brief Startup is over, only checked in the MALLOC_GUARD build
+ *
+ */
+void arena_seal()
+{
+}
+#endif
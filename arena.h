@@ -0,0 +1,39 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ARENA_ITERATION_SIZE 16384  // everything one loop iteration needs (copies of a 1500 B response, messages)
+#define ARENA_FLIGHT_SIZE 4096      // the UDP message waiting for CONFIRM
+#define POOL_SLOTS 8                // session strings (display name, username, secret, channel)
+#define POOL_SLOT_SIZE 160          // the longest one is the 128 character secret
+
+// bump allocator, everything is released at once by arena_reset
+typedef struct ipk_arena
+{
+    char *base;
+    size_t size;
+    size_t used;
+} ipk_arena;
+
+// fixed slots for strings that live for the whole session
+typedef struct ipk_pool
+{
+    char slots[POOL_SLOTS][POOL_SLOT_SIZE];
+    unsigned used;                  // bit i set if slot i is taken
+} ipk_pool;
+
+int arena_init(ipk_arena *arena, size_t size);
+void *arena_alloc(ipk_arena *arena, size_t size);
+char *arena_strdup(ipk_arena *arena, const char *s);
+void arena_reset(ipk_arena *arena);
+void arena_free(ipk_arena *arena);
+void pool_init(ipk_pool *pool);
+char *pool_strdup(ipk_pool *pool, const char *s);
+void pool_free(ipk_pool *pool, char *s);
+void arena_seal();
+
+#endif
@@ -0,0 +1,726 @@
+#include "bridge.h"
+#include "udp_id_history.h"
+
+// the arguments of a generated encoder taken from a decoded message
+#define BRIDGE_ARG(NAME, field, keyword, kind, cls) , view->field
+#define BRIDGE_TO_UDP(NAME, name, code, keyword) \
+    case code: \
+        failed = udp_encode_##name(&arena, &buff, &length, &s->lsb, &s->msb IPK_FIELDS_##NAME(BRIDGE_ARG)); \
+        break;
+#define BRIDGE_TO_TCP(NAME, name, code, keyword) \
+    case code: \
+        if (arena.size < IPK_TEXT_MAX_##NAME) return 1; \
+        failed = tcp_encode_##name(&arena, &buff IPK_FIELDS_##NAME(BRIDGE_ARG)); \
+        break;
+
+_Static_assert(BRIDGE_TEXT_SIZE >= 2 * IPK_TEXT_MAX_MSG, "the TCP buffers must hold the longest message");
+
+static char bridge_name[] = BRIDGE_NAME;
+
+/**
+ * @brief Takes a free session
+ *
+ * @param bridge
+ * @param tcp the TCP side
+ * @param udp socket of the UDP side
+ * @param peer where the UDP side is
+ * @param peer_len
+ * @return ipk_bridge_session* NULL if all sessions are used
+ */
+static ipk_bridge_session *bridge_open(ipk_bridge *bridge, int tcp, int udp, struct sockaddr *peer, socklen_t peer_len)
+{
+    ipk_clock clock = {.now = rel_monotonic, .ctx = NULL};
+
+    for (int i = 0; i < BRIDGE_SESSIONS; i++)
+    {
+        ipk_bridge_session *s = &bridge->sessions[i];
+        if (s->used) continue;
+
+        s->used = 1;
+        s->tcp = tcp;
+        s->udp = udp;
+        s->connecting = s->closing = s->switched = 0;
+        memcpy(&s->peer, peer, peer_len);
+        ipk_transport transport = {.send = rel_socket_send, .recv = rel_socket_recv, .connect = rel_socket_connect, .ctx = &s->udp};
+        rel_init(&s->rel, clock, transport, (struct sockaddr *) &s->peer, peer_len, bridge->conf_timeout, bridge->max_retx, NULL);
+        s->lsb = s->msb = 0;
+        s->request_id = 0;
+        s->udp_err = NULL;
+        s->udp_bye = 0;
+        s->in_start = s->in_used = 0;
+        s->out_start = s->out_used = 0;
+        return s;
+    }
+    fprintf(stderr, "ERR: Too many bridged sessions!\n");
+    return NULL;
+}
+
+/**
+ * @brief Closes both sides and frees the session
+ *
+ * @param s
+ */
+static void bridge_close(ipk_bridge_session *s)
+{
+    if (s->tcp >= 0) close(s->tcp);
+    close(s->udp);
+    free_list(s->rel.seen);
+    s->used = 0;
+}
+
+/**
+ * @brief Translates a message to the UDP side, it is built right in the slot kept
+ * for the retransmissions, so the fields are copied once
+ *
+ * @param s
+ * @param view decoded TCP message
+ * @return int 1 if the window is full, -1 if it can't be sent, 0 otherwise
+ */
+static int bridge_to_udp(ipk_bridge_session *s, ipk_view *view)
+{
+    char *slot = rel_buffer(&s->rel);
+    if (slot == NULL) return 1;
+
+    ipk_arena arena = {.base = slot, .size = REL_SLOT_SIZE, .used = 0};
+    uint16_t id = (uint16_t) (s->msb << 8 | s->lsb);
+    char *buff = NULL;
+    size_t length = 0;
+    int failed = 1;
+
+    if (view->type == IPK_REPLY) view->ref_id = s->request_id;
+    switch (view->type)
+    {
+        IPK_TEXT_MESSAGES(BRIDGE_TO_UDP)
+        default:
+            break;
+    }
+    if (failed || rel_send(&s->rel, buff, length, id)) return -1;
+
+    message_id_increase(&s->lsb, &s->msb);
+    return 0;
+}
+
+/**
+ * @brief Translates a message to the TCP side, it is built right in the output buffer
+ *
+ * @param s
+ * @param view decoded UDP message
+ * @return int 1 if the output buffer has no room, -1 if the message can't be translated, 0 otherwise
+ */
+static int bridge_to_tcp(ipk_bridge_session *s, ipk_view *view)
+{
+    ipk_arena arena = {.base = s->out + s->out_used, .size = BRIDGE_TEXT_SIZE - s->out_used, .used = 0};
+    char *buff = NULL;
+    int failed = 1;
+
+    switch (view->type)
+    {
+        IPK_TEXT_MESSAGES(BRIDGE_TO_TCP)
+        default:
+            break;
+    }
+    if (failed) return -1;
+
+    s->out_used += strlen(buff);
+    return 0;
+}
+
+/**
+ * @brief Sends the ERR and BYE of the bridge queued for the UDP side while the window has room,
+ * the rest waits for a CONFIRM
+ *
+ * @param s
+ */
+static void bridge_say_udp(ipk_bridge_session *s)
+{
+    ipk_view view = {.type = IPK_ERR, .display_name = bridge_name, .content = s->udp_err};
+    int result;
+
+    if (s->udp_err != NULL)
+    {
+        if ((result = bridge_to_udp(s, &view)) == 1) return;
+        s->udp_err = NULL;
+        // BYE can't follow an ERR that was not sent
+        if (result < 0) s->udp_bye = 0;
+    }
+
+    view.type = IPK_BYE;
+    if (s->udp_bye && bridge_to_udp(s, &view) != 1) s->udp_bye = 0;
+}
+
+/**
+ * @brief Sends ERR (if there is a reason) and BYE to one side, from the bridge itself,
+ * for the UDP side they wait for room in the window instead of being lost
+ *
+ * @param s
+ * @param to_tcp 1 the TCP side, 0 the UDP side
+ * @param reason content of the ERR, NULL for only BYE
+ */
+static void bridge_say(ipk_bridge_session *s, int to_tcp, char *reason)
+{
+    ipk_view view = {.type = IPK_ERR, .display_name = bridge_name, .content = reason};
+
+    if (!to_tcp)
+    {
+        s->udp_err = reason;
+        s->udp_bye = 1;
+        bridge_say_udp(s);
+        return;
+    }
+
+    if (s->tcp < 0) return;
+    if (reason != NULL) bridge_to_tcp(s, &view);
+
+    view.type = IPK_BYE;
+    bridge_to_tcp(s, &view);
+}
+
+/**
+ * @brief A side sent something that is not a message, it gets ERR and BYE, the other side BYE
+ *
+ * @param s
+ * @param from_tcp the side that sent it
+ */
+static void bridge_malformed(ipk_bridge_session *s, int from_tcp)
+{
+    bridge_say(s, from_tcp, "Malformed message");
+    bridge_say(s, !from_tcp, NULL);
+    s->closing = 1;
+}
+
+/**
+ * @brief The UDP side does not respond, the TCP side is told why and gets BYE
+ *
+ * @param s
+ * @param reason
+ */
+static void bridge_udp_lost(ipk_bridge_session *s, char *reason)
+{
+    rel_reset(&s->rel);
+    s->udp_err = NULL;
+    s->udp_bye = 0;
+    if (!s->closing) bridge_say(s, 1, reason);
+    s->closing = 1;
+}
+
+/**
+ * @brief The TCP side is gone, nothing can be written to it, the UDP side gets BYE
+ *
+ * @param s
+ * @param reason content of ERR for the UDP side, NULL if the TCP side just ended
+ */
+static void bridge_tcp_lost(ipk_bridge_session *s, char *reason)
+{
+    close(s->tcp);
+    s->tcp = -1;
+    s->out_start = s->out_used = 0;
+    if (!s->closing) bridge_say(s, 0, reason);
+    s->closing = 1;
+}
+
+/**
+ * @brief Writes what the TCP side can take, the rest waits for POLLOUT
+ *
+ * @param s
+ */
+static void bridge_flush(ipk_bridge_session *s)
+{
+    while (s->tcp >= 0 && !s->connecting && s->out_start < s->out_used)
+    {
+        ssize_t sent = send(s->tcp, s->out + s->out_start, s->out_used - s->out_start, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+            bridge_tcp_lost(s, NULL);
+            return;
+        }
+        s->out_start += sent;
+    }
+    // the buffer is reused from its start only when it is empty, nothing is moved
+    if (s->out_start == s->out_used) s->out_start = s->out_used = 0;
+}
+
+/**
+ * @brief Sends CONFIRM to the UDP side
+ *
+ * @param s
+ * @param id MessageID of the confirmed message
+ */
+static void bridge_confirm(ipk_bridge_session *s, uint16_t id)
+{
+    char confirm[IPK_BIN_MAX_CONFIRM];
+    ipk_arena arena = {.base = confirm, .size = sizeof(confirm), .used = 0};
+    uint8_t lsb = (uint8_t) (id & 0xFF);
+    uint8_t msb = (uint8_t) (id >> 8);
+    char *buff;
+    size_t length;
+
+    if (!udp_encode_confirm(&arena, &buff, &length, &lsb, &msb)) rel_confirm(&s->rel, buff, length);
+}
+
+/**
+ * @brief Translates the complete TCP lines while the UDP window has room,
+ * the rest stays in the buffer until a CONFIRM frees a slot
+ *
+ * @param s
+ */
+static void bridge_lines(ipk_bridge_session *s)
+{
+    while (!s->closing && s->in_start < s->in_used && !rel_full(&s->rel))
+    {
+        char *line = s->in + s->in_start;
+        size_t left = s->in_used - s->in_start;
+        size_t length = scan_crlf(line, left);
+        ipk_view view;
+
+        if (length == left)
+        {
+            // no message is as long as the whole buffer
+            if (left == BRIDGE_TEXT_SIZE) bridge_malformed(s, 1);
+            break;
+        }
+
+        s->in_start += length + 2;
+        line[length] = '\0';
+        if (tcp_decode(line, length, &view) || bridge_to_udp(s, &view))
+        {
+            bridge_malformed(s, 1);
+            break;
+        }
+        if (view.type == IPK_BYE) s->closing = 1;
+    }
+    if (s->in_start == s->in_used) s->in_start = s->in_used = 0;
+}
+
+/**
+ * @brief Reads from the TCP side, only a line cut by the end of the buffer is moved to its start
+ *
+ * @param s
+ */
+static void bridge_read(ipk_bridge_session *s)
+{
+    if (s->in_used == BRIDGE_TEXT_SIZE && s->in_start > 0)
+    {
+        memmove(s->in, s->in + s->in_start, s->in_used - s->in_start);
+        s->in_used -= s->in_start;
+        s->in_start = 0;
+    }
+
+    ssize_t length = recv(s->tcp, s->in + s->in_used, BRIDGE_TEXT_SIZE - s->in_used, 0);
+    if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (length <= 0)
+    {
+        bridge_tcp_lost(s, NULL);
+        return;
+    }
+    s->in_used += length;
+    bridge_lines(s);
+}
+
+/**
+ * @brief The upstream TCP connect finished
+ *
+ * @param s
+ */
+static void bridge_connected(ipk_bridge_session *s)
+{
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+
+    if (getsockopt(s->tcp, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error != 0)
+    {
+        fprintf(stderr, "ERR: Failed to connect to the server!\n");
+        bridge_tcp_lost(s, "Can't connect to the server");
+        return;
+    }
+    s->connecting = 0;
+}
+
+/**
+ * @brief One datagram from the UDP side: a CONFIRM frees its slot, anything else is confirmed,
+ * a retransmission is dropped and the rest is translated. A message the TCP side has no room for
+ * is not confirmed, so the UDP side sends it again later.
+ *
+ * @param bridge
+ * @param s
+ * @param buff the datagram
+ * @param length
+ * @param from its sender
+ */
+static void bridge_datagram(ipk_bridge *bridge, ipk_bridge_session *s, char *buff, size_t length, struct sockaddr *from)
+{
+    ipk_view view;
+    int malformed = udp_decode(buff, length, &view);
+    int result = 0;
+
+    if (length < 3) return;
+    if (view.type == IPK_CONFIRM)
+    {
+        rel_ack(&s->rel, view.id);
+        return;
+    }
+
+    int duplicate = search_node(s->rel.seen, view.id) != NULL;
+    if (!duplicate && !s->closing)
+    {
+        // like the client, everything after the first REPLY goes to the port it came from
+        if (bridge->udp_upstream && !s->switched && view.type == IPK_REPLY)
+        {
+            rel_switch_port(&s->rel, from);
+            s->switched = 1;
+        }
+        if (!malformed && (result = bridge_to_tcp(s, &view)) == 1) return;
+        if (view.type == IPK_AUTH || view.type == IPK_JOIN) s->request_id = view.id;
+    }
+
+    bridge_confirm(s, view.id);
+    rel_duplicate(&s->rel, view.id);
+    if (duplicate || s->closing) return;
+
+    if (malformed || result < 0) bridge_malformed(s, 0);
+    else if (view.type == IPK_BYE) s->closing = 1;
+    bridge_flush(s);
+}
+
+/**
+ * @brief Receives on the socket of the session
+ *
+ * @param bridge
+ * @param s
+ */
+static void bridge_receive(ipk_bridge *bridge, ipk_bridge_session *s)
+{
+    static char buff[REL_SLOT_SIZE];
+    struct sockaddr_storage from;
+    socklen_t from_len = sizeof(from);
+
+    ssize_t length = rel_recv(&s->rel, buff, sizeof(buff), (struct sockaddr *) &from, &from_len);
+    if (length < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+        bridge_udp_lost(s, errno == ECONNREFUSED ? "Server is unreachable" : "Can't receive from the UDP side");
+        return;
+    }
+    bridge_datagram(bridge, s, buff, length, (struct sockaddr *) &from);
+}
+
+/**
+ * @brief After a signal, waits until the UDP side confirmed the last messages of every session
+ * (BYE, retransmitted by -r), but at most limit ms
+ *
+ * @param bridge
+ * @param fds room for a descriptor of every session
+ * @param limit ms, the timeout of the last retransmission
+ */
+static void bridge_drain(ipk_bridge *bridge, struct pollfd *fds, long long limit)
+{
+    ipk_bridge_session *polled[BRIDGE_SESSIONS];
+    long long deadline = rel_monotonic(NULL) + limit;
+
+    while (1)
+    {
+        int count = 0;
+        int timeout = (int) (deadline - rel_monotonic(NULL));
+
+        if (timeout <= 0) return;
+        for (int i = 0; i < BRIDGE_SESSIONS; i++)
+        {
+            ipk_bridge_session *s = &bridge->sessions[i];
+            if (!s->used || (rel_idle(&s->rel) && !s->udp_bye)) continue;
+
+            int wait = rel_wait(&s->rel);
+            if (wait >= 0 && wait < timeout) timeout = wait;
+            polled[count] = s;
+            fds[count].fd = s->udp;
+            fds[count++].events = POLLIN;
+        }
+        if (count == 0) return;
+
+        if (poll(fds, count, timeout) < 0 && errno != EINTR) return;
+        for (int i = 0; i < count; i++)
+        {
+            ipk_bridge_session *s = polled[i];
+
+            if (fds[i].revents & (POLLIN | POLLERR)) bridge_receive(bridge, s);
+            if (rel_timeout(&s->rel) < 0) bridge_udp_lost(s, NULL);
+            bridge_say_udp(s);
+        }
+    }
+}
+
+/**
+ * @brief A new local TCP client, its UDP session starts at the server address
+ *
+ * @param bridge
+ * @param listen_socket
+ */
+static void bridge_accept(ipk_bridge *bridge, int listen_socket)
+{
+    int tcp = accept4(listen_socket, NULL, NULL, SOCK_NONBLOCK);
+    if (tcp < 0) return;
+
+    int udp = socket(bridge->server.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (udp < 0)
+    {
+        fprintf(stderr, "ERR: Creating socket!\n");
+        close(tcp);
+        return;
+    }
+    udp_recverr(udp, bridge->server.ss_family, 1);
+
+    if (bridge_open(bridge, tcp, udp, (struct sockaddr *) &bridge->server, bridge->server_len) == NULL)
+    {
+        close(tcp);
+        close(udp);
+    }
+}
+
+/**
+ * @brief A datagram on the listening port: a retransmission for a known local UDP client,
+ * or the AUTH of a new one. The new session answers from its own port and connects to the server.
+ *
+ * @param bridge
+ * @param listen_socket
+ */
+static void bridge_listen_datagram(ipk_bridge *bridge, int listen_socket)
+{
+    static char buff[REL_SLOT_SIZE];
+    struct sockaddr_storage from;
+    socklen_t from_len = sizeof(from);
+    ipk_bridge_session *s = NULL;
+    ipk_view view;
+
+    ssize_t length = recvfrom(listen_socket, buff, sizeof(buff), MSG_DONTWAIT, (struct sockaddr *) &from, &from_len);
+    if (length < 3) return;
+
+    for (int i = 0; i < BRIDGE_SESSIONS && s == NULL; i++)
+    {
+        ipk_bridge_session *known = &bridge->sessions[i];
+        if (known->used && known->rel.server_len == from_len && !memcmp(&known->peer, &from, from_len)) s = known;
+    }
+
+    if (s == NULL)
+    {
+        if (udp_decode(buff, length, &view) || view.type != IPK_AUTH) return;
+
+        int udp = socket(from.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        int tcp = socket(bridge->server.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (udp < 0 || tcp < 0 || (connect(tcp, (struct sockaddr *) &bridge->server, bridge->server_len) < 0 && errno != EINPROGRESS)
+            || (s = bridge_open(bridge, tcp, udp, (struct sockaddr *) &from, from_len)) == NULL)
+        {
+            fprintf(stderr, "ERR: Failed to connect to the server!\n");
+            if (udp >= 0) close(udp);
+            if (tcp >= 0) close(tcp);
+            return;
+        }
+        s->connecting = 1;
+        // the session socket is connected to the client, it only hears from it
+        rel_switch_port(&s->rel, (struct sockaddr *) &from);
+    }
+    bridge_datagram(bridge, s, buff, length, (struct sockaddr *) &from);
+}
+
+/**
+ * @brief Resolves the server, the first address in the Happy Eyeballs order is used by all sessions
+ *
+ * @param bridge
+ * @param host
+ * @param port
+ * @return int 1 if the server has no usable address, 0 otherwise
+ */
+static int bridge_resolve(ipk_bridge *bridge, char *host, char *port)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = bridge->udp_upstream ? SOCK_DGRAM : SOCK_STREAM};
+    struct addrinfo *info;
+    struct addrinfo *order[HE_MAX_ADDRESSES];
+
+    if (getaddrinfo(host, port, &hints, &info) != 0)
+    {
+        fprintf(stderr, "ERR: Failed to get address info for %s!\n", host);
+        return 1;
+    }
+    if (he_order(info, order, HE_MAX_ADDRESSES) == 0)
+    {
+        fprintf(stderr, "ERR: Failed to get address info for %s!\n", host);
+        freeaddrinfo(info);
+        return 1;
+    }
+    memcpy(&bridge->server, order[0]->ai_addr, order[0]->ai_addrlen);
+    bridge->server_len = order[0]->ai_addrlen;
+    freeaddrinfo(info);
+    return 0;
+}
+
+/**
+ * @brief Listens on the loopback addresses, the local side uses the other variant than the server
+ *
+ * @param bridge
+ * @param listen_port
+ * @return int 1 if no address could be bound, 0 otherwise
+ */
+static int bridge_listen(ipk_bridge *bridge, char *listen_port)
+{
+    int socktype = bridge->udp_upstream ? SOCK_STREAM : SOCK_DGRAM;
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = socktype};
+    struct addrinfo *info;
+    int on = 1;
+
+    // without AI_PASSIVE the addresses are the loopback ones
+    if (getaddrinfo(NULL, listen_port, &hints, &info) != 0)
+    {
+        fprintf(stderr, "ERR: Failed to get address info for port %s!\n", listen_port);
+        return 1;
+    }
+
+    for (struct addrinfo *p = info; p != NULL && bridge->listen_count < BRIDGE_LISTEN_MAX; p = p->ai_next)
+    {
+        int s = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK, p->ai_protocol);
+        if (s < 0) continue;
+
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (p->ai_family == AF_INET6) setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+        if (bind(s, p->ai_addr, p->ai_addrlen) < 0 || (socktype == SOCK_STREAM && listen(s, SOMAXCONN) < 0))
+        {
+            close(s);
+            continue;
+        }
+        bridge->listen[bridge->listen_count++] = s;
+    }
+    freeaddrinfo(info);
+
+    if (bridge->listen_count == 0)
+    {
+        fprintf(stderr, "ERR: Can't listen on port %s!\n", listen_port);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Translates between local clients and the server until a signal comes, the local side speaks
+ * TCP if the server speaks UDP and the other way round. Every session has its own UDP socket, its own
+ * reliability layer and both TCP buffers, so one slow session does not hold up the others.
+ *
+ * @param host the server
+ * @param port
+ * @param listen_port local port, loopback only
+ * @param udp_upstream 1 the server speaks UDP, 0 TCP
+ * @param conf_timeout UDP confirmation timeout in ms
+ * @param max_retx UDP retransmissions
+ * @param stop set by the signal handler
+ * @return int exit code
+ */
+int bridge_run(char *host, char *port, char *listen_port, int udp_upstream, int conf_timeout, int max_retx, volatile sig_atomic_t *stop)
+{
+    static ipk_bridge bridge;
+    static struct pollfd fds[BRIDGE_LISTEN_MAX + 2 * BRIDGE_SESSIONS];
+    int polled[BRIDGE_SESSIONS];        // where the session is in fds, -1 if it was not polled
+
+    bridge.udp_upstream = udp_upstream;
+    bridge.conf_timeout = conf_timeout;
+    bridge.max_retx = max_retx;
+    if (bridge_resolve(&bridge, host, port) || bridge_listen(&bridge, listen_port)) return 1;
+
+    while (!*stop)
+    {
+        int count = 0;
+        int timeout = -1;
+        int free_sessions = 0;
+
+        for (int i = 0; i < BRIDGE_SESSIONS; i++) free_sessions += !bridge.sessions[i].used;
+
+        // local TCP clients wait in the backlog while all sessions are used
+        for (int i = 0; i < bridge.listen_count; i++)
+        {
+            fds[count].fd = !udp_upstream || free_sessions > 0 ? bridge.listen[i] : -1;
+            fds[count++].events = POLLIN;
+        }
+
+        for (int i = 0; i < BRIDGE_SESSIONS; i++)
+        {
+            ipk_bridge_session *s = &bridge.sessions[i];
+            short events = 0;
+
+            polled[i] = -1;
+            if (!s->used) continue;
+
+            polled[i] = count;
+            if (s->connecting) events = POLLOUT;
+            else if (s->tcp >= 0)
+            {
+                if (!s->closing && s->in_used < BRIDGE_TEXT_SIZE && !rel_full(&s->rel)) events |= POLLIN;
+                if (s->out_start < s->out_used) events |= POLLOUT;
+            }
+            fds[count].fd = events ? s->tcp : -1;
+            fds[count++].events = events;
+            fds[count].fd = s->udp;
+            fds[count++].events = POLLIN;
+
+            int wait = rel_wait(&s->rel);
+            if (wait >= 0 && (timeout < 0 || wait < timeout)) timeout = wait;
+        }
+
+        if (poll(fds, count, timeout) < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "ERR: Poll!\n");
+            break;
+        }
+        if (*stop) break;
+
+        for (int i = 0; i < bridge.listen_count; i++)
+        {
+            if (!(fds[i].revents & POLLIN)) continue;
+
+            if (udp_upstream) bridge_accept(&bridge, bridge.listen[i]);
+            else bridge_listen_datagram(&bridge, bridge.listen[i]);
+        }
+
+        for (int i = 0; i < BRIDGE_SESSIONS; i++)
+        {
+            ipk_bridge_session *s = &bridge.sessions[i];
+
+            // a session opened in this iteration was not polled
+            if (polled[i] < 0) continue;
+
+            struct pollfd *tcp_fd = &fds[polled[i]];
+            struct pollfd *udp_fd = &fds[polled[i] + 1];
+
+            if (tcp_fd->revents)
+            {
+                if (s->connecting) bridge_connected(s);
+                else
+                {
+                    if (tcp_fd->events & POLLIN) bridge_read(s);
+                    if (tcp_fd->events & POLLOUT) bridge_flush(s);
+                }
+            }
+            if (udp_fd->revents & (POLLIN | POLLERR)) bridge_receive(&bridge, s);
+
+            int timed_out = rel_timeout(&s->rel);
+            if (timed_out < 0) bridge_udp_lost(s, "The UDP side does not respond");
+
+            bridge_say_udp(s);
+            bridge_lines(s);
+            bridge_flush(s);
+            if (s->closing && (s->tcp < 0 || s->out_used == 0) && rel_idle(&s->rel) && !s->udp_bye) bridge_close(s);
+        }
+    }
+
+    // a signal ends every session with BYE on both sides
+    for (int i = 0; i < BRIDGE_SESSIONS; i++)
+    {
+        ipk_bridge_session *s = &bridge.sessions[i];
+        if (!s->used || s->closing) continue;
+
+        bridge_say(s, 0, NULL);
+        bridge_say(s, 1, NULL);
+        bridge_flush(s);
+        s->closing = 1;
+    }
+    bridge_drain(&bridge, fds, (long long) conf_timeout * (max_retx + 1));
+
+    for (int i = 0; i < BRIDGE_SESSIONS; i++)
+        if (bridge.sessions[i].used) bridge_close(&bridge.sessions[i]);
+    for (int i = 0; i < bridge.listen_count; i++) close(bridge.listen[i]);
+    return 0;
+}
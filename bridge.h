@@ -0,0 +1,62 @@
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "tcp.h"
+#include "udp.h"
+#include "udp_rel.h"
+
+#define BRIDGE_SESSIONS 64          // translated sessions at the same time, more connections wait
+#define BRIDGE_LISTEN_MAX 4         // loopback addresses of the local side (::1, 127.0.0.1)
+#define BRIDGE_TEXT_SIZE 4096       // TCP data of a session in one direction, a few of the longest messages
+#define BRIDGE_NAME "bridge"        // DisplayName of the ERR the bridge sends itself
+
+// one translated session, a TCP connection and a UDP socket of its own
+typedef struct ipk_bridge_session
+{
+    int used;
+    int tcp;                        // -1 once the TCP side is gone
+    int udp;
+    int connecting;                 // the upstream TCP connect is in progress
+    int closing;                    // BYE went through, nothing more is translated, freed once flushed
+    int switched;                   // upstream UDP: the server answers from its dynamic port
+    struct sockaddr_storage peer;   // the UDP side, the server or the local client
+    ipk_rel rel;
+    uint8_t lsb;                    // MessageID of the next message to the UDP side
+    uint8_t msb;
+    uint16_t request_id;            // the last AUTH or JOIN from the UDP side, REPLY refers to it
+    char *udp_err;                  // ERR from the bridge waiting for a free slot of the UDP window, NULL if none
+    int udp_bye;                    // BYE from the bridge waiting for a free slot of the UDP window
+    char in[BRIDGE_TEXT_SIZE];      // TCP lines not translated yet (the UDP window is full)
+    size_t in_start;
+    size_t in_used;
+    char out[BRIDGE_TEXT_SIZE];     // translated messages not written to the TCP side yet
+    size_t out_start;
+    size_t out_used;
+} ipk_bridge_session;
+
+// local clients of one variant and the server of the other one, all sessions in one poll loop
+typedef struct ipk_bridge
+{
+    int udp_upstream;               // 1 local TCP clients and a UDP server, 0 the other way round
+    struct sockaddr_storage server;
+    socklen_t server_len;
+    int conf_timeout;
+    int max_retx;
+    int listen[BRIDGE_LISTEN_MAX];
+    int listen_count;
+    ipk_bridge_session sessions[BRIDGE_SESSIONS];
+} ipk_bridge;
+
+int bridge_run(char *host, char *port, char *listen_port, int udp_upstream, int conf_timeout, int max_retx, volatile sig_atomic_t *stop);
+
+#endif
@@ -0,0 +1,305 @@
+#include "bulk.h"
+
+/**
+ * @brief Adds the tokens earned since the last refill, at most BULK_BURST_MS worth
+ *
+ * @param bulk
+ */
+static void bulk_refill(ipk_bulk *bulk)
+{
+    long long now = ipk_now_us();
+    double elapsed = (now - bulk->refilled_at) / 1000000.0;
+    double msg_burst = bulk->msg_rate * BULK_BURST_MS / 1000.0;
+    double byte_burst = bulk->byte_rate * BULK_BURST_MS / 1000.0;
+
+    if (msg_burst < 1) msg_burst = 1;
+    if (byte_burst < BULK_MAX_LINE) byte_burst = BULK_MAX_LINE;
+
+    bulk->msg_tokens += bulk->msg_rate * elapsed;
+    bulk->byte_tokens += bulk->byte_rate * elapsed;
+    if (bulk->msg_tokens > msg_burst) bulk->msg_tokens = msg_burst;
+    if (bulk->byte_tokens > byte_burst) bulk->byte_tokens = byte_burst;
+    bulk->refilled_at = now;
+}
+
+/**
+ * @brief The lines can be released, the bucket starts full
+ *
+ * @param bulk
+ */
+static void bulk_start(ipk_bulk *bulk)
+{
+    bulk->enabled = 1;
+    bulk->refilled_at = ipk_now_us();
+    bulk->msg_tokens = bulk->byte_tokens = 1e18;     // a full bucket, bulk_refill caps it
+    bulk_refill(bulk);
+}
+
+/**
+ * @brief Maps the file and sets the target rate
+ *
+ * @param bulk
+ * @param path file with one message or command per line
+ * @param msg_rate messages per second, 0 is unlimited
+ * @param byte_rate bytes per second, 0 is unlimited
+ * @return int 1 if the file can not be read, 0 otherwise
+ */
+int bulk_open(ipk_bulk *bulk, const char *path, double msg_rate, double byte_rate)
+{
+    struct stat st;
+
+    memset(bulk, 0, sizeof(*bulk));
+    bulk->msg_rate = msg_rate;
+    bulk->byte_rate = byte_rate;
+    bulk->line = 1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        fprintf(stderr, "ERR: Can not open %s!\n", path);
+        if (fd != -1) close(fd);
+        return 1;
+    }
+
+    bulk->size = (size_t) st.st_size;
+    if (bulk->size > 0)
+    {
+        bulk->data = (char *) mmap(NULL, bulk->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (bulk->data == MAP_FAILED)
+        {
+            fprintf(stderr, "ERR: Can not map %s!\n", path);
+            bulk->data = NULL;
+            close(fd);
+            return 1;
+        }
+        madvise(bulk->data, bulk->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    bulk_start(bulk);
+    return 0;
+}
+
+/**
+ * @brief Maps anonymous memory for lines written by the caller instead of a file (--probe),
+ * bulk_close unmaps it like a file
+ *
+ * @param bulk
+ * @param size bytes of the script, the lines end with "\n"
+ * @param msg_rate lines per second, commands included, 0 is unlimited
+ * @param byte_rate bytes per second, 0 is unlimited
+ * @return char* where the caller writes the script, NULL if the memory can not be mapped
+ */
+char *bulk_script(ipk_bulk *bulk, size_t size, double msg_rate, double byte_rate)
+{
+    memset(bulk, 0, sizeof(*bulk));
+    bulk->msg_rate = msg_rate;
+    bulk->byte_rate = byte_rate;
+    bulk->paced = 1;
+    bulk->line = 1;
+
+    bulk->data = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bulk->data == MAP_FAILED)
+    {
+        fprintf(stderr, "ERR: Memory allocation failed!\n");
+        bulk->data = NULL;
+        return NULL;
+    }
+    bulk->size = size;
+
+    bulk_start(bulk);
+    return bulk->data;
+}
+
+/**
+ * @brief Finds the next line worth sending, empty and too long lines are skipped
+ *
+ * @param bulk
+ * @param size size of the caller's buffer
+ * @param length length of the line without "\r\n"
+ * @return char* beginning of the line, NULL at the end of the file
+ */
+static char *bulk_peek(ipk_bulk *bulk, size_t size, size_t *length)
+{
+    while (bulk->pos < bulk->size)
+    {
+        char *start = bulk->data + bulk->pos;
+        size_t rest = bulk->size - bulk->pos;
+        char *newline = (char *) memchr(start, '\n', rest);
+        size_t raw = newline != NULL ? (size_t) (newline - start) : rest;
+
+        *length = raw;
+        if (*length > 0 && start[*length - 1] == '\r') (*length)--;
+
+        if (*length > 0 && *length < size) return start;
+
+        if (*length > 0) fprintf(stderr, "ERR: Line %lu is too long!\n", bulk->line);
+        bulk->pos += raw + (newline != NULL);
+        bulk->line++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Checks the token bucket, commands are not rate limited
+ *
+ * @param bulk
+ * @param line
+ * @param length
+ * @return int 1 if the line can be released now, 0 otherwise
+ */
+static int bulk_ready(ipk_bulk *bulk, char *line, size_t length)
+{
+    if (line[0] == '/' && !bulk->paced) return 1;
+    if (bulk->msg_rate > 0 && bulk->msg_tokens < 1) return 0;
+    if (bulk->byte_rate > 0 && bulk->byte_tokens < length) return 0;
+    return 1;
+}
+
+/**
+ * @brief Copies the next line out of the file when the rate allows it
+ *
+ * @param bulk
+ * @param line output, zero terminated without "\r\n"
+ * @param size size of line
+ * @return int 1 if a line was copied, 0 if it has to wait, -1 at the end of the file
+ */
+int bulk_next(ipk_bulk *bulk, char *line, size_t size)
+{
+    size_t length;
+    char *start = bulk_peek(bulk, size, &length);
+
+    if (start == NULL) return -1;
+
+    bulk_refill(bulk);
+    if (!bulk_ready(bulk, start, length)) return 0;
+
+    if (start[0] != '/' || bulk->paced)
+    {
+        bulk->msg_tokens--;
+        bulk->byte_tokens -= length;
+    }
+
+    memcpy(line, start, length);
+    line[length] = '\0';
+
+    char *newline = (char *) memchr(start, '\n', bulk->size - bulk->pos);
+    bulk->pos = newline != NULL ? (size_t) (newline - bulk->data) + 1 : bulk->size;
+    bulk->line++;
+    return 1;
+}
+
+/**
+ * @brief How long poll should wait before the next line can be released
+ *
+ * @param bulk
+ * @return int milliseconds, 0 if a line is ready or the file is finished
+ */
+int bulk_wait(ipk_bulk *bulk)
+{
+    size_t length;
+    char *start = bulk_peek(bulk, BULK_MAX_LINE + 1, &length);
+    double wait = 0;
+
+    if (start == NULL) return 0;
+
+    bulk_refill(bulk);
+    if (bulk_ready(bulk, start, length)) return 0;
+
+    if (bulk->msg_rate > 0 && bulk->msg_tokens < 1)
+        wait = (1 - bulk->msg_tokens) / bulk->msg_rate;
+    if (bulk->byte_rate > 0 && bulk->byte_tokens < length && (length - bulk->byte_tokens) / bulk->byte_rate > wait)
+        wait = (length - bulk->byte_tokens) / bulk->byte_rate;
+
+    return (int) (wait * 1000) + 1;
+}
+
+/**
+ * @brief Check if the file has no more lines
+ *
+ * @param bulk
+ * @return int 1 if every line was taken, 0 otherwise
+ */
+int bulk_done(ipk_bulk *bulk)
+{
+    size_t length;
+    return bulk_peek(bulk, BULK_MAX_LINE + 1, &length) == NULL;
+}
+
+/**
+ * @brief MSG was sent, starts the latency measurement
+ *
+ * @param bulk
+ * @param bytes length of MessageContent
+ * @return long long when it was sent, us, for bulk_confirmed
+ */
+long long bulk_sent(ipk_bulk *bulk, size_t bytes)
+{
+    if (!bulk->enabled) return 0;
+
+    long long now = ipk_now_us();
+    if (bulk->messages == 0) bulk->start = now;
+    bulk->end = now;
+    bulk->messages++;
+    bulk->bytes += bytes;
+    return now;
+}
+
+/**
+ * @brief The MSG waiting for CONFIRM was sent again
+ *
+ * @param bulk
+ */
+void bulk_retransmit(ipk_bulk *bulk)
+{
+    if (bulk->enabled) bulk->retransmits++;
+}
+
+/**
+ * @brief CONFIRM of a MSG arrived, records its latency, several MSG may wait at once
+ *
+ * @param bulk
+ * @param sent_at what bulk_sent returned for it, 0 if it was not measured
+ */
+void bulk_confirmed(ipk_bulk *bulk, long long sent_at)
+{
+    if (!bulk->enabled || sent_at == 0) return;
+
+    long long now = ipk_now_us();
+
+    hist_add(&bulk->latency, now - sent_at);
+    bulk->end = now;
+}
+
+/**
+ * @brief Prints the achieved throughput, retransmits and latency to stderr
+ *
+ * @param bulk
+ */
+void bulk_report(ipk_bulk *bulk)
+{
+    if (!bulk->enabled || bulk->quiet) return;
+
+    double seconds = (bulk->end - bulk->start) / 1000000.0;
+
+    fprintf(stderr, "Bulk: %lu messages, %lu bytes in %.3f s", bulk->messages, bulk->bytes, seconds);
+    if (seconds > 0)
+        fprintf(stderr, " (%.1f msg/s, %.0f B/s)", bulk->messages / seconds, bulk->bytes / seconds);
+    fprintf(stderr, ", %lu retransmits\n", bulk->retransmits);
+
+    if (bulk->latency.samples > 0)
+        fprintf(stderr, "Latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", hist_percentile(&bulk->latency, 0.5) / 1000.0,
+                hist_percentile(&bulk->latency, 0.99) / 1000.0, bulk->latency.max / 1000.0);
+}
+
+/**
+ * @brief Unmaps the file
+ *
+ * @param bulk
+ */
+void bulk_close(ipk_bulk *bulk)
+{
+    if (bulk->data != NULL) munmap(bulk->data, bulk->size);
+    bulk->data = NULL;
+    bulk->enabled = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef BULK_H
+#define BULK_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "monotonic.h"
+#include "hist.h"
+
+#define BULK_BURST_MS 100           // the token bucket holds at most 100 ms worth of tokens
+#define BULK_MAX_LINE 1400          // the longest line without '\0', same as the console input
+
+// -f mode, the lines of a memory mapped file are sent instead of the console input
+typedef struct ipk_bulk
+{
+    int enabled;
+    int paced;                      // commands count against -m too (--probe)
+    int serial;                     // UDP: a MSG waits for the previous CONFIRM, one sample at a time (--probe)
+    int quiet;                      // no report, --probe prints its own
+    char *data;                     // the mapped file or script
+    size_t size;
+    size_t pos;                     // beginning of the next line
+    unsigned long line;             // number of the next line, for error messages
+    double msg_rate;                // messages per second, 0 is unlimited
+    double byte_rate;               // bytes per second, 0 is unlimited
+    double msg_tokens;
+    double byte_tokens;
+    long long refilled_at;          // us
+    long long start;                // first message sent, us
+    long long end;                  // last message sent or confirmed, us
+    unsigned long messages;         // MSG sent
+    unsigned long bytes;            // MessageContent bytes sent
+    unsigned long retransmits;
+    ipk_hist latency;               // MSG to CONFIRM, us
+} ipk_bulk;
+
+int bulk_open(ipk_bulk *bulk, const char *path, double msg_rate, double byte_rate);
+char *bulk_script(ipk_bulk *bulk, size_t size, double msg_rate, double byte_rate);
+int bulk_next(ipk_bulk *bulk, char *line, size_t size);
+int bulk_wait(ipk_bulk *bulk);
+int bulk_done(ipk_bulk *bulk);
+long long bulk_sent(ipk_bulk *bulk, size_t bytes);
+void bulk_retransmit(ipk_bulk *bulk);
+void bulk_confirmed(ipk_bulk *bulk, long long sent_at);
+void bulk_report(ipk_bulk *bulk);
+void bulk_close(ipk_bulk *bulk);
+
+#endif
@@ -0,0 +1,252 @@
+#include "busy.h"
+
+/**
+ * @brief Reads the -B argument
+ *
+ * @param busy
+ * @param arg <us>[:<cpu>]
+ * @return int 1 if the argument is invalid, 0 otherwise
+ */
+int busy_parse(ipk_busy *busy, const char *arg)
+{
+    char *end;
+    long long budget = strtoll(arg, &end, 10);
+    long cpu = -1;
+
+    if (*end == ':') cpu = strtol(end + 1, &end, 10);
+    if (budget <= 0 || budget > 1000000 || cpu < -1 || cpu >= CPU_SETSIZE || *end != '\0')
+    {
+        fprintf(stderr, "ERR: Invalid busy poll! Use -B <1-1000000 us>[:<cpu>]!\n");
+        return 1;
+    }
+
+    busy->enabled = 1;
+    busy->budget = budget;
+    busy->cpu = (int) cpu;
+    return 0;
+}
+
+/**
+ * @brief Pins the process to the CPU and locks its memory, a failure only costs latency,
+ * so it is reported and the client goes on
+ *
+ * @param busy
+ * @param stop set by the signal handler
+ */
+void busy_setup(ipk_busy *busy, volatile sig_atomic_t *stop)
+{
+    busy->stop = stop;
+    busy->start = ipk_now_us();
+    if (!busy->enabled) return;
+
+    if (busy->cpu == -1) busy->cpu = sched_getcpu();
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(busy->cpu, &set);
+    if (busy->cpu < 0 || sched_setaffinity(0, sizeof(set), &set) < 0)
+        fprintf(stderr, "ERR: Can't pin the client to CPU %d!\n", busy->cpu);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        fprintf(stderr, "ERR: Can't lock the memory (mlockall), it may be paged out!\n");
+}
+
+/**
+ * @brief Receive timestamps and SO_BUSY_POLL on a new socket, the kernel allows a budget
+ * above net.core.busy_read only with CAP_NET_ADMIN
+ *
+ * @param busy
+ * @param fd
+ */
+void busy_socket(ipk_busy *busy, int fd)
+{
+    static int warned = 0;
+    int on = 1;
+    int budget = (int) busy->budget;
+
+    if (!busy->enabled) return;
+
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &budget, sizeof(budget)) < 0 && !warned)
+    {
+        fprintf(stderr, "ERR: SO_BUSY_POLL is not permitted, spinning only in user space!\n");
+        warned = 1;
+    }
+}
+
+/**
+ * @brief poll that spins with a zero timeout for the budget and only then blocks
+ *
+ * @param busy
+ * @param fds
+ * @param nfds
+ * @param timeout ms, -1 is infinite
+ * @return int result of poll, 0 also when a signal stopped the spinning
+ */
+int busy_poll(ipk_busy *busy, struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    if (!busy->enabled) return poll(fds, nfds, timeout);
+
+    long long start = ipk_now_us();
+    long long budget = busy->budget;
+    int ret;
+
+    if (timeout >= 0 && (long long) timeout * 1000 < budget) budget = (long long) timeout * 1000;
+
+    busy->spun = 1;
+    do
+    {
+        ret = poll(fds, nfds, 0);
+        if (ret != 0 || *busy->stop)
+        {
+            if (ret > 0) busy->spin_wakeups++;
+            return ret;
+        }
+    } while (ipk_now_us() - start < budget);
+
+    if (timeout > 0)
+    {
+        timeout -= (int) ((ipk_now_us() - start) / 1000);
+        if (timeout < 0) timeout = 0;
+    }
+    busy->spun = 0;
+    ret = poll(fds, nfds, timeout);
+    if (ret > 0) busy->block_wakeups++;
+    return ret;
+}
+
+/**
+ * @brief recvfrom that also records how long the data waited since the kernel received it
+ *
+ * @param busy
+ * @param fd
+ * @param buff
+ * @param size
+ * @param addr NULL for TCP
+ * @param addr_len
+ * @return ssize_t result of recvmsg
+ */
+ssize_t busy_recv(ipk_busy *busy, int fd, char *buff, size_t size, struct sockaddr *addr, socklen_t *addr_len)
+{
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov = {.iov_base = buff, .iov_len = size};
+    struct msghdr msg = {
+        .msg_name = addr,
+        .msg_namelen = addr_len != NULL ? *addr_len : 0,
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    ssize_t length = recvmsg(fd, &msg, 0);
+    if (length <= 0) return length;
+    if (addr_len != NULL) *addr_len = msg.msg_namelen;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS) continue;
+
+        struct timespec received;
+        struct timespec now;
+        memcpy(&received, CMSG_DATA(cmsg), sizeof(received));
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        long long latency = (now.tv_sec - received.tv_sec) * 1000000LL + (now.tv_nsec - received.tv_nsec) / 1000;
+        hist_add(busy->spun ? &busy->spin_latency : &busy->block_latency, latency);
+    }
+    return length;
+}
+
+/**
+ * @brief Transport of the reliability layer, send or sendto on the UDP socket
+ *
+ * @param ctx ipk_busy
+ * @param buff
+ * @param length
+ * @param addr NULL on a connected socket
+ * @param addr_len
+ * @return ssize_t result of send or sendto
+ */
+ssize_t busy_socket_send(void *ctx, const char *buff, size_t length, const struct sockaddr *addr, socklen_t addr_len)
+{
+    return rel_socket_send(((ipk_busy *) ctx)->socket, buff, length, addr, addr_len);
+}
+
+/**
+ * @brief Transport of the reliability layer, sendmsg on the UDP socket
+ *
+ * @param ctx ipk_busy
+ * @param iov
+ * @param count
+ * @param addr NULL on a connected socket
+ * @param addr_len
+ * @return ssize_t result of sendmsg
+ */
+ssize_t busy_socket_sendv(void *ctx, const struct iovec *iov, int count, const struct sockaddr *addr, socklen_t addr_len)
+{
+    return rel_socket_sendv(((ipk_busy *) ctx)->socket, iov, count, addr, addr_len);
+}
+
+/**
+ * @brief Transport of the reliability layer, busy_recv on the UDP socket
+ *
+ * @param ctx ipk_busy
+ * @param buff
+ * @param size
+ * @param addr
+ * @param addr_len
+ * @return ssize_t result of recvmsg
+ */
+ssize_t busy_socket_recv(void *ctx, char *buff, size_t size, struct sockaddr *addr, socklen_t *addr_len)
+{
+    ipk_busy *busy = (ipk_busy *) ctx;
+    return busy_recv(busy, *busy->socket, buff, size, addr, addr_len);
+}
+
+/**
+ * @brief Transport of the reliability layer, connect on the UDP socket
+ *
+ * @param ctx ipk_busy
+ * @param addr
+ * @param addr_len
+ * @return int 1 if connect failed, 0 otherwise
+ */
+int busy_socket_connect(void *ctx, const struct sockaddr *addr, socklen_t addr_len)
+{
+    return udp_connect(*((ipk_busy *) ctx)->socket, addr, addr_len);
+}
+
+/**
+ * @brief Prints one latency histogram
+ *
+ * @param name
+ * @param hist
+ */
+static void busy_report_latency(const char *name, ipk_hist *hist)
+{
+    if (hist->samples == 0) return;
+
+    fprintf(stderr, "Wakeup to handle (%s): %lu samples, p50 %lld us, p99 %lld us, max %lld us\n", name,
+            hist->samples, hist_percentile(hist, 0.5), hist_percentile(hist, 0.99), hist->max);
+}
+
+/**
+ * @brief Prints the wakeups, the CPU time they cost and the latency from the kernel to the handler
+ *
+ * @param busy
+ */
+void busy_report(ipk_busy *busy)
+{
+    if (!busy->enabled) return;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+    double seconds = (ipk_now_us() - busy->start) / 1000000.0;
+
+    fprintf(stderr, "Busy poll: %lu wakeups while spinning, %lu after blocking, CPU %.3f s in %.3f s (%.0f%%)\n",
+            busy->spin_wakeups, busy->block_wakeups, cpu, seconds, seconds > 0 ? 100 * cpu / seconds : 0);
+    busy_report_latency("spinning", &busy->spin_latency);
+    busy_report_latency("blocking", &busy->block_latency);
+}
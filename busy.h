@@ -0,0 +1,46 @@
+#ifndef BUSY_H
+#define BUSY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "monotonic.h"
+#include "hist.h"
+#include "udp_rel.h"
+
+// -B mode, poll spins for a while before it blocks, so a message is handled without the wakeup
+typedef struct ipk_busy
+{
+    int enabled;
+    long long budget;                   // us of spinning before poll blocks
+    int cpu;                            // the loop is pinned here, -1 the CPU it started on
+    volatile sig_atomic_t *stop;        // a signal arrived, stop spinning
+    int *socket;                        // UDP transport, changes after a reconnect
+    int spun;                           // the last poll returned while spinning
+    unsigned long spin_wakeups;
+    unsigned long block_wakeups;
+    ipk_hist spin_latency;              // kernel receive to handle, us
+    ipk_hist block_latency;
+    long long start;                    // us
+} ipk_busy;
+
+int busy_parse(ipk_busy *busy, const char *arg);
+void busy_setup(ipk_busy *busy, volatile sig_atomic_t *stop);
+void busy_socket(ipk_busy *busy, int fd);
+int busy_poll(ipk_busy *busy, struct pollfd *fds, nfds_t nfds, int timeout);
+ssize_t busy_recv(ipk_busy *busy, int fd, char *buff, size_t size, struct sockaddr *addr, socklen_t *addr_len);
+ssize_t busy_socket_send(void *ctx, const char *buff, size_t length, const struct sockaddr *addr, socklen_t addr_len);
+ssize_t busy_socket_sendv(void *ctx, const struct iovec *iov, int count, const struct sockaddr *addr, socklen_t addr_len);
+ssize_t busy_socket_recv(void *ctx, char *buff, size_t size, struct sockaddr *addr, socklen_t *addr_len);
+int busy_socket_connect(void *ctx, const struct sockaddr *addr, socklen_t addr_len);
+void busy_report(ipk_busy *busy);
+
+#endif
@@ -0,0 +1,649 @@
+/*
+ * Checks of the parsers and data structures, built and run by make test next to the simulation.
+ * Every CHECK that fails is printed, the program exits with 1 if any did.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "udp.h"
+#include "tcp.h"
+#include "scan.h"
+#include "arena.h"
+#include "store.h"
+#include "endpoint.h"
+#include "ring.h"
+
+#define CHECK(cond) check_result((cond), #cond, __FILE__, __LINE__)
+
+static int checks = 0;
+static int failures = 0;
+
+/**
+ * @brief Counts one check, prints it if it failed
+ *
+ * @param ok the checked condition
+ * @param text the condition as written
+ * @param file
+ * @param line
+ */
+static void check_result(int ok, const char *text, const char *file, int line)
+{
+    checks++;
+    if (ok) return;
+
+    failures++;
+    fprintf(stderr, "FAIL %s:%d: %s\n", file, line, text);
+}
+
+/**
+ * @brief Compares a decoded field with the expected zero terminated value
+ *
+ * @param field from the view
+ * @param length from the view
+ * @param expected
+ * @return int 1 if they match
+ */
+static int check_field(const char *field, size_t length, const char *expected)
+{
+    return field != NULL && length == strlen(expected) && !memcmp(field, expected, length) && field[length] == '\0';
+}
+
+/**
+ * @brief Every byte shorter than a whole datagram is malformed, the copy keeps the bytes behind
+ * the cut out of reach of the decoder (valgrind or ASan see a read past it)
+ *
+ * @param buff encoded datagram
+ * @param length its size
+ */
+static void check_udp_truncated(const char *buff, size_t length)
+{
+    ipk_view view;
+
+    for (size_t cut = 0; cut < length; cut++)
+    {
+        char *copy = malloc(cut + 1);
+        memcpy(copy, buff, cut);
+        CHECK(udp_decode(copy, cut, &view) == 1);
+        free(copy);
+    }
+}
+
+/**
+ * @brief UDP: every message encodes and decodes back, every truncation of it is malformed
+ *
+ * @param arena
+ */
+static void check_udp_round_trip(ipk_arena *arena)
+{
+    char *buff;
+    size_t length;
+    uint8_t lsb = 0x34, msb = 0x12;
+    ipk_view view;
+
+    CHECK(udp_encode_auth(arena, &buff, &length, &lsb, &msb, "user-1", "Name", "s3cret") == 0);
+    CHECK(udp_decode(buff, length, &view) == 0);
+    CHECK(view.type == IPK_AUTH && view.id == 0x1234);
+    CHECK(check_field(view.username, view.username_len, "user-1"));
+    CHECK(check_field(view.display_name, view.display_name_len, "Name"));
+    CHECK(check_field(view.secret, view.secret_len, "s3cret"));
+    check_udp_truncated(buff, length);
+
+    CHECK(udp_encode_join(arena, &buff, &length, &lsb, &msb, "general", "Name") == 0);
+    CHECK(udp_decode(buff, length, &view) == 0);
+    CHECK(view.type == IPK_JOIN && check_field(view.channel, view.channel_len, "general"));
+    check_udp_truncated(buff, length);
+
+    CHECK(udp_encode_msg(arena, &buff, &length, &lsb, &msb, "Name", "hello world") == 0);
+    CHECK(udp_decode(buff, length, &view) == 0);
+    CHECK(view.type == IPK_MSG && check_field(view.content, view.content_len, "hello world"));
+    check_udp_truncated(buff, length);
+
+    CHECK(udp_encode_err(arena, &buff, &length, &lsb, &msb, "Name", "bad") == 0);
+    CHECK(udp_decode(buff, length, &view) == 0);
+    CHECK(view.type == IPK_ERR && check_field(view.display_name, view.display_name_len, "Name"));
+    check_udp_truncated(buff, length);
+
+    CHECK(udp_encode_reply(arena, &buff, &length, &lsb, &msb, 1, 0xABCD, "Auth success.") == 0);
+    CHECK(udp_decode(buff, length, &view) == 0);
+    CHECK(view.type == IPK_REPLY && view.result == 1 && view.ref_id == 0xABCD);
+    CHECK(check_field(view.content, view.content_len, "Auth success."));
+    check_udp_truncated(buff, length);
+
+    CHECK(udp_encode_confirm(arena, &buff, &length, &lsb, &msb) == 0);
+    CHECK(length == 3 && udp_decode(buff, length, &view) == 0 && view.type == IPK_CONFIRM);
+    check_udp_truncated(buff, length);
+
+    CHECK(udp_encode_bye(arena, &buff, &length, &lsb, &msb) == 0);
+    CHECK(length == 3 && udp_decode(buff, length, &view) == 0 && view.type == IPK_BYE);
+
+    // the encoders refuse what the decoder would refuse
+    CHECK(udp_encode_msg(arena, &buff, &length, &lsb, &msb, "two words", "x") == 1);
+    CHECK(udp_encode_join(arena, &buff, &length, &lsb, &msb, "chan nel", "Name") == 1);
+}
+
+/**
+ * @brief UDP: fields without their zero byte, too long or with bytes behind them
+ */
+static void check_udp_malformed()
+{
+    ipk_view view;
+    char buff[1600];
+    size_t length;
+
+    // MSG whose content has no zero byte
+    memcpy(buff, "\x04\x00\x01Name\0hello", 13);
+    CHECK(udp_decode(buff, 13, &view) == 1);
+
+    // bytes behind the last field
+    memcpy(buff, "\x04\x00\x01Name\0hi\0x", 12);
+    CHECK(udp_decode(buff, 12, &view) == 1);
+
+    // an empty DisplayName
+    memcpy(buff, "\x04\x00\x01\0hi\0", 7);
+    CHECK(udp_decode(buff, 7, &view) == 1);
+
+    // a DisplayName of SCAN_DNAME_MAX characters and one more
+    buff[0] = IPK_MSG;
+    buff[1] = buff[2] = 0;
+    memset(buff + 3, 'a', SCAN_DNAME_MAX);
+    memcpy(buff + 3 + SCAN_DNAME_MAX, "\0hi\0", 4);
+    CHECK(udp_decode(buff, 3 + SCAN_DNAME_MAX + 4, &view) == 0);
+    CHECK(view.display_name_len == SCAN_DNAME_MAX);
+    memset(buff + 3, 'a', SCAN_DNAME_MAX + 1);
+    memcpy(buff + 3 + SCAN_DNAME_MAX + 1, "\0hi\0", 4);
+    CHECK(udp_decode(buff, 3 + SCAN_DNAME_MAX + 1 + 4, &view) == 1);
+
+    // MessageContent of SCAN_CONTENT_MAX characters and one more
+    length = 3;
+    memcpy(buff + length, "Name", 5);
+    length += 5;
+    memset(buff + length, 'c', SCAN_CONTENT_MAX + 1);
+    buff[length + SCAN_CONTENT_MAX] = '\0';
+    CHECK(udp_decode(buff, length + SCAN_CONTENT_MAX + 1, &view) == 0);
+    CHECK(view.content_len == SCAN_CONTENT_MAX);
+    buff[length + SCAN_CONTENT_MAX] = 'c';
+    buff[length + SCAN_CONTENT_MAX + 1] = '\0';
+    CHECK(udp_decode(buff, length + SCAN_CONTENT_MAX + 2, &view) == 1);
+
+    // a control character in MessageContent
+    memcpy(buff, "\x04\x00\x01Name\0h\ti\0", 12);
+    CHECK(udp_decode(buff, 12, &view) == 1);
+
+    // REPLY with a result other than 0 or 1
+    memcpy(buff, "\x01\x00\x01\x02\x00\x00ok\0", 9);
+    CHECK(udp_decode(buff, 9, &view) == 1);
+
+    // udp_peek reads only the header, REPLY has its Ref_MessageID in it
+    CHECK(udp_peek("\x04\x00", 2, &view) == 1);
+    CHECK(udp_peek("\x04\x00\x07", 3, &view) == 0 && view.type == IPK_MSG && view.id == 7);
+    CHECK(udp_peek("\x01\x00\x07\x01\x00", 5, &view) == 1);
+    CHECK(udp_peek("\x01\x00\x07\x01\x00\x02", 6, &view) == 0 && view.ref_id == 2);
+
+    // an unknown type is not malformed, its header is read
+    memcpy(buff, "\x42\x01\x02", 3);
+    CHECK(udp_decode(buff, 3, &view) == 0 && view.type == 0x42 && view.id == 0x0102);
+}
+
+/**
+ * @brief Decodes a TCP message from a copy with exactly one byte behind it,
+ * tcp_decode cuts the message in place and ends MessageContent with a zero there
+ *
+ * @param text the message without "\r\n"
+ * @param length
+ * @param view
+ * @param copy set to the copy the view points into, freed by the caller
+ * @return int what tcp_decode returned
+ */
+static int check_tcp_decode(const char *text, size_t length, ipk_view *view, char **copy)
+{
+    *copy = malloc(length + 1);
+    memcpy(*copy, text, length);
+    return tcp_decode(*copy, length, view);
+}
+
+/**
+ * @brief Every cut in front of the last value is malformed, a cut inside the last value
+ * is a shorter value
+ *
+ * @param text the message without "\r\n"
+ * @param last where the last value starts
+ */
+static void check_tcp_truncated(const char *text, size_t last)
+{
+    ipk_view view;
+    char *copy;
+
+    for (size_t cut = 0; cut < last; cut++)
+    {
+        CHECK(check_tcp_decode(text, cut, &view, &copy) == 1);
+        free(copy);
+    }
+}
+
+/**
+ * @brief TCP: every message encodes and decodes back, the keywords are case insensitive
+ *
+ * @param arena
+ */
+static void check_tcp_round_trip(ipk_arena *arena)
+{
+    char *buff;
+    char *copy;
+    ipk_view view;
+
+    CHECK(tcp_encode_auth(arena, &buff, "user-1", "Name", "s3cret") == 0);
+    CHECK(!strcmp(buff, "AUTH user-1 AS Name USING s3cret\r\n"));
+    CHECK(check_tcp_decode(buff, strlen(buff) - 2, &view, &copy) == 0);
+    CHECK(view.type == IPK_AUTH && check_field(view.username, view.username_len, "user-1"));
+    CHECK(check_field(view.display_name, view.display_name_len, "Name"));
+    CHECK(check_field(view.secret, view.secret_len, "s3cret"));
+    free(copy);
+    check_tcp_truncated(buff, strlen("AUTH user-1 AS Name USING "));
+
+    CHECK(tcp_encode_join(arena, &buff, "general", "Name") == 0);
+    CHECK(check_tcp_decode(buff, strlen(buff) - 2, &view, &copy) == 0);
+    CHECK(view.type == IPK_JOIN && check_field(view.channel, view.channel_len, "general"));
+    free(copy);
+    check_tcp_truncated(buff, strlen("JOIN general AS "));
+
+    CHECK(tcp_encode_msg(arena, &buff, "Name", "hello  world ") == 0);
+    CHECK(check_tcp_decode(buff, strlen(buff) - 2, &view, &copy) == 0);
+    CHECK(view.type == IPK_MSG && check_field(view.content, view.content_len, "hello  world "));
+    free(copy);
+    check_tcp_truncated(buff, strlen("MSG FROM Name IS "));
+
+    CHECK(tcp_encode_err(arena, &buff, "Name", "bad") == 0);
+    CHECK(check_tcp_decode(buff, strlen(buff) - 2, &view, &copy) == 0);
+    CHECK(view.type == IPK_ERR && check_field(view.content, view.content_len, "bad"));
+    free(copy);
+
+    CHECK(tcp_encode_reply(arena, &buff, 0, 0, "No.") == 0);
+    CHECK(!strcmp(buff, "REPLY NOK IS No.\r\n"));
+    CHECK(check_tcp_decode(buff, strlen(buff) - 2, &view, &copy) == 0);
+    CHECK(view.type == IPK_REPLY && view.result == 0 && check_field(view.content, view.content_len, "No."));
+    free(copy);
+    check_tcp_truncated(buff, strlen("REPLY NOK IS "));
+
+    CHECK(tcp_encode_bye(arena, &buff) == 0);
+    CHECK(check_tcp_decode(buff, strlen(buff) - 2, &view, &copy) == 0 && view.type == IPK_BYE);
+    free(copy);
+
+    CHECK(check_tcp_decode("reply ok is Yes", 15, &view, &copy) == 0 && view.result == 1);
+    free(copy);
+    CHECK(check_tcp_decode("Msg From Name Is hi", 19, &view, &copy) == 0 && view.type == IPK_MSG);
+    free(copy);
+}
+
+/**
+ * @brief TCP: missing keywords, stray spaces, fields over their limit
+ */
+static void check_tcp_malformed()
+{
+    static const char *bad[] = {
+        "",
+        "HELLO there",
+        "MSG Name IS hi",               // no FROM
+        "MSG FROM Name hi",             // no IS
+        "MSG  FROM Name IS hi",         // two spaces
+        "MSG FROM Name IS",             // no content
+        "JOIN general",                 // no AS
+        "REPLY MAYBE IS x",
+        "BYE ",                         // a space at the end
+        "BYE now",
+        "MSG FROM Na\tme IS hi",
+        "MSG FROM Name IS h\ti",
+        "AUTH us_er AS Name USING s",   // '_' is not allowed in Username
+    };
+    ipk_view view;
+    char *copy;
+    char line[SCAN_CONTENT_MAX + 64];
+    size_t length;
+
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        CHECK(check_tcp_decode(bad[i], strlen(bad[i]), &view, &copy) == 1);
+        free(copy);
+    }
+
+    // DisplayName of SCAN_DNAME_MAX characters and one more
+    length = sprintf(line, "MSG FROM %0*d IS hi", SCAN_DNAME_MAX, 0);
+    CHECK(check_tcp_decode(line, length, &view, &copy) == 0 && view.display_name_len == SCAN_DNAME_MAX);
+    free(copy);
+    length = sprintf(line, "MSG FROM %0*d IS hi", SCAN_DNAME_MAX + 1, 0);
+    CHECK(check_tcp_decode(line, length, &view, &copy) == 1);
+    free(copy);
+
+    // Secret of SCAN_SECRET_MAX characters and one more
+    length = sprintf(line, "AUTH user AS Name USING %0*d", SCAN_SECRET_MAX, 0);
+    CHECK(check_tcp_decode(line, length, &view, &copy) == 0 && view.secret_len == SCAN_SECRET_MAX);
+    free(copy);
+    length = sprintf(line, "AUTH user AS Name USING %0*d", SCAN_SECRET_MAX + 1, 0);
+    CHECK(check_tcp_decode(line, length, &view, &copy) == 1);
+    free(copy);
+
+    // MessageContent of SCAN_CONTENT_MAX characters and one more
+    length = sprintf(line, "MSG FROM Name IS %0*d", SCAN_CONTENT_MAX, 0);
+    CHECK(check_tcp_decode(line, length, &view, &copy) == 0 && view.content_len == SCAN_CONTENT_MAX);
+    free(copy);
+    length = sprintf(line, "MSG FROM Name IS %0*d", SCAN_CONTENT_MAX + 1, 0);
+    CHECK(check_tcp_decode(line, length, &view, &copy) == 1);
+    free(copy);
+}
+
+/**
+ * @brief Unmaps and closes both files of the history, store_open leaves them open when it fails
+ *
+ * @param store
+ */
+static void check_store_close(ipk_store *store)
+{
+    if (store->log.base != NULL) munmap(store->log.base, store->log.size);
+    if (store->index.base != NULL) munmap(store->index.base, store->index.size);
+    if (store->log.fd != -1) close(store->log.fd);
+    if (store->index.fd != -1) close(store->index.fd);
+    memset(store, 0, sizeof(*store));
+    store->log.fd = store->index.fd = -1;
+}
+
+/**
+ * @brief Entry of the opened index
+ *
+ * @param store
+ * @param i
+ * @return ipk_store_entry*
+ */
+static ipk_store_entry *check_store_entry(ipk_store *store, uint32_t i)
+{
+    return (ipk_store_entry *) (store->index.base + sizeof(ipk_store_head)) + i;
+}
+
+/**
+ * @brief Record of the entry in the opened log
+ *
+ * @param store
+ * @param i
+ * @return ipk_store_record*
+ */
+static ipk_store_record *check_store_record(ipk_store *store, uint32_t i)
+{
+    return (ipk_store_record *) (store->log.base + check_store_entry(store, i)->offset);
+}
+
+/**
+ * @brief Entries left after the files are closed and opened again
+ *
+ * @param store
+ * @param path
+ * @return long number of entries, -1 if store_open refused the files
+ */
+static long check_store_reopen(ipk_store *store, const char *path)
+{
+    check_store_close(store);
+    if (store_open(store, path)) return -1;
+    return (long) ((ipk_store_head *) store->index.base)->used;
+}
+
+/**
+ * @brief A new history with three messages, alice, bob and alice
+ *
+ * @param store
+ * @param path
+ * @param index_path
+ */
+static void check_store_fill(ipk_store *store, const char *path, const char *index_path)
+{
+    check_store_close(store);
+    unlink(path);
+    unlink(index_path);
+    CHECK(store_open(store, path) == 0);
+    store_reserve(store, 3);
+    store_add(store, STORE_TX, "alice", "one", 3);
+    store_add(store, STORE_RX, "bob", "two", 3);
+    store_add(store, STORE_TX, "alice", "three", 5);
+}
+
+/**
+ * @brief History: what was added is there after store_open, an entry that can not be followed
+ * is dropped with everything behind it, a file with a bad head or shorter than its head says is refused
+ *
+ */
+static void check_store()
+{
+    char dir[] = "/tmp/ipk24chat-check-XXXXXX";
+    char path[64];
+    char index_path[64];
+    ipk_store store = {.log.fd = -1, .index.fd = -1};
+
+    CHECK(mkdtemp(dir) != NULL);
+    snprintf(path, sizeof(path), "%s/history", dir);
+    snprintf(index_path, sizeof(index_path), "%s/history.idx", dir);
+
+    check_store_fill(&store, path, index_path);
+    CHECK(check_store_reopen(&store, path) == 3);
+    CHECK(check_store_entry(&store, 2)->prev == 1 && check_store_entry(&store, 1)->prev == 0);
+    CHECK(check_store_record(&store, 2)->content_len == 5 && check_store_record(&store, 2)->sender_len == 5);
+
+    // the client was killed after the entry and before the log head
+    check_store_fill(&store, path, index_path);
+    ((ipk_store_head *) store.log.base)->used = check_store_entry(&store, 2)->offset;
+    CHECK(check_store_reopen(&store, path) == 2);
+
+    // a length that runs past the log
+    check_store_fill(&store, path, index_path);
+    check_store_record(&store, 2)->content_len = 60000;
+    CHECK(check_store_reopen(&store, path) == 2);
+
+    // a field without its zero, everything behind it goes too
+    check_store_fill(&store, path, index_path);
+    ((char *) (check_store_record(&store, 1) + 1))[1 + check_store_record(&store, 1)->sender_len] = 'x';
+    CHECK(check_store_reopen(&store, path) == 1);
+
+    // a sender chain going forward, a record inside the head
+    check_store_fill(&store, path, index_path);
+    check_store_entry(&store, 2)->prev = 3;
+    CHECK(check_store_reopen(&store, path) == 2);
+    check_store_fill(&store, path, index_path);
+    check_store_entry(&store, 0)->offset = 0;
+    CHECK(check_store_reopen(&store, path) == 0);
+
+    // heads that do not fit their files
+    check_store_fill(&store, path, index_path);
+    ((ipk_store_head *) store.log.base)->used = store.log.size + 1;
+    CHECK(check_store_reopen(&store, path) == -1);
+    check_store_fill(&store, path, index_path);
+    ((ipk_store_head *) store.index.base)->used = store.index.size;
+    CHECK(check_store_reopen(&store, path) == -1);
+    check_store_fill(&store, path, index_path);
+    ((ipk_store_head *) store.index.base)->magic = 0;
+    CHECK(check_store_reopen(&store, path) == -1);
+
+    // truncated files, shorter than the head or than the entries in use
+    check_store_fill(&store, path, index_path);
+    check_store_close(&store);
+    CHECK(truncate(path, sizeof(ipk_store_head) - 1) == 0 && check_store_reopen(&store, path) == -1);
+    check_store_fill(&store, path, index_path);
+    check_store_close(&store);
+    CHECK(truncate(index_path, sizeof(ipk_store_head) + sizeof(ipk_store_entry)) == 0 && check_store_reopen(&store, path) == -1);
+
+    check_store_close(&store);
+    unlink(path);
+    unlink(index_path);
+    rmdir(dir);
+}
+
+/**
+ * @brief Parses a copy of the -s argument, the endpoints point into the copy
+ *
+ * @param eps
+ * @param copy at least as long as text
+ * @param text the -s argument
+ * @param port -p
+ * @return int the result of endpoints_parse
+ */
+static int check_endpoints(ipk_endpoints *eps, char *copy, const char *text, char *port)
+{
+    strcpy(copy, text);
+    return endpoints_parse(eps, copy, port);
+}
+
+/**
+ * @brief -s: host, host:port, [IPv6]:port and a bare IPv6 address, at most ENDPOINT_MAX of them;
+ * a port that is not only digits from 1 to 65535, an empty host or an open bracket is refused
+ *
+ */
+static void check_endpoints_parse()
+{
+    char copy[128];
+    char port[] = "4567";
+    char zero[] = "0";
+    char name[] = "http";
+    ipk_endpoints eps;
+    const char *invalid[] = {"", ",", "a:0", "a:65536", "a:", "a:80x", "a:-1", "a:+80", "a: 80",
+                             "[::1", "[::1]x", "[::1]:", "[]:80", ":80", "a:1,b:0"};
+
+    CHECK(check_endpoints(&eps, copy, "localhost", port) == 0 && eps.count == 1);
+    CHECK(!strcmp(eps.list[0].host, "localhost") && eps.list[0].port == port);
+
+    CHECK(check_endpoints(&eps, copy, "a:1,b,[::1]:2,[fe80::1],::1,c:65535", port) == 0 && eps.count == 6);
+    CHECK(!strcmp(eps.list[0].host, "a") && !strcmp(eps.list[0].port, "1"));
+    CHECK(!strcmp(eps.list[1].host, "b") && eps.list[1].port == port);
+    CHECK(!strcmp(eps.list[2].host, "::1") && !strcmp(eps.list[2].port, "2"));
+    CHECK(!strcmp(eps.list[3].host, "fe80::1") && eps.list[3].port == port);
+    CHECK(!strcmp(eps.list[4].host, "::1") && eps.list[4].port == port);
+    CHECK(!strcmp(eps.list[5].host, "c") && !strcmp(eps.list[5].port, "65535"));
+
+    CHECK(check_endpoints(&eps, copy, "a,b,c,d,e,f,g,h", port) == 0 && eps.count == ENDPOINT_MAX);
+    CHECK(check_endpoints(&eps, copy, "a,b,c,d,e,f,g,h,i", port) == 1);
+
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+        CHECK(check_endpoints(&eps, copy, invalid[i], port) == 1);
+
+    // -p is the port of every endpoint without one
+    CHECK(check_endpoints(&eps, copy, "a", zero) == 1);
+    CHECK(check_endpoints(&eps, copy, "a", name) == 1);
+    CHECK(check_endpoints(&eps, copy, "a:1", zero) == 0);
+}
+
+/**
+ * @brief Takes the next record and checks it is the expected one
+ *
+ * @param ring
+ * @param kind expected IpkRingKind
+ * @param text expected text
+ */
+static void check_ring_take(ipk_ring *ring, uint32_t kind, const char *text)
+{
+    ipk_ring_record *record = ring_peek(ring);
+
+    CHECK(record != NULL && record->kind == kind && check_field(record->text, record->length, text));
+    if (record != NULL) ring_pop(ring);
+}
+
+/**
+ * @brief --ring: records come out in order across the end of the slots and across the 64 bit
+ * counters overflowing, a full ring refuses a push, a wrong kind or length is skipped, the text
+ * is zero terminated by the client, END ends the stream; the doorbell rings only for a sleeping client
+ *
+ */
+static void check_ring()
+{
+    ipk_ring_producer producer;
+    ipk_ring ring;
+    char arg[32];
+    char text[16];
+    uint64_t count;
+    int next = 0;
+
+    if (ipk_ring_create(&producer, 4))
+    {
+        CHECK(!"ipk_ring_create");
+        return;
+    }
+    CHECK(ipk_ring_create(&producer, 3) == 1 && ipk_ring_create(&producer, 0) == 1);
+
+    strcpy(arg, "3");
+    CHECK(ring_open(&ring, arg) == 1);
+    snprintf(arg, sizeof(arg), "%d:%d", producer.memfd, producer.eventfd);
+    producer.header->magic = 0;
+    CHECK(ring_open(&ring, arg) == 1);
+    producer.header->magic = IPK_RING_MAGIC;
+    CHECK(ring_open(&ring, arg) == 0);
+
+    // the counters overflow in the middle, 3 in and 2 out at a time goes round the 4 slots
+    atomic_store(&producer.header->head, UINT64_MAX - 5);
+    atomic_store(&producer.header->tail, UINT64_MAX - 5);
+    CHECK(ring_peek(&ring) == NULL);
+    for (int round = 0; round < 6; round++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            int pushed = next + (int) (atomic_load(&producer.header->head) - atomic_load(&producer.header->tail));
+            snprintf(text, sizeof(text), "r%d", pushed);
+            CHECK(ipk_ring_push(&producer, IPK_RING_MSG, text, strlen(text)) == (pushed - next >= 4));
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            snprintf(text, sizeof(text), "r%d", next++);
+            check_ring_take(&ring, IPK_RING_MSG, text);
+        }
+    }
+    CHECK(atomic_load(&producer.header->head) < 16);
+    for (int i = 0; i < 4 && atomic_load(&producer.header->head) != atomic_load(&producer.header->tail); i++)
+    {
+        snprintf(text, sizeof(text), "r%d", next++);
+        check_ring_take(&ring, IPK_RING_MSG, text);
+    }
+    CHECK(next == 14 && ring_peek(&ring) == NULL);
+
+    // damaged records are skipped, the text is cut at its length
+    CHECK(ipk_ring_push(&producer, IPK_RING_MSG, text, IPK_RING_TEXT_MAX + 1) == 1);
+    CHECK(ipk_ring_push(&producer, 7, "x", 1) == 0);
+    CHECK(ipk_ring_push(&producer, IPK_RING_LINE, "long", 4) == 0);
+    producer.records[(atomic_load(&producer.header->head) - 1) & 3].length = IPK_RING_TEXT_MAX + 1;
+    CHECK(ipk_ring_push(&producer, IPK_RING_LINE, "/join a", 7) == 0);
+    producer.records[(atomic_load(&producer.header->head) - 1) & 3].text[7] = 'x';
+    check_ring_take(&ring, IPK_RING_LINE, "/join a");
+    CHECK(ring.rejected == 2);
+
+    // the doorbell
+    CHECK(ring_arm(&ring) == 0 && atomic_load(&producer.header->sleeping) == 1);
+    CHECK(ipk_ring_push(&producer, IPK_RING_MSG, "bell", 4) == 0 && atomic_load(&producer.header->sleeping) == 0);
+    CHECK(read(producer.eventfd, &count, sizeof(count)) == sizeof(count) && count == 1);
+    CHECK(ring_arm(&ring) == 1);
+    atomic_store(&producer.header->sleeping, 0);
+    check_ring_take(&ring, IPK_RING_MSG, "bell");
+    CHECK(ipk_ring_push(&producer, IPK_RING_MSG, "quiet", 5) == 0);
+    CHECK(read(producer.eventfd, &count, sizeof(count)) == -1);
+
+    // END after the last record, nothing behind it is taken
+    CHECK(ipk_ring_push(&producer, IPK_RING_END, "", 0) == 0 && ipk_ring_push(&producer, IPK_RING_MSG, "late", 4) == 0);
+    check_ring_take(&ring, IPK_RING_MSG, "quiet");
+    CHECK(!ring_done(&ring) && ring_peek(&ring) == NULL && ring_done(&ring) && ring_peek(&ring) == NULL);
+
+    ring_close(&ring);
+    munmap(producer.header, producer.size);
+    close(producer.memfd);
+    close(producer.eventfd);
+}
+
+int main()
+{
+    ipk_arena arena;
+
+    scan_init();
+    if (arena_init(&arena, ARENA_ITERATION_SIZE)) return 1;
+
+    check_udp_round_trip(&arena);
+    check_udp_malformed();
+    check_tcp_round_trip(&arena);
+    check_tcp_malformed();
+    check_store();
+    check_endpoints_parse();
+    check_ring();
+
+    arena_free(&arena);
+    printf("Checks %d, failed %d\n", checks, failures);
+    return failures != 0;
+}
@@ -0,0 +1,325 @@
+#include "endpoint.h"
+#include "net_connect.h"
+
+/**
+ * @brief Checks a port of the -s list, only digits, 1 to 65535
+ *
+ * @param port
+ * @return int 1 if it is a port, 0 otherwise
+ */
+static int endpoint_port(const char *port)
+{
+    char *end;
+
+    if (port[0] < '0' || port[0] > '9') return 0;
+
+    long value = strtol(port, &end, 10);
+    return *end == '\0' && value > 0 && value <= 65535;
+}
+
+/**
+ * @brief Splits -s into endpoints, host, host:port or [IPv6]:port separated by commas,
+ * an IPv6 address without brackets has no port
+ *
+ * @param eps
+ * @param arg the -s argument, split in place
+ * @param port -p, used when an endpoint has none
+ * @return int 1 if the list is wrong, 0 otherwise
+ */
+int endpoints_parse(ipk_endpoints *eps, char *arg, char *port)
+{
+    char *save = NULL;
+
+    memset(eps, 0, sizeof(*eps));
+    for (char *item = strtok_r(arg, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        if (eps->count == ENDPOINT_MAX)
+        {
+            fprintf(stderr, "ERR: At most %d servers can be given!\n", ENDPOINT_MAX);
+            return 1;
+        }
+
+        ipk_endpoint *ep = &eps->list[eps->count++];
+        char *colon = strrchr(item, ':');
+        ep->host = item;
+        ep->port = port;
+
+        if (item[0] == '[')
+        {
+            char *close = strchr(item, ']');
+            if (close == NULL || (close[1] != '\0' && close[1] != ':'))
+            {
+                fprintf(stderr, "ERR: Invalid server '%s'!\n", item);
+                return 1;
+            }
+            ep->host = item + 1;
+            if (close[1] == ':') ep->port = close + 2;
+            *close = '\0';
+        }
+        else if (colon != NULL && colon == strchr(item, ':'))
+        {
+            *colon = '\0';
+            ep->port = colon + 1;
+        }
+
+        if (ep->host[0] == '\0' || !endpoint_port(ep->port))
+        {
+            fprintf(stderr, "ERR: Invalid server '%s'!\n", ep->host);
+            return 1;
+        }
+    }
+    if (eps->count == 0)
+    {
+        fprintf(stderr, "ERR: No server given!\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Resolves every endpoint, one that can not be resolved is never picked
+ *
+ * @param eps
+ * @param socktype SOCK_STREAM or SOCK_DGRAM
+ * @return int 1 if no endpoint can be resolved, 0 otherwise
+ */
+int endpoints_resolve(ipk_endpoints *eps, int socktype)
+{
+    struct addrinfo hints;
+    int resolved = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    eps->socktype = socktype;
+
+    for (int i = 0; i < eps->count; i++)
+    {
+        ipk_endpoint *ep = &eps->list[i];
+        struct addrinfo *first;
+
+        if (getaddrinfo(ep->host, ep->port, &hints, &ep->info) != 0)
+        {
+            fprintf(stderr, "ERR: Failed to get address info for %s!\n", ep->host);
+            ep->info = NULL;
+            continue;
+        }
+        if (he_order(ep->info, &first, 1) == 0) continue;
+
+        memcpy(&ep->addr, first->ai_addr, first->ai_addrlen);
+        ep->addr_len = first->ai_addrlen;
+        ep->family = first->ai_family;
+        eps->protocol = first->ai_protocol;
+        ep->resolved = 1;
+        resolved++;
+    }
+    return resolved == 0;
+}
+
+/**
+ * @brief Hands the getaddrinfo results of an endpoint to the session, which frees them
+ *
+ * @param eps
+ * @param i endpoint
+ * @return struct addrinfo* the results, NULL if they were taken already
+ */
+struct addrinfo *endpoints_take(ipk_endpoints *eps, int i)
+{
+    struct addrinfo *info = eps->list[i].info;
+    eps->list[i].info = NULL;
+    return info;
+}
+
+/**
+ * @brief Frees the results nobody took, the copied addresses stay for the failover
+ *
+ * @param eps
+ */
+void endpoints_free(ipk_endpoints *eps)
+{
+    for (int i = 0; i < eps->count; i++)
+        if (eps->list[i].info != NULL) freeaddrinfo(endpoints_take(eps, i));
+}
+
+/**
+ * @brief Score of an endpoint, its smoothed RTT made worse by its failure rate
+ *
+ * @param ep
+ * @param now ms
+ * @return double lower is better, -1 if it can not be used now
+ */
+static double endpoint_score(ipk_endpoint *ep, long long now)
+{
+    if (!ep->resolved) return -1;
+    if (ep->failures >= ENDPOINT_FAIL_THRESHOLD && now - ep->out_at < ENDPOINT_RETRY) return -1;
+
+    double rtt = ep->rtt > 0 ? ep->rtt : ENDPOINT_RTT_UNKNOWN;
+    return rtt * (1 + ENDPOINT_FAILURE_WEIGHT * ep->failure);
+}
+
+/**
+ * @brief Picks the endpoint with the best score for the next session, ties go to the earlier one
+ * in the list. When all are out, the one that is out the longest is tried again.
+ *
+ * @param eps
+ * @return int the endpoint, also set as the current one, -1 if none is resolved
+ */
+int endpoints_pick(ipk_endpoints *eps)
+{
+    long long now = ipk_now_us() / 1000;
+    int best = -1;
+    double best_score = 0;
+
+    for (int i = 0; i < eps->count; i++)
+    {
+        double score = endpoint_score(&eps->list[i], now);
+        if (score >= 0 && (best == -1 || score < best_score))
+        {
+            best = i;
+            best_score = score;
+        }
+    }
+    if (best == -1)
+    {
+        for (int i = 0; i < eps->count; i++)
+            if (eps->list[i].resolved && (best == -1 || eps->list[i].out_at < eps->list[best].out_at)) best = i;
+    }
+
+    if (best >= 0) eps->current = best;
+    return best;
+}
+
+/**
+ * @brief Updates the health of the current endpoint, only with more than one endpoint
+ *
+ * @param eps
+ * @param event EndpointEvent
+ * @param rtt ms, with ENDPOINT_OK
+ */
+void endpoints_event(ipk_endpoints *eps, int event, double rtt)
+{
+    if (eps->count < 2) return;
+
+    ipk_endpoint *ep = &eps->list[eps->current];
+    if (event == ENDPOINT_OK)
+    {
+        if (rtt < 0.1) rtt = 0.1;   // the clock has ms, a loopback sample of 0 still counts
+        ep->rtt = ep->rtt > 0 ? (1 - ENDPOINT_ALPHA) * ep->rtt + ENDPOINT_ALPHA * rtt : rtt;
+        ep->failure *= 1 - ENDPOINT_ALPHA;
+        ep->failures = 0;
+        return;
+    }
+
+    ep->failure = (1 - ENDPOINT_ALPHA) * ep->failure + ENDPOINT_ALPHA;
+    if (++ep->failures == ENDPOINT_FAIL_THRESHOLD) ep->out_at = ipk_now_us() / 1000;
+    if (event == ENDPOINT_TIMEOUT) ep->timeouts++;
+    else ep->refused++;
+}
+
+/**
+ * @brief The session lost its endpoint, errno tells how
+ *
+ * @param eps
+ * @param error errno of the failed call, 0 if the server closed the connection
+ */
+void endpoints_lost(ipk_endpoints *eps, int error)
+{
+    int timeout = error == ETIMEDOUT || error == EAGAIN || error == EWOULDBLOCK;
+    endpoints_event(eps, timeout ? ENDPOINT_TIMEOUT : ENDPOINT_REFUSED, 0);
+}
+
+/**
+ * @brief Check if the live session should move, its endpoint crossed the threshold
+ * and another one can be used
+ *
+ * @param eps
+ * @return int 1 if the session should fail over, 0 otherwise
+ */
+int endpoints_failing(ipk_endpoints *eps)
+{
+    if (eps->count < 2 || eps->list[eps->current].failures < ENDPOINT_FAIL_THRESHOLD) return 0;
+
+    long long now = ipk_now_us() / 1000;
+    for (int i = 0; i < eps->count; i++)
+        if (i != eps->current && endpoint_score(&eps->list[i], now) >= 0) return 1;
+    return 0;
+}
+
+/**
+ * @brief A socket to the best endpoint, TCP connects with ENDPOINT_CONNECT_TIMEOUT and the connect
+ * time is an RTT sample, a failed connect counts against the endpoint
+ *
+ * @param eps
+ * @return int blocking socket, -1 if it could not be created or connected
+ */
+int endpoints_connect(ipk_endpoints *eps)
+{
+    int previous = eps->current;
+    int i = endpoints_pick(eps);
+    if (i < 0) return -1;
+
+    ipk_endpoint *ep = &eps->list[i];
+    if (i != previous)
+        fprintf(stderr, "Failover: %s:%s -> %s:%s\n", eps->list[previous].host, eps->list[previous].port, ep->host, ep->port);
+
+    int s = socket(ep->family, eps->socktype, eps->protocol);
+    if (s < 0)
+    {
+        fprintf(stderr, "ERR: Socket creation!\n");
+        return -1;
+    }
+    if (eps->socktype != SOCK_STREAM) return s;
+
+    long long start = ipk_now_us() / 1000;
+    int flags = fcntl(s, F_GETFL);
+    fcntl(s, F_SETFL, flags | O_NONBLOCK);
+
+    int error = 0;
+    if (connect(s, (struct sockaddr *) &ep->addr, ep->addr_len) < 0)
+    {
+        struct pollfd pfd = {.fd = s, .events = POLLOUT};
+        socklen_t error_len = sizeof(error);
+
+        error = errno;
+        if (error == EINPROGRESS)
+        {
+            int ready = poll(&pfd, 1, ENDPOINT_CONNECT_TIMEOUT);
+            if (ready == 0) error = ETIMEDOUT;
+            else if (ready < 0 || getsockopt(s, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0) error = errno;
+        }
+    }
+    if (error != 0)
+    {
+        endpoints_lost(eps, error);
+        close(s);
+        return -1;
+    }
+
+    fcntl(s, F_SETFL, flags);
+    endpoints_event(eps, ENDPOINT_OK, (double) (ipk_now_us() / 1000 - start));
+    endpoints_tune(eps, s);
+    return s;
+}
+
+/**
+ * @brief A TCP session that can fail over notices a dead server in seconds, not minutes:
+ * unacknowledged data and a silent idle connection both fail after ENDPOINT_USER_TIMEOUT
+ *
+ * @param eps
+ * @param s TCP socket
+ */
+void endpoints_tune(ipk_endpoints *eps, int s)
+{
+    if (eps->count < 2 || eps->socktype != SOCK_STREAM) return;
+
+    int user_timeout = ENDPOINT_USER_TIMEOUT;
+    int on = 1;
+    int idle = 1;               // s, keepalive after 1 s of silence, then 2 probes 1 s apart
+    int count = 2;
+
+    setsockopt(s, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout));
+    setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(s, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(s, IPPROTO_TCP, TCP_KEEPINTVL, &idle, sizeof(idle));
+    setsockopt(s, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+}
@@ -0,0 +1,73 @@
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "monotonic.h"
+
+#define ENDPOINT_MAX 8                  // servers in the -s list
+#define ENDPOINT_FAIL_THRESHOLD 2       // failures in a row that take an endpoint out
+#define ENDPOINT_RETRY 5000             // ms, an endpoint that is out is tried again after this
+#define ENDPOINT_RTT_UNKNOWN 100.0      // ms, assumed until the first sample
+#define ENDPOINT_ALPHA 0.25             // weight of a new sample in the smoothed RTT and failure rate
+#define ENDPOINT_FAILURE_WEIGHT 4.0     // a failure rate of 1 makes the RTT count 5 times
+#define ENDPOINT_CONNECT_TIMEOUT 1000   // ms, one TCP connect attempt during failover
+#define ENDPOINT_USER_TIMEOUT 3000      // ms, TCP_USER_TIMEOUT and keepalive of a session that can fail over
+
+enum EndpointEvent
+{
+    ENDPOINT_OK = 0,                    // connected or confirmed, with an RTT sample
+    ENDPOINT_TIMEOUT,                   // CONFIRM or the connect did not come in time
+    ENDPOINT_REFUSED                    // refused, reset or closed by the server
+};
+
+// one server of the -s list with its health
+typedef struct ipk_endpoint
+{
+    char *host;
+    char *port;
+    struct addrinfo *info;              // getaddrinfo results, moved to the session that uses them
+    struct sockaddr_storage addr;       // the first address in the Happy Eyeballs order
+    socklen_t addr_len;
+    int family;
+    int resolved;
+    double rtt;                         // smoothed, ms, 0 before the first sample
+    double failure;                     // smoothed failure rate, 0 to 1
+    int failures;                       // in a row
+    long long out_at;                   // when it crossed ENDPOINT_FAIL_THRESHOLD, ms
+    unsigned long timeouts;
+    unsigned long refused;
+} ipk_endpoint;
+
+// -s host[:port],host[:port],..., sessions go to the endpoint with the best score
+typedef struct ipk_endpoints
+{
+    ipk_endpoint list[ENDPOINT_MAX];
+    int count;
+    int current;                        // the endpoint of the session
+    int socktype;
+    int protocol;
+} ipk_endpoints;
+
+int endpoints_parse(ipk_endpoints *eps, char *arg, char *port);
+int endpoints_resolve(ipk_endpoints *eps, int socktype);
+struct addrinfo *endpoints_take(ipk_endpoints *eps, int i);
+void endpoints_free(ipk_endpoints *eps);
+int endpoints_pick(ipk_endpoints *eps);
+void endpoints_event(ipk_endpoints *eps, int event, double rtt);
+void endpoints_lost(ipk_endpoints *eps, int error);
+int endpoints_failing(ipk_endpoints *eps);
+int endpoints_connect(ipk_endpoints *eps);
+void endpoints_tune(ipk_endpoints *eps, int s);
+
+#endif
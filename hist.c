@@ -0,0 +1,67 @@
+#include "hist.h"
+
+/**
+ * @brief Bucket of a value, 8 linear buckets per power of two
+ *
+ * @param value
+ * @return int index
+ */
+static int hist_bucket(long long value)
+{
+    if (value < 8) return value < 0 ? 0 : (int) value;
+
+    int exponent = 63 - __builtin_clzll((unsigned long long) value);
+    int index = ((exponent - 2) << 3) + (int) ((value >> (exponent - 3)) & 7);
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+/**
+ * @brief The largest value that falls into the bucket
+ *
+ * @param index
+ * @return long long
+ */
+static long long hist_bucket_limit(int index)
+{
+    if (index < 8) return index;
+
+    int exponent = (index >> 3) + 2;
+    return ((long long) (8 + (index & 7) + 1) << (exponent - 3)) - 1;
+}
+
+/**
+ * @brief Records one sample
+ *
+ * @param hist
+ * @param value e.g. latency in microseconds
+ */
+void hist_add(ipk_hist *hist, long long value)
+{
+    hist->count[hist_bucket(value)]++;
+    hist->samples++;
+    if (value > hist->max) hist->max = value;
+}
+
+/**
+ * @brief Value below which the given part of the samples falls
+ *
+ * @param hist
+ * @param part 0.5 for the median, ...
+ * @return long long upper limit of the bucket, at most the largest sample, 0 without samples
+ */
+long long hist_percentile(ipk_hist *hist, double part)
+{
+    unsigned long target = (unsigned long) (part * hist->samples + 0.999999);
+    unsigned long count = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        count += hist->count[i];
+        if (count >= target)
+        {
+            long long limit = hist_bucket_limit(i);
+            return limit < hist->max ? limit : hist->max;
+        }
+    }
+    return hist->max;
+}
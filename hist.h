@@ -0,0 +1,17 @@
+#ifndef HIST_H
+#define HIST_H
+
+#define HIST_BUCKETS 320            // 8 linear buckets per power of two, up to 2^41
+
+// latency histogram with a bounded relative error (1/8), filled without allocation
+typedef struct ipk_hist
+{
+    unsigned long count[HIST_BUCKETS];
+    unsigned long samples;
+    long long max;
+} ipk_hist;
+
+void hist_add(ipk_hist *hist, long long value);
+long long hist_percentile(ipk_hist *hist, double part);
+
+#endif
@@ -0,0 +1,240 @@
+#include "input.h"
+
+/**
+ * @brief Empty reader
+ *
+ * @param reader
+ */
+void reader_init(ipk_reader *reader)
+{
+    reader->start = 0;
+    reader->used = 0;
+    reader->eof = 0;
+}
+
+/**
+ * @brief One read() into the free space, the lines already taken are dropped first
+ *
+ * @param reader
+ * @param fd console
+ * @return int 1 if reading failed (it is then treated as the end of the input), 0 otherwise
+ */
+int reader_fill(ipk_reader *reader, int fd)
+{
+    if (reader->start > 0)
+    {
+        memmove(reader->buff, reader->buff + reader->start, reader->used - reader->start);
+        reader->used -= reader->start;
+        reader->start = 0;
+    }
+    if (reader->eof || reader->used == READER_SIZE) return 0;
+
+    ssize_t length = read(fd, reader->buff + reader->used, READER_SIZE - reader->used);
+    if (length < 0 && errno == EINTR) return 0;
+    if (length <= 0)
+    {
+        reader->eof = 1;
+        if (length < 0)
+        {
+            fprintf(stderr, "ERR: Can't read input!\n");
+            return 1;
+        }
+        return 0;
+    }
+    reader->used += length;
+    return 0;
+}
+
+/**
+ * @brief Takes the next line, without "\n" or "\r\n". A line longer than READER_SIZE is cut,
+ * the last line does not need "\n".
+ *
+ * @param reader
+ * @param line zero terminated, points into the reader, valid until the next reader_fill
+ * @param length
+ * @return int 1 if a line was taken, 0 if the rest of it was not read yet, -1 at the end of the input
+ */
+int reader_next(ipk_reader *reader, char **line, size_t *length)
+{
+    char *start = reader->buff + reader->start;
+    size_t left = reader->used - reader->start;
+    char *newline = memchr(start, '\n', left);
+
+    if (newline == NULL)
+    {
+        if (left == 0 && reader->eof) return -1;
+        if (left == 0 || (!reader->eof && left < READER_SIZE)) return 0;
+        newline = start + left;
+    }
+
+    *length = newline - start;
+    reader->start += *length + (*length < left);
+    if (*length > 0 && start[*length - 1] == '\r') (*length)--;
+    start[*length] = '\0';
+    *line = start;
+    return 1;
+}
+
+/**
+ * @brief Check if reader_next has something without reading
+ *
+ * @param reader
+ * @return int 1 if a line or the end of the input is ready, 0 otherwise
+ */
+int reader_ready(ipk_reader *reader)
+{
+    size_t left = reader->used - reader->start;
+
+    return reader->eof || left == READER_SIZE || memchr(reader->buff + reader->start, '\n', left) != NULL;
+}
+
+/**
+ * @brief Check if reader_fill can read more, poll watches the console only then
+ *
+ * @param reader
+ * @return int 1 if the input did not end and there is free space, 0 otherwise
+ */
+int reader_room(ipk_reader *reader)
+{
+    return !reader->eof && reader->used - reader->start < READER_SIZE;
+}
+
+/**
+ * @brief Adds a line as if it came from the console, before everything read later (-u, -j)
+ *
+ * @param reader
+ * @param line without "\n"
+ * @return int 1 if it does not fit, 0 otherwise
+ */
+int reader_push(ipk_reader *reader, const char *line)
+{
+    size_t length = strlen(line);
+
+    if (reader->used + length + 1 > READER_SIZE) return 1;
+    memcpy(reader->buff + reader->used, line, length);
+    reader->buff[reader->used + length] = '\n';
+    reader->used += length + 1;
+    return 0;
+}
+
+/**
+ * @brief Where the chunk starting at pos ends, at a space near the limit if there is one,
+ * otherwise at the limit, never inside a UTF-8 sequence
+ *
+ * @param chunker
+ * @param pos
+ * @param next where the following chunk starts, the space is dropped
+ * @return size_t end of the chunk
+ */
+static size_t chunk_end(ipk_chunker *chunker, size_t pos, size_t *next)
+{
+    size_t capacity = CHUNK_MAX - chunker->reserve;
+    size_t end = pos + capacity;
+
+    if (chunker->length - pos <= capacity)
+    {
+        *next = chunker->length;
+        return chunker->length;
+    }
+
+    for (size_t i = end; i > end - CHUNK_WORD_SEARCH; i--)
+    {
+        if (chunker->line[i] != ' ') continue;
+
+        *next = i + 1;
+        return i;
+    }
+
+    while (end > pos + 1 && ((unsigned char) chunker->line[end] & 0xC0) == 0x80) end--;
+    *next = end;
+    return end;
+}
+
+/**
+ * @brief Prepares the split of a line, a line that fits into one MSG is one untagged chunk
+ *
+ * @param chunker
+ * @param line
+ * @param length
+ * @param tagged prefix the chunks of a long line with "[i/n] "
+ */
+void chunk_init(ipk_chunker *chunker, const char *line, size_t length, int tagged)
+{
+    chunker->line = line;
+    chunker->length = length;
+    chunker->pos = 0;
+    chunker->index = 0;
+    chunker->count = 1;
+    chunker->reserve = 0;
+
+    if (length <= CHUNK_MAX) return;
+
+    if (tagged)
+    {
+        // every chunk but the last one is longer than half of CHUNK_MAX, so this bounds the count
+        int digits = 1;
+        for (size_t most = length / (CHUNK_MAX / 2) + 1; most >= 10; most /= 10) digits++;
+        chunker->reserve = 2 * digits + 4;
+    }
+
+    chunker->count = 0;
+    for (size_t pos = 0; pos < length; chunker->count++) chunk_end(chunker, pos, &pos);
+}
+
+/**
+ * @brief Copies the next chunk with its tag
+ *
+ * @param chunker
+ * @param out at least CHUNK_MAX + 1 bytes
+ * @param size
+ * @return int 1 if a chunk was copied, 0 if the line is done
+ */
+int chunk_next(ipk_chunker *chunker, char *out, size_t size)
+{
+    const char *text;
+    size_t tag;
+    size_t length;
+
+    if (size <= CHUNK_MAX || !chunk_view(chunker, out, &tag, &text, &length)) return 0;
+    memcpy(out + tag, text, length);
+    out[tag + length] = '\0';
+    return 1;
+}
+
+/**
+ * @brief Takes the next chunk without copying it, the text stays in the line
+ *
+ * @param chunker
+ * @param tag set to "[i/n] " or "", CHUNK_TAG_SIZE bytes
+ * @param tag_len
+ * @param text set to the chunk inside the line, not zero terminated
+ * @param length
+ * @return int 1 if there was a chunk, 0 if the line is done
+ */
+int chunk_view(ipk_chunker *chunker, char *tag, size_t *tag_len, const char **text, size_t *length)
+{
+    if (chunk_done(chunker)) return 0;
+
+    size_t next;
+    size_t end = chunk_end(chunker, chunker->pos, &next);
+
+    chunker->index++;
+    tag[0] = '\0';
+    if (chunker->reserve > 0) snprintf(tag, CHUNK_TAG_SIZE, "[%d/%d] ", chunker->index, chunker->count);
+    *tag_len = strlen(tag);
+    *text = chunker->line + chunker->pos;
+    *length = end - chunker->pos;
+    chunker->pos = next;
+    return 1;
+}
+
+/**
+ * @brief Check if all chunks were taken
+ *
+ * @param chunker
+ * @return int 1 if the line is done, 0 otherwise
+ */
+int chunk_done(ipk_chunker *chunker)
+{
+    return chunker->index == chunker->count;
+}
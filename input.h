@@ -0,0 +1,46 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "scan.h"
+
+#define READER_SIZE 65536       // console input not yet split into lines, a longer line is cut here
+#define CHUNK_MAX SCAN_CONTENT_MAX
+#define CHUNK_WORD_SEARCH 80    // a chunk ends at a space if there is one among its last characters
+#define CHUNK_TAG_SIZE 32       // "[i/n] " with its zero
+
+// the console read with read(), so poll sees every byte that was not processed yet
+typedef struct ipk_reader
+{
+    char buff[READER_SIZE + 1];
+    size_t start;               // the next line
+    size_t used;
+    int eof;                    // read returned 0 or failed
+} ipk_reader;
+
+// splits a line longer than one MSG into MSG contents, optionally tagged "[1/3] "
+typedef struct ipk_chunker
+{
+    const char *line;
+    size_t length;
+    size_t pos;                 // the next chunk starts here
+    int index;                  // chunks taken
+    int count;                  // chunks of the line
+    size_t reserve;             // characters of the tag
+} ipk_chunker;
+
+void reader_init(ipk_reader *reader);
+int reader_fill(ipk_reader *reader, int fd);
+int reader_next(ipk_reader *reader, char **line, size_t *length);
+int reader_ready(ipk_reader *reader);
+int reader_room(ipk_reader *reader);
+int reader_push(ipk_reader *reader, const char *line);
+void chunk_init(ipk_chunker *chunker, const char *line, size_t length, int tagged);
+int chunk_next(ipk_chunker *chunker, char *out, size_t size);
+int chunk_view(ipk_chunker *chunker, char *tag, size_t *tag_len, const char **text, size_t *length);
+int chunk_done(ipk_chunker *chunker);
+
+#endif
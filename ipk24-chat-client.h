@@ -20,31 +20,60 @@
 #include "udp.h"
 #include "tcp.h"
 #include "udp_id_history.h"
+#include "reconnect.h"
+#include "net_connect.h"
+#include "arena.h"
+#include "bulk.h"
+#include "udp_rel.h"
+#include "sim.h"
+#include "input.h"
+#include "busy.h"
+#include "bridge.h"
+#include "race.h"
+#include "stats.h"
+#include "store.h"
+#include "probe.h"
+#include "login.h"
+#include "endpoint.h"
+#include "trace.h"
+#include "usdt.h"
+#include "sched.h"
+#include "ring.h"
+#include "session.h"
 
 #define DEFAULT_CONF_TIMEOUT 250
 #define DEFAULT_MAX_RETRANSMISSIONS 3
+// a chunk that is not the last one is shorter than CHUNK_MAX by at most the word search and its tag
+#define CHUNK_MIN (CHUNK_MAX - CHUNK_WORD_SEARCH - CHUNK_TAG_SIZE)
+#define UDP_LINE_NODES (READER_SIZE / CHUNK_MIN + 1)        // FIFO nodes of the longest console line, as its chunks
+#define RING_LINE_NODES (IPK_RING_TEXT_MAX / CHUNK_MIN + 1) // FIFO nodes of a --ring record
+#define STORE_ITERATION (SCHED_SOCKET_BUDGET + 1)       // messages stored in one loop iteration at most, received and sent
 #define MAX_MESSAGE_SIZE 1500
 #define DEFAULT_CHANNEL "channel1"
 #define DEFAULT_SERVER_PORT "4567"
+#define UNKNOWN_DISPLAY_NAME "unknown"     // ERR sent before AUTH
+
+// a MSG with CHUNK_MAX characters fits into the receive buffer of the server
+_Static_assert(IPK_BIN_MAX_MSG <= MAX_MESSAGE_SIZE && IPK_BIN_MAX_MSG <= REL_SLOT_SIZE, "a chunk does not fit into one datagram");
 //11559478-9b5c-4b74-935b-13070e18d768
 
 volatile sig_atomic_t received_signal = 0;
 
-enum State
+// the options of one run, main fills them in and hands them to tcp() or udp()
+typedef struct ipk_options
 {
-    START = 0,
-    AUTH_SEND,
-    AUTH_CONF,
-    AUTH_REPLY,
-    JOIN_SEND,
-    JOIN_CONF,
-    MSG_SEND,
-    MSG_CONF,
-    ERR_SEND,
-    ERR_CONF,
-    BYE_SEND,
-    BYE_CONF
-};
+    int conf_timeout;               // -d, ms to wait for CONFIRM (UDP)
+    int max_retransmissions;        // -r, retransmissions of a message (UDP)
+    int resilient;                  // -R, reconnect after a connection loss instead of exiting
+    int tag_chunks;                 // -c, the chunks of a long message get "[i/n] "
+    ipk_bulk *bulk;                 // -f, lines of the file sent instead of the console input
+    ipk_busy *busy;                 // -B, poll spins before it blocks
+    ipk_store *store;               // -H, the sent and received messages are kept here
+    ipk_probe *probe;               // --probe, the requests are timed and reported at the end
+    ipk_login *login;               // -u, AUTH and JOIN are sent before the console input
+    ipk_endpoints *endpoints;       // -s with several servers, a lost session fails over to the best one
+    ipk_ring *ring;                 // --ring, records of a local process are sent next to the console input
+} ipk_options;
 
 enum Response
 {
@@ -61,9 +90,14 @@ void handle_interrupt(int signum);
 void opt_arg_check(char *transfer_protocol, char *ip_addr);
 void print_help();
 int check_input(char *input);
-enum Response check_response(char *response, char **resp, char **resp_succ, char **message);
-int recv_next_state(char *response, char **display_name, char **buff, int state, int *proccessing, int client_socket);
-void udp_exit(char **buff, char **display_name, char **buff_confirm, struct Node **head, struct ipk_list **fifo, int client_socket, struct addrinfo **server_info, int exit_code);
-void udp_conf(int *id_conf, char ** buff, int *retransmition, int max_num_retransmissions, int *timeout, enum State *current_state, enum State next_state);
-void tcp(char *host, char *port);
-void udp(char *host, char *port, int conf_timeout, int max_num_retransmissions);
\ No newline at end of file
+int check_param(char *param, enum ScanClass cls);
+int check_message(char *input, int tagged);
+enum Response check_response(char *response, ipk_view *view);
+int recv_next_state(ipk_arena *arena, char *response, char **display_name, char **buff, int state, int *proccessing, int client_socket, ipk_store *store, ipk_probe *probe, int *replied);
+void udp_exit(ipk_arena *arena, ipk_arena *flight, struct Node **head, ipk_lanes *lanes, int client_socket, struct addrinfo **server_info, int exit_code);
+void udp_conf(char ** buff, enum State *current_state, enum State next_state);
+int udp_show(ipk_view *view, ipk_rel *rel);
+void udp_queue(ipk_lanes *lanes, char *line, int tagged);
+struct addrinfo *resolve(char *host, char *port, int socktype);
+void tcp(int client_socket, struct addrinfo *server_info, struct addrinfo *p, ipk_options *options);
+void udp(struct addrinfo *server_info, ipk_options *options);
\ No newline at end of file
@@ -21,7 +21,7 @@ void handle_interrupt(int signum)
 /**
  * @brief Checks if the specified arguments have been specified
  * 
- * @param transfer_protocol udp/tcp
+ * @param transfer_protocol udp/tcp/auto
  * @param ip_addr IPv4
  * @param conf_timeout timeout for udp 
  * @param max_num_retransmissions maximum number of forwarding for udp
@@ -33,7 +33,7 @@ void opt_arg_check(char *transfer_protocol, char *ip_addr)
         fprintf(stderr, "ERR: Use './ipk24-chat-client -h' for help!\n");
         exit(1);
     }
-    if (strcmp(transfer_protocol, "udp") && strcmp(transfer_protocol, "tcp")) 
+    if (strcmp(transfer_protocol, "udp") && strcmp(transfer_protocol, "tcp") && strcmp(transfer_protocol, "auto")) 
     {
         fprintf(stderr, "ERR: Unknown transport protocol: '%s'!\n", transfer_protocol);
         exit(1);
@@ -46,15 +46,31 @@ void opt_arg_check(char *transfer_protocol, char *ip_addr)
  */
 void print_help()
 {
-    printf("Usage: ./ipk24-chat-client -t <protocol> -s <IP address> -p <port> -d <number> -r <number> -h\n");
+    printf("Usage: ./ipk24-chat-client -t <protocol> -s <host>[:<port>][,...] -p <port> -d <number> -r <number> -R -c -f <file> -m <number> -b <number> -S <number>[:<seed>] -B <us>[:<cpu>] -L <port> -H <file> -u <username> -k <secret> -n <name> -j <channel> --probe <user>:<secret>[:<count>[:<channel>]] --trace <file> --ring <memfd>:<eventfd> -h\n");
     printf("\n");
     printf("Argument    | Value         | Possible values	        | Meaning or expected program behaviour\n");
     printf("--------------------------------------------------------------------------------------------------\n");
-    printf("-t          | User provided | tcp or udp                | Transport protocol used for connection\n");
-    printf("-s          | User provided | IP address or hostname    | Server IP or hostname\n");
+    printf("-t          | User provided | tcp, udp or auto          | Transport protocol used for connection, auto races both\n");
+    printf("-s          | User provided | host[:port][,...]         | Server IP or hostname, a list fails over to the healthiest\n");
     printf("-p          | 4567          | uint16	                | Server port\n");
     printf("-d          | 250           | uint16	                | UDP confirmation timeout\n");
     printf("-r          | 3	            | uint8                     | Maximum number of UDP retransmissions\n");
+    printf("-R          | 	            |                           | Reconnect and resume the session after a connection loss\n");
+    printf("-c          | 	            |                           | Tag the chunks of a message longer than 1400 characters with [i/n]\n");
+    printf("-f          | 	            | path                      | Send the lines of the file instead of the console input\n");
+    printf("-m          | unlimited     | number                    | Maximum messages per second with -f or --probe\n");
+    printf("-b          | unlimited     | number                    | Maximum bytes per second with -f\n");
+    printf("-S          | 	            | sessions[:seed]           | Simulate UDP sessions over a lossy network (uses -d, -r) and exit\n");
+    printf("-B          | 	            | us[:cpu]                  | Spin before poll blocks, pin to the CPU, lock memory, report latency\n");
+    printf("-L          | 	            | uint16                    | Bridge local clients of the other protocol to the server (uses -d, -r)\n");
+    printf("-H          | 	            | path                      | Keep the messages in a mapped log, /history [sender] [since] searches it\n");
+    printf("-u          | IPK_USERNAME  | Username                  | AUTH right after connecting, before the console is read, report time to ready\n");
+    printf("-k          | IPK_SECRET    | Secret                    | Secret of -u, the environment variable is not visible in ps\n");
+    printf("-n          | username      | DisplayName               | Display name of -u (IPK_DISPLAY_NAME)\n");
+    printf("-j          | IPK_CHANNEL   | ChannelID                 | JOIN right after AUTH of -u\n");
+    printf("--probe     | 	            | user:secret[:count[:chan]]| AUTH, JOIN chan (probe), count MSG (20) paced by -m, print RTT and loss as JSON\n");
+    printf("--trace     | 	            | path                      | Write the lifecycle of every message as Chrome trace JSON at exit\n");
+    printf("--ring      | 	            | memfd:eventfd             | Take messages from the shared-memory ring of a local process (ipk_ring.h)\n");
     printf("-h          | 	            |                           | Prints program help output and exits\n\n");
 }
 
@@ -62,7 +78,7 @@ void print_help()
  * @brief Check if the client's input starts with a command.
  * 
  * @param input client input
- * @return int number, depending on how the input starts, 5 = invalid command
+ * @return int number, depending on how the input starts, 5 = invalid command, 7 = /history
  */
 int check_input(char *input)
 {
@@ -72,128 +88,109 @@ int check_input(char *input)
         else if (!strncmp(input, "/join", strlen("/join"))) return 2;
         else if (!strncmp(input, "/rename", strlen("/rename"))) return 3;
         else if (!strncmp(input, "/help", strlen("/help"))) return 4;
+        else if (!strncmp(input, "/history", strlen("/history"))) return 7;
         else return 5;
     }
     else return 6;
 }
 
 /**
- * @brief This function checks the response from the server and decides what came. 
- * It uses functions like tcp_check_reply and if any of them return 0, 
- * it returns a Response value. They always have to copy the response to resp and then work with it, 
- * because there happens to be deletion of the value using strtok.
+ * @brief Checks a parameter of a command or a message before it is sent to the server
  * 
- * @param response response from the server
- * @param resp auxiliary copy of the response to work with
- * @param resp_succ this value is either supplied with DisplayName or OK|NOK, depending on what the message is from the server
- * @param message message
- * @return enum Response represents what came from the server, INT_ERR represents an allocation error
+ * @param param the parameter
+ * @param cls what the parameter is
+ * @return int 1 if the parameter is valid, 0 otherwise
  */
-enum Response check_response(char *response, char **resp, char **resp_succ, char **message)
+int check_param(char *param, enum ScanClass cls)
 {
-    enum Response resp_code = UKNOWN;
+    if (scan_valid(param, strlen(param), cls)) return 1;
 
-    *resp = strdup(response);
-    if (*resp == NULL)
+    switch (cls)
     {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return INT_ERR;
+        case SCAN_ID:
+            fprintf(stderr, "ERR: Username and ChannelID must be 1-20 characters [A-Za-z0-9-]!\n");
+            break;
+        case SCAN_SECRET:
+            fprintf(stderr, "ERR: Secret must be 1-128 characters [A-Za-z0-9-]!\n");
+            break;
+        case SCAN_DNAME:
+            fprintf(stderr, "ERR: DisplayName must be 1-20 printable characters!\n");
+            break;
+        default:
+            fprintf(stderr, "ERR: Message must be 1-1400 printable characters!\n");
+            break;
     }
+    return 0;
+}
 
-    if (!tcp_check_err(*resp, resp_succ, message)) 
-        resp_code = ERR;
-    else
+/**
+ * @brief Checks a message before it is sent, a message longer than CHUNK_MAX is checked chunk
+ * by chunk, so either all of its chunks go or none
+ * 
+ * @param input the message
+ * @param tagged the chunks get "[i/n] "
+ * @return int 1 if the message is valid, 0 otherwise
+ */
+int check_message(char *input, int tagged)
+{
+    ipk_chunker chunker;
+    char chunk[CHUNK_MAX + 1];
+
+    chunk_init(&chunker, input, strlen(input), tagged);
+    while (chunk_next(&chunker, chunk, sizeof(chunk)))
+        if (!check_param(chunk, SCAN_CONTENT)) return 0;
+    return 1;
+}
+
+/**
+ * @brief This function checks the response from the server and decides what came. 
+ * The message is decoded in place by tcp_decode, the parameters in view point into it.
+ * 
+ * @param response response from the server without "\r\n"
+ * @param view the decoded message
+ * @return enum Response represents what came from the server
+ */
+enum Response check_response(char *response, ipk_view *view)
+{
+    size_t length = strlen(response);
+    int malformed = tcp_decode(response, length, view);
+
+    USDT3(recv, malformed ? 0 : view->type, -1, length);
+    if (malformed) return UKNOWN;
+
+    switch (view->type)
     {
-        if (*resp_succ != NULL) free(*resp_succ);
-        if (*message != NULL) free(*message);
-        *resp_succ = NULL;
-        *message = NULL;
-        free(*resp);
-        *resp = strdup(response);
-        if (*resp == NULL)
-        {
-            fprintf(stderr, "ERR: Memory allocation failed!\n");
-            return INT_ERR;
-        }
-        if (!tcp_check_reply(*resp, resp_succ, message))
-        {
-            if (!strcasecmp(*resp_succ, "OK")) resp_code = OK;
-            else resp_code = NOK;
-        }
-        else 
-        {
-            if (*resp_succ != NULL) free(*resp_succ);
-            if (*message != NULL) free(*message);
-            *resp_succ = NULL;
-            *message = NULL;
-            free(*resp);
-            *resp = strdup(response);
-            if (*resp == NULL)
-            {
-                fprintf(stderr, "ERR: Memory allocation failed!\n");
-                return INT_ERR;
-            }
-            if (!tcp_check_msg(*resp, resp_succ, message))
-                resp_code = MSG;
-            else
-            {
-                if (*resp_succ != NULL) free(*resp_succ);
-                if (*message != NULL) free(*message);
-                *resp_succ = NULL;
-                *message = NULL;
-                free(*resp);
-                *resp = strdup(response);
-                if (*resp == NULL)
-                {
-                    fprintf(stderr, "ERR: Memory allocation failed!\n");
-                    return INT_ERR;
-                }
-                if (!tcp_check_bye(*resp))
-                {
-                    resp_code = BYE;
-                    if (*resp_succ != NULL) free(*resp_succ);
-                    if (*message != NULL) free(*message);
-                    if (*resp != NULL) free(*resp);
-                    *resp_succ = NULL;
-                    *message = NULL;
-                    *resp = NULL;
-                }
-                else resp_code = UKNOWN;
-            }
-        }
+        case IPK_ERR: return ERR;
+        case IPK_REPLY: return view->result ? OK : NOK;
+        case IPK_MSG: return MSG;
+        case IPK_BYE: return BYE;
+        default: return UKNOWN;
     }
-
-    return resp_code;
 }
 
 /**
  * @brief It checks the response from the server and decides the next state. 
  * In the event of an error, free all pointers, close the socket and terminate the program.
  * 
+ * @param arena memory for the parsed message and the reply
  * @param response the message from the server
  * @param display_name the client's display name
  * @param buff final client response
  * @param state current state
  * @param proccessing decides whether or not the client can currently send more messages
  * @param client_socket the socket
+ * @param store message history, MSG from the server is added
+ * @param probe --probe, REPLY ends the measured request
+ * @param replied set to 1 for REPLY OK, 0 for REPLY NOK and -1 for anything else
  * @return int next state
  */
-int recv_next_state(char *response, char **display_name, char **buff, int state, int *proccessing, int client_socket)
+int recv_next_state(ipk_arena *arena, char *response, char **display_name, char **buff, int state, int *proccessing, int client_socket, ipk_store *store, ipk_probe *probe, int *replied)
 {
     int current_state = state;
-    char *message = NULL;
-    char *resp_succ = NULL;
-    char *resp = NULL;
+    ipk_view view;
 
-    enum Response resp_code = check_response(response, &resp, &resp_succ, &message);
-    
-    if (resp_code == INT_ERR)
-    {
-        if (*buff != NULL) free(*buff);
-        if (*display_name != NULL) free(*display_name);
-        close(client_socket);
-        exit(1);
-    }
+    enum Response resp_code = check_response(response, &view);
+    *replied = -1;
 
     switch (current_state)
     {
@@ -203,11 +200,9 @@ int recv_next_state(char *response, char **display_name, char **buff, int state,
             {
                 current_state = 4;
                 *proccessing = 1;
-                fprintf(stderr, "ERR FROM %s: %s\n", resp_succ, message);
-                if (content_bye(buff))
+                STATS_CALL(STATS_WRITE, fprintf(stderr, "ERR FROM %s: %s\n", view.display_name, view.content));
+                if (tcp_encode_bye(arena, buff))
                 {
-                    if (*buff != NULL) free(*buff);
-                    if (*display_name != NULL) free(*display_name);
                     close(client_socket);
                     exit(1);
                 }
@@ -215,19 +210,23 @@ int recv_next_state(char *response, char **display_name, char **buff, int state,
             else if (resp_code == OK)
             {
                 current_state = 2;
-                fprintf(stderr, "Success: %s\n", message);
+                STATS_CALL(STATS_WRITE, fprintf(stderr, "Success: %s\n", view.content));
+                probe_replied(probe, 1);
+                TRACE_REPLIED();
+                *replied = 1;
             }
             else if (resp_code == NOK)
             {
-                fprintf(stderr, "Failure: %s\n", message);
+                STATS_CALL(STATS_WRITE, fprintf(stderr, "Failure: %s\n", view.content));
+                probe_replied(probe, 0);
+                TRACE_REPLIED();
+                *replied = 0;
             }
             else if (resp_code == UKNOWN)
             {
                 fprintf(stderr, "ERR: Unrecognized message from server!\n");
-                if (content_err(buff, *display_name, "Unrecognized message from server!"))
+                if (tcp_encode_err(arena, buff, *display_name != NULL ? *display_name : UNKNOWN_DISPLAY_NAME, "Unrecognized message from server!"))
                 {
-                    if (*buff != NULL) free(*buff);
-                    if (*display_name != NULL) free(*display_name);
                     close(client_socket);
                     exit(1);
                 }
@@ -236,8 +235,6 @@ int recv_next_state(char *response, char **display_name, char **buff, int state,
             }
             else
             {
-                if (*buff != NULL) free(*buff);
-                if (*display_name != NULL) free(*display_name);
                 close(client_socket);
                 exit(1);
             }
@@ -248,19 +245,19 @@ int recv_next_state(char *response, char **display_name, char **buff, int state,
             {
                 current_state = 4;
                 *proccessing = 1;
-                fprintf(stderr, "ERR FROM %s: %s\n", resp_succ, message);
-                if (content_bye(buff))
+                STATS_CALL(STATS_WRITE, fprintf(stderr, "ERR FROM %s: %s\n", view.display_name, view.content));
+                if (tcp_encode_bye(arena, buff))
                 {
-                    if (*buff != NULL) free(*buff);
-                    if (*display_name != NULL) free(*display_name);
                     close(client_socket);
                     exit(1);
                 }
             }
             else if (resp_code == MSG)
             {
-                fprintf(stdout, "%s: %s\n", resp_succ, message);
-                fflush(stdout);
+                fprintf(stdout, "%s: %s\n", view.display_name, view.content);
+                STATS_CALL(STATS_WRITE, fflush(stdout));
+                TRACE_RECEIVED(-1);
+                store_add(store, STORE_RX, view.display_name, view.content, view.content_len);
             }
             else if (resp_code == BYE)
             {
@@ -270,10 +267,8 @@ int recv_next_state(char *response, char **display_name, char **buff, int state,
             else if (resp_code == UKNOWN)
             {
                 fprintf(stderr, "ERR: Unrecognized message from server!\n");
-                if (content_err(buff, *display_name, "Unrecognized message from server!"))
+                if (tcp_encode_err(arena, buff, *display_name != NULL ? *display_name : UNKNOWN_DISPLAY_NAME, "Unrecognized message from server!"))
                 {
-                    if (*buff != NULL) free(*buff);
-                    if (*display_name != NULL) free(*display_name);
                     close(client_socket);
                     exit(1);
                 }
@@ -286,11 +281,9 @@ int recv_next_state(char *response, char **display_name, char **buff, int state,
             {
                 current_state = 4;
                 *proccessing = 1;
-                fprintf(stderr, "ERR FROM %s: %s\n", resp_succ, message);
-                if (content_bye(buff))
+                STATS_CALL(STATS_WRITE, fprintf(stderr, "ERR FROM %s: %s\n", view.display_name, view.content));
+                if (tcp_encode_bye(arena, buff))
                 {
-                    if (*buff != NULL) free(*buff);
-                    if (*display_name != NULL) free(*display_name);
                     close(client_socket);
                     exit(1);
                 }
@@ -298,18 +291,27 @@ int recv_next_state(char *response, char **display_name, char **buff, int state,
             else if (resp_code == OK)
             {
                 current_state = 2;
-                fprintf(stderr, "Success: %s\n", message);
+                STATS_CALL(STATS_WRITE, fprintf(stderr, "Success: %s\n", view.content));
+                store_joined(store);
+                probe_replied(probe, 1);
+                TRACE_REPLIED();
+                *replied = 1;
             }
             else if (resp_code == NOK)
             {
                 current_state = 2;
-                fprintf(stderr, "Failure: %s\n", message);
+                STATS_CALL(STATS_WRITE, fprintf(stderr, "Failure: %s\n", view.content));
+                probe_replied(probe, 0);
+                TRACE_REPLIED();
+                *replied = 0;
             }
             else if (resp_code == MSG)
             {
                 *proccessing = 1;
-                fprintf(stdout, "%s: %s\n", resp_succ, message);
-                fflush(stdout);
+                fprintf(stdout, "%s: %s\n", view.display_name, view.content);
+                STATS_CALL(STATS_WRITE, fflush(stdout));
+                TRACE_RECEIVED(-1);
+                store_add(store, STORE_RX, view.display_name, view.content, view.content_len);
             }
             else if (resp_code == BYE)
             {
@@ -319,10 +321,8 @@ int recv_next_state(char *response, char **display_name, char **buff, int state,
             else if (resp_code == UKNOWN)
             {
                 fprintf(stderr, "ERR: Unrecognized message from server!\n");
-                if (content_err(buff, *display_name, "Unrecognized message from server!"))
+                if (tcp_encode_err(arena, buff, *display_name != NULL ? *display_name : UNKNOWN_DISPLAY_NAME, "Unrecognized message from server!"))
                 {
-                    if (*buff != NULL) free(*buff);
-                    if (*display_name != NULL) free(*display_name);
                     close(client_socket);
                     exit(1);
                 }
@@ -331,8 +331,6 @@ int recv_next_state(char *response, char **display_name, char **buff, int state,
             }
             else
             {
-                if (*buff != NULL) free(*buff);
-                if (*display_name != NULL) free(*display_name);
                 close(client_socket);
                 exit(1);
             }
@@ -341,37 +339,27 @@ int recv_next_state(char *response, char **display_name, char **buff, int state,
             break; 
     }
 
-    if (resp_code != ERR)
-    {
-        if (resp_succ != NULL) free(resp_succ);
-        if (message != NULL) free(message);
-    }
-    if (resp != NULL) free(resp);
     return current_state;
 }
 
 /**
  * @brief Correctlly exit program, close socket and free memmory.
  * 
- * @param buff 
- * @param display_name 
- * @param buff_confirm 
+ * @param arena per iteration memory
+ * @param flight memory of the message waiting for CONFIRM
  * @param head udp id history
- * @param fifo udp fifo
+ * @param lanes udp fifo
  * @param client_socket 
- * @param server_info IPv4
+ * @param server_info IPv4/IPv6
  * @param exit_code 
  */
-void udp_exit(char **buff, char **display_name, char **buff_confirm, struct Node **head, struct ipk_list **fifo, int client_socket, struct addrinfo **server_info, int exit_code)
+void udp_exit(ipk_arena *arena, ipk_arena *flight, struct Node **head, ipk_lanes *lanes, int client_socket, struct addrinfo **server_info, int exit_code)
 {
-    if (*buff != NULL) free(*buff);
-    if (*display_name != NULL) free(*display_name);
-    if (*buff_confirm != NULL) free(*buff_confirm);
-    *buff = NULL;
-    *display_name = NULL;
-    *buff_confirm = NULL;
+    arena_free(arena);
+    arena_free(flight);
     free_list(*head);
-    free_fifo(*fifo);
+    lanes_free(lanes);
+    fifo_pool_free();
     close(client_socket);
     freeaddrinfo(*server_info);
     exit(exit_code);
@@ -380,83 +368,133 @@ void udp_exit(char **buff, char **display_name, char **buff_confirm, struct Node
 /**
  * @brief Resets variables after CONFIRM from server
  * 
- * @param id_conf 
  * @param buff 
- * @param retransmition 
- * @param max_num_retransmissions 
- * @param timeout 
  * @param current_state 
  * @param next_state 
  */
-void udp_conf(int *id_conf, char ** buff, int *retransmition, int max_num_retransmissions, int *timeout, enum State *current_state, enum State next_state)
+void udp_conf(char ** buff, enum State *current_state, enum State next_state)
 {
-    *id_conf = -1;
-    if (*buff != NULL) free(*buff);
-    *buff = NULL;
-    *retransmition = max_num_retransmissions;
-    *timeout = -1;
+    *buff = NULL;       // the memory is reused by the next message in flight
     *current_state = next_state;
 }
 
 /**
- * @brief Connects to the server socket. Then in while, whichever is the current state,
- * thus decides what will be done with the input from the client or the response from the server
+ * @brief Prints MSG or ERR from the server, a retransmitted message (known ID) is printed only once
+ * 
+ * @param view the decoded message
+ * @param rel reliability layer with the udp id history
+ * @return int 1 if it was printed, 0 if it is a retransmission
+ */
+int udp_show(ipk_view *view, ipk_rel *rel)
+{
+    if (rel_duplicate(rel, view->id)) return 0;
+    TRACE_RECEIVED(view->id);
+
+    if (view->type == IPK_ERR)
+        STATS_CALL(STATS_WRITE, fprintf(stderr, "ERR FROM %s: %s\n", view->display_name, view->content));
+    else
+    {
+        fprintf(stdout, "%s: %s\n", view->display_name, view->content);
+        STATS_CALL(STATS_WRITE, fflush(stdout));
+    }
+    return 1;
+}
+
+/**
+ * @brief Puts a console line into the FIFO, a message longer than one MSG goes as its chunks.
+ * The caller checks that UDP_LINE_NODES nodes are available
  * 
+ * @param lanes udp fifo
+ * @param line console line
+ * @param tagged the chunks get "[i/n] "
+ */
+void udp_queue(ipk_lanes *lanes, char *line, int tagged)
+{
+    ipk_chunker chunker;
+    char chunk[CHUNK_MAX + 1];
+    size_t length = strlen(line);
+
+    if (line[0] == '/' || length <= CHUNK_MAX)
+    {
+        if (length >= FIFO_INPUT_MAX) fprintf(stderr, "ERR: Command is too long!\n");
+        else if (lanes_push(lanes, line, 0)) fprintf(stderr, "ERR: Input queue is full!\n");
+        return;
+    }
+    if (!check_message(line, tagged)) return;
+
+    chunk_init(&chunker, line, length, tagged);
+    while (chunk_next(&chunker, chunk, sizeof(chunk)))
+    {
+        if (!lanes_push(lanes, chunk, 1)) continue;
+        fprintf(stderr, "ERR: Input queue is full, the rest of the message is not sent!\n");
+        return;
+    }
+}
+
+/**
+ * @brief Resolves the server for one transport
+ *
  * @param host ip or domain name
  * @param port the port
+ * @param socktype SOCK_STREAM or SOCK_DGRAM
+ * @return struct addrinfo* getaddrinfo results, NULL if the host can't be resolved
  */
-void tcp(char *host, char *port) 
+struct addrinfo *resolve(char *host, char *port, int socktype)
 {
     struct addrinfo *server_info;
-    struct addrinfo *p;
     struct addrinfo hints;
-    int client_socket;
 
     memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
     hints.ai_protocol = 0;
 
     if (getaddrinfo(host, port, &hints, &server_info) != 0)
     {
         fprintf(stderr, "ERR: Failed to get address info for %s!\n", host);
-        exit(1);
+        return NULL;
     }
+    return server_info;
+}
 
-    for (p = server_info; p != NULL; p = p->ai_next)
-    {
-        if ((client_socket = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
-        {
-            fprintf(stderr, "ERR: Socket creation!\n");
-            continue;
-        }
-
-        if (connect(client_socket, p->ai_addr, p->ai_addrlen) < 0)
-        {
-            close(client_socket);
-            fprintf(stderr, "ERR: Socket connection!\n");
-            continue;
-        }
-
-        struct timeval timeval = {.tv_sec = 5};
-
-        if (setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeval, sizeof(timeval)) < 0)
-        {
-            fprintf(stderr, "ERR: Setsockopt!\n");
-            freeaddrinfo(server_info);
-            exit(1);
-        }
-        
-        break;
-    }
+/**
+ * @brief Connects to the server socket. Then in while, whichever is the current state,
+ * thus decides what will be done with the input from the client or the response from the server
+ * 
+ * @param client_socket connected to p, by he_connect or by the -t auto race
+ * @param server_info resolved server, freed here
+ * @param p the address that connected
+ * @param options of the run, -d and -r are not used
+ */
+void tcp(int client_socket, struct addrinfo *server_info, struct addrinfo *p, ipk_options *options)
+{
+    int resilient = options->resilient;
+    int tag_chunks = options->tag_chunks;
+    ipk_bulk *bulk = options->bulk;
+    ipk_busy *busy = options->busy;
+    ipk_store *store = options->store;
+    ipk_probe *probe = options->probe;
+    ipk_login *login = options->login;
+    ipk_endpoints *endpoints = options->endpoints;
+    ipk_ring *ring = options->ring;
+    ipk_reconnect rc;
+    ipk_arena arena;            // everything one iteration allocates, reset at the start of the next one
+    ipk_pool pool;              // display name and the credentials replayed after a reconnect
+
+    struct timeval timeval = {.tv_sec = 5};
 
-    if (p == NULL)
+    if (setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeval, sizeof(timeval)) < 0)
     {
-        fprintf(stderr, "ERR: Failed to connect to %s!\n", host);
+        fprintf(stderr, "ERR: Setsockopt!\n");
         freeaddrinfo(server_info);
         exit(1);
     }
 
+    busy_socket(busy, client_socket);
+    pool_init(&pool);
+    reconnect_init(&rc, resilient, p, &pool);
+    rc.endpoints = endpoints->count > 1 ? endpoints : NULL;
+    endpoints_tune(endpoints, client_socket);
     freeaddrinfo(server_info);
     
     struct sigaction sa;
@@ -471,45 +509,130 @@ void tcp(char *host, char *port)
     }
 
     // poll setting
-    struct pollfd fds[2];
-    fds[0].fd = STDIN_FILENO;
+    struct pollfd fds[3];
+    fds[0].fd = -1;             // the console, set before every poll
     fds[0].events = POLLIN;
 
     fds[1].fd = client_socket;
     fds[1].events = POLLIN;
 
+    fds[2].fd = -1;             // --ring, the doorbell, set before every poll
+    fds[2].events = POLLIN;
+
+    static ipk_reader reader;   // console lines
+    char ring_line[IPK_RING_TEXT_MAX + 1];  // --ring, the record being sent
+    ipk_chunker chunker;        // the rest of a long message
+    int chunking = 0;           // chunks of the last message are still to be sent
+    uint32_t line_trace = 0;    // --trace, lifecycle of the message being sent
+    int probed_state = -1;      // the state last reported to ipk:state
+    char bulk_line[BULK_MAX_LINE + 1];      // -f, the line being sent
+    ipk_prefix prefix = {0};    // "MSG FROM <DisplayName> IS ", built again after AUTH and /rename
+    struct iovec frame[4];      // MSG sent by sendmsg: the prefix, the tag, the content in the input buffer, "\r\n"
+    char tag[CHUNK_TAG_SIZE];
+    char unsent[CHUNK_TAG_SIZE + CHUNK_MAX];    // -R, the MSG (tag and content) the lost connection did not take
+    size_t unsent_len = 0;
+    reader_init(&reader);
+    // -u, AUTH and JOIN go first, the console is read while they are answered
+    if (login->enabled)
+    {
+        reader_push(&reader, login->auth);
+        if (login->channel != NULL) reader_push(&reader, login->join);
+    }
+
     int proccessing = 0;        // when 1, blocks the client from writing messages (currently being processed)
     int current_state = 1;      // a variable that represents the current state
     char *display_name = NULL;  // the name under which messages are written
+    int connection_lost = 0;    // the socket failed in resilient mode, reconnect in the next iteration
+    int replay_join = 0;        // after a reconnect, JOIN the last channel once AUTH succeeds
+    char response[MAX_MESSAGE_SIZE + 1];    // received data, may end with an incomplete message
+    size_t response_len = 0;
+
+    if (arena_init(&arena, ARENA_ITERATION_SIZE))
+    {
+        close(client_socket);
+        exit(1);
+    }
+    // from here on the loop only uses the arena and the pool
+    arena_seal();
 
     while(1)
     {
         char *buff = NULL;
+        int frame_count = 0;    // MSG in frame, instead of buff
+        arena_reset(&arena);
+        USDT_STATE(probed_state, current_state);
+        sched_begin();
+        // the connection was lost, connect again and replay AUTH
+        if (connection_lost)
+        {
+            client_socket = reconnect_socket(&rc, client_socket);
+            if (client_socket < 0)
+            {
+                reconnect_free(&rc);
+                arena_free(&arena);
+                exit(0);
+            }
+            busy_socket(busy, client_socket);
+            fds[1].fd = client_socket;
+            // the rest of a long message stays in its buffer, it goes after the replay
+            connection_lost = 0;
+            proccessing = 0;
+            response_len = 0;
+            current_state = 1;
+
+            if (rc.username != NULL)
+            {
+                if (tcp_encode_auth(&arena, &buff, rc.username, display_name, rc.secret))
+                {
+                    close(client_socket);
+                    exit(1);
+                }
+                proccessing = 1;
+                replay_join = rc.channel != NULL;
+            }
+        }
         // a nonsense message came from the server and an ERR was sent, so just send BYE
-        if (current_state == 3)
+        else if (current_state == 3)
         {
             current_state = 4;
             proccessing = 1;
-            if (content_bye(&buff))
+            if (tcp_encode_bye(&arena, &buff))
             {
-                if (buff != NULL) free(buff);
                 close(client_socket);
                 exit(1);
             }
         }
         else
         {
-            int ret = poll(fds, 2, -1);
+            // in bulk mode poll also wakes up when the rate allows the next line, a ready line
+            // or chunk does not wait at all, the console is not read while a long message is sent
+            // out of its buffer
+            // with --ring the end of the console does not end the session, the ring's end does
+            int wait = -1;
+            int console_ready = reader_ready(&reader) && !(reader.eof && reader.start == reader.used && !ring_done(ring));
+            if (!proccessing && (chunking || (!bulk->enabled && console_ready))) wait = 0;
+            else if (!proccessing && bulk->enabled) wait = bulk_wait(bulk);
+            if (sched_pending()) wait = 0;
+            fds[0].fd = (bulk->enabled || chunking || !reader_room(&reader)) ? -1 : STDIN_FILENO;
+            // a record is taken only when nothing is being sent, until then it waits in the ring
+            fds[2].fd = -1;
+            if (!proccessing && !chunking && !ring_done(ring))
+            {
+                if (ring_arm(ring)) wait = 0;
+                fds[2].fd = ring->eventfd;
+            }
+            store_reserve(store, STORE_ITERATION);
+            STATS_IDLE();
+            int ret = STATS_CALL(STATS_POLL, busy_poll(busy, fds, 3, wait));
+            STATS_WAKE();
 
             // if true, then Ctrl + C was recorded, send BYE and go to exit state
             if (received_signal)
             {
                 current_state = 4;
                 proccessing = 1;
-                if (content_bye(&buff))
+                if (tcp_encode_bye(&arena, &buff))
                 {
-                    if (buff != NULL) free(buff);
-                    if (display_name != NULL) free(display_name);
                     close(client_socket);
                     exit(1);
                 }
@@ -519,21 +642,31 @@ void tcp(char *host, char *port)
                 if (ret < 0)    // poll error
                 {
                     fprintf(stderr, "ERR: poll!\n");
-                    if (buff != NULL) free(buff);
+                    if (rc.enabled)
+                    {
+                        connection_lost = 1;
+                        continue;
+                    }
                     close(client_socket);
                     exit(1);
                 }
 
-                // messages have arrived from the server
-                if (fds[1].revents & POLLIN) 
+                // messages have arrived from the server, a full buffer still holds messages left
+                // by the budget and is read again once they are handled
+                int readable = (fds[1].revents & POLLIN) && response_len < MAX_MESSAGE_SIZE;
+                if (readable) 
                 {
-                    char response[MAX_MESSAGE_SIZE] = {0};
-                    ssize_t recv_result = recv(client_socket, response, sizeof(response), 0);
-                    if (recv_result < 0) 
+                    ssize_t recv_result = STATS_CALL(STATS_RECV, busy->enabled ? busy_recv(busy, client_socket, response + response_len, MAX_MESSAGE_SIZE - response_len, NULL, NULL)
+                                                                               : recv(client_socket, response + response_len, MAX_MESSAGE_SIZE - response_len, 0));
+                    if (recv_result < 0 || (recv_result == 0 && rc.enabled)) 
                     {
                         fprintf(stderr, "ERR: Can't receive message!\n");
-                        if (buff != NULL) free(buff);
-                        if (display_name != NULL) free(display_name);
+                        if (rc.enabled)
+                        {
+                            endpoints_lost(endpoints, recv_result < 0 ? errno : 0);
+                            connection_lost = 1;
+                            continue;
+                        }
                         close(client_socket);
                         exit(1);
                     } 
@@ -541,199 +674,337 @@ void tcp(char *host, char *port)
                     {
                         current_state = 4;
                         proccessing = 1;
-                        if (content_bye(&buff))
+                        if (tcp_encode_bye(&arena, &buff))
                         {
-                            if (buff != NULL) free(buff);
-                            if (display_name != NULL) free(display_name);
                             close(client_socket);
                             exit(1);
                         }
                     }
-                    proccessing = 0;
-                    current_state = recv_next_state(response, &display_name, &buff, current_state, &proccessing, client_socket);
+                    else response_len += recv_result;
                 }
-            }
 
-            // the user entered something into the console, it is allowed but only when something is not being processed
-            if (!proccessing)
-                if (fds[0].revents & POLLIN) 
+                // one recv may bring several messages or only a part of one, each "\r\n" ends a message;
+                // at most SCHED_SOCKET_BUDGET of them, so a burst from the server does not hold up the console
+                if (readable || sched_deferred(SCHED_SOCKET))
                 {
-                    char input[1400];
-                    if (fgets(input, sizeof(input), stdin) != NULL) 
+                    size_t start = 0;
+                    int more = 1;
+                    while (current_state != 3 && current_state != 4 && (more = sched_take(SCHED_SOCKET)))
                     {
-                        if (input[strlen(input) - 1] == '\n') 
-                            input[strlen(input) - 1] = '\0';
-                        int input_code = check_input(input);
-                        
-                        switch (current_state)
+                        size_t end = start + scan_crlf(response + start, response_len - start);
+                        if (end == response_len && (start > 0 || response_len < MAX_MESSAGE_SIZE)) break;
+                        response[end] = '\0';
+
+                        proccessing = 0;
+                        int prev_state = current_state;
+                        int replied;
+                        current_state = recv_next_state(&arena, response + start, &display_name, &buff, current_state, &proccessing, client_socket, store, probe, &replied);
+                        start = end + 2 < response_len ? end + 2 : response_len;
+                        if (replied != -1) reconnect_replied(&rc, replied);
+
+                        // authenticated, after a reconnect join the last channel again
+                        if (prev_state == 5 && replied == 1) login_step(login, LOGIN_JOINED);
+                        if ((prev_state == 1 || prev_state == 5) && replied == 0) login_failed(login, prev_state == 5 ? LOGIN_JOINED : LOGIN_AUTHENTICATED);
+                        if (prev_state == 1 && current_state == 2)
                         {
-                        case 1:
-                            if (input_code == 1)    // AUTH
+                            login_step(login, LOGIN_AUTHENTICATED);
+                            reconnect_done(&rc);
+                            if (replay_join)
                             {
-                                char *token = strtok(input, " ");
-                                char *param1 = NULL;
-                                char *param2 = NULL;
-                                char *param3 = NULL;
-
-                                if (token != NULL)
-                                {
-                                    param1 = strtok(NULL, " ");
-                                    param2 = strtok(NULL, " ");
-                                    param3 = strtok(NULL, " ");
-                                }
-
-                                if (param1 == NULL || param2 == NULL || param3 == NULL)
-                                {
-                                    fprintf(stderr, "ERR: Parameters do not match!\n");
-                                    continue;
-                                }
-
-                                int message_code = content_auth(&buff, param1, param3, param2);
-                                if (message_code)
-                                {
-                                    if (buff != NULL) free(buff);
-                                    if (display_name != NULL) free(display_name);
-                                    close(client_socket);
-                                    exit(1);
-                                }
-
-                                if (display_name != NULL) free(display_name);
-                                display_name = strdup(param3);
-                                if (display_name == NULL)
+                                replay_join = 0;
+                                store_join(store, rc.channel);
+                                if (tcp_encode_join(&arena, &buff, rc.channel, display_name))
                                 {
-                                    fprintf(stderr, "ERR: Memory allocation failed!\n");
-                                    if (buff != NULL) free(buff);
                                     close(client_socket);
                                     exit(1);
                                 }
                                 proccessing = 1;
+                                current_state = 5;
                             }
-                            else if (input_code == 4)   // HELP
+                        }
+                    }
+                    sched_left(SCHED_SOCKET, !more);
+                    memmove(response, response + start, response_len - start);
+                    response_len -= start;
+                }
+            }
+
+            if (fds[0].revents & (POLLIN | POLLHUP)) STATS_CALL(STATS_READ, reader_fill(&reader, STDIN_FILENO));
+            if (fds[2].revents & POLLIN) ring_doorbell(ring);
+
+            // -R, the MSG the lost connection did not take goes first once the session is restored
+            if (!proccessing && current_state == 2 && unsent_len > 0)
+            {
+                if ((frame_count = tcp_frame_msg(&prefix, display_name, "", 0, unsent, unsent_len, frame)) == 0)
+                {
+                    close(client_socket);
+                    exit(1);
+                }
+                TRACE_BEGIN(line_trace);
+                TRACE(line_trace, TRACE_ENCODE);
+                unsent_len = 0;
+            }
+            // the next chunk of a long message goes right after the previous one, TCP needs no CONFIRM
+            else if (!proccessing && chunking)
+            {
+                const char *text;
+                size_t tag_len, length;
+                chunk_view(&chunker, tag, &tag_len, &text, &length);
+                if ((frame_count = tcp_frame_msg(&prefix, display_name, tag, tag_len, text, length, frame)) == 0)
+                {
+                    close(client_socket);
+                    exit(1);
+                }
+                TRACE_BEGIN(line_trace);
+                TRACE(line_trace, TRACE_ENCODE);
+                store_add(store, STORE_TX, display_name, text, length);
+                chunking = !chunk_done(&chunker);
+            }
+            // the user entered something into the console, it is allowed but only when something is not being processed
+            else if (!proccessing)
+            {
+                char *input = bulk_line;
+                size_t length;
+                int raw = 0;            // MessageContent from --ring, not a command
+                int next = bulk->enabled ? bulk_next(bulk, bulk_line, sizeof(bulk_line)) : reader_next(&reader, &input, &length);
+                // --ring, a record goes when no console line is ready, the end of the ring ends the session
+                if (next != 1 && ring->enabled)
+                {
+                    ipk_ring_record *record = ring_peek(ring);
+                    if (record != NULL)
+                    {
+                        memcpy(ring_line, record->text, record->length + 1);
+                        raw = record->kind == IPK_RING_MSG;
+                        ring_pop(ring);
+                        input = ring_line;
+                        next = 1;
+                    }
+                    else next = ring_done(ring) ? -1 : 0;
+                }
+                if (next == 1) 
+                {
+                    int input_code = raw ? 6 : check_input(input);
+                    TRACE_LINE();
+                    if (input_code == 7)    // HISTORY, answered from the local log in any state
+                    {
+                        store_command(store, input);
+                        continue;
+                    }
+                    
+                    switch (current_state)
+                    {
+                    case 1:
+                        if (input_code == 1)    // AUTH
+                        {
+                            char *token = strtok(input, " ");
+                            char *param1 = NULL;
+                            char *param2 = NULL;
+                            char *param3 = NULL;
+
+                            if (token != NULL)
                             {
-                                print_help();
-                                continue;
+                                param1 = strtok(NULL, " ");
+                                param2 = strtok(NULL, " ");
+                                param3 = strtok(NULL, " ");
                             }
-                            else
+
+                            if (param1 == NULL || param2 == NULL || param3 == NULL)
                             {
-                                fprintf(stderr, "ERR: You are not authenticated!\n");
+                                fprintf(stderr, "ERR: Parameters do not match!\n");
                                 continue;
                             }
-                            break; 
-                        case 2:
-                            if (input_code == 1)    // AUTH - but already logged in
-                            {
-                                fprintf(stderr, "ERR: Already authenticated!\n");
+
+                            if (!check_param(param1, SCAN_ID) || !check_param(param2, SCAN_SECRET) || !check_param(param3, SCAN_DNAME))
                                 continue;
+
+                            int message_code = tcp_encode_auth(&arena, &buff, param1, param3, param2);
+                            if (message_code)
+                            {
+                                close(client_socket);
+                                exit(1);
                             }
-                            else if (input_code == 2)   // JOIN
+                            TRACE_BEGIN(line_trace);
+                            TRACE(line_trace, TRACE_ENCODE);
+
+                            pool_free(&pool, display_name);
+                            display_name = pool_strdup(&pool, param3);
+                            STATS_ALLOC(POOL_SLOT_SIZE);
+                            prefix.length = 0;
+                            if (display_name == NULL)
                             {
-                                char *token = strtok(input, " ");
-                                char *param1 = NULL;
+                                fprintf(stderr, "ERR: Memory allocation failed!\n");
+                                close(client_socket);
+                                exit(1);
+                            }
+                            reconnect_set_auth(&rc, param1, param2);
+                            probe_request(probe);
+                            proccessing = 1;
+                        }
+                        else if (input_code == 4)   // HELP
+                        {
+                            print_help();
+                            continue;
+                        }
+                        else
+                        {
+                            fprintf(stderr, "ERR: You are not authenticated!\n");
+                            continue;
+                        }
+                        break; 
+                    case 2:
+                        if (input_code == 1)    // AUTH - but already logged in
+                        {
+                            fprintf(stderr, "ERR: Already authenticated!\n");
+                            continue;
+                        }
+                        else if (input_code == 2)   // JOIN
+                        {
+                            char *token = strtok(input, " ");
+                            char *param1 = NULL;
 
-                                if (token != NULL) param1 = strtok(NULL, " ");
+                            if (token != NULL) param1 = strtok(NULL, " ");
 
-                                if (param1 == NULL)
-                                {
-                                    fprintf(stderr, "ERR: Parameter's number does not match!\n");
-                                    continue;
-                                }
-                                int message_code = content_join(&buff, display_name, param1);
-                                proccessing = 1;
-                                if (message_code)
-                                {
-                                    if (buff != NULL) free(buff);
-                                    if (display_name != NULL) free(display_name);
-                                    close(client_socket);
-                                    exit(1);
-                                }
-                                current_state = 5;
+                            if (param1 == NULL)
+                            {
+                                fprintf(stderr, "ERR: Parameter's number does not match!\n");
+                                continue;
                             }
-                            else if (input_code == 3)   // RENAME
+                            if (!check_param(param1, SCAN_ID)) continue;
+
+                            int message_code = tcp_encode_join(&arena, &buff, param1, display_name);
+                            TRACE_BEGIN(line_trace);
+                            TRACE(line_trace, TRACE_ENCODE);
+                            reconnect_set_join(&rc, param1);
+                            store_join(store, param1);
+                            probe_request(probe);
+                            proccessing = 1;
+                            if (message_code)
                             {
-                                char *token = strtok(input, " ");
-                                char *param1 = NULL;
-
-                                if (token != NULL) param1 = strtok(NULL, " ");
+                                close(client_socket);
+                                exit(1);
+                            }
+                            current_state = 5;
+                        }
+                        else if (input_code == 3)   // RENAME
+                        {
+                            char *token = strtok(input, " ");
+                            char *param1 = NULL;
 
-                                if (param1 == NULL)
-                                {
-                                    fprintf(stderr, "ERR: Parameter's number does not match!\n");
-                                    continue;
-                                }
+                            if (token != NULL) param1 = strtok(NULL, " ");
 
-                                if (display_name != NULL) free(display_name);
-                                display_name = strdup(param1);
-                                if (display_name == NULL)
-                                {
-                                    fprintf(stderr, "ERR: Memory allocation failed!\n");
-                                    if (buff != NULL) free(buff);
-                                    close(client_socket);
-                                    exit(1);
-                                }
-                                continue;
-                            }
-                            else if (input_code == 4)   // HELP
+                            if (param1 == NULL)
                             {
-                                print_help();
+                                fprintf(stderr, "ERR: Parameter's number does not match!\n");
                                 continue;
                             }
-                            else if (input_code == 6)   // MSG
+                            if (!check_param(param1, SCAN_DNAME)) continue;
+
+                            pool_free(&pool, display_name);
+                            display_name = pool_strdup(&pool, param1);
+                            STATS_ALLOC(POOL_SLOT_SIZE);
+                            prefix.length = 0;
+                            if (display_name == NULL)
                             {
-                                int message_code = content_message(&buff, display_name, input);
-                                if (message_code)
-                                {
-                                    if (buff != NULL) free(buff);
-                                    if (display_name != NULL) free(display_name);
-                                    close(client_socket);
-                                    exit(1);
-                                }
+                                fprintf(stderr, "ERR: Memory allocation failed!\n");
+                                close(client_socket);
+                                exit(1);
                             }
-                            else
+                            continue;
+                        }
+                        else if (input_code == 4)   // HELP
+                        {
+                            print_help();
+                            continue;
+                        }
+                        else if (input_code == 6)   // MSG, a longer one in chunks
+                        {
+                            if (!check_message(input, tag_chunks)) continue;
+
+                            // the content is sent from the input buffer, it stays there until the send below
+                            const char *text;
+                            size_t tag_len, length;
+                            chunk_init(&chunker, input, strlen(input), tag_chunks);
+                            chunk_view(&chunker, tag, &tag_len, &text, &length);
+                            if ((frame_count = tcp_frame_msg(&prefix, display_name, tag, tag_len, text, length, frame)) == 0)
                             {
-                                fprintf(stderr, "ERR: Unknown command!\n\b");
-                                continue;
+                                close(client_socket);
+                                exit(1);
                             }
-                            break;
-                        default:
-                            break;
+                            TRACE_BEGIN(line_trace);
+                            TRACE(line_trace, TRACE_ENCODE);
+                            store_add(store, STORE_TX, display_name, text, length);
+                            bulk_sent(bulk, strlen(input));
+                            chunking = !chunk_done(&chunker);
                         }
-                    }
-                    if (feof(stdin))
-                    {
-                        current_state = 4;
-                        proccessing = 1;
-                        if (content_bye(&buff))
+                        else
                         {
-                            if (buff != NULL) free(buff);
-                            if (display_name != NULL) free(display_name);
-                            close(client_socket);
-                            exit(1);
+                            fprintf(stderr, "ERR: Unknown command!\n\b");
+                            continue;
                         }
+                        break;
+                    default:
+                        break;
+                    }
+                }
+                if (next == -1)
+                {
+                    current_state = 4;
+                    proccessing = 1;
+                    if (tcp_encode_bye(&arena, &buff))
+                    {
+                        close(client_socket);
+                        exit(1);
                     }
                 }
+            }
         }
 
-        // if there is something in the buff, send it and release it
-        if (buff != NULL)
+        // if there is something in the buff (or a MSG in frame), send it and release it
+        if (buff != NULL || frame_count > 0)
         {
-            if (send(client_socket, buff, strlen(buff), 0) < 0) 
+            struct msghdr msg = {.msg_iov = frame, .msg_iovlen = frame_count};
+            ssize_t sent = frame_count > 0 ? STATS_CALL(STATS_SEND, sendmsg(client_socket, &msg, MSG_NOSIGNAL))
+                                           : STATS_CALL(STATS_SEND, send(client_socket, buff, strlen(buff), MSG_NOSIGNAL));
+            if (sent < 0) 
             {
                 fprintf(stderr, "ERR: Can't send message!\n");
-                free(buff);
-                if (display_name != NULL) free(display_name);
+                if (rc.enabled && current_state != 4)
+                {
+                    // the MSG is kept (everything between the prefix and "\r\n"), AUTH and JOIN are replayed
+                    for (int i = 1; i < frame_count - 1; i++)
+                    {
+                        memcpy(unsent + unsent_len, frame[i].iov_base, frame[i].iov_len);
+                        unsent_len += frame[i].iov_len;
+                    }
+                    endpoints_lost(endpoints, errno);
+                    connection_lost = 1;
+                    continue;
+                }
                 close(client_socket);
                 exit(1);
             }
 
-            free(buff);
+            USDT3(send, -1, -1, sent);
+            // a MSG is done once it is sent, TCP has no CONFIRM; AUTH and JOIN wait for REPLY
+            if (line_trace != 0)
+            {
+                TRACE(line_trace, TRACE_SEND);
+                if (proccessing) TRACE_AWAIT(line_trace);
+                else TRACE(line_trace, TRACE_DONE);
+                line_trace = 0;
+            }
             buff = NULL;
         }
 
         // came BYE, that's it
         if (current_state == 4)
         {
-            if (buff != NULL) free(buff);
-            if (display_name != NULL) free(display_name);
+            bulk_report(bulk);
+            busy_report(busy);
+            probe_report(probe, NULL, client_socket);
+            bulk_close(bulk);
+            reconnect_free(&rc);
+            arena_free(&arena);
             close(client_socket);
             exit(0);
         }
@@ -744,36 +1015,37 @@ void tcp(char *host, char *port)
  * @brief Connects to the server socket. Then in while, whichever is the current state,
  * thus decides what will be done with the input from the client or the response from the server
  *
- * @param host ip or domain name
- * @param port the port
- * @param conf_timeout time to wait for CONFIRM, default is 250ms
- * @param max_num_retransmissions maximum number of message retransmissions, default is 3 attempts
+ * @param server_info resolved server, freed when the client exits
+ * @param options of the run, -d is the time to wait for CONFIRM (250 ms) and -r the retransmissions (3)
  */
-void udp(char *host, char *port, int conf_timeout, int max_num_retransmissions)
+void udp(struct addrinfo *server_info, ipk_options *options)
 {
-    struct addrinfo *server_info;
-    struct addrinfo hints;
+    int conf_timeout = options->conf_timeout;
+    int max_num_retransmissions = options->max_retransmissions;
+    int resilient = options->resilient;
+    int tag_chunks = options->tag_chunks;
+    ipk_bulk *bulk = options->bulk;
+    ipk_busy *busy = options->busy;
+    ipk_store *store = options->store;
+    ipk_probe *probe = options->probe;
+    ipk_login *login = options->login;
+    ipk_endpoints *endpoints = options->endpoints;
+    ipk_ring *ring = options->ring;
     int client_socket;
-
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_protocol = 0;
-
-    int status = getaddrinfo(host, port, &hints, &server_info);
-
-    if (status != 0)
-    {
-        fprintf(stderr, "ERR: getaddrinfo: failed to resolve hostname!\n");
-        exit(1);
-    }
-
-    if ((client_socket = socket(server_info->ai_family, server_info->ai_socktype, server_info->ai_protocol)) <= 0)
+    ipk_reconnect rc;
+    ipk_arena arena = {0};      // CONFIRM and parsed parameters, reset at the start of every iteration
+    ipk_arena flight = {0};     // the message waiting for CONFIRM, reset when the next one is built
+    ipk_pool pool;              // display name and the credentials replayed after a reconnect
+
+    // the first IPv6 or IPv4 address with a route
+    struct addrinfo *server_addr_info;
+    if ((client_socket = he_udp_socket(server_info, &server_addr_info)) < 0)
     {
         fprintf(stderr, "ERR: Socket creation!\n");
         freeaddrinfo(server_info);
         exit(1);
     }
+    login_step(login, LOGIN_CONNECTED);
 
     struct timeval timeval = {.tv_sec = 2};
 
@@ -784,6 +1056,11 @@ void udp(char *host, char *port, int conf_timeout, int max_num_retransmissions)
         exit(1);
     }
 
+    busy_socket(busy, client_socket);
+    pool_init(&pool);
+    reconnect_init(&rc, resilient, server_addr_info, &pool);
+    rc.endpoints = endpoints->count > 1 ? endpoints : NULL;
+
     struct sigaction sa;
     sa.sa_handler = handle_interrupt;
     sa.sa_flags = 0;
@@ -801,487 +1078,497 @@ void udp(char *host, char *port, int conf_timeout, int max_num_retransmissions)
     uint8_t message_id_msb = 0xFF;
 
     enum State current_state = START;       // current state
+    int probed_state = -1;                  // the state last reported to ipk:state
     int proccessing = 0;                    // allows/disallows klint to send messages
     char *display_name = NULL;
-    Node *head = NULL;                      // pointer to the list of arrived IDs
-    ipk_list *fifo = NULL;                  // pointer to the FIFO of messages/commands written by the client
+    Node *head = create_list();             // IDs of the messages that already arrived
+    ipk_lanes lanes;                        // the FIFO of commands and messages written by the client
+    ipk_list *inflight = NULL;              // MSGs waiting for CONFIRM in the order they were sent, requeued after a reconnect
+    int connection_lost = 0;                // the server stopped responding in resilient mode
+    static ipk_reader reader;               // console lines
+    reader_init(&reader);
     
-    struct pollfd fds[2];
-    fds[0].fd = STDIN_FILENO;
+    struct pollfd fds[3];
+    fds[0].fd = -1;                         // the console, set before every poll
     fds[0].events = POLLIN;
 
     fds[1].fd = client_socket;
     fds[1].events = POLLIN;
 
-    int timeout = -1;                               // if it is -1, then poll waits indefinitely
-    int err_event = 0;                              // error happened
-    int retransmition = max_num_retransmissions;    // maximum number of forwarding
-    time_t send_time;                               // variable to measure time
+    fds[2].fd = -1;                         // --ring, the doorbell, set before every poll
+    fds[2].events = POLLIN;
 
-    int id_conf = -1;                               // variable to check if the CONFIRM ID matches the ID of the message sent
+    int err_event = 0;                              // error happened
+    int id_conf = -1;                               // ID of the last message sent, REPLY refers to it
     char *buff = NULL;                              // messages to be sent to the server
     size_t buff_len = 0;                            // buff length
+    ipk_prefix prefix = {0};                        // 0x04 | ID | DisplayName 0x00, built again after AUTH and /rename
+    struct iovec frame[2];                          // MSG instead of buff: the prefix and the content in its FIFO node
+    int frame_count = 0;
 
-    socklen_t addr_len = sizeof(struct sockaddr);
+    socklen_t addr_len = server_addr_info->ai_addrlen;  // length of the IPv4/IPv6 server address
     struct sockaddr_storage server_addr;            // used to change the port
+    struct sockaddr_storage server_dest;            // where the messages go, a failover may change its family
+    memcpy(&server_dest, server_addr_info->ai_addr, addr_len);
+
+    // CONFIRM matching, retransmissions, the port switch and duplicates, over the real socket and clock
+    ipk_rel rel;
+    ipk_clock clock = {rel_monotonic, NULL};
+    ipk_transport transport = {rel_socket_send, rel_socket_recv, rel_socket_connect, &client_socket, rel_socket_sendv};
+    busy->socket = &client_socket;
+    if (busy->enabled) transport = (ipk_transport) {busy_socket_send, busy_socket_recv, busy_socket_connect, busy, busy_socket_sendv};
+    rel_init(&rel, clock, transport, (struct sockaddr *) &server_dest, addr_len, conf_timeout, max_num_retransmissions, head);
+
+    if (arena_init(&arena, ARENA_ITERATION_SIZE) || arena_init(&flight, ARENA_FLIGHT_SIZE))
+        udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
+    lanes_init(&lanes);
+    fifo_pool_init(FIFO_POOL_SIZE);
+    // -u, AUTH and JOIN are queued first, the console is read while they are answered,
+    // the pool is full here
+    if (login->enabled)
+    {
+        TRACE_LINE();
+        lanes_push(&lanes, login->auth, 0);
+        if (login->channel != NULL) lanes_push(&lanes, login->join, 0);
+    }
+    // from here on the loop only uses the arenas, the pool and the FIFO nodes
+    arena_seal();
 
     while(1)
     {
-        char *buff_confirm = NULL;
-        size_t buff_confirm_len = 0;
-        int not_conf = 0;
+        arena_reset(&arena);
+        USDT_STATE(probed_state, current_state);
+        sched_begin();
+
+        // the server is gone, open a new socket and start a new session with AUTH and the last JOIN,
+        // the FIFO with messages written in the meantime is kept
+        if (connection_lost)
+        {
+            if (current_state == BYE_SEND || current_state == ERR_SEND || received_signal)
+                udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
+
+            client_socket = reconnect_socket(&rc, client_socket);
+            if (client_socket < 0)
+                udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 0);
+            busy_socket(busy, client_socket);
+            fds[1].fd = client_socket;
+            reconnect_restore(&rc, (struct sockaddr *) &server_dest);
+            rel.server_len = rc.addr_len;
+
+            message_id_lsb = 0xFF;
+            message_id_msb = 0xFF;
+            clear_list(head);
+            rel_reset(&rel);
+            rel_disconnect(&rel);
+            udp_conf(&buff, &current_state, START);
+            proccessing = 0;
+            err_event = 0;
+
+            for (ipk_list *temp = inflight; temp != NULL; temp = temp->next) temp->id = -1;
+            lanes_requeue(&lanes, inflight);
+            inflight = NULL;
+            if (reconnect_replay(&rc, &lanes, display_name))
+                udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
+            connection_lost = 0;
+            continue;
+        }
 
         if (current_state == ERR_CONF)
         {
+            // the session ends, chunks still waiting for CONFIRM do not matter any more
+            rel_reset(&rel);
+            free_fifo(inflight);
+            inflight = NULL;
             current_state = BYE_SEND;
             message_id_increase(&message_id_lsb, &message_id_msb);
-            if (buff != NULL) free(buff);
             buff = NULL;
-            bye(&buff, &buff_len, &message_id_lsb, &message_id_msb);
+            arena_reset(&flight);
+            udp_encode_bye(&flight, &buff, &buff_len, &message_id_lsb, &message_id_msb);
         }
         else
         {
-            int ret = poll(fds, 2, timeout);
-
-            if (timeout != -1 && ret == 0)
+            // queued input waits only when a message is being processed (the next chunk of a long
+            // message or the next -f message only when the window is full), in bulk mode poll also
+            // wakes up when the rate allows the next line
+            int window = current_state == MSG_CONF && !rel_full(&rel);
+            int pipeline = window && lanes_next_pipelined(&lanes);
+            int wait = rel_wait(&rel);
+            if (received_signal)
+            {
+                if (wait == -1) wait = 0;
+            }
+            else if ((!proccessing && !lanes_empty(&lanes)) || pipeline || sched_pending()) wait = 0;
+            else if (bulk->enabled && lanes_empty(&lanes) && (!proccessing || (window && !bulk_done(bulk))))
+            {
+                int bulk_ms = bulk_wait(bulk);
+                if (wait == -1 || bulk_ms < wait) wait = bulk_ms;
+            }
+            // the console is not read while the FIFO pool has no room for its longest line, the lines
+            // wait in the reader and the rest in the pipe
+            fds[0].fd = (bulk->enabled || !reader_room(&reader) || fifo_available() < UDP_LINE_NODES + FIFO_RESERVE) ? -1 : STDIN_FILENO;
+            // --ring, records are queued only when no message waits, until then they wait in the ring
+            fds[2].fd = -1;
+            if (lanes.head[LANE_CHAT] == NULL && fifo_available() >= RING_LINE_NODES + FIFO_RESERVE && !ring_done(ring) && !received_signal)
+            {
+                if (ring_arm(ring)) wait = 0;
+                fds[2].fd = ring->eventfd;
+            }
+            store_reserve(store, STORE_ITERATION);
+            STATS_IDLE();
+            int ret = STATS_CALL(STATS_POLL, busy_poll(busy, fds, 3, wait));
+            STATS_WAKE();
+
+            // CONFIRM did not come in time, the message is sent again
+            int expired = rel_timeout(&rel);
+            if (expired) endpoints_event(endpoints, ENDPOINT_TIMEOUT, 0);
+            if (expired < 0)
             {
-                retransmition--;
-                if (retransmition == 0)
+                if (expired == -1) fprintf(stderr, "ERR: Timeout and retransmition failed!\n");
+                if (rc.enabled)
                 {
-                    fprintf(stderr, "ERR: Timeout and retransmition failed!\n");
-                    udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                    connection_lost = 1;
+                    continue;
                 }
+                udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
             }
-            else if (received_signal && current_state != BYE_SEND)
+            else if (expired)
+            {
+                bulk_retransmit(bulk);
+                // the server stopped answering, the session moves before all retransmissions are spent
+                if (rc.enabled && endpoints_failing(endpoints))
+                {
+                    fprintf(stderr, "ERR: Server is not responding!\n");
+                    connection_lost = 1;
+                    continue;
+                }
+            }
+            // Ctrl + C, BYE is the most urgent control message, but it does not replace
+            // a message waiting for CONFIRM, it goes right after it
+            else if (received_signal && current_state != BYE_SEND && rel_idle(&rel))
             {
                 current_state = BYE_SEND;
                 message_id_increase(&message_id_lsb, &message_id_msb);
-                if (buff != NULL) free(buff);
                 buff = NULL;
-                bye(&buff, &buff_len, &message_id_lsb, &message_id_msb);
+                arena_reset(&flight);
+                udp_encode_bye(&flight, &buff, &buff_len, &message_id_lsb, &message_id_msb);
             }
             else
             {
+                if (ret < 0 && errno == EINTR) continue;
                 if (ret < 0) 
                 {
                     fprintf(stderr, "ERR: poll!\n");
-                    udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                    if (rc.enabled)
+                    {
+                        connection_lost = 1;
+                        continue;
+                    }
+                    udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
                 }
 
-                if (fds[1].revents & POLLIN) 
+                // POLLERR, ICMP port unreachable came, recv reports it
+                if (fds[1].revents & (POLLIN | POLLERR)) 
                 {
-                    char response[MAX_MESSAGE_SIZE] = {0};
-                    ssize_t recv_result = recvfrom(client_socket, response, sizeof(response), 0, (struct sockaddr *) &server_addr, &addr_len);
+                    char response[MAX_MESSAGE_SIZE];
+                    ipk_view view;
+                    socklen_t server_addr_len = sizeof(server_addr);
+                    ssize_t recv_result = rel_recv(&rel, response, sizeof(response), (struct sockaddr *) &server_addr, &server_addr_len);
                     if (recv_result < 0)
                     {
-                        fprintf(stderr, "ERR: Can't receive message!\n");
-                        udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                        if (errno == ECONNREFUSED) fprintf(stderr, "ERR: Server is unreachable (connection refused)!\n");
+                        else fprintf(stderr, "ERR: Can't receive message!\n");
+                        if (rc.enabled)
+                        {
+                            endpoints_lost(endpoints, errno);
+                            connection_lost = 1;
+                            continue;
+                        }
+                        udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
                     }
                     else if (recv_result == 0)
                     {
                         current_state = ERR_CONF;
                         continue;
                     }
-                    
-                    // there is no timeout, the message arrived, but it is not CONFIRM to the message sent by the client, 
-                    // so we detect the elapsed time and set it as a timeout
-                    if (timeout != -1)
+                    probe_port(probe, (struct sockaddr *) &server_addr, rel.server);
+
+                    // the header decides if the datagram is confirmed, the CONFIRM goes out before the message
+                    // is decoded and shown, so a slow console does not look like loss to the server;
+                    // a retransmission is only confirmed again, the rest of the iteration still runs
+                    enum State before = current_state;
+                    enum Received received = udp_receive(&rel, &current_state, id_conf, response, recv_result, (struct sockaddr *) &server_addr, &view);
+                    if (received == RECEIVED_LOST)
                     {
-                        if (response[0] != 0)
+                        if (rc.enabled)
                         {
-                            double arrival_time = difftime(time(NULL), send_time);
-                            timeout = timeout - (int) (arrival_time * 1000);
-                            not_conf = 1;
+                            connection_lost = 1;
+                            continue;
                         }
+                        udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
                     }
+                    if (received != RECEIVED_DUPLICATE) USDT3(recv, view.type, view.id, recv_result);
+                    int shown = 0;      // printed MSG, stored once its CONFIRM is out
 
-                    // The ID of the message from the server
-                    int message_id = (response[1] << 8) | response[2];
+                    // a REPLY that overtook the CONFIRM of its AUTH or JOIN confirmed the request as well
+                    if (current_state != before)
+                    {
+                        udp_conf(&buff, &current_state, current_state);
+                        probe_confirmed(probe);
+                    }
 
-                    switch (current_state)
+                    if (received == RECEIVED_DUPLICATE)
                     {
-                    case BYE_SEND:
-                        if (response[0] == 0)
-                        {             
-                            if (message_id == id_conf)
-                            {
-                                udp_conf(&id_conf, &buff, &retransmition, max_num_retransmissions, &timeout, &current_state, BYE_CONF);
-                            }
-                            else
+                        // a retransmission, it was only confirmed again
+                    }
+                    // a malformed message that was confirmed by its header ends the session with ERR and BYE
+                    else if (received == RECEIVED_MALFORMED || received == RECEIVED_REJECTED)
+                    {
+                        fprintf(stderr, "ERR: Malformed message from server!\n");
+                        if (received == RECEIVED_REJECTED)
+                        {
+                            // messages waiting for CONFIRM do not matter any more, ERR gets a free slot
+                            rel_reset(&rel);
+                            rel_duplicate(&rel, view.id);
+                            message_id_increase(&message_id_lsb, &message_id_msb);
+                            buff = NULL;
+                            arena_reset(&flight);
+                            if (udp_encode_err(&flight, &buff, &buff_len, &message_id_lsb, &message_id_msb, display_name != NULL ? display_name : UNKNOWN_DISPLAY_NAME, "Malformed message!"))
                             {
-                                // it is CONFIRM, but not on the message sent by the client, so we detect 
-                                // the elapsed time and set it as a timeout
-                                double arrival_time = difftime(time(NULL), send_time);
-                                timeout = timeout - (int) (arrival_time * 1000);
-                                not_conf = 1;
+                                fprintf(stderr, "ERR: Can't send message!\n");
+                                udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
                             }
+                            current_state = ERR_SEND;
+                            err_event = 1;
+                        }
+                    }
+                    else switch (current_state)
+                    {
+                    case BYE_SEND:
+                        if (view.type == IPK_CONFIRM && rel_ack(&rel, view.id))
+                        {
+                            udp_conf(&buff, &current_state, BYE_CONF);
                         }
                         break;
                     case AUTH_SEND:
-                        if (response[0] == 0)
+                        if (view.type == IPK_CONFIRM && rel_ack(&rel, view.id))
                         {
-                            if (message_id == id_conf)
-                            {
-                                udp_conf(&id_conf, &buff, &retransmition, max_num_retransmissions, &timeout, &current_state, AUTH_CONF);
-                                id_conf = message_id;
-                            }
-                            else
-                            {
-                                // it is CONFIRM, but not on the message sent by the client, 
-                                // so we detect the elapsed time and set it as a timeout
-                                double arrival_time = difftime(time(NULL), send_time);
-                                timeout = timeout - (int) (arrival_time * 1000);
-                                not_conf = 1;
-                            }
+                            udp_conf(&buff, &current_state, AUTH_CONF);
+                            probe_confirmed(probe);
                         }
                         break;
                     case AUTH_CONF:
-                        if (response[0] == 1)
+                        if (view.type == IPK_REPLY)
                         {
-                            int result = response[3];
-                            int ref_message_id = (response[4] << 8) | response[5];
-                            char *message = NULL;
-
-                            if (ref_message_id == id_conf)
+                            if (view.ref_id == id_conf)
                             {
-                                udp_message_next(response, &message, 6, sizeof(response));
-                                add_node(&head, message_id);
+                                rel_duplicate(&rel, view.id);
                                 
-                                if (result == 1)
+                                if (view.result == 1)
                                 {
                                     current_state = MSG_SEND;
-                                    fprintf(stderr, "Success: %s\n", message);
+                                    STATS_CALL(STATS_WRITE, fprintf(stderr, "Success: %s\n", view.content));
+                                    login_step(login, LOGIN_AUTHENTICATED);
+                                    reconnect_done(&rc);
                                 }
                                 else
                                 {
                                     current_state = START;
-                                    fprintf(stderr, "Failure: %s\n", message);
+                                    STATS_CALL(STATS_WRITE, fprintf(stderr, "Failure: %s\n", view.content));
+                                    login_failed(login, LOGIN_AUTHENTICATED);
                                 }
 
-                                free(message);
                                 proccessing = 0;
-
-                                // port change
-                                uint16_t server_port = ntohs(((struct sockaddr_in *)& server_addr)->sin_port);
-                                ((struct sockaddr_in *)server_info->ai_addr)->sin_port = htons(server_port);
-                                confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);
+                                reconnect_replied(&rc, view.result == 1);
+                                probe_replied(probe, view.result == 1);
+                                TRACE_REPLIED();
                             }
                         }
-                        else if (response[0] == -2)
+                        else if (view.type == IPK_ERR)
                         {
                             current_state = ERR_CONF;
-                            char *display_name;
-                            char *message;
-
-                            Node *search_res = search_node(head, message_id);
-                            if (search_res == NULL)
-                            {
-                                add_node(&head, message_id);
-                                udp_message_next(response, &display_name, 3, sizeof(response));
-                                udp_message_next(response, &message, 4 + strlen(display_name), sizeof(response));
-                                fprintf(stderr, "ERR FROM %s: %s\n", display_name, message);
-                                if (message != NULL) free(message);
-                                if (display_name != NULL) free(display_name);
-                            }
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);    
+                            shown = udp_show(&view, &rel);
                         }
                         break;
                     case MSG_CONF:
-                        if (response[0] == 0)
+                        if (view.type == IPK_CONFIRM && rel_ack(&rel, view.id))
                         {
-                            if (message_id == id_conf)
-                            {
-                                udp_conf(&id_conf, &buff, &retransmition, max_num_retransmissions, &timeout, &current_state, MSG_SEND);
-                                proccessing = 0;
-                            }
-                            else
+                            // other chunks of a long message may still wait
+                            udp_conf(&buff, &current_state, rel_idle(&rel) ? MSG_SEND : MSG_CONF);
+                            proccessing = !rel_idle(&rel);
+                            ipk_list *confirmed = remove_by_id(&inflight, view.id);
+                            if (confirmed != NULL)
                             {
-                                // it is CONFIRM, but not on the message sent by the client, so we detect the elapsed time 
-                                // and set it as a timeout
-                                double arrival_time = difftime(time(NULL), send_time);
-                                timeout = timeout - (int) (arrival_time * 1000);
-                                not_conf = 1;
+                                bulk_confirmed(bulk, confirmed->sent_at);
+                                probe_message(probe, confirmed->sent_at);
+                                release_node(confirmed);
                             }
                         }
-                        else if (response[0] == 1)
-                        {
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);
-                        }
-                        else if (response[0] == 4)
+                        else if (view.type == IPK_MSG)
                         {
-                            char *display_name;
-                            char *message;
-
-                            Node *search_res = search_node(head, message_id);
-                            if (search_res == NULL)
-                            {
-                                add_node(&head, message_id);
-                                udp_message_next(response, &display_name, 3, sizeof(response));
-                                udp_message_next(response, &message, 4 + strlen(display_name), sizeof(response));
-                                fprintf(stdout, "%s: %s\n", display_name, message);
-                                fflush(stdout);
-                                if (message != NULL) free(message);
-                                if (display_name != NULL) free(display_name);
-                            }
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);    
+                            shown = udp_show(&view, &rel);
                         }
-                        else if (response[0] == -2)
+                        else if (view.type == IPK_ERR)
                         {
                             current_state = ERR_CONF;
-                            char *display_name;
-                            char *message;
-
-                            Node *search_res = search_node(head, message_id);
-                            if (search_res == NULL)
-                            {
-                                add_node(&head, message_id);
-                                udp_message_next(response, &display_name, 3, sizeof(response));
-                                udp_message_next(response, &message, 4 + strlen(display_name), sizeof(response));
-                                fprintf(stderr, "ERR FROM %s: %s\n", display_name, message);
-                                if (message != NULL) free(message);
-                                if (display_name != NULL) free(display_name);
-                            }
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);    
+                            shown = udp_show(&view, &rel);
                         }
-                        else if (response[0] == -1)
+                        else if (view.type == IPK_BYE)
                         {
-                                current_state = BYE_CONF;
-                                confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]); 
+                            current_state = BYE_CONF;
                         }
                         break;
                     case MSG_SEND:
-                        if (response[0] == 4)
+                    case JOIN_CONF:
+                        if (view.type == IPK_REPLY)
                         {
-                            char *display_name;
-                            char *message;
-
-                            Node *search_res = search_node(head, message_id);
-                            if (search_res == NULL)
+                            // a REPLY sent again because its CONFIRM was lost is only confirmed
+                            if (current_state == JOIN_CONF && view.ref_id == id_conf && !rel_duplicate(&rel, view.id))
                             {
-                                add_node(&head, message_id);
-                                udp_message_next(response, &display_name, 3, sizeof(response));
-                                udp_message_next(response, &message, 4 + strlen(display_name), sizeof(response));
-                                fprintf(stdout, "%s: %s\n", display_name, message);
-                                fflush(stdout);
-                                if (message != NULL) free(message);
-                                if (display_name != NULL) free(display_name);
+                                if (view.result == 1)
+                                {
+                                    STATS_CALL(STATS_WRITE, fprintf(stderr, "Success: %s\n", view.content));
+                                    store_joined(store);
+                                }
+                                else
+                                {
+                                    STATS_CALL(STATS_WRITE, fprintf(stderr, "Failure: %s\n", view.content));
+                                }
+                                reconnect_replied(&rc, view.result == 1);
+                                probe_replied(probe, view.result == 1);
+                                TRACE_REPLIED();
+                                if (view.result == 1) login_step(login, LOGIN_JOINED);
+                                else login_failed(login, LOGIN_JOINED);
+                                proccessing = 0;
+                                current_state = MSG_SEND;
                             }
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);    
                         }
-                        else if (response[0] == -2)
+                        else if (view.type == IPK_MSG)
+                        {
+                            shown = udp_show(&view, &rel);
+                        }
+                        else if (view.type == IPK_ERR)
                         {
                             current_state = ERR_CONF;
-                            char *display_name = NULL;
-                            char *message = NULL;
-
-                            Node *search_res = search_node(head, message_id);
-                            if (search_res == NULL)
-                            {
-                                add_node(&head, message_id);
-                                udp_message_next(response, &display_name, 3, sizeof(response));
-                                udp_message_next(response, &message, 4 + strlen(display_name), sizeof(response));
-                                fprintf(stderr, "ERR FROM %s: %s\n", display_name, message);
-                                if (message != NULL) free(message);
-                                if (display_name != NULL) free(display_name);
-                            }
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);    
+                            shown = udp_show(&view, &rel);
                         }
-                        else if (response[0] == -1)
+                        else if (view.type == IPK_BYE)
                         {
-                                current_state = BYE_CONF;
-                                confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]); 
+                            current_state = BYE_CONF;
                         }
-                        else if (response[0] != 0 && response[0] != 1 && response[0] != 2)
+                        else if (view.type != IPK_CONFIRM && view.type != IPK_REPLY && view.type != IPK_AUTH)
                         {
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);  
                             message_id_increase(&message_id_lsb, &message_id_msb);
-                            if (buff != NULL) free(buff);
                             buff = NULL;
-                            int message_code = err(&buff, &buff_len, &message_id_lsb, &message_id_msb, display_name, "ERR: Uknown message!\n");
+                            arena_reset(&flight);
+                            int message_code = udp_encode_err(&flight, &buff, &buff_len, &message_id_lsb, &message_id_msb, display_name, "Unknown message!");
                             if (message_code)
                             {
                                 fprintf(stderr, "ERR: Can't send message!\n");
-                                udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                                udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
                             }
-                            fprintf(stderr, "ERR: Uknown message!\n");
+                            fprintf(stderr, "ERR: Unknown message!\n");
                             current_state = ERR_SEND;
                             err_event = 1;
                         }
                         break;
                     case JOIN_SEND:
-                        if (response[0] == 0)
+                        if (view.type == IPK_CONFIRM && rel_ack(&rel, view.id))
                         {
-                            if (message_id == id_conf)
-                            {
-                                udp_conf(&id_conf, &buff, &retransmition, max_num_retransmissions, &timeout, &current_state, JOIN_CONF);
-                                id_conf = message_id;
-                            }
-                            else
-                            {
-                                double arrival_time = difftime(time(NULL), send_time);
-                                timeout = timeout - (int) (arrival_time * 1000);
-                                not_conf = 1;
-                            }
+                            udp_conf(&buff, &current_state, JOIN_CONF);
+                            probe_confirmed(probe);
                         }
-                        else if (response[0] == 4)
+                        else if (view.type == IPK_MSG)
                         {
-                            char *display_name;
-                            char *message;
-
-                            Node *search_res = search_node(head, message_id);
-                            if (search_res == NULL)
-                            {
-                                add_node(&head, message_id);
-                                udp_message_next(response, &display_name, 3, sizeof(response));
-                                udp_message_next(response, &message, 4 + strlen(display_name), sizeof(response));
-                                fprintf(stdout, "%s: %s\n", display_name, message);
-                                fflush(stdout);
-                                if (message != NULL) free(message);
-                                if (display_name != NULL) free(display_name);
-                            }
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);    
+                            shown = udp_show(&view, &rel);
                         }
-                        else if (response[0] == -2)
+                        else if (view.type == IPK_ERR)
                         {
                             current_state = ERR_CONF;
-                            char *display_name;
-                            char *message;
-
-                            Node *search_res = search_node(head, message_id);
-                            if (search_res == NULL)
-                            {
-                                add_node(&head, message_id);
-                                udp_message_next(response, &display_name, 3, sizeof(response));
-                                udp_message_next(response, &message, 4 + strlen(display_name), sizeof(response));
-                                fprintf(stderr, "ERR FROM %s: %s\n", display_name, message);
-                                if (message != NULL) free(message);
-                                if (display_name != NULL) free(display_name);
-                            }
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);    
+                            shown = udp_show(&view, &rel);
                         }
-                        else if (response[0] == -1)
+                        else if (view.type == IPK_BYE)
                         {
-                                current_state = BYE_CONF;
-                                confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]); 
-                        }
-                        break;
-                    case JOIN_CONF:
-                        if (response[0] == 1)
-                        {
-                            int result = response[3];
-                            int ref_message_id = (response[4] << 8) | response[5];
-                            char *message;
-                            if (ref_message_id == id_conf)
-                            {
-                                udp_message_next(response, &message, 6, sizeof(response));
-                                add_node(&head, message_id);
-
-                                if (result == 1)
-                                {
-                                    fprintf(stderr, "Success: %s\n", message);
-                                }
-                                else
-                                {
-                                    fprintf(stderr, "Failure: %s\n", message);
-                                }
-                                free(message);
-                                proccessing = 0;
-                                current_state = MSG_SEND;
-                                confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);
-                            }
-                        }
-                        else if (response[0] == 4)
-                        {
-                            char *display_name;
-                            char *message;
-
-                            Node *search_res = search_node(head, message_id);
-                            if (search_res == NULL)
-                            {
-                                add_node(&head, message_id);
-                                udp_message_next(response, &display_name, 3, sizeof(response));
-                                udp_message_next(response, &message, 4 + strlen(display_name), sizeof(response));
-                                fprintf(stdout, "%s: %s\n", display_name, message);
-                                fflush(stdout);
-                                if (message != NULL) free(message);
-                                if (display_name != NULL) free(display_name);
-                            }
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);    
-                        }
-                        else if (response[0] == -2)
-                        {
-                            current_state = ERR_CONF;
-                            char *display_name = NULL;
-                            char *message = NULL;
-
-                            Node *search_res = search_node(head, message_id);
-                            if (search_res == NULL)
-                            {
-                                add_node(&head, message_id);
-                                udp_message_next(response, &display_name, 3, sizeof(response));
-                                udp_message_next(response, &message, 4 + strlen(display_name), sizeof(response));
-                                fprintf(stderr, "ERR FROM %s: %s\n", display_name, message);
-                                if (message != NULL) free(message);
-                                if (display_name != NULL) free(display_name);
-                            }
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);    
-                        }
-                        else if (response[0] == -1)
-                        {
-                                current_state = BYE_CONF;
-                                confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]); 
-                        }
-                        else if (response[0] != 0 && response[0] != 1 && response[0] != 2)
-                        {
-                            confirm(&buff_confirm, &buff_confirm_len, (uint8_t *) &response[2], (uint8_t *) &response[1]);  
-                            message_id_increase(&message_id_lsb, &message_id_msb);
-                            if (buff != NULL) free(buff);
-                            buff = NULL;
-                            int message_code = err(&buff, &buff_len, &message_id_lsb, &message_id_msb, display_name, "ERR: Uknown message!\n");
-                            if (message_code)
-                            {
-                                fprintf(stderr, "ERR: Can't send message!\n");
-                                udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
-                            }
-                            fprintf(stderr, "ERR: Uknown message!\n");
-                            current_state = ERR_SEND;
-                            err_event = 1;
+                            current_state = BYE_CONF;
                         }
                         break;
                     case ERR_SEND:
-                        if (response[0] == 0)
+                        if (view.type == IPK_CONFIRM && rel_ack(&rel, view.id))
                         {
-                            if (message_id == id_conf)
-                            {
-                                current_state = ERR_CONF;
-                                continue;
-                            }
-                            else
-                            {
-                                double arrival_time = difftime(time(NULL), send_time);
-                                timeout = timeout - (int) (arrival_time * 1000);
-                                not_conf = 1;
-                            }
+                            current_state = ERR_CONF;
+                            continue;
                         }
                         break;
                     default:
                         break;
                     }
+
+                    if (shown && view.type == IPK_MSG) store_add(store, STORE_RX, view.display_name, view.content, view.content_len);
+                    if (rel.rtt >= 0)
+                    {
+                        endpoints_event(endpoints, ENDPOINT_OK, (double) rel.rtt);
+                        rel.rtt = -1;
+                    }
                 }
 
-                // message from server
-                if (fds[0].revents & POLLIN) 
+                // the console, complete lines go into the FIFO, a long message as its chunks,
+                // /history is answered right away from the local log; at most SCHED_CONSOLE_BUDGET lines,
+                // the rest stays in the reader, so piped input does not hold up the datagrams; a line
+                // is taken only when the pool has nodes for all of its chunks, lines left for the pool
+                // are taken once a CONFIRM gives nodes back
+                int console_room = fifo_available() >= UDP_LINE_NODES + FIFO_RESERVE;
+                if ((fds[0].revents & (POLLIN | POLLHUP)) || sched_deferred(SCHED_CONSOLE) || (console_room && reader_ready(&reader)))
                 {
-                    char input[1400];
-                    if (fgets(input, sizeof(input), stdin) != NULL) 
+                    char *line;
+                    size_t length;
+                    int more = 1;
+                    if (fds[0].revents & (POLLIN | POLLHUP)) STATS_CALL(STATS_READ, reader_fill(&reader, STDIN_FILENO));
+                    while ((more = sched_take(SCHED_CONSOLE)) && fifo_available() >= UDP_LINE_NODES + FIFO_RESERVE &&
+                           reader_next(&reader, &line, &length) == 1)
                     {
-                        if (input[strlen(input) - 1] == '\n') 
-                            input[strlen(input) - 1] = '\0';
+                        TRACE_LINE();
+                        if (check_input(line) == 7) store_command(store, line);
+                        else udp_queue(&lanes, line, tag_chunks);
+                    }
+                    sched_left(SCHED_CONSOLE, !more);
+                }
 
-                        // save into FIFO
-                        insert_at_end(&fifo, input);
+                // --ring, a message record goes into the FIFO as it is, a line record like a console line;
+                // at most RING_BATCH of them and only into an empty chat lane, so a fast producer
+                // fills its ring instead of the FIFO
+                if (fds[2].revents & POLLIN) ring_doorbell(ring);
+                if (ring->enabled && lanes.head[LANE_CHAT] == NULL && !received_signal)
+                {
+                    ipk_ring_record *record;
+                    for (int i = 0; i < RING_BATCH && fifo_available() >= RING_LINE_NODES + FIFO_RESERVE && (record = ring_peek(ring)) != NULL; i++)
+                    {
+                        TRACE_LINE();
+                        if (record->kind == IPK_RING_MSG) lanes_push_raw(&lanes, record->text);
+                        else if (check_input(record->text) == 7) store_command(store, record->text);
+                        else udp_queue(&lanes, record->text, tag_chunks);
+                        ring_pop(ring);
                     }
-                    if (feof(stdin))
+                }
+
+                // the end of the console input (with --ring the end of the ring) ends the session once everything queued was sent
+                int input_end = ring->enabled ? ring_done(ring) : reader.eof;
+                if (!bulk->enabled && input_end && !sched_deferred(SCHED_CONSOLE) && !proccessing && lanes_empty(&lanes))
+                {
+                    current_state = ERR_CONF;
+                    continue;
+                }
+
+                // in bulk mode the next line of the file goes into the FIFO once the previous one is done,
+                // a message already while MSG wait for CONFIRM and the window has room, so only the token
+                // bucket paces them; a command waits for every CONFIRM; the end of the file ends
+                // the session like the end of the console input once nothing waits
+                if (bulk->enabled && lanes_empty(&lanes) && fifo_available() > FIFO_RESERVE &&
+                    (!proccessing || (current_state == MSG_CONF && !rel_full(&rel))))
+                {
+                    char input[BULK_MAX_LINE + 1];
+                    int next = bulk_next(bulk, input, sizeof(input));
+                    TRACE_LINE();
+                    if (next == 1) lanes_push(&lanes, input, input[0] != '/' && !bulk->serial);
+                    else if (next == -1 && !proccessing)
                     {
                         current_state = ERR_CONF;
                         continue;
@@ -1289,17 +1576,22 @@ void udp(char *host, char *port, int conf_timeout, int max_num_retransmissions)
                 }
 
                 // if the client is not blocking the sending of further messages 
-                // (one is currently being processed), then the oldest input is 
-                // taken from the FIFO, processed and sent
-                if (!proccessing)
+                // (one is currently being processed), then the next input is 
+                // taken from the FIFO, processed and sent, commands before messages (lanes_pop),
+                // after Ctrl + C nothing more is taken, chunks of a long message fill the window
+                // without waiting for each CONFIRM
+                pipeline = current_state == MSG_CONF && !rel_full(&rel) && lanes_next_pipelined(&lanes);
+                if ((!proccessing || pipeline) && !received_signal)
                 {
                     if (!err_event)
                     {
                         // takes a record from the FIFO
-                        ipk_list *removed_node = remove_from_front(&fifo);
+                        ipk_list *removed_node = lanes_pop(&lanes);
                         if (removed_node != NULL)
                         {
-                            int input_code = check_input(removed_node->input);
+                            int input_code = removed_node->pipelined || removed_node->raw ? 6 : check_input(removed_node->input);
+                            // the reliability layer keeps its own copy, the memory of the last message can be reused
+                            arena_reset(&flight);
 
                             switch (current_state)
                             {
@@ -1322,22 +1614,29 @@ void udp(char *host, char *port, int conf_timeout, int max_num_retransmissions)
                                     {
                                         fprintf(stderr, "ERR: Parameters do not match!\n");
                                     }
-                                    else
+                                    else if (check_param(param1, SCAN_ID) && check_param(param2, SCAN_SECRET) && check_param(param3, SCAN_DNAME))
                                     {
                                         message_id_increase(&message_id_lsb, &message_id_msb);
-                                        int message_code = auth(&buff, &buff_len, &message_id_lsb, &message_id_msb, param1, param3, param2);
-                                        display_name = strdup(param3);
+                                        int message_code = udp_encode_auth(&flight, &buff, &buff_len, &message_id_lsb, &message_id_msb, param1, param3, param2);
+                                        reconnect_set_auth(&rc, param1, param2);
+                                        probe_request(probe);
+                                        TRACE_AWAIT(removed_node->trace);
+                                        TRACE_BIND(removed_node->trace, (message_id_msb << 8) | message_id_lsb);
+                                        pool_free(&pool, display_name);
+                                        display_name = pool_strdup(&pool, param3);
+                                        STATS_ALLOC(POOL_SLOT_SIZE);
+                                        prefix.length = 0;
                                         if (display_name == NULL)
                                         {
                                             fprintf(stderr, "ERR: Memory allocation failed!\n");
-                                            udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                                            udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
                                         }
                                         current_state = AUTH_SEND;
 
                                         if (message_code)
                                         {
                                             fprintf(stderr, "ERR: Can't send message!\n");
-                                            udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                                            udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
                                         }
                                     }
                                 }
@@ -1350,6 +1649,7 @@ void udp(char *host, char *port, int conf_timeout, int max_num_retransmissions)
                                     fprintf(stderr, "ERR: You are not authorized!\n");
                                 }
                                 break;
+                            case MSG_CONF:      // only a pipelined message, see pipeline
                             case MSG_SEND:
                                 if (input_code == 1)
                                 {
@@ -1366,14 +1666,19 @@ void udp(char *host, char *port, int conf_timeout, int max_num_retransmissions)
                                     {
                                         fprintf(stderr, "ERR: Parameter's number does not match!\n");
                                     }
-                                    else
+                                    else if (check_param(param1, SCAN_ID))
                                     {
                                         message_id_increase(&message_id_lsb, &message_id_msb);
-                                        int message_code = join(&buff, &buff_len, &message_id_lsb, &message_id_msb, param1, display_name);
+                                        int message_code = udp_encode_join(&flight, &buff, &buff_len, &message_id_lsb, &message_id_msb, param1, display_name);
+                                        reconnect_set_join(&rc, param1);
+                                        store_join(store, param1);
+                                        probe_request(probe);
+                                        TRACE_AWAIT(removed_node->trace);
+                                        TRACE_BIND(removed_node->trace, (message_id_msb << 8) | message_id_lsb);
                                         if (message_code)
                                         {
                                             fprintf(stderr, "ERR: Can't send message!\n");
-                                            udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                                            udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
                                         }
                                         current_state = JOIN_SEND;
                                     }
@@ -1389,14 +1694,16 @@ void udp(char *host, char *port, int conf_timeout, int max_num_retransmissions)
                                     {
                                         fprintf(stderr, "ERR: Parameter's number does not match!\n");
                                     }
-                                    else
+                                    else if (check_param(param1, SCAN_DNAME))
                                     {
-                                        if (display_name != NULL) free(display_name);
-                                        display_name = strdup(param1);
+                                        pool_free(&pool, display_name);
+                                        display_name = pool_strdup(&pool, param1);
+                                        STATS_ALLOC(POOL_SLOT_SIZE);
+                                        prefix.length = 0;
                                         if (display_name == NULL)
                                         {
                                             fprintf(stderr, "ERR: Memory allocation failed!\n");
-                                            udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                                            udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
                                         }
                                     }
                                 }
@@ -1404,79 +1711,127 @@ void udp(char *host, char *port, int conf_timeout, int max_num_retransmissions)
                                 {
                                     print_help();
                                 }
-                                else if (input_code == 6)
+                                else if (input_code == 6 && check_param(removed_node->input, SCAN_CONTENT))
                                 {
                                     message_id_increase(&message_id_lsb, &message_id_msb);
-                                    int message_code = msg(&buff, &buff_len, &message_id_lsb, &message_id_msb, display_name, removed_node->input);
-                                    if (message_code)
+                                    // the node stays in inflight until CONFIRM, so the content is sent from it
+                                    size_t length = strlen(removed_node->input);
+                                    frame_count = udp_frame_msg(&prefix, display_name, message_id_lsb, message_id_msb, removed_node->input, length, frame);
+                                    if (frame_count == 0)
                                     {
                                         fprintf(stderr, "ERR: Can't send message!\n");
-                                        udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                                        udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
                                     }
+                                    store_add(store, STORE_TX, display_name, removed_node->input, length);
+                                    removed_node->sent_at = bulk_sent(bulk, strlen(removed_node->input));
+                                    TRACE_BIND(removed_node->trace, (message_id_msb << 8) | message_id_lsb);
                                     current_state = MSG_CONF;
+
+                                    // kept until CONFIRM, so it can be sent again after a reconnect
+                                    ipk_list **last = &inflight;
+                                    while (*last != NULL)
+                                        last = &(*last)->next;
+                                    removed_node->id = (message_id_msb << 8) | message_id_lsb;
+                                    removed_node->next = NULL;
+                                    *last = removed_node;
+                                    removed_node = NULL;
                                 }
                                 break;
                             default:
                                 break;
                             }
-                            free(removed_node->input);
-                            free(removed_node);
+                            if (removed_node != NULL)
+                            {
+                                release_node(removed_node);
+                            }
                         }
                     }
                 }
-                else
-                {
-                    not_conf = 1;
-                }
             }
         }
 
-        // sends CONFIRM to messages from the server
-        if (buff_confirm != NULL)
+        // sending messages to the server specified by the client, a new message has a new ID,
+        // the ones waiting for CONFIRM are sent again only by rel_timeout
+        if (frame_count > 0)
         {
-            if (sendto(client_socket, buff_confirm, buff_confirm_len, 0, server_info->ai_addr, addr_len) < 0)
+            id_conf = (message_id_msb << 8) | message_id_lsb;
+            proccessing = 1;
+            int failed = rel_sendv(&rel, frame, frame_count, id_conf);
+            frame_count = 0;
+            if (failed)
             {
-                fprintf(stderr, "ERR: Can't send message!\n");
-                udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                if (rc.enabled)
+                {
+                    connection_lost = 1;
+                    continue;
+                }
+                udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
             }
-
-            free(buff_confirm);
-            buff_confirm = NULL;
         }
-
-        // sending messages to the server specified by the client
-        if (buff != NULL && not_conf == 0)
+        else if (buff != NULL && !rel_waiting(&rel, (message_id_msb << 8) | message_id_lsb))
         {
             id_conf = (message_id_msb << 8) | message_id_lsb;
-            timeout = conf_timeout;
-            send_time = time(NULL);
             proccessing = 1;
-            if (sendto(client_socket, buff, buff_len, 0, server_info->ai_addr, addr_len) < 0)
+            if (rel_send(&rel, buff, buff_len, id_conf))
             {
-                fprintf(stderr, "ERR: Can't send message!\n");
-                udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 1);
+                if (rc.enabled)
+                {
+                    connection_lost = 1;
+                    continue;
+                }
+                udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 1);
             }
         }
 
         // the connection was terminated correctly
         if (current_state == BYE_CONF)
         {
-            udp_exit(&buff, &display_name, &buff_confirm, &head, &fifo, client_socket, &server_info, 0);
+            bulk_report(bulk);
+            busy_report(busy);
+            probe_report(probe, &rel, client_socket);
+            bulk_close(bulk);
+            udp_exit(&arena, &flight, &head, &lanes, client_socket, &server_info, 0);
         }
     }
 }
 
 int main(int argc, char *argv[])
 {
+    static ipk_login login;     // -u, -k, -n, -j, the time to ready starts here
+    login_start(&login);
+
     int opt;
     int conf_timeout = DEFAULT_CONF_TIMEOUT;
     int max_num_retransmissions = DEFAULT_MAX_RETRANSMISSIONS;
+    int resilient = 0;
+    int tag_chunks = 0;         // -c
+    char *bulk_file = NULL;
+    double msg_rate = 0;        // -m, 0 is as fast as possible
+    double byte_rate = 0;       // -b
+    static ipk_bulk bulk;
+    static ipk_busy busy;       // -B
+    unsigned long sim_sessions = 0;   // -S, run the simulation instead of connecting
+    unsigned long long sim_seed = 1;
+    char *listen_port = NULL;   // -L, bridge local clients instead of reading the console
+    char *history_file = NULL;  // -H
+    static ipk_store store;
+    static ipk_probe probe;     // --probe
+    char *trace_path = NULL;    // --trace
+    char *ring_arg = NULL;      // --ring
+    static ipk_ring ring;
+    static ipk_endpoints endpoints;     // -s host[:port],...
+    static struct option long_options[] = {
+        {"probe", required_argument, NULL, 'P'},
+        {"trace", required_argument, NULL, 'T'},
+        {"ring", required_argument, NULL, 'G'},
+        {NULL, 0, NULL, 0}
+    };
 
     char *port = DEFAULT_SERVER_PORT;
     char *transfer_protocol = NULL;
     char *ip_addr = NULL;
 
-    while ((opt = getopt(argc, argv, "t:s:p:d:r:h")) != -1) 
+    while ((opt = getopt_long(argc, argv, "t:s:p:d:r:Rcf:m:b:S:B:L:H:u:k:n:j:h", long_options, NULL)) != -1) 
     {
         switch (opt)
         {
@@ -1505,6 +1860,72 @@ int main(int argc, char *argv[])
             case 'r':
                 max_num_retransmissions = atoi(optarg);
                 break;
+            case 'R':
+                resilient = 1;
+                break;
+            case 'c':
+                tag_chunks = 1;
+                break;
+            case 'f':
+                bulk_file = optarg;
+                break;
+            case 'm':
+            case 'b':
+                if (atof(optarg) <= 0)
+                {
+                    fprintf(stderr, "ERR: Invalid rate! Must be a positive number!\n");
+                    exit(1);
+                }
+                if (opt == 'm') msg_rate = atof(optarg);
+                else byte_rate = atof(optarg);
+                break;
+            case 'S':
+            {
+                char *end;
+                sim_sessions = strtoul(optarg, &end, 10);
+                if (*end == ':') sim_seed = strtoull(end + 1, &end, 10);
+                if (sim_sessions == 0 || *end != '\0')
+                {
+                    fprintf(stderr, "ERR: Invalid simulation! Use -S <sessions>[:<seed>]!\n");
+                    exit(1);
+                }
+                break;
+            }
+            case 'B':
+                if (busy_parse(&busy, optarg)) exit(1);
+                break;
+            case 'L':
+                if (atoi(optarg) <= 0 || atoi(optarg) > 65535) 
+                {
+                    fprintf(stderr, "ERR: Invalid port number! Port must be between 1 and 65535!\n");
+                    exit(1);
+                }
+                listen_port = optarg;
+                break;
+            case 'H':
+                history_file = optarg;
+                break;
+            case 'P':
+                if (probe_parse(&probe, optarg)) exit(1);
+                break;
+            case 'T':
+                trace_path = optarg;
+                break;
+            case 'G':
+                ring_arg = optarg;
+                break;
+            case 'u':
+                login.username = optarg;
+                break;
+            case 'k':
+                login.secret = optarg;
+                break;
+            case 'n':
+                login.display_name = optarg;
+                break;
+            case 'j':
+                login.channel = optarg;
+                break;
             case 'h':
                 print_help();
                 exit(0);
@@ -1514,10 +1935,172 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (sim_sessions > 0)
+    {
+        scan_init();
+        return sim_run(sim_sessions, sim_seed, conf_timeout, max_num_retransmissions);
+    }
+
     opt_arg_check(transfer_protocol, ip_addr);
+    if (endpoints_parse(&endpoints, ip_addr, port)) exit(1);
+    if (endpoints.count == 1)
+    {
+        ip_addr = endpoints.list[0].host;
+        port = endpoints.list[0].port;
+    }
+    else
+    {
+        // a session that loses its server moves to another one, that is the resilient mode
+        if (!strcmp(transfer_protocol, "auto") || listen_port != NULL)
+        {
+            fprintf(stderr, "ERR: Several servers (-s) can not be used with -t auto or -L!\n");
+            exit(1);
+        }
+        resilient = 1;
+    }
+    if (login_setup(&login)) exit(1);
+    if (login.enabled)
+    {
+        if (bulk_file != NULL || probe.enabled || listen_port != NULL)
+        {
+            fprintf(stderr, "ERR: -u can not be used with -f, --probe or -L, they send their own AUTH!\n");
+            exit(1);
+        }
+        if (!check_param(login.username, SCAN_ID) || !check_param(login.secret, SCAN_SECRET) || !check_param(login.display_name, SCAN_DNAME) ||
+            (login.channel != NULL && !check_param(login.channel, SCAN_ID)))
+            exit(1);
+    }
+    if (listen_port != NULL)
+    {
+        if (resilient || tag_chunks || bulk_file != NULL || busy.enabled || history_file != NULL || probe.enabled || trace_path != NULL || ring_arg != NULL || !strcmp(transfer_protocol, "auto"))
+        {
+            fprintf(stderr, "ERR: The bridge (-L) only uses -t tcp|udp, -s, -p, -d and -r!\n");
+            exit(1);
+        }
+
+        struct sigaction sa;
+        sa.sa_handler = handle_interrupt;
+        sa.sa_flags = 0;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGINT, &sa, NULL) == -1 || sigaction(SIGQUIT, &sa, NULL) == -1 || sigaction(SIGTERM, &sa, NULL) == -1)
+        {
+            fprintf(stderr, "ERR: Setting up signal handler!\n");
+            exit(1);
+        }
+        scan_init();
+        return bridge_run(ip_addr, port, listen_port, !strcmp(transfer_protocol, "udp"), conf_timeout, max_num_retransmissions, &received_signal);
+    }
+    if (bulk_file == NULL && !probe.enabled && (msg_rate > 0 || byte_rate > 0))
+    {
+        fprintf(stderr, "ERR: Rate (-m, -b) can only be used with -f or --probe!\n");
+        exit(1);
+    }
+    if (probe.enabled)
+    {
+        if (bulk_file != NULL)
+        {
+            fprintf(stderr, "ERR: --probe sends its own requests, it can not be used with -f!\n");
+            exit(1);
+        }
+        if (!check_param(probe.username, SCAN_ID) || !check_param(probe.secret, SCAN_SECRET) || !check_param(probe.channel, SCAN_ID)) exit(1);
+        if (probe_open(&probe, &bulk, msg_rate, byte_rate)) exit(1);
+    }
+    if (ring_arg != NULL && (bulk_file != NULL || probe.enabled))
+    {
+        fprintf(stderr, "ERR: --ring can not be used with -f or --probe, they replace the input!\n");
+        exit(1);
+    }
+    if (bulk_file != NULL && bulk_open(&bulk, bulk_file, msg_rate, byte_rate)) exit(1);
+    if (ring_arg != NULL && ring_open(&ring, ring_arg)) exit(1);
+    if (history_file != NULL && store_open(&store, history_file)) exit(1);
+    if (trace_path != NULL && trace_open(trace_path)) exit(1);
+    scan_init();
+    busy_setup(&busy, &received_signal);
+    sched_init();
+    STATS_INIT();                // make STATS=1, the cost table is printed at exit
+
+    // stdio would allocate its buffer on the first use, inside the loop (the console is read with read())
+    static char stdout_buffer[BUFSIZ];
+    setvbuf(stdout, stdout_buffer, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, sizeof(stdout_buffer));
     
-    if (!strcmp(transfer_protocol, "tcp")) tcp(ip_addr, port);
-    else udp(ip_addr, port, conf_timeout, max_num_retransmissions);
+    struct addrinfo *tcp_info = NULL;
+    struct addrinfo *udp_info = NULL;
+    struct addrinfo *winner = NULL;
+    int client_socket = -1;
+
+    // several servers, the first session goes to the first one that connects in the list order,
+    // failed attempts already count against the others
+    if (endpoints.count > 1)
+    {
+        int stream = !strcmp(transfer_protocol, "tcp");
+        if (endpoints_resolve(&endpoints, stream ? SOCK_STREAM : SOCK_DGRAM)) exit(1);
+        login_step(&login, LOGIN_RESOLVED);
+
+        if (stream)
+        {
+            for (int i = 0; i < endpoints.count * ENDPOINT_FAIL_THRESHOLD && client_socket < 0; i++)
+                client_socket = endpoints_connect(&endpoints);
+            if (client_socket < 0)
+            {
+                fprintf(stderr, "ERR: Failed to connect to any server!\n");
+                exit(1);
+            }
+            tcp_info = endpoints_take(&endpoints, endpoints.current);
+            he_order(tcp_info, &winner, 1);
+        }
+        else
+        {
+            endpoints_pick(&endpoints);
+            udp_info = endpoints_take(&endpoints, endpoints.current);
+        }
+        endpoints_free(&endpoints);
+    }
+    else
+    {
+        if (strcmp(transfer_protocol, "udp")) tcp_info = resolve(ip_addr, port, SOCK_STREAM);
+        if (strcmp(transfer_protocol, "tcp")) udp_info = resolve(ip_addr, port, SOCK_DGRAM);
+        login_step(&login, LOGIN_RESOLVED);
+    }
+
+    // both transports are probed at the same time, the loser is dropped before AUTH
+    if (!strcmp(transfer_protocol, "auto"))
+    {
+        ipk_race race;
+        client_socket = race_run(&race, tcp_info, udp_info, conf_timeout, &winner);
+        race_report(&race);
+        transfer_protocol = race.udp ? "udp" : "tcp";
+        if (!race.udp && client_socket < 0)
+        {
+            fprintf(stderr, "ERR: Failed to connect to %s!\n", ip_addr);
+            exit(1);
+        }
+    }
+    else if (!strcmp(transfer_protocol, "tcp") && tcp_info != NULL && client_socket < 0)
+    {
+        // IPv6 and IPv4 addresses race each other with a staggered start (RFC 8305)
+        if ((client_socket = he_connect(tcp_info, &winner)) < 0)
+        {
+            fprintf(stderr, "ERR: Failed to connect to %s!\n", ip_addr);
+            exit(1);
+        }
+    }
+
+    ipk_options options = {.conf_timeout = conf_timeout, .max_retransmissions = max_num_retransmissions, .resilient = resilient,
+                           .tag_chunks = tag_chunks, .bulk = &bulk, .busy = &busy, .store = &store, .probe = &probe, .login = &login,
+                           .endpoints = &endpoints, .ring = &ring};
+    if (!strcmp(transfer_protocol, "tcp"))
+    {
+        if (udp_info != NULL) freeaddrinfo(udp_info);
+        if (tcp_info == NULL) exit(1);
+        login_step(&login, LOGIN_CONNECTED);
+        tcp(client_socket, tcp_info, winner, &options);
+    }
+    else
+    {
+        if (tcp_info != NULL) freeaddrinfo(tcp_info);
+        if (udp_info == NULL) exit(1);
+        udp(udp_info, &options);
+    }
 
     return 0;
 }
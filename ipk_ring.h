@@ -0,0 +1,170 @@
+#ifndef IPK_RING_H
+#define IPK_RING_H
+
+/*
+ * Shared-memory ingest ring of the client (--ring), the layout and the producer side. This header
+ * is all a bot needs: it creates the ring, starts the client with both descriptors inherited
+ * and pushes records, without a pipe, a copy through the kernel or a line to parse.
+ *
+ *     ipk_ring_producer ring;
+ *     char arg[32];
+ *     if (ipk_ring_create(&ring, 1024)) ...
+ *     snprintf(arg, sizeof(arg), "%d:%d", ring.memfd, ring.eventfd);
+ *     ... fork and exec: ipk24chat-client -t udp -s host -u user -k secret -j channel --ring <arg>
+ *     ipk_ring_push(&ring, IPK_RING_MSG, "hello", 5);
+ *     ipk_ring_close(&ring);      // IPK_RING_END, the client sends BYE once everything is sent
+ *
+ * memfd_create needs _GNU_SOURCE defined before the first include.
+ *
+ * One producer and one consumer. The producer publishes a record by moving head, the client takes
+ * it by moving tail. The eventfd is written only when the client sleeps in poll, so a stream of
+ * records costs no syscall per record.
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#define IPK_RING_MAGIC 0x524B5049u      // "IPKR"
+#define IPK_RING_VERSION 1
+#define IPK_RING_TEXT_MAX 1400          // MessageContent, or a console line
+#define IPK_RING_SLOTS_MAX 65536
+
+enum IpkRingKind
+{
+    IPK_RING_MSG = 1,                   // MessageContent, sent as MSG as it is, never taken as a command
+    IPK_RING_LINE,                      // a console line, "/join general" works as if it was typed
+    IPK_RING_END                        // no more records, like the end of the console input
+};
+
+typedef struct ipk_ring_record
+{
+    uint32_t kind;                      // IpkRingKind
+    uint32_t length;                    // of text, at most IPK_RING_TEXT_MAX
+    char text[IPK_RING_TEXT_MAX + 1];   // zero terminated
+} ipk_ring_record;
+
+// at the start of the memfd, the records follow it
+typedef struct ipk_ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;                     // power of two
+    uint32_t record_size;               // sizeof(ipk_ring_record)
+    _Alignas(64) _Atomic uint64_t head; // records published, written by the producer
+    _Alignas(64) _Atomic uint64_t tail; // records taken, written by the client
+    _Alignas(64) _Atomic uint32_t sleeping;     // the client waits for the eventfd
+} ipk_ring_header;
+
+typedef struct ipk_ring_producer
+{
+    int memfd;
+    int eventfd;
+    ipk_ring_header *header;
+    ipk_ring_record *records;
+    size_t size;
+} ipk_ring_producer;
+
+/**
+ * @brief Bytes of a ring
+ *
+ * @param slots
+ * @return size_t the header and the records
+ */
+static inline size_t ipk_ring_size(uint32_t slots)
+{
+    return sizeof(ipk_ring_header) + (size_t) slots * sizeof(ipk_ring_record);
+}
+
+/**
+ * @brief Creates the ring, the descriptors are inherited by exec
+ *
+ * @param ring
+ * @param slots records, a power of two up to IPK_RING_SLOTS_MAX
+ * @return int 1 if it can not be created, 0 otherwise
+ */
+static inline int ipk_ring_create(ipk_ring_producer *ring, uint32_t slots)
+{
+    if (slots == 0 || slots > IPK_RING_SLOTS_MAX || (slots & (slots - 1)) != 0) return 1;
+
+    ring->size = ipk_ring_size(slots);
+    ring->memfd = memfd_create("ipk-ring", 0);
+    if (ring->memfd < 0) return 1;
+    ring->eventfd = eventfd(0, EFD_NONBLOCK);
+    if (ring->eventfd < 0 || ftruncate(ring->memfd, (off_t) ring->size) < 0)
+    {
+        close(ring->memfd);
+        if (ring->eventfd >= 0) close(ring->eventfd);
+        return 1;
+    }
+
+    void *base = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+    if (base == MAP_FAILED)
+    {
+        close(ring->memfd);
+        close(ring->eventfd);
+        return 1;
+    }
+    ring->header = (ipk_ring_header *) base;
+    ring->records = (ipk_ring_record *) ((char *) base + sizeof(ipk_ring_header));
+    ring->header->magic = IPK_RING_MAGIC;
+    ring->header->version = IPK_RING_VERSION;
+    ring->header->slots = slots;
+    ring->header->record_size = sizeof(ipk_ring_record);
+    return 0;
+}
+
+/**
+ * @brief Publishes one record and rings the doorbell if the client sleeps
+ *
+ * @param ring
+ * @param kind IpkRingKind
+ * @param text
+ * @param length at most IPK_RING_TEXT_MAX
+ * @return int 1 if the ring is full or the text too long, 0 otherwise
+ */
+static inline int ipk_ring_push(ipk_ring_producer *ring, uint32_t kind, const char *text, size_t length)
+{
+    ipk_ring_header *header = ring->header;
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+
+    if (length > IPK_RING_TEXT_MAX) return 1;
+    if (head - atomic_load_explicit(&header->tail, memory_order_acquire) == header->slots) return 1;
+
+    ipk_ring_record *record = &ring->records[head & (header->slots - 1)];
+    record->kind = kind;
+    record->length = (uint32_t) length;
+    memcpy(record->text, text, length);
+    record->text[length] = '\0';
+
+    // sequentially consistent with the client's store to sleeping and load of head, one of the two sees the other
+    atomic_store(&header->head, head + 1);
+    if (atomic_exchange(&header->sleeping, 0))
+    {
+        uint64_t one = 1;
+        // the record is published either way, a failed write (full counter) still leaves the eventfd readable
+        if (write(ring->eventfd, &one, sizeof(one)) < 0) return 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief Ends the stream (IPK_RING_END) and releases the producer's side
+ *
+ * @param ring
+ * @return int 1 if the ring was full and the end could not be published, 0 otherwise
+ */
+static inline int ipk_ring_close(ipk_ring_producer *ring)
+{
+    int full = ipk_ring_push(ring, IPK_RING_END, "", 0);
+
+    munmap(ring->header, ring->size);
+    close(ring->memfd);
+    close(ring->eventfd);
+    return full;
+}
+
+#endif
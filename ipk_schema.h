@@ -0,0 +1,135 @@
+#ifndef IPK_SCHEMA_H
+#define IPK_SCHEMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "scan.h"
+
+/*
+ * The protocol messages, described once for both variants. The TCP (text) and UDP (binary)
+ * encoders, decoders and the maximum sizes are generated from these lists in tcp.c and udp.c.
+ *
+ * X(NAME, name, code, keyword)
+ *   code       the first byte of the UDP message
+ *   keyword    the first word of the TCP message
+ *
+ * F(NAME, field, keyword, kind, class), in the same order in both variants
+ *   field      parameter of the encoder and member of ipk_view
+ *   keyword    word in front of the field in the TCP message, "" if there is none
+ *   kind       WORD    a parameter ended by a space (TCP) or a zero byte (UDP)
+ *              TEXT    MessageContent, the rest of the TCP message or ended by a zero byte
+ *              RESULT  OK|NOK (TCP), one byte 1|0 (UDP)
+ *              REF     Ref_MessageID, only in UDP
+ *   class      allowed characters and maximum length, see scan.h
+ */
+#define IPK_TEXT_MESSAGES(X) \
+    X(REPLY, reply, 0x01, "REPLY") \
+    X(AUTH, auth, 0x02, "AUTH") \
+    X(JOIN, join, 0x03, "JOIN") \
+    X(MSG, msg, 0x04, "MSG") \
+    X(ERR, err, 0xFE, "ERR") \
+    X(BYE, bye, 0xFF, "BYE")
+
+// CONFIRM exists only in UDP, its MessageID is the ID of the confirmed message
+#define IPK_MESSAGES(X) \
+    X(CONFIRM, confirm, 0x00, "CONFIRM") \
+    IPK_TEXT_MESSAGES(X)
+
+#define IPK_FIELDS_CONFIRM(F)
+
+#define IPK_FIELDS_REPLY(F) \
+    F(REPLY, result, "", RESULT, SCAN_ANY) \
+    F(REPLY, ref_id, "", REF, SCAN_ANY) \
+    F(REPLY, content, "IS", TEXT, SCAN_CONTENT)
+
+#define IPK_FIELDS_AUTH(F) \
+    F(AUTH, username, "", WORD, SCAN_ID) \
+    F(AUTH, display_name, "AS", WORD, SCAN_DNAME) \
+    F(AUTH, secret, "USING", WORD, SCAN_SECRET)
+
+#define IPK_FIELDS_JOIN(F) \
+    F(JOIN, channel, "", WORD, SCAN_ID) \
+    F(JOIN, display_name, "AS", WORD, SCAN_DNAME)
+
+#define IPK_FIELDS_MSG(F) \
+    F(MSG, display_name, "FROM", WORD, SCAN_DNAME) \
+    F(MSG, content, "IS", TEXT, SCAN_CONTENT)
+
+#define IPK_FIELDS_ERR(F) \
+    F(ERR, display_name, "FROM", WORD, SCAN_DNAME) \
+    F(ERR, content, "IS", TEXT, SCAN_CONTENT)
+
+#define IPK_FIELDS_BYE(F)
+
+#define SCAN_ANY_MAX 0          // RESULT and REF have no class
+
+// message types, IPK_AUTH, IPK_MSG, ...
+#define IPK_TYPE(NAME, name, code, keyword) IPK_##NAME = code,
+enum IpkType
+{
+    IPK_MESSAGES(IPK_TYPE)
+};
+
+// a decoded message, the strings point into the decoded buffer and are zero terminated
+typedef struct ipk_view
+{
+    uint8_t type;
+    uint16_t id;                // MessageID (UDP)
+    uint8_t result;             // REPLY, 1 OK, 0 NOK
+    uint16_t ref_id;            // REPLY, Ref_MessageID (UDP)
+    char *username;             // AUTH
+    size_t username_len;
+    char *secret;               // AUTH
+    size_t secret_len;
+    char *channel;              // JOIN
+    size_t channel_len;
+    char *display_name;         // AUTH, JOIN, MSG, ERR
+    size_t display_name_len;
+    char *content;              // REPLY, MSG, ERR
+    size_t content_len;
+} ipk_view;
+
+// the part of MSG in front of the content, it only depends on the DisplayName, so it is built once
+// per session and again after /rename (length 0 means it has to be built)
+typedef struct ipk_prefix
+{
+    char buff[48];
+    size_t length;
+} ipk_prefix;
+
+// parameter of a generated encoder
+#define IPK_PARAM_WORD(field) char *field
+#define IPK_PARAM_TEXT(field) char *field
+#define IPK_PARAM_RESULT(field) int field
+#define IPK_PARAM_REF(field) uint16_t field
+#define IPK_PARAM(NAME, field, keyword, kind, cls) , IPK_PARAM_##kind(field)
+
+// bytes of a field in the TCP message: " keyword value"
+#define IPK_TEXT_SIZE_WORD(keyword, cls) (sizeof(keyword) + (sizeof(keyword) > 1) + cls##_MAX)
+#define IPK_TEXT_SIZE_TEXT(keyword, cls) IPK_TEXT_SIZE_WORD(keyword, cls)
+#define IPK_TEXT_SIZE_RESULT(keyword, cls) (sizeof(" NOK") - 1)
+#define IPK_TEXT_SIZE_REF(keyword, cls) 0
+#define IPK_TEXT_FIELD_SIZE(NAME, field, keyword, kind, cls) + IPK_TEXT_SIZE_##kind(keyword, cls)
+
+// bytes of a field in the UDP message
+#define IPK_BIN_SIZE_WORD(cls) (cls##_MAX + 1)
+#define IPK_BIN_SIZE_TEXT(cls) (cls##_MAX + 1)
+#define IPK_BIN_SIZE_RESULT(cls) 1
+#define IPK_BIN_SIZE_REF(cls) 2
+#define IPK_BIN_FIELD_SIZE(NAME, field, keyword, kind, cls) + IPK_BIN_SIZE_##kind(cls)
+
+// the longest possible message with "\r\n" and '\0', IPK_TEXT_MAX_AUTH, ...
+#define IPK_TEXT_SIZE(NAME, name, code, keyword) IPK_TEXT_MAX_##NAME = sizeof(keyword) - 1 IPK_FIELDS_##NAME(IPK_TEXT_FIELD_SIZE) + 3,
+enum
+{
+    IPK_TEXT_MESSAGES(IPK_TEXT_SIZE)
+};
+
+// the longest possible datagram, IPK_BIN_MAX_AUTH, ...
+#define IPK_BIN_SIZE(NAME, name, code, keyword) IPK_BIN_MAX_##NAME = 3 IPK_FIELDS_##NAME(IPK_BIN_FIELD_SIZE),
+enum
+{
+    IPK_MESSAGES(IPK_BIN_SIZE)
+};
+
+#endif
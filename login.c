@@ -0,0 +1,88 @@
+#include "login.h"
+
+/**
+ * @brief Called first in main, the time to ready is measured from here
+ *
+ * @param login
+ */
+void login_start(ipk_login *login)
+{
+    memset(login, 0, sizeof(*login));
+    login->at[LOGIN_START] = ipk_now_us();
+}
+
+/**
+ * @brief Takes the fields not given by the options from the environment and builds the lines.
+ * The secret is better passed in IPK_SECRET, the command line is visible to everyone in ps.
+ *
+ * @param login
+ * @return int 1 if the fields do not make a login, 0 otherwise
+ */
+int login_setup(ipk_login *login)
+{
+    if (login->username == NULL) login->username = getenv("IPK_USERNAME");
+    if (login->secret == NULL) login->secret = getenv("IPK_SECRET");
+    if (login->display_name == NULL) login->display_name = getenv("IPK_DISPLAY_NAME");
+    if (login->channel == NULL) login->channel = getenv("IPK_CHANNEL");
+
+    if (login->username == NULL)
+    {
+        if (login->secret == NULL && login->display_name == NULL && login->channel == NULL) return 0;
+        fprintf(stderr, "ERR: -k, -n and -j need the username (-u or IPK_USERNAME)!\n");
+        return 1;
+    }
+    if (login->secret == NULL)
+    {
+        fprintf(stderr, "ERR: -u needs the secret (-k or IPK_SECRET)!\n");
+        return 1;
+    }
+    if (login->display_name == NULL) login->display_name = login->username;
+
+    snprintf(login->auth, sizeof(login->auth), "/auth %s %s %s", login->username, login->secret, login->display_name);
+    if (login->channel != NULL) snprintf(login->join, sizeof(login->join), "/join %s", login->channel);
+    login->enabled = 1;
+    return 0;
+}
+
+/**
+ * @brief Records a step, the last one (JOIN, or AUTH without a channel) prints the time to ready
+ * and how it splits into the steps to stderr
+ *
+ * @param login
+ * @param step LoginStep
+ */
+void login_step(ipk_login *login, int step)
+{
+    static const char *names[LOGIN_STEPS] = {"start", "resolve", "connect", "auth", "join"};
+
+    if (!login->enabled || login->reported || login->at[step] != 0) return;
+
+    login->at[step] = ipk_now_us();
+    if (step != LOGIN_JOINED && (step != LOGIN_AUTHENTICATED || login->channel != NULL)) return;
+
+    long long prev = login->at[LOGIN_START];
+    fprintf(stderr, "Ready: %.3f ms (", (login->at[step] - prev) / 1000.0);
+    for (int i = LOGIN_RESOLVED; i <= step; i++)
+    {
+        if (login->at[i] == 0) continue;
+        fprintf(stderr, "%s%s %.3f", i > LOGIN_RESOLVED ? ", " : "", names[i], (login->at[i] - prev) / 1000.0);
+        prev = login->at[i];
+    }
+    fprintf(stderr, ")\n");
+    login->reported = 1;
+}
+
+/**
+ * @brief The REPLY to AUTH or JOIN was NOK, the login is reported as failed instead of ready
+ *
+ * @param login
+ * @param step LOGIN_AUTHENTICATED or LOGIN_JOINED, the step that failed
+ */
+void login_failed(ipk_login *login, int step)
+{
+    if (!login->enabled || login->reported) return;
+
+    fprintf(stderr, "Login failed: %s rejected after %.3f ms\n", step == LOGIN_JOINED ? "join" : "auth",
+            (ipk_now_us() - login->at[LOGIN_START]) / 1000.0);
+    login->reported = 1;
+}
@@ -0,0 +1,45 @@
+#ifndef LOGIN_H
+#define LOGIN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "monotonic.h"
+#include "scan.h"
+
+// "/auth <Username> <Secret> <DisplayName>" with its zero, the fields are checked before
+#define LOGIN_LINE_MAX (SCAN_ID_MAX + SCAN_SECRET_MAX + SCAN_DNAME_MAX + 9)
+
+// steps from the start of the process to the first message that can be sent
+enum LoginStep
+{
+    LOGIN_START = 0,                // main was entered
+    LOGIN_RESOLVED,                 // getaddrinfo returned
+    LOGIN_CONNECTED,                // TCP connected, UDP socket ready
+    LOGIN_AUTHENTICATED,            // REPLY to AUTH was OK
+    LOGIN_JOINED,                   // REPLY to JOIN was OK
+    LOGIN_STEPS
+};
+
+// -u/-k/-n/-j or IPK_USERNAME, IPK_SECRET, IPK_DISPLAY_NAME and IPK_CHANNEL, AUTH and JOIN are queued
+// before the console is read and the time to ready is reported
+typedef struct ipk_login
+{
+    int enabled;
+    char *username;
+    char *secret;
+    char *display_name;             // the username if not given
+    char *channel;                  // NULL, no JOIN
+    char auth[LOGIN_LINE_MAX];      // the console lines that are queued first
+    char join[LOGIN_LINE_MAX];
+    long long at[LOGIN_STEPS];      // when the step was reached, us, 0 if not yet
+    int reported;
+} ipk_login;
+
+void login_start(ipk_login *login);
+int login_setup(ipk_login *login);
+void login_step(ipk_login *login, int step);
+void login_failed(ipk_login *login, int step);
+
+#endif
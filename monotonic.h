@@ -0,0 +1,18 @@
+#ifndef MONOTONIC_H
+#define MONOTONIC_H
+
+#include <time.h>
+
+/**
+ * @brief Monotonic time, the one clock every module measures with
+ *
+ * @return long long microseconds
+ */
+static inline long long ipk_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif
@@ -0,0 +1,237 @@
+#include "net_connect.h"
+
+/**
+ * @brief Orders the getaddrinfo results so the address families alternate (RFC 8305, section 4).
+ * The family of the first result (the one preferred by the system) goes first.
+ *
+ * @param list getaddrinfo results
+ * @param order output array
+ * @param max size of the output array
+ * @return int number of addresses in order
+ */
+int he_order(struct addrinfo *list, struct addrinfo **order, int max)
+{
+    struct addrinfo *first[HE_MAX_ADDRESSES];
+    struct addrinfo *other[HE_MAX_ADDRESSES];
+    int first_count = 0;
+    int other_count = 0;
+
+    if (list == NULL) return 0;
+
+    for (struct addrinfo *p = list; p != NULL; p = p->ai_next)
+    {
+        if (p->ai_family == list->ai_family)
+        {
+            if (first_count < HE_MAX_ADDRESSES) first[first_count++] = p;
+        }
+        else if (other_count < HE_MAX_ADDRESSES) other[other_count++] = p;
+    }
+
+    int count = 0;
+    for (int i = 0; count < max && (i < first_count || i < other_count); i++)
+    {
+        if (i < first_count) order[count++] = first[i];
+        if (i < other_count && count < max) order[count++] = other[i];
+    }
+    return count;
+}
+
+/**
+ * @brief Happy Eyeballs TCP connect. Starts a non-blocking connect to the next address every
+ * HE_ATTEMPT_DELAY ms (or as soon as the previous one fails) and keeps the first one that succeeds,
+ * so a black-holed address does not delay the start by the whole kernel connect timeout.
+ *
+ * @param list getaddrinfo results
+ * @param winner set to the address that connected
+ * @return int connected blocking socket, -1 if no address could be reached
+ */
+int he_connect(struct addrinfo *list, struct addrinfo **winner)
+{
+    struct addrinfo *order[HE_MAX_ADDRESSES];
+    struct pollfd fds[HE_MAX_ADDRESSES];
+    struct addrinfo *pending[HE_MAX_ADDRESSES];
+    int count = he_order(list, order, HE_MAX_ADDRESSES);
+    int pending_count = 0;
+    int started = 0;
+    int client_socket = -1;
+    long long deadline = ipk_now_us() / 1000 + HE_TIMEOUT;
+    long long next_start = ipk_now_us() / 1000;
+
+    while (client_socket < 0)
+    {
+        long long now = ipk_now_us() / 1000;
+        if (now >= deadline) break;
+
+        // start the next attempt
+        if (started < count && (now >= next_start || pending_count == 0))
+        {
+            struct addrinfo *p = order[started++];
+            next_start = now + HE_ATTEMPT_DELAY;
+
+            int s = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK, p->ai_protocol);
+            if (s < 0)
+            {
+                fprintf(stderr, "ERR: Socket creation!\n");
+                continue;
+            }
+
+            if (connect(s, p->ai_addr, p->ai_addrlen) == 0)
+            {
+                client_socket = s;
+                *winner = p;
+                break;
+            }
+            if (errno != EINPROGRESS)
+            {
+                close(s);
+                continue;
+            }
+
+            fds[pending_count].fd = s;
+            fds[pending_count].events = POLLOUT;
+            pending[pending_count++] = p;
+        }
+
+        if (pending_count == 0)
+        {
+            if (started == count) break;
+            continue;
+        }
+
+        int timeout = (int) (deadline - now);
+        if (started < count && next_start - now < timeout) timeout = (int) (next_start - now);
+        if (timeout < 0) timeout = 0;
+
+        if (poll(fds, pending_count, timeout) < 0)
+        {
+            if (errno == EINTR) break;
+            continue;
+        }
+
+        for (int i = 0; i < pending_count; i++)
+        {
+            if (!fds[i].revents) continue;
+
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && error == 0)
+            {
+                client_socket = fds[i].fd;
+                *winner = pending[i];
+                fds[i].fd = -1;
+                break;
+            }
+
+            // failed, remove it and let the next address start right away
+            close(fds[i].fd);
+            fds[i] = fds[pending_count - 1];
+            pending[i] = pending[pending_count - 1];
+            pending_count--;
+            next_start = now;
+            i--;
+        }
+    }
+
+    // the losers of the race
+    for (int i = 0; i < pending_count; i++)
+        if (fds[i].fd >= 0 && fds[i].fd != client_socket) close(fds[i].fd);
+
+    if (client_socket >= 0)
+    {
+        int flags = fcntl(client_socket, F_GETFL);
+        fcntl(client_socket, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    return client_socket;
+}
+
+/**
+ * @brief Picks the first address (in the Happy Eyeballs order) that has a route. UDP has no handshake
+ * to race, but connect() on a datagram socket fails immediately when the family is not routable.
+ * The socket is disconnected again, because the server answers from a different port. Until it is
+ * connected to that port (udp_connect), ICMP errors are reported with IP_RECVERR.
+ *
+ * @param list getaddrinfo results
+ * @param winner set to the chosen address
+ * @return int unconnected socket, -1 if no address is usable
+ */
+int he_udp_socket(struct addrinfo *list, struct addrinfo **winner)
+{
+    struct addrinfo *order[HE_MAX_ADDRESSES];
+    int count = he_order(list, order, HE_MAX_ADDRESSES);
+
+    for (int i = 0; i < count; i++)
+    {
+        int s = socket(order[i]->ai_family, order[i]->ai_socktype, order[i]->ai_protocol);
+        if (s < 0) continue;
+
+        if (connect(s, order[i]->ai_addr, order[i]->ai_addrlen) < 0)
+        {
+            close(s);
+            continue;
+        }
+
+        struct sockaddr unspec = {.sa_family = AF_UNSPEC};
+        connect(s, &unspec, sizeof(unspec));
+        udp_recverr(s, order[i]->ai_family, 1);
+        *winner = order[i];
+        return s;
+    }
+    return -1;
+}
+
+/**
+ * @brief Port of an IPv4 or IPv6 address
+ *
+ * @param addr
+ * @return uint16_t port in host byte order
+ */
+uint16_t sockaddr_get_port(struct sockaddr *addr)
+{
+    if (addr->sa_family == AF_INET6) return ntohs(((struct sockaddr_in6 *) addr)->sin6_port);
+    return ntohs(((struct sockaddr_in *) addr)->sin_port);
+}
+
+/**
+ * @brief Changes the port of an IPv4 or IPv6 address
+ *
+ * @param addr
+ * @param port port in host byte order
+ */
+void sockaddr_set_port(struct sockaddr *addr, uint16_t port)
+{
+    if (addr->sa_family == AF_INET6) ((struct sockaddr_in6 *) addr)->sin6_port = htons(port);
+    else ((struct sockaddr_in *) addr)->sin_port = htons(port);
+}
+
+/**
+ * @brief Reports ICMP errors (port unreachable, ...) on an unconnected UDP socket too,
+ * the next recv fails with ECONNREFUSED instead of waiting for the retransmissions to run out
+ *
+ * @param s UDP socket
+ * @param family AF_INET or AF_INET6
+ * @param on 1 to enable, 0 to disable (the queued errors are dropped)
+ * @return int 1 if setsockopt failed, 0 otherwise
+ */
+int udp_recverr(int s, int family, int on)
+{
+    if (family == AF_INET6) return setsockopt(s, IPPROTO_IPV6, IPV6_RECVERR, &on, sizeof(on)) < 0;
+    return setsockopt(s, IPPROTO_IP, IP_RECVERR, &on, sizeof(on)) < 0;
+}
+
+/**
+ * @brief Connects the UDP socket to the port the server answered from. The kernel then drops datagrams
+ * from anyone else and a connected socket reports port unreachable by itself, so IP_RECVERR goes off
+ * and only such hard errors end the session.
+ *
+ * @param s UDP socket
+ * @param addr the server with its dynamic port
+ * @param addr_len
+ * @return int 1 if connect failed, 0 otherwise
+ */
+int udp_connect(int s, const struct sockaddr *addr, socklen_t addr_len)
+{
+    if (connect(s, addr, addr_len) < 0) return 1;
+
+    udp_recverr(s, addr->sa_family, 0);
+    return 0;
+}
\ No newline at end of file
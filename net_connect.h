@@ -0,0 +1,24 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "monotonic.h"
+
+#define HE_ATTEMPT_DELAY 250        // RFC 8305 Connection Attempt Delay in ms
+#define HE_TIMEOUT 10000            // give up on all attempts after 10 s
+#define HE_MAX_ADDRESSES 16         // at most this many resolved addresses are tried
+
+int he_order(struct addrinfo *list, struct addrinfo **order, int max);
+int he_connect(struct addrinfo *list, struct addrinfo **winner);
+int he_udp_socket(struct addrinfo *list, struct addrinfo **winner);
+uint16_t sockaddr_get_port(struct sockaddr *addr);
+void sockaddr_set_port(struct sockaddr *addr, uint16_t port);
+int udp_recverr(int s, int family, int on);
+int udp_connect(int s, const struct sockaddr *addr, socklen_t addr_len);
@@ -0,0 +1,207 @@
+#include "probe.h"
+
+/**
+ * @brief Reads the argument of --probe, username:secret[:count[:channel]], split in place
+ *
+ * @param probe
+ * @param arg
+ * @return int 1 if the argument is wrong, 0 otherwise
+ */
+int probe_parse(ipk_probe *probe, char *arg)
+{
+    memset(probe, 0, sizeof(*probe));
+    probe->count = PROBE_COUNT;
+    probe->channel = PROBE_CHANNEL;
+    probe->handoff = -1;
+
+    probe->username = strtok(arg, ":");
+    probe->secret = strtok(NULL, ":");
+    char *count = strtok(NULL, ":");
+    char *channel = strtok(NULL, ":");
+    char *end = NULL;
+
+    if (count != NULL) probe->count = strtoul(count, &end, 10);
+    if (channel != NULL) probe->channel = channel;
+
+    if (probe->secret == NULL || (end != NULL && (*end != '\0' || probe->count == 0 || probe->count > PROBE_MAX)) || strtok(NULL, "") != NULL)
+    {
+        fprintf(stderr, "ERR: Invalid probe! Use --probe <username>:<secret>[:<count>[:<channel>]]!\n");
+        return 1;
+    }
+    probe->enabled = 1;
+    return 0;
+}
+
+/**
+ * @brief Writes the script, AUTH, one JOIN and count times MSG, and hands it to the bulk mode.
+ * A single JOIN times the REPLY without a join notice to the channel for every sample,
+ * -m paces the MSG, the end of the script sends BYE.
+ *
+ * @param probe
+ * @param bulk
+ * @param msg_rate requests per second, 0 is back to back
+ * @param byte_rate bytes per second, 0 is unlimited
+ * @return int 1 if the script can not be made, 0 otherwise
+ */
+int probe_open(ipk_probe *probe, ipk_bulk *bulk, double msg_rate, double byte_rate)
+{
+    size_t size = (size_t) snprintf(NULL, 0, "/auth %s %s %s\n/join %s\n", probe->username, probe->secret, PROBE_NAME, probe->channel);
+    for (unsigned long i = 1; i <= probe->count; i++) size += (size_t) snprintf(NULL, 0, "probe %lu\n", i);
+
+    char *script = bulk_script(bulk, size, msg_rate, byte_rate);
+    if (script == NULL) return 1;
+
+    // the bulk mode reads the whole mapping, the lines are copied without their '\0',
+    // the one after the commands is overwritten by the first MSG (count is at least 1)
+    char *p = script + sprintf(script, "/auth %s %s %s\n/join %s\n", probe->username, probe->secret, PROBE_NAME, probe->channel);
+    for (unsigned long i = 1; i <= probe->count; i++)
+    {
+        char line[32];
+        int length = snprintf(line, sizeof(line), "probe %lu\n", i);
+        memcpy(p, line, length);
+        p += length;
+    }
+    bulk->quiet = 1;
+    bulk->serial = 1;
+    return 0;
+}
+
+/**
+ * @brief AUTH or JOIN was sent, starts both measurements
+ *
+ * @param probe
+ */
+void probe_request(ipk_probe *probe)
+{
+    if (!probe->enabled) return;
+
+    probe->sent_at = ipk_now_us();
+    if (probe->auth_at == 0) probe->auth_at = probe->sent_at;
+    probe->confirming = 1;
+    probe->requests++;
+}
+
+/**
+ * @brief CONFIRM of the request arrived, the time includes its retransmissions
+ *
+ * @param probe
+ */
+void probe_confirmed(ipk_probe *probe)
+{
+    if (!probe->enabled || !probe->confirming) return;
+
+    hist_add(&probe->confirm, ipk_now_us() - probe->sent_at);
+    probe->confirming = 0;
+}
+
+/**
+ * @brief CONFIRM of a MSG of the stream arrived, the time includes its retransmissions
+ *
+ * @param probe
+ * @param sent_at when the MSG was sent (bulk_sent), us
+ */
+void probe_message(ipk_probe *probe, long long sent_at)
+{
+    if (!probe->enabled || sent_at == 0) return;
+
+    hist_add(&probe->confirm, ipk_now_us() - sent_at);
+    probe->messages++;
+}
+
+/**
+ * @brief REPLY to the request arrived
+ *
+ * @param probe
+ * @param ok Result of the REPLY
+ */
+void probe_replied(ipk_probe *probe, int ok)
+{
+    if (!probe->enabled || probe->sent_at == 0) return;
+
+    hist_add(&probe->reply, ipk_now_us() - probe->sent_at);
+    probe->sent_at = 0;
+    probe->confirming = 0;
+    probe->replies++;
+    if (!ok) probe->failed++;
+}
+
+/**
+ * @brief Port of an IPv4 or IPv6 address
+ *
+ * @param addr
+ * @return int the port in network order
+ */
+static int probe_port_of(const struct sockaddr *addr)
+{
+    if (addr->sa_family == AF_INET6) return ((const struct sockaddr_in6 *) addr)->sin6_port;
+    return ((const struct sockaddr_in *) addr)->sin_port;
+}
+
+/**
+ * @brief A datagram arrived, the first one from another port than AUTH went to ends the handoff
+ *
+ * @param probe
+ * @param from sender of the datagram
+ * @param server where the messages go, before rel_switch_port
+ */
+void probe_port(ipk_probe *probe, const struct sockaddr *from, const struct sockaddr *server)
+{
+    if (!probe->enabled || probe->handoff >= 0 || probe->auth_at == 0) return;
+
+    if (probe_port_of(from) != probe_port_of(server)) probe->handoff = ipk_now_us() - probe->auth_at;
+}
+
+/**
+ * @brief Prints the percentiles of a histogram in ms as a JSON object, null without samples
+ *
+ * @param hist
+ */
+static void probe_hist(ipk_hist *hist)
+{
+    if (hist->samples == 0)
+    {
+        printf("null");
+        return;
+    }
+    printf("{\"samples\":%lu,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}", hist->samples, hist_percentile(hist, 0.5) / 1000.0,
+           hist_percentile(hist, 0.9) / 1000.0, hist_percentile(hist, 0.99) / 1000.0, hist->max / 1000.0);
+}
+
+/**
+ * @brief Prints the report, one JSON line on stdout. UDP loss is inferred from the retransmissions:
+ * a message is sent again when it or its CONFIRM was lost, so retransmits / transmissions estimates
+ * the round trip loss. TCP hides its losses, the kernel counters of the socket are reported instead.
+ *
+ * @param probe
+ * @param rel the UDP reliability layer, NULL for TCP
+ * @param client_socket the TCP socket
+ */
+void probe_report(ipk_probe *probe, ipk_rel *rel, int client_socket)
+{
+    if (!probe->enabled) return;
+
+    printf("{\"transport\":\"%s\",\"requests\":%lu,\"replies\":%lu,\"failed\":%lu,\"messages\":%lu,\"confirm_rtt_ms\":",
+           rel != NULL ? "udp" : "tcp", probe->requests, probe->replies, probe->failed, probe->messages);
+    probe_hist(&probe->confirm);
+    printf(",\"reply_rtt_ms\":");
+    probe_hist(&probe->reply);
+
+    if (rel != NULL)
+    {
+        unsigned long transmissions = rel->sent + rel->retransmits;
+        printf(",\"transmissions\":%lu,\"retransmits\":%lu,\"loss\":%.4f,\"duplicates\":%lu", transmissions, rel->retransmits,
+               transmissions > 0 ? (double) rel->retransmits / transmissions : 0.0, rel->duplicates);
+        if (probe->handoff >= 0) printf(",\"port_handoff_ms\":%.3f", probe->handoff / 1000.0);
+        else printf(",\"port_handoff_ms\":null");
+    }
+    else
+    {
+        struct tcp_info info;
+        socklen_t info_len = sizeof(info);
+        if (getsockopt(client_socket, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0)
+            printf(",\"kernel_rtt_ms\":%.3f,\"retransmits\":%u", info.tcpi_rtt / 1000.0, info.tcpi_total_retrans);
+        else printf(",\"kernel_rtt_ms\":null,\"retransmits\":null");
+    }
+    printf("}\n");
+    fflush(stdout);
+}
@@ -0,0 +1,52 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "monotonic.h"
+#include "hist.h"
+#include "bulk.h"
+#include "udp_rel.h"
+
+#define PROBE_COUNT 20              // MSG sent when the count is not given
+#define PROBE_MAX 1000000           // at most this many MSG
+#define PROBE_CHANNEL "probe"       // the channel of the MSG stream, its members see every MSG
+#define PROBE_NAME "probe"          // DisplayName of the probe
+
+// --probe, AUTH, one JOIN to the probe channel and a paced stream of MSG there, sent through the bulk
+// mode one at a time; AUTH and JOIN are timed to their CONFIRM (UDP) and REPLY, every MSG to its
+// CONFIRM (UDP), the report is one JSON line on stdout
+typedef struct ipk_probe
+{
+    int enabled;
+    char *username;
+    char *secret;
+    char *channel;
+    unsigned long count;            // MSG after AUTH and JOIN
+    unsigned long requests;         // AUTH and JOIN sent
+    unsigned long messages;         // MSG confirmed
+    unsigned long replies;
+    unsigned long failed;           // REPLY with Result 0
+    long long sent_at;              // the request waiting for REPLY, us, 0 if there is none
+    int confirming;                 // its CONFIRM did not come yet
+    long long auth_at;              // the first AUTH was sent, us
+    long long handoff;              // AUTH to the first datagram from the new port, us, -1 if not seen
+    ipk_hist confirm;               // request or MSG to CONFIRM including retransmissions, us
+    ipk_hist reply;                 // request to REPLY, us
+} ipk_probe;
+
+int probe_parse(ipk_probe *probe, char *arg);
+int probe_open(ipk_probe *probe, ipk_bulk *bulk, double msg_rate, double byte_rate);
+void probe_request(ipk_probe *probe);
+void probe_confirmed(ipk_probe *probe);
+void probe_message(ipk_probe *probe, long long sent_at);
+void probe_replied(ipk_probe *probe, int ok);
+void probe_port(ipk_probe *probe, const struct sockaddr *from, const struct sockaddr *server);
+void probe_report(ipk_probe *probe, ipk_rel *rel, int client_socket);
+
+#endif
@@ -0,0 +1,200 @@
+#include "race.h"
+
+/**
+ * @brief Sends the UDP probes at once. A probe is BYE from an address that has no session,
+ * the server only confirms it. The IDs count down from 0xFFFF and the socket is closed after the race,
+ * so they never meet the IDs of the session.
+ *
+ * @param race
+ * @param udp_list getaddrinfo results
+ * @param sent_at CLOCK_REALTIME of every probe, compared with the kernel receive timestamps
+ * @return int the probe socket, -1 if no address has a route
+ */
+static int race_probe(ipk_race *race, struct addrinfo *udp_list, struct timespec *sent_at)
+{
+    struct addrinfo *addr;
+    int on = 1;
+    int s = he_udp_socket(udp_list, &addr);
+
+    if (s < 0) return -1;
+    setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+
+    for (int i = 0; i < RACE_PROBES; i++)
+    {
+        char probe[IPK_BIN_MAX_BYE];
+        ipk_arena arena = {.base = probe, .size = sizeof(probe), .used = 0};
+        uint16_t id = (uint16_t) (0xFFFF - i);
+        uint8_t lsb = (uint8_t) (id & 0xFF);
+        uint8_t msb = (uint8_t) (id >> 8);
+        char *buff;
+        size_t length;
+
+        if (udp_encode_bye(&arena, &buff, &length, &lsb, &msb)) break;
+        clock_gettime(CLOCK_REALTIME, &sent_at[i]);
+        if (sendto(s, buff, length, 0, addr->ai_addr, addr->ai_addrlen) < 0)
+        {
+            // an earlier probe was already refused
+            if (errno == ECONNREFUSED) race->udp_refused = 1;
+            break;
+        }
+        race->udp_sent++;
+    }
+    return s;
+}
+
+/**
+ * @brief Reads the CONFIRMs of the probes. They may have waited in the socket while the TCP connect ran,
+ * the RTT is taken from the time the kernel received them.
+ *
+ * @param race
+ * @param s the probe socket
+ * @param sent_at
+ * @param rtt set to the RTT of every answered probe, ms
+ * @param deadline ms (race_now) when the missing answers count as lost
+ */
+static void race_collect(ipk_race *race, int s, struct timespec *sent_at, double *rtt, long long deadline)
+{
+    int answered[RACE_PROBES] = {0};
+
+    while (race->udp_answered < race->udp_sent && !race->udp_refused)
+    {
+        long long left = deadline - ipk_now_us() / 1000;
+        struct pollfd fd = {.fd = s, .events = POLLIN};
+
+        if (poll(&fd, 1, left > 0 ? (int) left : 0) <= 0) break;
+
+        // IP_RECVERR queued an ICMP error, nothing listens on the port
+        if (fd.revents & POLLERR)
+        {
+            race->udp_refused = 1;
+            break;
+        }
+
+        char buff[IPK_BIN_MAX_CONFIRM];
+        char control[CMSG_SPACE(sizeof(struct timespec))];
+        struct iovec iov = {.iov_base = buff, .iov_len = sizeof(buff)};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+        struct timespec received;
+
+        ssize_t length = recvmsg(s, &msg, MSG_DONTWAIT);
+        if (length < 0)
+        {
+            if (errno == ECONNREFUSED) race->udp_refused = 1;
+            if (errno == EAGAIN || errno == EINTR || errno == ECONNREFUSED) continue;
+            break;
+        }
+
+        // a short datagram leaves the MessageID unread, it is taken only from a whole CONFIRM
+        if (length != IPK_BIN_MAX_CONFIRM || buff[0] != IPK_CONFIRM) continue;
+        int i = 0xFFFF - ((uint8_t) buff[1] << 8 | (uint8_t) buff[2]);
+        if (i >= race->udp_sent || answered[i]) continue;
+
+        clock_gettime(CLOCK_REALTIME, &received);
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) memcpy(&received, CMSG_DATA(cmsg), sizeof(received));
+
+        answered[i] = 1;
+        rtt[race->udp_answered++] = (received.tv_sec - sent_at[i].tv_sec) * 1000.0 + (received.tv_nsec - sent_at[i].tv_nsec) / 1000000.0;
+    }
+}
+
+/**
+ * @brief Median, the array is sorted in place
+ *
+ * @param values
+ * @param count at least 1
+ * @return double
+ */
+static double race_median(double *values, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        double value = values[i];
+        int j = i;
+        for (; j > 0 && values[j - 1] > value; j--) values[j] = values[j - 1];
+        values[j] = value;
+    }
+    return values[count / 2];
+}
+
+/**
+ * @brief -t auto, probes both transports at the same time before AUTH. The UDP probes leave first,
+ * the Happy Eyeballs TCP connect runs while they are on their way. The loss of the probes hits both
+ * transports, so it is charged to UDP as the confirmation timeout and to TCP as its retransmission timeout.
+ * UDP wins only when it is clearly cheaper, TCP needs no retransmissions from the client.
+ *
+ * @param race filled with the measurements and the decision
+ * @param tcp_list getaddrinfo results for TCP
+ * @param udp_list getaddrinfo results for UDP, NULL if they can't be resolved
+ * @param conf_timeout -d, ms
+ * @param tcp_winner set to the address that connected
+ * @return int connected TCP socket if TCP won, -1 otherwise
+ */
+int race_run(ipk_race *race, struct addrinfo *tcp_list, struct addrinfo *udp_list, int conf_timeout, struct addrinfo **tcp_winner)
+{
+    struct timespec sent_at[RACE_PROBES];
+    double rtt[RACE_PROBES];
+    long long start = ipk_now_us() / 1000;
+
+    memset(race, 0, sizeof(*race));
+    race->tcp_rtt = race->udp_rtt = -1;
+
+    int probe = udp_list != NULL ? race_probe(race, udp_list, sent_at) : -1;
+    int tcp_socket = tcp_list != NULL ? he_connect(tcp_list, tcp_winner) : -1;
+
+    if (tcp_socket >= 0)
+    {
+        struct tcp_info info;
+        socklen_t info_len = sizeof(info);
+
+        race->tcp_rtt = ipk_now_us() / 1000 - start;
+        if (getsockopt(tcp_socket, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0)
+        {
+            // the kernel has no RTT sample when the SYN was sent again (Karn)
+            if (info.tcpi_rtt > 0) race->tcp_rtt = info.tcpi_rtt / 1000.0;
+            race->tcp_retransmits = info.tcpi_total_retrans;
+        }
+    }
+    if (probe >= 0)
+    {
+        race_collect(race, probe, sent_at, rtt, start + RACE_WARMUP);
+        close(probe);
+    }
+
+    if (race->udp_sent > 0) race->loss = (double) (race->udp_sent - race->udp_answered) / race->udp_sent;
+    if (race->udp_answered > 0) race->udp_rtt = race_median(rtt, race->udp_answered);
+    race->tcp_cost = race->tcp_rtt + race->loss * RACE_TCP_RTO + race->tcp_retransmits * RACE_SYN_RTO;
+    race->udp_cost = race->udp_rtt + race->loss * conf_timeout;
+
+    if (tcp_socket < 0) race->udp = race->udp_sent > 0 && !race->udp_refused;
+    else race->udp = race->udp_answered > 0 && race->udp_cost < race->tcp_cost * RACE_MARGIN;
+
+    if (race->udp && tcp_socket >= 0)
+    {
+        close(tcp_socket);
+        tcp_socket = -1;
+    }
+    return tcp_socket;
+}
+
+/**
+ * @brief Logs the measurements and the decision
+ *
+ * @param race
+ */
+void race_report(ipk_race *race)
+{
+    char tcp[64] = "failed";
+    char udp[96] = "no route";
+
+    if (race->tcp_rtt >= 0) snprintf(tcp, sizeof(tcp), "handshake %.3f ms, %u SYN retransmits", race->tcp_rtt, race->tcp_retransmits);
+    if (race->udp_refused) snprintf(udp, sizeof(udp), "refused");
+    else if (race->udp_answered > 0)
+        snprintf(udp, sizeof(udp), "RTT %.3f ms, %d/%d probes lost", race->udp_rtt, race->udp_sent - race->udp_answered, race->udp_sent);
+    else if (race->udp_sent > 0) snprintf(udp, sizeof(udp), "no answer, %d/%d probes lost", race->udp_sent, race->udp_sent);
+
+    fprintf(stderr, "Transport race: TCP %s; UDP %s", tcp, udp);
+    if (race->tcp_rtt >= 0 && race->udp_answered > 0)
+        fprintf(stderr, "; expected delay TCP %.3f ms, UDP %.3f ms", race->tcp_cost, race->udp_cost);
+    fprintf(stderr, "; using %s\n", race->udp ? "udp" : "tcp");
+}
@@ -0,0 +1,42 @@
+#ifndef RACE_H
+#define RACE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "monotonic.h"
+#include "udp.h"
+#include "net_connect.h"
+
+#define RACE_PROBES 8               // UDP probes sent at the start, the loss is measured on them
+#define RACE_WARMUP 300             // ms the UDP answers are waited for (longer if the TCP connect takes longer)
+#define RACE_TCP_RTO 200            // ms, the minimum TCP retransmission timeout of Linux, what a lost segment costs
+#define RACE_SYN_RTO 1000           // ms, what a lost SYN costs
+#define RACE_MARGIN 0.9             // UDP is picked only when it costs less than 90 % of TCP
+
+// -t auto: what both transports measured and which one won
+typedef struct ipk_race
+{
+    double tcp_rtt;                 // ms, RTT of the handshake, -1 if TCP did not connect
+    unsigned tcp_retransmits;       // SYN retransmissions
+    int udp_sent;                   // probes, 0 if there is no UDP route
+    int udp_answered;
+    int udp_refused;                // ICMP port unreachable
+    double udp_rtt;                 // ms, median of the answered probes, -1 if none
+    double loss;                    // lost probes / sent probes
+    double tcp_cost;                // ms, expected delay of one message
+    double udp_cost;
+    int udp;                        // 1 UDP won, 0 TCP
+} ipk_race;
+
+int race_run(ipk_race *race, struct addrinfo *tcp_info, struct addrinfo *udp_info, int conf_timeout, struct addrinfo **tcp_winner);
+void race_report(ipk_race *race);
+
+#endif
@@ -0,0 +1,272 @@
+#include "reconnect.h"
+#include "udp_fifo.h"
+#include "net_connect.h"
+#include "endpoint.h"
+
+extern volatile sig_atomic_t received_signal;
+
+/**
+ * @brief Saves the resolved server address, so that the reconnect
+ * does not have to go through DNS again
+ *
+ * @param rc
+ * @param enabled 1 if the resilient mode is on
+ * @param ai the address the client connected to
+ * @param pool memory for the credentials and the channel
+ */
+void reconnect_init(ipk_reconnect *rc, int enabled, struct addrinfo *ai, ipk_pool *pool)
+{
+    memset(rc, 0, sizeof(*rc));
+    rc->pool = pool;
+    rc->enabled = enabled;
+    rc->backoff = RECONNECT_BACKOFF_MIN;
+    if (ai != NULL)
+    {
+        memcpy(&rc->addr, ai->ai_addr, ai->ai_addrlen);
+        rc->addr_len = ai->ai_addrlen;
+        rc->family = ai->ai_family;
+        rc->socktype = ai->ai_socktype;
+        rc->protocol = ai->ai_protocol;
+    }
+}
+
+/**
+ * @brief Writes the cached address back, UDP rewrites the port after AUTH
+ *
+ * @param rc
+ * @param addr address used for sending
+ */
+void reconnect_restore(ipk_reconnect *rc, struct sockaddr *addr)
+{
+    memcpy(addr, &rc->addr, rc->addr_len);
+}
+
+/**
+ * @brief Keeps a string in the pool, the old one is released
+ *
+ * @param rc
+ * @param slot where the copy goes
+ * @param value NULL only releases the old one
+ */
+static void reconnect_keep(ipk_reconnect *rc, char **slot, char *value)
+{
+    pool_free(rc->pool, *slot);
+    *slot = NULL;
+    if (value == NULL) return;
+
+    *slot = pool_strdup(rc->pool, value);
+    if (*slot == NULL)
+    {
+        fprintf(stderr, "ERR: Memory allocation failed!\n");
+        exit(1);
+    }
+}
+
+/**
+ * @brief Remembers the credentials of an AUTH that waits for REPLY, they are replayed
+ * only after REPLY OK (reconnect_replied) or when the connection is lost before any REPLY
+ *
+ * @param rc
+ * @param username
+ * @param secret
+ */
+void reconnect_set_auth(ipk_reconnect *rc, char *username, char *secret)
+{
+    reconnect_keep(rc, &rc->asked_username, username);
+    reconnect_keep(rc, &rc->asked_secret, secret);
+}
+
+/**
+ * @brief Remembers the channel of a JOIN that waits for REPLY, like reconnect_set_auth
+ *
+ * @param rc
+ * @param channel
+ */
+void reconnect_set_join(ipk_reconnect *rc, char *channel)
+{
+    reconnect_keep(rc, &rc->asked_channel, channel);
+}
+
+/**
+ * @brief Moves the request waiting for REPLY to the replayed ones
+ *
+ * @param rc
+ */
+static void reconnect_accept(ipk_reconnect *rc)
+{
+    if (rc->asked_username != NULL)
+    {
+        pool_free(rc->pool, rc->username);
+        pool_free(rc->pool, rc->secret);
+        rc->username = rc->asked_username;
+        rc->secret = rc->asked_secret;
+        rc->asked_username = rc->asked_secret = NULL;
+    }
+    if (rc->asked_channel != NULL)
+    {
+        pool_free(rc->pool, rc->channel);
+        rc->channel = rc->asked_channel;
+        rc->asked_channel = NULL;
+    }
+}
+
+/**
+ * @brief REPLY came, an accepted AUTH or JOIN is replayed after a reconnect, a rejected one is forgotten
+ *
+ * @param rc
+ * @param ok 1 if REPLY OK
+ */
+void reconnect_replied(ipk_reconnect *rc, int ok)
+{
+    if (ok)
+    {
+        reconnect_accept(rc);
+        return;
+    }
+    reconnect_keep(rc, &rc->asked_username, NULL);
+    reconnect_keep(rc, &rc->asked_secret, NULL);
+    reconnect_keep(rc, &rc->asked_channel, NULL);
+}
+
+/**
+ * @brief Closes the broken socket and opens a new one to the cached address.
+ * Waits with exponential backoff before every attempt, the backoff is reset
+ * only after the session is restored (reconnect_done). With several servers
+ * every attempt goes to the endpoint with the best score, which becomes the cached
+ * address, the backoff is only waited after a round over all of them.
+ *
+ * @param rc
+ * @param old_socket socket to be closed
+ * @return int new socket, -1 if interrupted by Ctrl + C
+ */
+int reconnect_socket(ipk_reconnect *rc, int old_socket)
+{
+    if (old_socket >= 0) close(old_socket);
+    // a request the lost connection did not answer is sent again, it was not rejected
+    reconnect_accept(rc);
+
+    if (!rc->recovering)
+    {
+        rc->recovering = 1;
+        rc->attempts = 0;
+        rc->lost_at = ipk_now_us();
+    }
+
+    while (!received_signal)
+    {
+        if (rc->endpoints == NULL || rc->attempts % rc->endpoints->count == 0)
+        {
+            poll(NULL, 0, rc->backoff);
+            if (received_signal) break;
+
+            rc->backoff *= 2;
+            if (rc->backoff > RECONNECT_BACKOFF_MAX) rc->backoff = RECONNECT_BACKOFF_MAX;
+        }
+        rc->attempts++;
+
+        int client_socket;
+        if (rc->endpoints != NULL)
+        {
+            client_socket = endpoints_connect(rc->endpoints);
+            if (client_socket < 0) continue;
+
+            ipk_endpoint *ep = &rc->endpoints->list[rc->endpoints->current];
+            memcpy(&rc->addr, &ep->addr, ep->addr_len);
+            rc->addr_len = ep->addr_len;
+            rc->family = ep->family;
+        }
+        else
+        {
+            client_socket = socket(rc->family, rc->socktype, rc->protocol);
+            if (client_socket < 0)
+            {
+                fprintf(stderr, "ERR: Socket creation!\n");
+                continue;
+            }
+
+            if (rc->socktype == SOCK_STREAM && connect(client_socket, (struct sockaddr *) &rc->addr, rc->addr_len) < 0)
+            {
+                close(client_socket);
+                continue;
+            }
+        }
+
+        if (rc->socktype == SOCK_DGRAM) udp_recverr(client_socket, rc->family, 1);
+
+        struct timeval timeval = {.tv_sec = rc->socktype == SOCK_STREAM ? 5 : 2};
+        if (setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeval, sizeof(timeval)) < 0)
+        {
+            fprintf(stderr, "ERR: Setsockopt!\n");
+            close(client_socket);
+            continue;
+        }
+
+        return client_socket;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Puts AUTH and the last JOIN at the front of the FIFO,
+ * so they are sent before anything the user queued during the outage.
+ * The input is read only while FIFO_RESERVE nodes stay in the pool, they are used here
+ *
+ * @param rc
+ * @param lanes udp fifo
+ * @param display_name current display name
+ * @return int 0 if they were queued, 1 if the pool had no room for them
+ */
+int reconnect_replay(ipk_reconnect *rc, struct ipk_lanes *lanes, char *display_name)
+{
+    if (rc->username == NULL) return 0;
+    if (fifo_available() < FIFO_RESERVE)
+    {
+        fprintf(stderr, "ERR: No room to replay the session!\n");
+        return 1;
+    }
+
+    if (display_name == NULL) display_name = rc->username;
+
+    char line[FIFO_INPUT_MAX];
+
+    if (rc->channel != NULL)
+    {
+        snprintf(line, sizeof(line), "/join %s", rc->channel);
+        lanes_push_front(lanes, line);
+    }
+
+    snprintf(line, sizeof(line), "/auth %s %s %s", rc->username, rc->secret, display_name);
+    lanes_push_front(lanes, line);
+    return 0;
+}
+
+/**
+ * @brief The session was restored, prints how long it took and resets the backoff
+ *
+ * @param rc
+ */
+void reconnect_done(ipk_reconnect *rc)
+{
+    if (!rc->recovering) return;
+
+    long elapsed = (long) ((ipk_now_us() - rc->lost_at) / 1000);
+
+    fprintf(stderr, "Reconnected in %ld ms (%d attempts)\n", elapsed, rc->attempts);
+    rc->recovering = 0;
+    rc->backoff = RECONNECT_BACKOFF_MIN;
+}
+
+/**
+ * @brief Free memmory
+ *
+ * @param rc
+ */
+void reconnect_free(ipk_reconnect *rc)
+{
+    pool_free(rc->pool, rc->username);
+    pool_free(rc->pool, rc->secret);
+    pool_free(rc->pool, rc->channel);
+    rc->username = rc->secret = rc->channel = NULL;
+    reconnect_replied(rc, 0);
+}
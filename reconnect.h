@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "monotonic.h"
+#include "arena.h"
+
+struct ipk_lanes;
+struct ipk_endpoints;
+
+#define RECONNECT_BACKOFF_MIN 100      // first reconnect attempt after 100 ms
+#define RECONNECT_BACKOFF_MAX 5000     // the delay doubles up to 5 s
+
+typedef struct ipk_reconnect
+{
+    int enabled;                    // resilient mode (-R)
+    struct sockaddr_storage addr;   // cached resolved server address
+    socklen_t addr_len;
+    int family;
+    int socktype;
+    int protocol;
+    int backoff;                    // delay before the next attempt in ms
+    int attempts;                   // attempts since the connection was lost
+    int recovering;                 // 1 between the loss and a successful AUTH
+    long long lost_at;              // when the connection was lost, us
+    ipk_pool *pool;                 // memory of the strings below
+    char *username;                 // replayed AUTH, the server accepted it
+    char *secret;
+    char *channel;                  // replayed JOIN, the server accepted it
+    char *asked_username;           // AUTH waiting for REPLY
+    char *asked_secret;
+    char *asked_channel;            // JOIN waiting for REPLY
+    struct ipk_endpoints *endpoints;    // -s with several servers, every attempt goes to the best one, NULL otherwise
+} ipk_reconnect;
+
+void reconnect_init(ipk_reconnect *rc, int enabled, struct addrinfo *ai, ipk_pool *pool);
+void reconnect_restore(ipk_reconnect *rc, struct sockaddr *addr);
+void reconnect_set_auth(ipk_reconnect *rc, char *username, char *secret);
+void reconnect_set_join(ipk_reconnect *rc, char *channel);
+void reconnect_replied(ipk_reconnect *rc, int ok);
+int reconnect_socket(ipk_reconnect *rc, int old_socket);
+int reconnect_replay(ipk_reconnect *rc, struct ipk_lanes *lanes, char *display_name);
+void reconnect_done(ipk_reconnect *rc);
+void reconnect_free(ipk_reconnect *rc);
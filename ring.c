@@ -0,0 +1,146 @@
+#include "ring.h"
+
+/**
+ * @brief Maps the ring a local producer created (ipk_ring.h), both descriptors are inherited
+ *
+ * @param ring
+ * @param arg "<memfd>:<eventfd>"
+ * @return int 1 if the descriptors do not hold a ring, 0 otherwise
+ */
+int ring_open(ipk_ring *ring, char *arg)
+{
+    struct stat st;
+    char *colon = strchr(arg, ':');
+
+    memset(ring, 0, sizeof(*ring));
+    if (colon == NULL || colon == arg || colon[1] == '\0')
+    {
+        fprintf(stderr, "ERR: --ring needs <memfd>:<eventfd>!\n");
+        return 1;
+    }
+    ring->memfd = atoi(arg);
+    ring->eventfd = atoi(colon + 1);
+
+    if (fstat(ring->memfd, &st) < 0 || (size_t) st.st_size < sizeof(ipk_ring_header))
+    {
+        fprintf(stderr, "ERR: --ring descriptor %d is not a ring!\n", ring->memfd);
+        return 1;
+    }
+    ring->size = (size_t) st.st_size;
+    void *base = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "ERR: Can't map the ring!\n");
+        return 1;
+    }
+    ring->header = (ipk_ring_header *) base;
+    ring->records = (ipk_ring_record *) ((char *) base + sizeof(ipk_ring_header));
+
+    ipk_ring_header *header = ring->header;
+    if (header->magic != IPK_RING_MAGIC || header->version != IPK_RING_VERSION || header->record_size != sizeof(ipk_ring_record) ||
+        header->slots == 0 || header->slots > IPK_RING_SLOTS_MAX || (header->slots & (header->slots - 1)) != 0 ||
+        ipk_ring_size(header->slots) > ring->size)
+    {
+        fprintf(stderr, "ERR: --ring descriptor %d is not a ring of this version!\n", ring->memfd);
+        munmap(base, ring->size);
+        return 1;
+    }
+    ring->enabled = 1;
+    return 0;
+}
+
+/**
+ * @brief The next record, it stays in the ring until ring_pop. A record with a wrong kind
+ * or length is skipped.
+ *
+ * @param ring
+ * @return ipk_ring_record* NULL if there is none or the stream ended
+ */
+ipk_ring_record *ring_peek(ipk_ring *ring)
+{
+    ipk_ring_header *header = ring->header;
+
+    while (!ring->ended)
+    {
+        uint64_t tail = atomic_load_explicit(&header->tail, memory_order_relaxed);
+        if (atomic_load_explicit(&header->head, memory_order_acquire) == tail) return NULL;
+
+        ipk_ring_record *record = &ring->records[tail & (header->slots - 1)];
+        if (record->kind == IPK_RING_END)
+        {
+            ring->ended = 1;
+            ring_pop(ring);
+            return NULL;
+        }
+        if ((record->kind == IPK_RING_MSG || record->kind == IPK_RING_LINE) && record->length <= IPK_RING_TEXT_MAX)
+        {
+            record->text[record->length] = '\0';    // the producer's zero is not trusted
+            return record;
+        }
+        ring->rejected++;
+        ring_pop(ring);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Gives the slot of the record from ring_peek back to the producer
+ *
+ * @param ring
+ */
+void ring_pop(ipk_ring *ring)
+{
+    uint64_t tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->header->tail, tail + 1, memory_order_release);
+    ring->taken++;
+}
+
+/**
+ * @brief Called before poll may block, asks the producer for the doorbell
+ *
+ * @param ring
+ * @return int 1 if a record is already there, poll must not block, 0 otherwise
+ */
+int ring_arm(ipk_ring *ring)
+{
+    if (!ring->enabled || ring->ended) return 0;
+
+    // sequentially consistent with the producer's store to head and exchange of sleeping
+    atomic_store(&ring->header->sleeping, 1);
+    return atomic_load(&ring->header->head) != atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+}
+
+/**
+ * @brief The eventfd woke poll, resets it
+ *
+ * @param ring
+ */
+void ring_doorbell(ipk_ring *ring)
+{
+    uint64_t count;
+    if (read(ring->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        fprintf(stderr, "ERR: Can't read the ring doorbell!\n");
+}
+
+/**
+ * @brief Check if the ring does not keep the session open
+ *
+ * @param ring
+ * @return int 1 if there is no ring or its producer ended the stream, 0 otherwise
+ */
+int ring_done(ipk_ring *ring)
+{
+    return !ring->enabled || ring->ended;
+}
+
+/**
+ * @brief Unmaps the ring
+ *
+ * @param ring
+ */
+void ring_close(ipk_ring *ring)
+{
+    if (!ring->enabled) return;
+    munmap(ring->header, ring->size);
+    ring->enabled = 0;
+}
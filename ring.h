@@ -0,0 +1,35 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "ipk_ring.h"
+
+#define RING_BATCH 16               // records queued at once, only when no message waits in the FIFO (UDP)
+
+// --ring <memfd>:<eventfd>, the client's side of the ingest ring of ipk_ring.h
+typedef struct ipk_ring
+{
+    int enabled;
+    int memfd;
+    int eventfd;                    // the doorbell, polled next to the console
+    ipk_ring_header *header;
+    ipk_ring_record *records;
+    size_t size;
+    int ended;                      // IPK_RING_END was taken
+    unsigned long taken;
+    unsigned long rejected;         // records with a wrong kind or length
+} ipk_ring;
+
+int ring_open(ipk_ring *ring, char *arg);
+ipk_ring_record *ring_peek(ipk_ring *ring);
+void ring_pop(ipk_ring *ring);
+int ring_arm(ipk_ring *ring);
+void ring_doorbell(ipk_ring *ring);
+int ring_done(ipk_ring *ring);
+void ring_close(ipk_ring *ring);
+
+#endif
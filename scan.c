@@ -0,0 +1,281 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/**
+ * @brief Scalar check of one character against a class
+ *
+ * @param c
+ * @param cls
+ * @return int 1 if the character does not belong to the class
+ */
+static inline int scan_bad_char(unsigned char c, enum ScanClass cls)
+{
+    switch (cls)
+    {
+        case SCAN_ID:
+        case SCAN_SECRET:
+            return !((c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '-');
+        case SCAN_DNAME:
+            return c < 0x21 || c > 0x7E;
+        case SCAN_CONTENT:
+            return c < 0x20 || c > 0x7E;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Scalar fallback, finds the delimiter and validates everything before it
+ *
+ * @param buf the data
+ * @param len length of the data
+ * @param delim delimiter ('\0', ' ', '\r')
+ * @param cls class of the characters before the delimiter
+ * @param valid set to 0 if a character does not belong to the class
+ * @return size_t position of the delimiter, len if there is none
+ */
+static size_t scan_field_scalar(const char *buf, size_t len, char delim, enum ScanClass cls, int *valid)
+{
+    size_t i = 0;
+    *valid = 1;
+    for (; i < len && buf[i] != delim; i++)
+        if (scan_bad_char((unsigned char) buf[i], cls)) *valid = 0;
+    return i;
+}
+
+#ifdef SCAN_X86
+/**
+ * @brief 16 characters at once, x in [lo, hi] is (x - lo) <= (hi - lo) unsigned
+ */
+static inline __attribute__((target("sse2"))) __m128i sse2_range(__m128i v, char lo, char hi)
+{
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8((char) (hi - lo))), d);
+}
+
+/**
+ * @brief Mask of the characters that belong to the class
+ */
+static inline __attribute__((target("sse2"))) __m128i sse2_good(__m128i v, enum ScanClass cls)
+{
+    switch (cls)
+    {
+        case SCAN_ID:
+        case SCAN_SECRET:
+            return _mm_or_si128(_mm_or_si128(sse2_range(v, '0', '9'), sse2_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z')),
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+        case SCAN_DNAME:
+            return sse2_range(v, 0x21, 0x7E);
+        case SCAN_CONTENT:
+            return sse2_range(v, 0x20, 0x7E);
+        default:
+            return _mm_set1_epi8(-1);
+    }
+}
+
+/**
+ * @brief SSE2 version of scan_field_scalar
+ */
+static __attribute__((target("sse2"))) size_t scan_field_sse2(const char *buf, size_t len, char delim, enum ScanClass cls, int *valid)
+{
+    size_t i = 0;
+    __m128i d = _mm_set1_epi8(delim);
+    *valid = 1;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+        unsigned found = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, d));
+        unsigned bad = (unsigned) _mm_movemask_epi8(sse2_good(v, cls)) ^ 0xFFFF;
+
+        if (found)
+        {
+            // only the characters before the delimiter count
+            unsigned pos = (unsigned) __builtin_ctz(found);
+            if (bad & ((1u << pos) - 1)) *valid = 0;
+            return i + pos;
+        }
+        if (bad) *valid = 0;
+    }
+
+    int tail_valid;
+    size_t pos = i + scan_field_scalar(buf + i, len - i, delim, cls, &tail_valid);
+    if (!tail_valid) *valid = 0;
+    return pos;
+}
+
+static inline __attribute__((target("avx2"))) __m256i avx2_range(__m256i v, char lo, char hi)
+{
+    __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8((char) (hi - lo))), d);
+}
+
+static inline __attribute__((target("avx2"))) __m256i avx2_good(__m256i v, enum ScanClass cls)
+{
+    switch (cls)
+    {
+        case SCAN_ID:
+        case SCAN_SECRET:
+            return _mm256_or_si256(_mm256_or_si256(avx2_range(v, '0', '9'), avx2_range(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z')),
+                                   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')));
+        case SCAN_DNAME:
+            return avx2_range(v, 0x21, 0x7E);
+        case SCAN_CONTENT:
+            return avx2_range(v, 0x20, 0x7E);
+        default:
+            return _mm256_set1_epi8(-1);
+    }
+}
+
+/**
+ * @brief AVX2 version of scan_field_scalar, 32 characters at once, the rest goes through SSE2
+ */
+static __attribute__((target("avx2"))) size_t scan_field_avx2(const char *buf, size_t len, char delim, enum ScanClass cls, int *valid)
+{
+    size_t i = 0;
+    __m256i d = _mm256_set1_epi8(delim);
+    *valid = 1;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (buf + i));
+        unsigned found = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, d));
+        unsigned bad = ~(unsigned) _mm256_movemask_epi8(avx2_good(v, cls));
+
+        if (found)
+        {
+            unsigned pos = (unsigned) __builtin_ctz(found);
+            if (pos && (bad << (32 - pos))) *valid = 0;
+            return i + pos;
+        }
+        if (bad) *valid = 0;
+    }
+
+    int tail_valid;
+    size_t pos = i + scan_field_sse2(buf + i, len - i, delim, cls, &tail_valid);
+    if (!tail_valid) *valid = 0;
+    return pos;
+}
+#endif
+
+// kernel chosen by scan_init
+static size_t (*scan_field_impl)(const char *, size_t, char, enum ScanClass, int *) = scan_field_scalar;
+static const char *scan_impl_name = "scalar";
+
+/**
+ * @brief Chooses the fastest kernel the CPU supports
+ *
+ */
+void scan_init()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scan_field_impl = scan_field_avx2;
+        scan_impl_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        scan_field_impl = scan_field_sse2;
+        scan_impl_name = "sse2";
+    }
+#endif
+}
+
+/**
+ * @brief Name of the kernel in use
+ *
+ * @return const char* scalar|sse2|avx2
+ */
+const char *scan_isa()
+{
+    return scan_impl_name;
+}
+
+/**
+ * @brief Finds the delimiter and validates the characters before it in one pass
+ *
+ * @param buf the data
+ * @param len length of the data
+ * @param delim delimiter ('\0', ' ', '\r')
+ * @param cls class of the characters before the delimiter
+ * @param valid set to 0 if a character does not belong to the class
+ * @return size_t position of the delimiter, len if there is none
+ */
+size_t scan_field(const char *buf, size_t len, char delim, enum ScanClass cls, int *valid)
+{
+    return scan_field_impl(buf, len, delim, cls, valid);
+}
+
+/**
+ * @brief Finds a character
+ *
+ * @param buf the data
+ * @param len length of the data
+ * @param c the character
+ * @return size_t position of the character, len if there is none
+ */
+size_t scan_byte(const char *buf, size_t len, char c)
+{
+    int valid;
+    return scan_field_impl(buf, len, c, SCAN_ANY, &valid);
+}
+
+/**
+ * @brief Finds the end of a TCP message
+ *
+ * @param buf the data
+ * @param len length of the data
+ * @return size_t position of "\r\n", len if there is none
+ */
+size_t scan_crlf(const char *buf, size_t len)
+{
+    size_t i = 0;
+    while ((i += scan_byte(buf + i, len - i, '\r')) < len)
+    {
+        if (i + 1 < len && buf[i + 1] == '\n') return i;
+        i++;
+    }
+    return len;
+}
+
+/**
+ * @brief Maximum length of a parameter of the class
+ *
+ * @param cls
+ * @return size_t
+ */
+size_t scan_max(enum ScanClass cls)
+{
+    switch (cls)
+    {
+        case SCAN_ID: return SCAN_ID_MAX;
+        case SCAN_SECRET: return SCAN_SECRET_MAX;
+        case SCAN_DNAME: return SCAN_DNAME_MAX;
+        case SCAN_CONTENT: return SCAN_CONTENT_MAX;
+        default: return (size_t) -1;
+    }
+}
+
+/**
+ * @brief Checks a whole message parameter, its characters and length
+ *
+ * @param buf the parameter
+ * @param len length of the parameter
+ * @param cls what the parameter is
+ * @return int 1 if it is valid, 0 otherwise
+ */
+int scan_valid(const char *buf, size_t len, enum ScanClass cls)
+{
+    if (len == 0 || len > scan_max(cls)) return 0;
+
+    int valid;
+    // a zero byte inside is not a valid character of any class
+    if (scan_field_impl(buf, len, '\0', cls, &valid) != len) return 0;
+    return valid;
+}
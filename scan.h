@@ -0,0 +1,30 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <string.h>
+
+#define SCAN_ID_MAX 20          // Username, ChannelID
+#define SCAN_SECRET_MAX 128     // Secret
+#define SCAN_DNAME_MAX 20       // DisplayName
+#define SCAN_CONTENT_MAX 1400   // MessageContent
+
+// character classes of the message parameters
+enum ScanClass
+{
+    SCAN_ANY = 0,       // no check, only looks for the delimiter
+    SCAN_ID,            // [A-Za-z0-9-]
+    SCAN_SECRET,        // [A-Za-z0-9-]
+    SCAN_DNAME,         // 0x21-0x7E
+    SCAN_CONTENT        // 0x20-0x7E
+};
+
+void scan_init();
+const char *scan_isa();
+size_t scan_field(const char *buf, size_t len, char delim, enum ScanClass cls, int *valid);
+size_t scan_byte(const char *buf, size_t len, char c);
+size_t scan_crlf(const char *buf, size_t len);
+size_t scan_max(enum ScanClass cls);
+int scan_valid(const char *buf, size_t len, enum ScanClass cls);
+
+#endif
@@ -0,0 +1,100 @@
+#include "sched.h"
+
+// the session loop, the socket and the console take turns within their budgets
+static ipk_sched_source sched_sources[SCHED_SOURCES];
+
+/**
+ * @brief Sets the budgets, make STATS=1 prints the starvation counters at exit
+ */
+void sched_init()
+{
+    sched_sources[SCHED_SOCKET].budget = SCHED_SOCKET_BUDGET;
+    sched_sources[SCHED_CONSOLE].budget = SCHED_CONSOLE_BUDGET;
+#ifdef IPK_STATS
+    atexit(sched_report);
+#endif
+}
+
+/**
+ * @brief A new loop iteration, every source gets its budget again
+ */
+void sched_begin()
+{
+    for (int i = 0; i < SCHED_SOURCES; i++) sched_sources[i].used = 0;
+}
+
+/**
+ * @brief Takes one unit of work of a source
+ *
+ * @param source SchedSource
+ * @return int 1 if the budget allows it, 0 if the rest waits for the next iteration
+ */
+int sched_take(int source)
+{
+    ipk_sched_source *s = &sched_sources[source];
+    return s->used++ < s->budget;
+}
+
+/**
+ * @brief The turn of a source ended, the time its work was left is measured until a turn
+ * ends with nothing left
+ *
+ * @param source SchedSource
+ * @param left 1 if the budget ran out before the work, 0 otherwise
+ */
+void sched_left(int source, int left)
+{
+    ipk_sched_source *s = &sched_sources[source];
+
+    s->turns++;
+    if (left)
+    {
+        s->starved++;
+        if (!s->deferred) s->since = ipk_now_us();
+        s->deferred = 1;
+    }
+    else if (s->deferred)
+    {
+        long long wait = ipk_now_us() - s->since;
+        if (wait > s->max_wait) s->max_wait = wait;
+        s->deferred = 0;
+    }
+}
+
+/**
+ * @brief Check if a source left work that has to be done without waiting for poll
+ *
+ * @param source SchedSource
+ * @return int 1 if it did, 0 otherwise
+ */
+int sched_deferred(int source)
+{
+    return sched_sources[source].deferred;
+}
+
+/**
+ * @brief Check if the next poll must not block
+ *
+ * @return int 1 if some source left work, 0 otherwise
+ */
+int sched_pending()
+{
+    for (int i = 0; i < SCHED_SOURCES; i++)
+        if (sched_sources[i].deferred) return 1;
+    return 0;
+}
+
+/**
+ * @brief Prints how often each source ran out of its budget and the longest wait of its work
+ */
+void sched_report()
+{
+    static const char *names[SCHED_SOURCES] = {"socket", "console"};
+
+    for (int i = 0; i < SCHED_SOURCES; i++)
+    {
+        ipk_sched_source *s = &sched_sources[i];
+        fprintf(stderr, "Scheduler %-8s budget %d, turns %lu, starved %lu, max wait %.3f ms\n",
+                names[i], s->budget, s->turns, s->starved, s->max_wait / 1000.0);
+    }
+}
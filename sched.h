@@ -0,0 +1,40 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "monotonic.h"
+
+#define SCHED_SOCKET_BUDGET 16      // TCP messages handled per loop iteration
+#define SCHED_CONSOLE_BUDGET 16     // console lines queued per loop iteration (UDP)
+
+// sources of work in one loop iteration, the timers (rel_timeout) go before both and have no budget
+enum SchedSource
+{
+    SCHED_SOCKET = 0,
+    SCHED_CONSOLE,
+    SCHED_SOURCES
+};
+
+// one source, its budget and how much it had to wait
+typedef struct ipk_sched_source
+{
+    int budget;                     // units of work per iteration
+    int used;                       // in this iteration
+    int deferred;                   // work was left for the next iteration
+    long long since;                // when the work was first left, us
+    unsigned long turns;            // iterations the source had work
+    unsigned long starved;          // iterations that ended with its work left
+    long long max_wait;             // us, the longest its work was left
+} ipk_sched_source;
+
+void sched_init();
+void sched_begin();
+int sched_take(int source);
+void sched_left(int source, int left);
+int sched_deferred(int source);
+int sched_pending();
+void sched_report();
+
+#endif
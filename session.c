@@ -0,0 +1,82 @@
+#include "session.h"
+
+/**
+ * @brief Check if a datagram is confirmed in the state, from its header only. The same rules
+ * as the receive switch in udp: CONFIRM never, AUTH's REPLY only when it refers to AUTH,
+ * also when it overtook the CONFIRM of AUTH or JOIN.
+ *
+ * @param state current state
+ * @param header from udp_peek
+ * @param id_conf MessageID of the request waiting for REPLY
+ * @return int 1 if the datagram is confirmed, 0 otherwise
+ */
+int udp_confirms(enum State state, ipk_view *header, int id_conf)
+{
+    switch (state)
+    {
+    case AUTH_SEND:
+        return header->type == IPK_REPLY && header->ref_id == id_conf;
+    case AUTH_CONF:
+        return (header->type == IPK_REPLY && header->ref_id == id_conf) || header->type == IPK_ERR;
+    case MSG_CONF:
+    case JOIN_SEND:
+        return header->type == IPK_MSG || header->type == IPK_ERR || header->type == IPK_BYE ||
+               (state == MSG_CONF && header->type == IPK_REPLY) || (header->type == IPK_REPLY && header->ref_id == id_conf);
+    case MSG_SEND:
+    case JOIN_CONF:
+        return header->type != IPK_CONFIRM && header->type != IPK_AUTH;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief What every state does with a received datagram before it looks at it, udp() and
+ * the simulation both start with this. The header decides if the datagram is confirmed and
+ * the CONFIRM goes out before the message is decoded, a retransmission is only confirmed again.
+ * REPLY to AUTH comes from the new port and its CONFIRM already goes there, the socket is
+ * connected to the sender only when that REPLY decodes, a malformed one does not move it.
+ * A REPLY that overtook the CONFIRM of its AUTH or JOIN (the CONFIRM was lost or reordered)
+ * confirms the request as well.
+ *
+ * @param rel
+ * @param state current state, AUTH_SEND or JOIN_SEND moves on when its REPLY confirmed the request
+ * @param id_conf MessageID of the request waiting for REPLY
+ * @param buff the datagram
+ * @param length its size
+ * @param from where it came from
+ * @param view the decoded message, only the type (IPK_CONFIRM) is set for a retransmission
+ * @return enum Received
+ */
+enum Received udp_receive(ipk_rel *rel, enum State *state, int id_conf, char *buff, size_t length, struct sockaddr *from, ipk_view *view)
+{
+    ipk_view header;
+    int confirms = !udp_peek(buff, length, &header) && udp_confirms(*state, &header, id_conf);
+    int decoded = 0;
+    int malformed = 0;
+
+    view->type = IPK_CONFIRM;
+    if (confirms && (*state == AUTH_CONF || *state == AUTH_SEND) && header.type == IPK_REPLY)
+    {
+        malformed = udp_decode(buff, length, view);
+        decoded = 1;
+        if (malformed) confirms = 0;
+        else rel_switch_port(rel, from);
+    }
+    if (confirms)
+    {
+        char confirm[3] = {IPK_CONFIRM, buff[1], buff[2]};
+
+        if (rel_confirm(rel, confirm, sizeof(confirm))) return RECEIVED_LOST;
+        if (rel_seen(rel, header.id)) return RECEIVED_DUPLICATE;
+    }
+
+    // the parameters must have the allowed characters and be zero terminated
+    if (!decoded) malformed = udp_decode(buff, length, view);
+    if (malformed) return confirms ? RECEIVED_REJECTED : RECEIVED_MALFORMED;
+
+    if (view->type == IPK_REPLY && view->ref_id == id_conf && (*state == AUTH_SEND || *state == JOIN_SEND) &&
+        rel_ack(rel, (uint16_t) id_conf))
+        *state = *state == AUTH_SEND ? AUTH_CONF : JOIN_CONF;
+    return RECEIVED_NEW;
+}
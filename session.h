@@ -0,0 +1,39 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "udp.h"
+#include "udp_rel.h"
+
+enum State
+{
+    START = 0,
+    AUTH_SEND,
+    AUTH_CONF,
+    AUTH_REPLY,
+    JOIN_SEND,
+    JOIN_CONF,
+    MSG_SEND,
+    MSG_CONF,
+    ERR_SEND,
+    ERR_CONF,
+    BYE_SEND,
+    BYE_CONF
+};
+
+// what udp_receive made of a datagram, udp() and the simulation (sim.c) act on it by their state
+enum Received
+{
+    RECEIVED_NEW,           // decoded, the state handles it
+    RECEIVED_DUPLICATE,     // a retransmission, it was only confirmed again
+    RECEIVED_MALFORMED,     // not confirmed, only reported
+    RECEIVED_REJECTED,      // malformed but confirmed by its header, the session ends with ERR and BYE
+    RECEIVED_LOST           // its CONFIRM could not be sent
+};
+
+int udp_confirms(enum State state, ipk_view *header, int id_conf);
+enum Received udp_receive(ipk_rel *rel, enum State *state, int id_conf, char *buff, size_t length, struct sockaddr *from, ipk_view *view);
+
+#endif
@@ -0,0 +1,695 @@
+#include "sim.h"
+#include "udp.h"
+#include "udp_id_history.h"
+#include "session.h"
+
+// the client: AUTH, SIM_MESSAGES MSG one by one, BYE. What a datagram does before its state
+// looks at it (CONFIRM, duplicates, malformed messages, the port switch, REPLY overtaking CONFIRM)
+// is udp_receive from session.c like in udp(), only the actions of the states are written here;
+// the simulation says nothing about the FIFO, the window of chunks, reconnects or commands
+typedef struct sim_client
+{
+    ipk_rel rel;
+    sim_end end;
+    struct sockaddr_in server;      // the port is switched by the first REPLY
+    enum State state;               // AUTH_SEND, AUTH_CONF, MSG_SEND, MSG_CONF, ERR_SEND, ERR_CONF, BYE_SEND, BYE_CONF
+    int gave_up;
+    uint8_t lsb;
+    uint8_t msb;
+    int id_conf;
+    int next;                       // the next MSG to send
+    int rejected;                   // a malformed message was answered with ERR
+    int shown[SIM_SERVER_MESSAGES]; // how many times each server MSG was printed
+} sim_client;
+
+// the server, it confirms everything, answers AUTH with REPLY and then sends SIM_SERVER_MESSAGES MSG
+typedef struct sim_server
+{
+    ipk_rel rel;
+    sim_end end;
+    struct sockaddr_in client;
+    uint8_t lsb;
+    uint8_t msb;
+    int reply_ref;                  // ID of the AUTH to answer, -1 if there is none
+    int replied;                    // the client confirmed REPLY
+    int sending;                    // the server MSG waiting for CONFIRM, -1 for REPLY
+    int next;                       // the next server MSG to send
+    long long next_at;              // when it can be sent
+    int gave_up;
+    int bye;
+    int err;                        // the client sent ERR, nothing more is sent
+    int reply_first;                // AUTH is not confirmed, REPLY has to do it
+    int corrupt;                    // the server MSG sent with a control character, -1 if none
+    int expected;                   // the client MSG that has to come next
+    int out_of_order;
+    int misrouted;                  // datagrams sent to the wrong port
+    int delivered[SIM_MESSAGES];
+    int confirmed[SIM_SERVER_MESSAGES];
+} sim_server;
+
+// memory shared by all sessions, allocated once
+typedef struct sim_memory
+{
+    ipk_arena client_flight;
+    ipk_arena server_flight;
+    ipk_arena scratch;              // CONFIRM, sent right away
+    Node *client_seen;
+    Node *server_seen;
+} sim_memory;
+
+/**
+ * @brief splitmix64, the same seed always gives the same session
+ *
+ * @param net
+ * @return uint64_t
+ */
+static uint64_t sim_random(sim_net *net)
+{
+    uint64_t z = (net->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Random number from [0, 1)
+ *
+ * @param net
+ * @return double
+ */
+static double sim_chance(sim_net *net)
+{
+    return (sim_random(net) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @brief Random number from [low, high]
+ *
+ * @param net
+ * @param low
+ * @param high
+ * @return int
+ */
+static int sim_between(sim_net *net, int low, int high)
+{
+    if (high <= low) return low;
+    return low + (int) (sim_random(net) % (uint64_t) (high - low + 1));
+}
+
+/**
+ * @brief The virtual clock
+ *
+ * @param ctx sim_net
+ * @return long long milliseconds
+ */
+static long long sim_now(void *ctx)
+{
+    return ((sim_net *) ctx)->now;
+}
+
+/**
+ * @brief Puts a copy of the datagram on its way with a random delay
+ *
+ * @param end the sender
+ * @param buff
+ * @param length
+ * @param port server port
+ */
+static void sim_enqueue(sim_end *end, const char *buff, size_t length, uint16_t port)
+{
+    sim_net *net = end->net;
+
+    if (net->count == SIM_QUEUE || length > SIM_PACKET_SIZE) return;
+
+    sim_packet *packet = &net->queue[net->count++];
+    packet->at = net->now + sim_between(net, net->delay_min, net->delay_max);
+    if (sim_chance(net) < net->reorder) packet->at += sim_between(net, 0, net->conf_timeout);
+    packet->to_client = !end->client;
+    packet->port = port;
+    packet->length = length;
+    memcpy(packet->data, buff, length);
+}
+
+/**
+ * @brief ipk_transport send, the datagram may be lost or duplicated
+ *
+ * @param ctx sim_end of the sender
+ * @param buff
+ * @param length
+ * @param addr destination, NULL if the client is connected
+ * @param addr_len
+ * @return ssize_t length, a lost datagram is sent successfully too
+ */
+static ssize_t sim_send(void *ctx, const char *buff, size_t length, const struct sockaddr *addr, socklen_t addr_len)
+{
+    sim_end *end = (sim_end *) ctx;
+    sim_net *net = end->net;
+    uint16_t port = SIM_DYNAMIC_PORT;
+
+    if (end->client) port = addr != NULL ? sockaddr_get_port((struct sockaddr *) addr) : end->connected;
+
+    (void) addr_len;
+    if (end->client && length >= 3 && (uint8_t) buff[0] != IPK_CONFIRM)
+    {
+        unsigned id = ((uint8_t) buff[1] << 8) | (uint8_t) buff[2];
+        if (id < sizeof(end->tx) / sizeof(end->tx[0])) end->tx[id]++;
+    }
+
+    if (sim_chance(net) >= net->loss) sim_enqueue(end, buff, length, port);
+    if (sim_chance(net) < net->dup) sim_enqueue(end, buff, length, port);
+    return (ssize_t) length;
+}
+
+/**
+ * @brief ipk_transport connect, from now on the client sends to this port and only accepts datagrams from it
+ *
+ * @param ctx sim_end of the client
+ * @param addr
+ * @param addr_len
+ * @return int 0
+ */
+static int sim_connect(void *ctx, const struct sockaddr *addr, socklen_t addr_len)
+{
+    (void) addr_len;
+    ((sim_end *) ctx)->connected = sockaddr_get_port((struct sockaddr *) addr);
+    return 0;
+}
+
+/**
+ * @brief The datagram that arrives first on the given side
+ *
+ * @param net
+ * @param to_client
+ * @return int index in the queue, -1 if nothing has arrived yet
+ */
+static int sim_due(sim_net *net, int to_client)
+{
+    int first = -1;
+
+    for (int i = 0; i < net->count; i++)
+    {
+        if (net->queue[i].at > net->now) continue;
+        if (to_client != -1 && net->queue[i].to_client != to_client) continue;
+        if (first == -1 || net->queue[i].at < net->queue[first].at) first = i;
+    }
+    return first;
+}
+
+/**
+ * @brief ipk_transport recv, takes the datagram that arrived first
+ *
+ * @param ctx sim_end of the receiver
+ * @param buff
+ * @param size
+ * @param addr sender
+ * @param addr_len
+ * @return ssize_t number of bytes, -1 if nothing has arrived
+ */
+static ssize_t sim_recv(void *ctx, char *buff, size_t size, struct sockaddr *addr, socklen_t *addr_len)
+{
+    sim_end *end = (sim_end *) ctx;
+    sim_net *net = end->net;
+    int i = sim_due(net, end->client);
+
+    if (i == -1) return -1;
+
+    sim_packet *packet = &net->queue[i];
+    if (end->connected != 0 && packet->port != end->connected)
+    {
+        // the kernel drops it on a connected socket
+        net->queue[i] = net->queue[--net->count];
+        return -1;
+    }
+    size_t length = packet->length < size ? packet->length : size;
+    struct sockaddr_in *from = (struct sockaddr_in *) addr;
+
+    memcpy(buff, packet->data, length);
+    memset(from, 0, sizeof(*from));
+    from->sin_family = AF_INET;
+    from->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    from->sin_port = htons(end->client ? packet->port : SIM_CLIENT_PORT);
+    *addr_len = sizeof(*from);
+    end->arrived = packet->port;
+
+    net->queue[i] = net->queue[--net->count];
+    return (ssize_t) length;
+}
+
+/**
+ * @brief Sends CONFIRM of the received message
+ *
+ * @param rel
+ * @param scratch
+ * @param id
+ */
+static void sim_confirm(ipk_rel *rel, ipk_arena *scratch, uint16_t id)
+{
+    char *buff = NULL;
+    size_t length = 0;
+    uint8_t lsb = id & 0xFF;
+    uint8_t msb = id >> 8;
+
+    arena_reset(scratch);
+    if (!udp_encode_confirm(scratch, &buff, &length, &lsb, &msb)) rel_confirm(rel, buff, length);
+}
+
+/**
+ * @brief The client encodes and sends one message
+ *
+ * @param client
+ * @param memory
+ * @param type IPK_MSG, IPK_ERR or IPK_BYE
+ * @param content MessageContent of MSG and ERR
+ * @param next the state waiting for its CONFIRM
+ */
+static void sim_client_send(sim_client *client, sim_memory *memory, uint8_t type, char *content, enum State next)
+{
+    char display_name[] = "sim";
+    char *buff = NULL;
+    size_t length = 0;
+
+    arena_reset(&memory->client_flight);
+    message_id_increase(&client->lsb, &client->msb);
+    if (type == IPK_MSG) udp_encode_msg(&memory->client_flight, &buff, &length, &client->lsb, &client->msb, display_name, content);
+    else if (type == IPK_ERR) udp_encode_err(&memory->client_flight, &buff, &length, &client->lsb, &client->msb, display_name, content);
+    else udp_encode_bye(&memory->client_flight, &buff, &length, &client->lsb, &client->msb);
+    client->state = next;
+    if (buff != NULL) rel_send(&client->rel, buff, length, (client->msb << 8) | client->lsb);
+}
+
+/**
+ * @brief The client takes one datagram, udp_receive first and then the actions of its state (see sim_client)
+ *
+ * @param client
+ * @param memory
+ */
+static void sim_client_receive(sim_client *client, sim_memory *memory)
+{
+    char response[SIM_PACKET_SIZE];
+    char reason[] = "Malformed message!";
+    struct sockaddr_storage from;
+    socklen_t from_len = sizeof(from);
+    ipk_view view;
+
+    ssize_t length = rel_recv(&client->rel, response, sizeof(response), (struct sockaddr *) &from, &from_len);
+    if (length < 0) return;
+
+    enum Received received = udp_receive(&client->rel, &client->state, client->id_conf, response, length, (struct sockaddr *) &from, &view);
+    if (received == RECEIVED_LOST) client->gave_up = 1;
+    if (received == RECEIVED_REJECTED)
+    {
+        // like udp(), the session ends with ERR and BYE
+        rel_reset(&client->rel);
+        rel_duplicate(&client->rel, view.id);
+        client->rejected = 1;
+        sim_client_send(client, memory, IPK_ERR, reason, ERR_SEND);
+    }
+    if (received != RECEIVED_NEW) return;
+
+    switch (client->state)
+    {
+    case AUTH_SEND:
+        if (view.type == IPK_CONFIRM && rel_ack(&client->rel, view.id)) client->state = AUTH_CONF;
+        break;
+    case AUTH_CONF:
+        // like udp(), only the REPLY to AUTH is taken here
+        if (view.type == IPK_REPLY && view.ref_id == client->id_conf)
+        {
+            rel_duplicate(&client->rel, view.id);
+            client->state = MSG_SEND;
+        }
+        break;
+    case MSG_SEND:
+    case MSG_CONF:
+        if (view.type == IPK_CONFIRM && client->state == MSG_CONF && rel_ack(&client->rel, view.id))
+        {
+            client->next++;
+            client->state = MSG_SEND;
+        }
+        else if (view.type == IPK_MSG && !rel_duplicate(&client->rel, view.id))
+        {
+            int index = view.content[0] == 's' ? atoi(view.content + 1) : -1;
+            if (index >= 0 && index < SIM_SERVER_MESSAGES) client->shown[index]++;
+        }
+        break;
+    case ERR_SEND:
+        if (view.type == IPK_CONFIRM && rel_ack(&client->rel, view.id)) client->state = ERR_CONF;
+        break;
+    case BYE_SEND:
+        if (view.type == IPK_CONFIRM && rel_ack(&client->rel, view.id)) client->state = BYE_CONF;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Sends the next MSG or BYE once the previous message is confirmed, BYE also after ERR
+ *
+ * @param client
+ * @param memory
+ */
+static void sim_client_pump(sim_client *client, sim_memory *memory)
+{
+    char content[16];
+
+    if ((client->state != MSG_SEND && client->state != ERR_CONF) || !rel_idle(&client->rel)) return;
+
+    if (client->state == MSG_SEND && client->next < SIM_MESSAGES)
+    {
+        snprintf(content, sizeof(content), "c%d", client->next);
+        sim_client_send(client, memory, IPK_MSG, content, MSG_CONF);
+    }
+    else sim_client_send(client, memory, IPK_BYE, NULL, BYE_SEND);
+}
+
+/**
+ * @brief The server takes one datagram
+ *
+ * @param server
+ * @param memory
+ */
+static void sim_server_receive(sim_server *server, sim_memory *memory)
+{
+    char request[SIM_PACKET_SIZE];
+    struct sockaddr_storage from;
+    socklen_t from_len = sizeof(from);
+    ipk_view view;
+
+    ssize_t length = rel_recv(&server->rel, request, sizeof(request), (struct sockaddr *) &from, &from_len);
+    if (length < 0 || server->gave_up || udp_decode(request, length, &view)) return;
+
+    if (server->end.arrived != SIM_DYNAMIC_PORT && (server->end.arrived != SIM_SERVER_PORT || view.type != IPK_AUTH))
+        server->misrouted++;
+
+    if (view.type == IPK_CONFIRM)
+    {
+        if (rel_ack(&server->rel, view.id))
+        {
+            if (server->sending == -1) server->replied = 1;
+            else server->confirmed[server->sending] = 1;
+            server->next_at = server->end.net->now + sim_between(server->end.net, 0, server->end.net->conf_timeout);
+        }
+        return;
+    }
+
+    if (view.type != IPK_AUTH || !server->reply_first) sim_confirm(&server->rel, &memory->scratch, view.id);
+    if (rel_duplicate(&server->rel, view.id)) return;
+
+    if (view.type == IPK_AUTH) server->reply_ref = view.id;
+    else if (view.type == IPK_BYE) server->bye = 1;
+    else if (view.type == IPK_ERR)
+    {
+        // the MSG waiting for CONFIRM is not retransmitted any more
+        server->err = 1;
+        rel_reset(&server->rel);
+    }
+    else if (view.type == IPK_MSG)
+    {
+        int index = view.content[0] == 'c' ? atoi(view.content + 1) : -1;
+        if (index != server->expected) server->out_of_order++;
+        else server->expected++;
+        if (index >= 0 && index < SIM_MESSAGES) server->delivered[index]++;
+    }
+}
+
+/**
+ * @brief Whether the server has something to send
+ *
+ * @param server
+ * @return int 1 if it has, 0 otherwise
+ */
+static int sim_server_pending(sim_server *server)
+{
+    if (server->gave_up || !rel_idle(&server->rel)) return 0;
+    return server->reply_ref != -1 || (server->replied && server->next < SIM_SERVER_MESSAGES && !server->bye && !server->err);
+}
+
+/**
+ * @brief Sends REPLY or the next server MSG once the previous one is confirmed
+ *
+ * @param server
+ * @param memory
+ */
+static void sim_server_pump(sim_server *server, sim_memory *memory)
+{
+    char content[16];
+    char display_name[] = "server";
+    char *buff = NULL;
+    size_t length = 0;
+
+    if (!sim_server_pending(server) || server->end.net->now < server->next_at) return;
+
+    arena_reset(&memory->server_flight);
+    message_id_increase(&server->lsb, &server->msb);
+    if (server->reply_ref != -1)
+    {
+        snprintf(content, sizeof(content), "ok");
+        udp_encode_reply(&memory->server_flight, &buff, &length, &server->lsb, &server->msb, 1, (uint16_t) server->reply_ref, content);
+        server->reply_ref = -1;
+        server->sending = -1;
+    }
+    else
+    {
+        snprintf(content, sizeof(content), "s%d", server->next);
+        udp_encode_msg(&memory->server_flight, &buff, &length, &server->lsb, &server->msb, display_name, content);
+        // the last character of the content, the encoder does not allow it
+        if (buff != NULL && server->next == server->corrupt) buff[length - 2] = 0x01;
+        server->sending = server->next++;
+    }
+    if (buff != NULL) rel_send(&server->rel, buff, length, (server->msb << 8) | server->lsb);
+}
+
+/**
+ * @brief Draws the network of the session, a quarter of the sessions is clean
+ * (no loss, no reordering, round trip shorter than conf_timeout) and must not retransmit
+ *
+ * @param net
+ * @param seed seed of the session
+ * @param conf_timeout
+ * @return int 1 if the session is clean, 0 otherwise
+ */
+static int sim_network(sim_net *net, unsigned long long seed, int conf_timeout)
+{
+    net->now = 0;
+    net->count = 0;
+    net->rng = seed;
+    net->conf_timeout = conf_timeout;
+
+    int clean = sim_chance(net) < 0.25;
+    net->loss = clean ? 0 : sim_chance(net) * 0.3;
+    net->dup = sim_chance(net) < 0.5 ? 0 : sim_chance(net) * 0.1;
+    net->reorder = clean ? 0 : sim_chance(net) * 0.2;
+    net->delay_min = sim_between(net, 0, conf_timeout / 8);
+    net->delay_max = sim_between(net, net->delay_min, clean ? (conf_timeout - 1) / 2 : conf_timeout);
+    return clean;
+}
+
+/**
+ * @brief Runs one session in virtual time and checks it
+ *
+ * @param memory
+ * @param seed seed of the session
+ * @param conf_timeout
+ * @param max_retx
+ * @param reason what went wrong, empty if nothing did
+ * @param size size of reason
+ * @param client
+ * @return int 0 completed, 1 the client gave up, 2 the server gave up
+ */
+static int sim_session(sim_memory *memory, unsigned long long seed, int conf_timeout, int max_retx, char *reason, size_t size, sim_client *client)
+{
+    static sim_net net;
+    static sim_server server;
+    int clean = sim_network(&net, seed, conf_timeout);
+    ipk_clock clock = {sim_now, &net};
+    char username[] = "user";
+    char display_name[] = "sim";
+    char secret[] = "secret";
+    char *buff = NULL;
+    size_t length = 0;
+    int result = 0;
+
+    reason[0] = '\0';
+    memset(client, 0, sizeof(*client));
+    memset(&server, 0, sizeof(server));
+    clear_list(memory->client_seen);
+    clear_list(memory->server_seen);
+
+    client->end.net = server.end.net = &net;
+    client->end.client = 1;
+    client->server.sin_family = server.client.sin_family = AF_INET;
+    client->server.sin_addr.s_addr = server.client.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    client->server.sin_port = htons(SIM_SERVER_PORT);
+    server.client.sin_port = htons(SIM_CLIENT_PORT);
+
+    ipk_transport client_transport = {sim_send, sim_recv, sim_connect, &client->end, NULL};
+    ipk_transport server_transport = {sim_send, sim_recv, NULL, &server.end, NULL};
+    rel_init(&client->rel, clock, client_transport, (struct sockaddr *) &client->server, sizeof(client->server), conf_timeout, max_retx, memory->client_seen);
+    rel_init(&server.rel, clock, server_transport, (struct sockaddr *) &server.client, sizeof(server.client), conf_timeout, max_retx, memory->server_seen);
+    server.reply_ref = -1;
+    client->lsb = client->msb = server.lsb = server.msb = 0xFF;
+
+    // the scenarios of the session: AUTH confirmed only by its REPLY, a server MSG
+    // with a control character, a REPLY cut after Ref_MessageID's first byte from another port
+    server.reply_first = sim_chance(&net) < SIM_SCENARIO;
+    server.corrupt = sim_chance(&net) < SIM_SCENARIO ? sim_between(&net, 0, SIM_SERVER_MESSAGES - 1) : -1;
+    if (sim_chance(&net) < SIM_SCENARIO)
+    {
+        char rogue[] = {IPK_REPLY, 0x00, 0x00, 1, 0x00};
+        sim_end end = {&net, 0, 0, 0, {0}};
+
+        sim_enqueue(&end, rogue, sizeof(rogue), SIM_ROGUE_PORT);
+        net.queue[net.count - 1].at = 0;
+    }
+
+    // AUTH at time 0
+    arena_reset(&memory->client_flight);
+    message_id_increase(&client->lsb, &client->msb);
+    udp_encode_auth(&memory->client_flight, &buff, &length, &client->lsb, &client->msb, username, display_name, secret);
+    client->id_conf = (client->msb << 8) | client->lsb;
+    client->state = AUTH_SEND;
+    rel_send(&client->rel, buff, length, client->id_conf);
+
+    while (client->state != BYE_CONF && !client->gave_up)
+    {
+        // jump to the next event: a datagram arrives, a timer expires or the server sends
+        long long next = -1;
+        for (int i = 0; i < net.count; i++)
+            if (next == -1 || net.queue[i].at < next) next = net.queue[i].at;
+        int client_wait = rel_wait(&client->rel);
+        int server_wait = server.gave_up ? -1 : rel_wait(&server.rel);
+        if (client_wait != -1 && (next == -1 || net.now + client_wait < next)) next = net.now + client_wait;
+        if (server_wait != -1 && (next == -1 || net.now + server_wait < next)) next = net.now + server_wait;
+        if (sim_server_pending(&server) && (next == -1 || server.next_at < next)) next = server.next_at;
+
+        if (next == -1)
+        {
+            if (server.gave_up)
+            {
+                result = 2;
+                break;
+            }
+            snprintf(reason, size, "no progress in state %d", client->state);
+            return 0;
+        }
+        if (next > SIM_TIME_LIMIT)
+        {
+            snprintf(reason, size, "not finished after %d ms", SIM_TIME_LIMIT);
+            return 0;
+        }
+        if (next > net.now) net.now = next;
+
+        int i;
+        while ((i = sim_due(&net, -1)) != -1)
+        {
+            if (net.queue[i].to_client) sim_client_receive(client, memory);
+            else sim_server_receive(&server, memory);
+        }
+
+        if (rel_timeout(&client->rel) < 0) client->gave_up = 1;
+        if (!server.gave_up && rel_timeout(&server.rel) < 0)
+        {
+            server.gave_up = 1;
+            rel_reset(&server.rel);
+        }
+
+        sim_client_pump(client, memory);
+        sim_server_pump(&server, memory);
+    }
+
+    if (client->gave_up) result = 1;
+
+    // safety, checked in every session
+    for (int id = 0; id < (int) (sizeof(client->end.tx) / sizeof(client->end.tx[0])); id++)
+        if (client->end.tx[id] > (unsigned) (1 + client->rel.max_retx))
+            snprintf(reason, size, "message %d sent %u times", id, client->end.tx[id]);
+    for (int m = 0; m < SIM_MESSAGES; m++)
+        if (server.delivered[m] > 1)
+            snprintf(reason, size, "MSG c%d delivered %d times", m, server.delivered[m]);
+    for (int m = 0; m < SIM_SERVER_MESSAGES; m++)
+        if (client->shown[m] > 1 || (server.confirmed[m] && client->shown[m] != (m != server.corrupt)))
+            snprintf(reason, size, "MSG s%d shown %d times", m, client->shown[m]);
+    if (server.corrupt != -1 && server.confirmed[server.corrupt] && !client->rejected)
+        snprintf(reason, size, "malformed MSG s%d confirmed without ERR", server.corrupt);
+    if (client->rejected && server.corrupt == -1)
+        snprintf(reason, size, "ERR sent for a valid message");
+    if (server.out_of_order)
+        snprintf(reason, size, "%d MSG out of order", server.out_of_order);
+    if (server.misrouted)
+        snprintf(reason, size, "%d datagrams sent to the wrong port", server.misrouted);
+
+    // liveness and overhead, checked when the session completed, a clean session has to complete
+    if (clean && result != 0)
+        snprintf(reason, size, "%s gave up on a clean network", result == 1 ? "client" : "server");
+    if (client->state == BYE_CONF)
+    {
+        if (client->rejected && !server.err)
+            snprintf(reason, size, "completed without ERR delivered");
+        if (!client->rejected && (server.expected != SIM_MESSAGES || !server.bye))
+            snprintf(reason, size, "completed with %d of %d MSG delivered", server.expected, SIM_MESSAGES);
+        if (clean && client->rel.retransmits > 0)
+            snprintf(reason, size, "%lu retransmits on a clean network", client->rel.retransmits);
+    }
+    return result;
+}
+
+/**
+ * @brief Runs randomized sessions of the reliability layer against a simulated server
+ * in virtual time and prints the summary, session n uses the seed seed + n
+ *
+ * @param sessions number of sessions
+ * @param seed
+ * @param conf_timeout
+ * @param max_retx
+ * @return int 1 if a session broke a check, 0 otherwise
+ */
+int sim_run(unsigned long sessions, unsigned long long seed, int conf_timeout, int max_retx)
+{
+    static sim_client client;
+    sim_memory memory;
+    char reason[128];
+    unsigned long completed = 0, client_gave_up = 0, server_gave_up = 0, violations = 0;
+    unsigned long sent = 0, retransmits = 0;
+    double virtual_ms = 0;
+    long long start = rel_monotonic(NULL);
+
+    if (arena_init(&memory.client_flight, ARENA_FLIGHT_SIZE) || arena_init(&memory.server_flight, ARENA_FLIGHT_SIZE)
+        || arena_init(&memory.scratch, ARENA_FLIGHT_SIZE))
+        return 1;
+    memory.client_seen = create_list();
+    memory.server_seen = create_list();
+
+    for (unsigned long n = 0; n < sessions; n++)
+    {
+        int result = sim_session(&memory, seed + n, conf_timeout, max_retx, reason, sizeof(reason), &client);
+
+        if (reason[0] != '\0')
+        {
+            if (violations < SIM_REPORTED)
+                fprintf(stderr, "ERR: Session %lu (-S 1:%llu): %s!\n", n, seed + n, reason);
+            violations++;
+        }
+        else if (result == 1) client_gave_up++;
+        else if (result == 2) server_gave_up++;
+        else completed++;
+
+        sent += client.rel.sent;
+        retransmits += client.rel.retransmits;
+        virtual_ms += client.end.net->now;
+    }
+
+    double seconds = (rel_monotonic(NULL) - start) / 1000.0;
+    printf("Simulated %lu sessions (seed %llu) in %.3f s", sessions, seed, seconds);
+    if (seconds > 0) printf(", %.0f sessions/s", sessions / seconds);
+    printf(", %.1f s of virtual time\n", virtual_ms / 1000);
+    printf("Completed %lu, client gave up %lu, server gave up %lu, violations %lu\n", completed, client_gave_up, server_gave_up, violations);
+    printf("Client retransmits %lu for %lu messages (%.3f per message)\n", retransmits, sent, sent ? (double) retransmits / sent : 0);
+
+    arena_free(&memory.client_flight);
+    arena_free(&memory.server_flight);
+    arena_free(&memory.scratch);
+    free_list(memory.client_seen);
+    free_list(memory.server_seen);
+    return violations > 0;
+}
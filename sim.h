@@ -0,0 +1,61 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "udp_rel.h"
+
+#define SIM_SERVER_PORT 4567        // the port AUTH goes to
+#define SIM_DYNAMIC_PORT 50000      // the port the server answers from
+#define SIM_ROGUE_PORT 50001        // a short REPLY comes from here in some sessions
+#define SIM_CLIENT_PORT 40000
+#define SIM_QUEUE 256               // datagrams in the air, more are dropped like by a full buffer
+#define SIM_PACKET_SIZE 256         // the simulated messages are short
+#define SIM_MESSAGES 8              // MSG sent by the client in every session
+#define SIM_SERVER_MESSAGES 4       // MSG sent by the server in every session
+#define SIM_TIME_LIMIT 600000       // a session that is not over after 10 minutes of virtual time is stuck
+#define SIM_REPORTED 10             // at most this many violations are printed
+#define SIM_SCENARIO 0.1            // probability of each scenario in a session (see sim_session)
+
+// a datagram on its way
+typedef struct sim_packet
+{
+    long long at;                   // delivery time, ms
+    int to_client;
+    uint16_t port;                  // server port it was sent to or from
+    size_t length;
+    char data[SIM_PACKET_SIZE];
+} sim_packet;
+
+// the network between the client and the server, one per session
+typedef struct sim_net
+{
+    long long now;                  // virtual clock, ms
+    uint64_t rng;
+    double loss;                    // probability a datagram is lost
+    double dup;                     // probability a datagram arrives twice
+    double reorder;                 // probability a datagram is held back by up to conf_timeout
+    int delay_min;                  // one way delay, ms
+    int delay_max;
+    int conf_timeout;
+    sim_packet queue[SIM_QUEUE];
+    int count;
+} sim_net;
+
+// one side of the network, ctx of its ipk_transport
+typedef struct sim_end
+{
+    sim_net *net;
+    int client;
+    uint16_t arrived;               // server side: the port the last datagram was sent to
+    uint16_t connected;             // client side: the port the transport is connected to, 0 if none
+    unsigned tx[SIM_MESSAGES + 4];  // client: transmissions of each MessageID
+} sim_end;
+
+int sim_run(unsigned long sessions, unsigned long long seed, int conf_timeout, int max_retx);
+
+#endif
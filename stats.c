@@ -0,0 +1,180 @@
+#include "stats.h"
+
+#ifdef IPK_STATS
+#define STATS_STARTUP -1        // before the loop starts
+#define STATS_IDLE_PHASE -2     // waiting in poll, wakeups that handled no message
+#define STATS_PENDING -3        // after a wakeup, until the message is known
+
+static ipk_stats_cost stats_messages[2][256];   // [direction][message type]
+static ipk_stats_cost stats_startup;
+static ipk_stats_cost stats_waiting;
+static ipk_stats_cost stats_pending;
+static int stats_direction = STATS_TX;
+static int stats_phase = STATS_STARTUP;
+
+/**
+ * @brief Where the costs go now
+ *
+ * @return ipk_stats_cost*
+ */
+static ipk_stats_cost *stats_current()
+{
+    switch (stats_phase)
+    {
+        case STATS_STARTUP: return &stats_startup;
+        case STATS_IDLE_PHASE: return &stats_waiting;
+        case STATS_PENDING: return &stats_pending;
+        default: return &stats_messages[stats_direction][stats_phase];
+    }
+}
+
+/**
+ * @brief Adds one cost to another and clears the first one
+ *
+ * @param to
+ * @param from
+ */
+static void stats_move(ipk_stats_cost *to, ipk_stats_cost *from)
+{
+    to->allocs += from->allocs;
+    to->bytes += from->bytes;
+    to->mallocs += from->mallocs;
+    for (int i = 0; i < STATS_CALLS; i++) to->calls[i] += from->calls[i];
+    memset(from, 0, sizeof(*from));
+}
+
+/**
+ * @brief The table is printed when the client exits, whichever exit() it takes
+ *
+ */
+void stats_init()
+{
+    atexit(stats_report);
+}
+
+/**
+ * @brief The loop is about to wait, what the last wakeup did not give to a message stays idle
+ *
+ */
+void stats_idle()
+{
+    stats_move(&stats_waiting, &stats_pending);
+    stats_phase = STATS_IDLE_PHASE;
+}
+
+/**
+ * @brief poll returned, the next reads belong to the message they bring
+ *
+ */
+void stats_wake()
+{
+    stats_phase = STATS_PENDING;
+}
+
+/**
+ * @brief A message is built (an encoder) or decoded, the costs since the wakeup are its
+ *
+ * @param direction STATS_TX or STATS_RX
+ * @param type message type (IPK_AUTH, ...)
+ */
+void stats_message(int direction, int type)
+{
+    ipk_stats_cost *cost = &stats_messages[direction][type & 0xFF];
+
+    cost->entered++;
+    stats_move(cost, &stats_pending);
+    stats_direction = direction;
+    stats_phase = type & 0xFF;
+}
+
+/**
+ * @brief Counts a syscall in the current phase
+ *
+ * @param call
+ */
+void stats_call(enum StatsCall call)
+{
+    stats_current()->calls[call]++;
+}
+
+/**
+ * @brief Counts an allocation in the current phase
+ *
+ * @param size bytes
+ * @param heap 1 malloc, 0 arena, pool or FIFO node
+ */
+void stats_alloc(size_t size, int heap)
+{
+    ipk_stats_cost *cost = stats_current();
+
+    if (heap) cost->mallocs++;
+    else cost->allocs++;
+    cost->bytes += size;
+}
+
+#define STATS_NAME(NAME, name, code, keyword) case code: return keyword;
+
+/**
+ * @brief Name of a message type
+ *
+ * @param type
+ * @return const char* NULL for an unknown type
+ */
+static const char *stats_name(int type)
+{
+    switch (type)
+    {
+        IPK_MESSAGES(STATS_NAME)
+        default: return NULL;
+    }
+}
+
+/**
+ * @brief One row of the table, the cost is added to the total
+ *
+ * @param name
+ * @param cost
+ * @param total NULL for the total row itself
+ */
+static void stats_row(const char *name, ipk_stats_cost *cost, ipk_stats_cost *total)
+{
+    if (cost->entered > 0) fprintf(stderr, "%-12s %6lu", name, cost->entered);
+    else fprintf(stderr, "%-12s %6s", name, "-");
+    fprintf(stderr, " %7lu %9lu %7lu", cost->allocs, cost->bytes, cost->mallocs);
+    for (int i = 0; i < STATS_CALLS; i++) fprintf(stderr, " %6lu", cost->calls[i]);
+    fprintf(stderr, "\n");
+
+    if (total == NULL) return;
+    total->entered += cost->entered;
+    stats_move(total, cost);
+}
+
+/**
+ * @brief Prints the cost of every phase that had any, per message type and direction
+ *
+ */
+void stats_report()
+{
+    ipk_stats_cost total = {0};
+    char name[32];
+
+    stats_idle();
+    fprintf(stderr, "%-12s %6s %7s %9s %7s %6s %6s %6s %6s %6s\n", "Phase", "Msgs", "Allocs", "Bytes", "Malloc", "poll", "recv", "send", "write", "read");
+    stats_row("startup", &stats_startup, &total);
+    stats_row("idle", &stats_waiting, &total);
+
+    for (int direction = STATS_TX; direction <= STATS_RX; direction++)
+    {
+        for (int type = 0; type < 256; type++)
+        {
+            ipk_stats_cost *cost = &stats_messages[direction][type];
+            if (cost->entered == 0) continue;
+
+            if (stats_name(type) != NULL) snprintf(name, sizeof(name), "%s %s", direction == STATS_TX ? "TX" : "RX", stats_name(type));
+            else snprintf(name, sizeof(name), "%s 0x%02X", direction == STATS_TX ? "TX" : "RX", type);
+            stats_row(name, cost, &total);
+        }
+    }
+    stats_row("total", &total, NULL);
+}
+#endif
@@ -0,0 +1,63 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ipk_schema.h"
+
+#define STATS_TX 0              // message built by the client
+#define STATS_RX 1              // message decoded by the client
+
+// counted syscalls
+enum StatsCall
+{
+    STATS_POLL = 0,
+    STATS_RECV,
+    STATS_SEND,
+    STATS_WRITE,                // console output (a flush of stdout, a line on stderr)
+    STATS_READ,                 // console input
+    STATS_CALLS
+};
+
+// what one phase cost
+typedef struct ipk_stats_cost
+{
+    unsigned long entered;      // messages of the phase
+    unsigned long allocs;       // arena, pool and FIFO node allocations
+    unsigned long bytes;
+    unsigned long mallocs;      // heap allocations
+    unsigned long calls[STATS_CALLS];
+} ipk_stats_cost;
+
+void stats_init();
+void stats_idle();
+void stats_wake();
+void stats_message(int direction, int type);
+void stats_call(enum StatsCall call);
+void stats_alloc(size_t size, int heap);
+void stats_report();
+
+/*
+ * Instrumentation build (make STATS=1). The macros are at the allocation and syscall sites,
+ * in the normal build they are nothing (STATS_CALL is just the call).
+ */
+#ifdef IPK_STATS
+#define STATS_INIT() stats_init()
+#define STATS_IDLE() stats_idle()
+#define STATS_WAKE() stats_wake()
+#define STATS_MESSAGE(direction, type) stats_message(direction, type)
+#define STATS_CALL(call, expr) (stats_call(call), (expr))
+#define STATS_ALLOC(size) stats_alloc(size, 0)
+#define STATS_MALLOC(size) stats_alloc(size, 1)
+#else
+#define STATS_INIT() ((void) 0)
+#define STATS_IDLE() ((void) 0)
+#define STATS_WAKE() ((void) 0)
+#define STATS_MESSAGE(direction, type) ((void) 0)
+#define STATS_CALL(call, expr) (expr)
+#define STATS_ALLOC(size) ((void) 0)
+#define STATS_MALLOC(size) ((void) 0)
+#endif
+
+#endif
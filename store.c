@@ -0,0 +1,425 @@
+#include "store.h"
+
+/**
+ * @brief Wall clock time
+ *
+ * @return int64_t milliseconds since the epoch
+ */
+static int64_t store_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief FNV-1a of the sender, picks its bucket
+ *
+ * @param sender
+ * @param length
+ * @return uint32_t bucket
+ */
+static uint32_t store_bucket(const char *sender, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t) sender[i];
+        hash *= 16777619u;
+    }
+    return hash % STORE_BUCKETS;
+}
+
+static ipk_store_head *store_head(ipk_store_map *map)
+{
+    return (ipk_store_head *) map->base;
+}
+
+static ipk_store_entry *store_entry(ipk_store *store, uint32_t i)
+{
+    return (ipk_store_entry *) (store->index.base + sizeof(ipk_store_head)) + i;
+}
+
+static ipk_store_record *store_record(ipk_store *store, ipk_store_entry *entry)
+{
+    return (ipk_store_record *) (store->log.base + entry->offset);
+}
+
+/**
+ * @brief Opens or creates one of the files and maps it
+ *
+ * @param map
+ * @param path
+ * @return int 1 if the file can not be used, 0 otherwise
+ */
+static int store_map(ipk_store_map *map, const char *path)
+{
+    struct stat st;
+
+    map->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (map->fd == -1 || fstat(map->fd, &st) == -1)
+    {
+        fprintf(stderr, "ERR: Can not open %s!\n", path);
+        return 1;
+    }
+
+    int created = st.st_size == 0;
+    map->size = created ? STORE_GROW : (size_t) st.st_size;
+    if ((created && ftruncate(map->fd, map->size) == -1) || map->size < sizeof(ipk_store_head))
+    {
+        fprintf(stderr, "ERR: Can not use %s!\n", path);
+        return 1;
+    }
+
+    map->base = (char *) mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+    if (map->base == MAP_FAILED)
+    {
+        fprintf(stderr, "ERR: Can not map %s!\n", path);
+        map->base = NULL;
+        return 1;
+    }
+
+    ipk_store_head *head = store_head(map);
+    if (created)
+    {
+        head->magic = STORE_MAGIC;
+        head->version = STORE_VERSION;
+        head->used = 0;
+    }
+    if (head->magic != STORE_MAGIC || head->version != STORE_VERSION)
+    {
+        fprintf(stderr, "ERR: %s is not a history file!\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Makes the file bigger when the next append might not fit
+ *
+ * @param map
+ * @param end bytes that must fit
+ * @return int 1 if the file can not grow, 0 otherwise
+ */
+static int store_grow(ipk_store_map *map, size_t end)
+{
+    if (end <= map->size) return 0;
+
+    size_t size = (end + STORE_GROW - 1) / STORE_GROW * STORE_GROW;
+    if (ftruncate(map->fd, size) == -1) return 1;
+
+    char *base = (char *) mremap(map->base, map->size, size, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED) return 1;
+    map->base = base;
+    map->size = size;
+    return 0;
+}
+
+/**
+ * @brief Whether an entry of an opened file can be followed, its record lies in the used part
+ * of the log with all three fields zero terminated and its sender chain only goes back
+ *
+ * @param store
+ * @param i index of the entry
+ * @param used bytes of the log in use
+ * @return int 1 if it can, 0 otherwise
+ */
+static int store_valid(ipk_store *store, uint32_t i, uint64_t used)
+{
+    ipk_store_entry *entry = store_entry(store, i);
+
+    if (entry->offset < sizeof(ipk_store_head) || entry->offset + sizeof(ipk_store_record) > used || entry->prev > i) return 0;
+
+    ipk_store_record *record = store_record(store, entry);
+    const char *channel = (const char *) (record + 1);
+    size_t end = entry->offset + sizeof(ipk_store_record) + record->channel_len + record->sender_len + record->content_len + 3;
+    if (end > used) return 0;
+
+    const char *sender = channel + record->channel_len + 1;
+    const char *content = sender + record->sender_len + 1;
+    return sender[-1] == '\0' && content[-1] == '\0' && content[record->content_len] == '\0';
+}
+
+/**
+ * @brief Maps the log and its index, the sender chains are found by one pass over the index.
+ * Entries whose record did not reach the log (the client was killed in between) are dropped,
+ * so is everything from the first entry that can not be followed (store_valid).
+ *
+ * @param store
+ * @param path the log, the index is path.idx
+ * @return int 1 if the files can not be used, 0 otherwise
+ */
+int store_open(ipk_store *store, const char *path)
+{
+    char index_path[PATH_MAX];
+
+    memset(store, 0, sizeof(*store));
+    store->log.fd = store->index.fd = -1;
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+
+    if (store_map(&store->log, path) || store_map(&store->index, index_path)) return 1;
+
+    ipk_store_head *log = store_head(&store->log);
+    ipk_store_head *index = store_head(&store->index);
+    if (log->used == 0) log->used = sizeof(ipk_store_head);
+    if (log->used > store->log.size || sizeof(ipk_store_head) + index->used * sizeof(ipk_store_entry) > store->index.size)
+    {
+        fprintf(stderr, "ERR: %s is damaged!\n", path);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < index->used; i++)
+    {
+        ipk_store_entry *entry = store_entry(store, i);
+        if (!store_valid(store, i, log->used))
+        {
+            index->used = i;
+            break;
+        }
+        ipk_store_record *record = store_record(store, entry);
+        const char *sender = (const char *) (record + 1) + record->channel_len + 1;
+        store->last[store_bucket(sender, record->sender_len)] = i + 1;
+        if (entry->time > store->newest) store->newest = entry->time;
+    }
+
+    // the first localtime_r reads the time zone, it happens here and not in the loop
+    tzset();
+    store->enabled = 1;
+    return 0;
+}
+
+/**
+ * @brief Called before poll, the appends of the next loop iteration fit without growing the files
+ *
+ * @param store
+ * @param count messages one iteration may store at most
+ */
+void store_reserve(ipk_store *store, size_t count)
+{
+    if (!store->enabled) return;
+
+    if (store->dropped > 0)
+    {
+        fprintf(stderr, "ERR: %lu messages did not fit into the history!\n", store->dropped);
+        store->dropped = 0;
+    }
+
+    size_t log_end = store_head(&store->log)->used + count * STORE_RECORD_MAX;
+    size_t index_end = sizeof(ipk_store_head) + (store_head(&store->index)->used + count) * sizeof(ipk_store_entry);
+    if (store_grow(&store->log, log_end) || store_grow(&store->index, index_end))
+    {
+        fprintf(stderr, "ERR: History file can not grow, history is off!\n");
+        store->enabled = 0;
+    }
+}
+
+/**
+ * @brief Appends a message, only copies into the mapped files (store_reserve made the room),
+ * a message that does not fit is counted and left out, the files never grow here.
+ * The record goes first, the entry counts only when the index head is updated.
+ *
+ * @param store
+ * @param direction STORE_TX or STORE_RX
+ * @param sender DisplayName
+ * @param content MessageContent, need not be zero terminated
+ * @param content_len
+ */
+void store_add(ipk_store *store, int direction, const char *sender, const char *content, size_t content_len)
+{
+    if (!store->enabled) return;
+
+    ipk_store_head *log = store_head(&store->log);
+    ipk_store_head *index = store_head(&store->index);
+    if (log->used + STORE_RECORD_MAX > store->log.size ||
+        sizeof(ipk_store_head) + (index->used + 1) * sizeof(ipk_store_entry) > store->index.size)
+    {
+        store->dropped++;
+        return;
+    }
+    size_t channel_len = strnlen(store->channel, SCAN_ID_MAX);
+    size_t sender_len = strnlen(sender, SCAN_DNAME_MAX);
+    uint32_t bucket = store_bucket(sender, sender_len);
+
+    if (content_len > SCAN_CONTENT_MAX) content_len = SCAN_CONTENT_MAX;
+
+    ipk_store_record *record = (ipk_store_record *) (store->log.base + log->used);
+    record->content_len = (uint16_t) content_len;
+    record->channel_len = (uint8_t) channel_len;
+    record->sender_len = (uint8_t) sender_len;
+    record->direction = (uint8_t) direction;
+
+    char *p = (char *) (record + 1);
+    memcpy(p, store->channel, channel_len);
+    p[channel_len] = '\0';
+    p += channel_len + 1;
+    memcpy(p, sender, sender_len);
+    p[sender_len] = '\0';
+    p += sender_len + 1;
+    memcpy(p, content, content_len);
+    p[content_len] = '\0';
+    p += content_len + 1;
+
+    // the wall clock may step back, the time index stays sorted for store_find
+    int64_t now = store_now();
+    if (now < store->newest) now = store->newest;
+    store->newest = now;
+
+    ipk_store_entry *entry = store_entry(store, index->used);
+    entry->time = now;
+    entry->offset = (uint32_t) log->used;
+    entry->prev = store->last[bucket];
+
+    log->used = ((size_t) (p - store->log.base) + 7) & ~(size_t) 7;
+    store->last[bucket] = (uint32_t) ++index->used;
+}
+
+/**
+ * @brief A JOIN was sent, the channel changes when it succeeds
+ *
+ * @param store
+ * @param channel ChannelID
+ */
+void store_join(ipk_store *store, const char *channel)
+{
+    snprintf(store->joining, sizeof(store->joining), "%s", channel);
+}
+
+/**
+ * @brief The JOIN succeeded, the next messages are in its channel
+ *
+ * @param store
+ */
+void store_joined(ipk_store *store)
+{
+    memcpy(store->channel, store->joining, sizeof(store->channel));
+}
+
+/**
+ * @brief Reads the since parameter of /history, a number with s, m, h or d
+ *
+ * @param arg
+ * @param since set to the oldest time asked for, ms since the epoch
+ * @return int 1 if arg is a duration, 0 otherwise
+ */
+static int store_since(const char *arg, int64_t *since)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+    int64_t unit;
+
+    if (end == arg || value < 0 || end[0] == '\0' || end[1] != '\0') return 0;
+    switch (end[0])
+    {
+        case 's': unit = 1000; break;
+        case 'm': unit = 60 * 1000; break;
+        case 'h': unit = 60 * 60 * 1000; break;
+        case 'd': unit = 24 * 60 * 60 * 1000; break;
+        default: return 0;
+    }
+    *since = store_now() - value * unit;
+    return 1;
+}
+
+/**
+ * @brief First entry not older than since, the entries are appended in time order
+ *
+ * @param store
+ * @param since ms since the epoch
+ * @return uint32_t index of the entry, the number of entries if all are older
+ */
+static uint32_t store_find(ipk_store *store, int64_t since)
+{
+    uint32_t low = 0;
+    uint32_t high = (uint32_t) store_head(&store->index)->used;
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (store_entry(store, mid)->time < since) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+/**
+ * @brief Prints one stored message
+ *
+ * @param store
+ * @param entry
+ */
+static void store_print(ipk_store *store, ipk_store_entry *entry)
+{
+    ipk_store_record *record = store_record(store, entry);
+    const char *channel = (const char *) (record + 1);
+    const char *sender = channel + record->channel_len + 1;
+    const char *content = sender + record->sender_len + 1;
+    time_t seconds = (time_t) (entry->time / 1000);
+    struct tm tm;
+    char stamp[32];
+
+    localtime_r(&seconds, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    if (record->channel_len > 0) fprintf(stdout, "[%s] #%s %s: %s\n", stamp, channel, sender, content);
+    else fprintf(stdout, "[%s] %s: %s\n", stamp, sender, content);
+}
+
+/**
+ * @brief /history [sender] [since], prints the newest STORE_SHOW matching messages, oldest first.
+ * Without a sender the time index is searched, with one its chain is followed back until since.
+ * A single parameter that is a duration (10m) is since, otherwise it is the sender.
+ *
+ * @param store
+ * @param input the console line, split by strtok
+ */
+void store_command(ipk_store *store, char *input)
+{
+    uint32_t picked[STORE_SHOW];
+    int count = 0;
+    int64_t since = 0;
+
+    if (!store->enabled)
+    {
+        fprintf(stderr, "ERR: History is off, use -H!\n");
+        return;
+    }
+
+    strtok(input, " ");
+    char *sender = strtok(NULL, " ");
+    char *duration = strtok(NULL, " ");
+    if (strtok(NULL, " ") != NULL)
+    {
+        fprintf(stderr, "ERR: Parameter's number does not match!\n");
+        return;
+    }
+    if (sender != NULL && duration == NULL && store_since(sender, &since)) sender = NULL;
+    else if (duration != NULL && !store_since(duration, &since))
+    {
+        fprintf(stderr, "ERR: Since must be a number with s, m, h or d!\n");
+        return;
+    }
+
+    if (sender == NULL)
+    {
+        uint32_t first = store_find(store, since);
+        for (uint32_t i = (uint32_t) store_head(&store->index)->used; i > first && count < STORE_SHOW; i--)
+            picked[count++] = i - 1;
+    }
+    else
+    {
+        size_t sender_len = strlen(sender);
+        for (uint32_t i = store->last[store_bucket(sender, sender_len)]; i != 0 && count < STORE_SHOW; )
+        {
+            ipk_store_entry *entry = store_entry(store, i - 1);
+            if (entry->time < since) break;
+
+            ipk_store_record *record = store_record(store, entry);
+            const char *name = (const char *) (record + 1) + record->channel_len + 1;
+            if (record->sender_len == sender_len && !memcmp(name, sender, sender_len)) picked[count++] = i - 1;
+            i = entry->prev;
+        }
+    }
+
+    if (count == 0) fprintf(stderr, "History: no messages\n");
+    while (count > 0) store_print(store, store_entry(store, picked[--count]));
+    fflush(stdout);
+}
@@ -0,0 +1,80 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "scan.h"
+
+#define STORE_MAGIC 0x484B5049      // "IPKH"
+#define STORE_VERSION 1
+#define STORE_GROW (1 << 20)        // the files grow by 1 MiB, before poll, never while a message is handled
+#define STORE_BUCKETS 256           // sender index, one chain of entries per bucket of the sender hash
+#define STORE_SHOW 20               // /history prints at most the 20 newest matches
+#define STORE_TX 0                  // sent by the client
+#define STORE_RX 1                  // received from the server
+
+// first bytes of both files
+typedef struct ipk_store_head
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t used;                  // log: bytes including the head, index: entries
+} ipk_store_head;
+
+// index entry, fixed size, the entries are in time order so the time index is a binary search
+typedef struct ipk_store_entry
+{
+    int64_t time;                   // ms since the epoch
+    uint32_t offset;                // record in the log
+    uint32_t prev;                  // older entry of the same sender bucket, +1, 0 if there is none
+} ipk_store_entry;
+
+// log record, followed by the zero terminated channel, sender and content, 8 byte aligned
+typedef struct ipk_store_record
+{
+    uint16_t content_len;
+    uint8_t channel_len;
+    uint8_t sender_len;
+    uint8_t direction;              // STORE_TX or STORE_RX
+    uint8_t pad[3];
+} ipk_store_record;
+
+#define STORE_RECORD_MAX ((sizeof(ipk_store_record) + SCAN_ID_MAX + SCAN_DNAME_MAX + SCAN_CONTENT_MAX + 3 + 7) & ~(size_t) 7)
+
+// one memory mapped file
+typedef struct ipk_store_map
+{
+    int fd;
+    char *base;
+    size_t size;
+} ipk_store_map;
+
+// -H, append only log of the sent and received messages with a time and sender index
+typedef struct ipk_store
+{
+    int enabled;
+    ipk_store_map log;              // path, the records
+    ipk_store_map index;            // path.idx, the entries
+    uint32_t last[STORE_BUCKETS];   // newest entry of every bucket, +1, 0 if there is none
+    char channel[SCAN_ID_MAX + 1];  // the channel the client is in, empty before the first JOIN
+    char joining[SCAN_ID_MAX + 1];  // JOIN waiting for its REPLY
+    int64_t newest;                 // time of the newest entry, ms since the epoch
+    unsigned long dropped;          // messages that did not fit into the reserved room, reported by store_reserve
+} ipk_store;
+
+int store_open(ipk_store *store, const char *path);
+void store_reserve(ipk_store *store, size_t count);
+void store_add(ipk_store *store, int direction, const char *sender, const char *content, size_t content_len);
+void store_join(ipk_store *store, const char *channel);
+void store_joined(ipk_store *store);
+void store_command(ipk_store *store, char *input);
+
+#endif
@@ -1,231 +1,267 @@
 #include "tcp.h"
 
 /**
- * @brief Builds an AUTH message and stores it in the buff variable
+ * @brief Appends " keyword value" to the message, the value is checked first
  *
- * @param buff final message
- * @param username the login name
- * @param display_name the name to be represented by
- * @param secret secret password/key
- * @return int 1 if an allocation error occurred, 0 otherwise
+ * @param p end of the message
+ * @param keyword word in front of the value, "" if there is none
+ * @param value the parameter
+ * @param cls what the parameter is
+ * @return char* new end of the message, NULL if the value is not allowed
  */
-int content_auth(char **buff, char *username, char *display_name, char *secret)
+static char *tcp_put_word(char *p, const char *keyword, const char *value, enum ScanClass cls)
 {
-    size_t length = strlen(username) + strlen(display_name) + strlen(secret) + 19;
-    *buff = (char *) malloc(length);
+    size_t length;
 
-    if (*buff == NULL)
+    if (value == NULL || !scan_valid(value, length = strlen(value), cls)) return NULL;
+
+    *p++ = ' ';
+    if (*keyword)
     {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
+        size_t keyword_length = strlen(keyword);
+        memcpy(p, keyword, keyword_length);
+        p += keyword_length;
+        *p++ = ' ';
     }
-
-    snprintf(*buff, length, "AUTH %s AS %s USING %s\r\n", username, display_name, secret);
-    return 0;
+    memcpy(p, value, length);
+    return p + length;
 }
 
 /**
- * @brief Builds a JOIN message and stores it in the buff variable
+ * @brief Appends " OK" or " NOK"
  *
- * @param buff final message
- * @param display_name the name to be represented by
- * @param channel_id the new channel
- * @return int 1 if an allocation error occurred, 0 otherwise
+ * @param p end of the message
+ * @param result 1 OK, 0 NOK
+ * @return char* new end of the message
  */
-int content_join(char **buff, char *display_name, char *channel_id)
+static char *tcp_put_result(char *p, int result)
 {
-    size_t length = strlen(display_name) + strlen(channel_id) + 12;
-    *buff = (char *) malloc(length);
+    const char *word = result ? " OK" : " NOK";
+    size_t length = strlen(word);
 
-    if (*buff == NULL)
-    {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
+    memcpy(p, word, length);
+    return p + length;
+}
+
+#define TCP_PUT_WORD(p, keyword, field, cls) tcp_put_word(p, keyword, field, cls)
+#define TCP_PUT_TEXT(p, keyword, field, cls) tcp_put_word(p, keyword, field, cls)
+#define TCP_PUT_RESULT(p, keyword, field, cls) tcp_put_result(p, field)
+#define TCP_PUT_REF(p, keyword, field, cls) ((void) field, p)
+#define TCP_PUT_FIELD(NAME, field, keyword, kind, cls) \
+    if ((p = TCP_PUT_##kind(p, keyword, field, cls)) == NULL) \
+    { \
+        fprintf(stderr, "ERR: Invalid " #field " in " #NAME "!\n"); \
+        return 1; \
     }
 
-    snprintf(*buff, length, "JOIN %s AS %s\r\n", channel_id, display_name);
-    return 0;
+/*
+ * Builds the message and stores it in the buff variable, the buffer has the maximum
+ * size of the message (IPK_TEXT_MAX_*), so no length is computed beforehand.
+ * Returns 1 if the arena is full or a parameter is not allowed, 0 otherwise.
+ */
+#define TCP_ENCODER_BODY(NAME, name, code, keyword) \
+int tcp_encode_##name(ipk_arena *arena, char **buff IPK_FIELDS_##NAME(IPK_PARAM)) \
+{ \
+    STATS_MESSAGE(STATS_TX, code); \
+    char *p = *buff = (char *) arena_alloc(arena, IPK_TEXT_MAX_##NAME); \
+    if (p == NULL) \
+    { \
+        fprintf(stderr, "ERR: Memory allocation failed!\n"); \
+        return 1; \
+    } \
+    STATS_ALLOC(IPK_TEXT_MAX_##NAME); \
+    memcpy(p, keyword, sizeof(keyword) - 1); \
+    p += sizeof(keyword) - 1; \
+    IPK_FIELDS_##NAME(TCP_PUT_FIELD) \
+    memcpy(p, "\r\n", 3); \
+    return 0; \
 }
+IPK_TEXT_MESSAGES(TCP_ENCODER_BODY)
 
 /**
- * @brief Builds an MSG message and stores it in the buff variable
+ * @brief Cuts the next word (up to a space) out of the message, the delimiter
+ * and the characters are checked in one pass
  *
- * @param buff final message
- * @param display_name the name to be represented by
- * @param message the message specified by the user
- * @return int 1 if an allocation error occurred, 0 otherwise
+ * @param cursor current position in the message, moved behind the word
+ * @param end end of the message
+ * @param cls what the word is, SCAN_ANY for keywords
+ * @param length set to the length of the word
+ * @return char* the word, NULL if it is missing or invalid
  */
-int content_message(char **buff, char *display_name, char *message)
+static char *tcp_word(char **cursor, char *end, enum ScanClass cls, size_t *length)
 {
-    size_t length = strlen(display_name) + strlen(message) + 16;
-    *buff = (char *) malloc(length);
+    char *word = *cursor;
+    int valid;
+
+    if (word >= end) return NULL;
 
-    if (*buff == NULL)
+    *length = scan_field(word, end - word, ' ', cls, &valid);
+    if (!valid || *length == 0 || *length > scan_max(cls)) return NULL;
+
+    if (word + *length == end) *cursor = end;
+    else
     {
-        fprintf(stderr, "ERROR: Memory allocation failed!\n");
-        return 1;
+        // a space at the very end is not followed by anything
+        if (word + *length + 1 == end) return NULL;
+        *cursor = word + *length + 1;
     }
-
-    snprintf(*buff, length, "MSG FROM %s IS %s\r\n", display_name, message);
-    return 0;
+    word[*length] = '\0';
+    return word;
 }
 
 /**
- * @brief Sestaví BYE zprávy a uloží jí do proměnné buff
- * 
- * @param buff finální zpráva
- * @return int 1 pokud nastala chyba při alokaci, 0 jinak
+ * @brief Reads the keyword in front of a field
+ *
+ * @param cursor current position in the message
+ * @param end end of the message
+ * @param keyword the expected word (case insensitive), "" if there is none
+ * @return int 1 if it is missing, 0 otherwise
  */
-int content_bye(char **buff)
+static int tcp_keyword(char **cursor, char *end, const char *keyword)
 {
-    *buff = (char *) malloc(6);
+    size_t length;
 
-    if (*buff == NULL)
-    {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
-    }
+    if (*keyword == '\0') return 0;
 
-    snprintf(*buff, 6, "BYE\r\n");
-    return 0;
+    char *word = tcp_word(cursor, end, SCAN_ANY, &length);
+    return word == NULL || strcasecmp(word, keyword) != 0;
 }
 
 /**
- * @brief Builds the ERR message and stores it in the buff variable
+ * @brief Reads " keyword value"
  *
- * @param buff final message
- * @param display_name the name to be represented by
- * @param message the error message
- * @return int 1 if an allocation error occurred, 0 otherwise
+ * @param cursor current position in the message
+ * @param end end of the message
+ * @param keyword word in front of the value
+ * @param cls what the value is
+ * @param field set to the value
+ * @param field_len set to the length of the value
+ * @return int 1 if the field is malformed, 0 otherwise
  */
-int content_err(char **buff, char *display_name, char *message)
+static int tcp_get_word(char **cursor, char *end, const char *keyword, enum ScanClass cls, char **field, size_t *field_len)
 {
-    size_t length = strlen(display_name) + strlen(message) + 16;
-    *buff = (char *) malloc(length);
+    if (tcp_keyword(cursor, end, keyword)) return 1;
 
-    if (*buff == NULL)
-    {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
-    }
-
-    snprintf(*buff, length, "ERR FROM %s IS %s\r\n", display_name, message);
-    return 0;
+    *field = tcp_word(cursor, end, cls, field_len);
+    return *field == NULL;
 }
 
 /**
- * @brief Checks if the MSG message from the server is in the correct format
+ * @brief Reads " keyword MessageContent", the content is the rest of the message
  *
- * @param reply message from the server
- * @param display_name message author
- * @param message the message
- * @return int 1 if the shape is wrong, 0 otherwise
+ * @param cursor current position in the message
+ * @param end end of the message
+ * @param keyword word in front of the content
+ * @param cls SCAN_CONTENT
+ * @param field set to the content
+ * @param field_len set to the length of the content
+ * @return int 1 if the field is malformed, 0 otherwise
  */
-int tcp_check_msg(char *reply, char **display_name, char **message)
+static int tcp_get_text(char **cursor, char *end, const char *keyword, enum ScanClass cls, char **field, size_t *field_len)
 {
-    char *token;
-
-    token = strtok(reply, " ");
-    if (token == NULL || strcasecmp(token, "MSG") != 0) return 1;
+    if (tcp_keyword(cursor, end, keyword)) return 1;
 
-    token = strtok(NULL, " ");
-    if (token == NULL || strcasecmp(token, "FROM") != 0) return 1;
+    *field = *cursor;
+    *field_len = end - *cursor;
+    if (!scan_valid(*field, *field_len, cls)) return 1;
 
-    token = strtok(NULL, " ");
-    if (token == NULL) return 1;
-
-    *display_name = strdup(token);
-
-    token = strtok(NULL, " ");
-    if (token == NULL || strcasecmp(token, "IS") != 0) return 1;
-
-    token = strtok(NULL, "\r\n");
-    if (token == NULL) return 1;
-
-    *message = strdup(token);
-    
+    *end = '\0';
+    *cursor = end;
     return 0;
 }
 
 /**
- * @brief Checks whether the REPLY message from the server is in the correct form
+ * @brief Reads OK|NOK
  *
- * @param reply message from the server
- * @param res_succ result (OK|NOK)
- * @param message the message
- * @return int 1 if the shape is wrong, 0 otherwise
+ * @param cursor current position in the message
+ * @param end end of the message
+ * @param result set to 1 for OK, 0 for NOK
+ * @return int 1 if the field is malformed, 0 otherwise
  */
-int tcp_check_reply(char *reply, char **res_succ, char **message)
+static int tcp_get_result(char **cursor, char *end, uint8_t *result)
 {
-    char *token;
-
-    token = strtok(reply, " ");
-    if (token == NULL || strcasecmp(token, "REPLY") != 0) return 1;
-
-    token = strtok(NULL, " ");
-    if (token == NULL || (strcasecmp(token, "OK") != 0 && strcasecmp(token, "NOK") != 0)) return 1;
-    
-    *res_succ = strdup(token);
+    size_t length;
+    char *word = tcp_word(cursor, end, SCAN_ANY, &length);
 
-    token = strtok(NULL, " ");
-    if (token == NULL || strcasecmp(token, "IS") != 0) return 1;
-
-    token = strtok(NULL, "\r\n");
-    if (token == NULL) return 1;
-
-    *message = strdup(token);
+    if (word == NULL) return 1;
+    if (!strcasecmp(word, "OK")) *result = 1;
+    else if (!strcasecmp(word, "NOK")) *result = 0;
+    else return 1;
     return 0;
 }
 
+#define TCP_GET_WORD(field, keyword, cls) tcp_get_word(&cursor, end, keyword, cls, &view->field, &view->field##_len)
+#define TCP_GET_TEXT(field, keyword, cls) tcp_get_text(&cursor, end, keyword, cls, &view->field, &view->field##_len)
+#define TCP_GET_RESULT(field, keyword, cls) tcp_get_result(&cursor, end, &view->field)
+#define TCP_GET_REF(field, keyword, cls) 0
+#define TCP_GET_FIELD(NAME, field, keyword, kind, cls) \
+    if (TCP_GET_##kind(field, keyword, cls)) return 1;
+#define TCP_DECODE_CASE(NAME, name, code, keyword) \
+    if (!strcasecmp(word, keyword)) \
+    { \
+        view->type = code; \
+        STATS_MESSAGE(STATS_RX, code); \
+        IPK_FIELDS_##NAME(TCP_GET_FIELD) \
+        return cursor != end; \
+    }
+
 /**
- * @brief Checks if the ERR message from the server is in the correct form
+ * @brief Decodes one message from the server (without "\r\n"). The message is cut in place,
+ * the parameters of the view point into it.
  *
- * @param reply message from the server
- * @param display_name message author
- * @param message the error message
- * @return int 1 if the shape is wrong, 0 otherwise
+ * @param line the message, the byte at line[len] is overwritten with the zero of the last parameter
+ * @param len length of the message
+ * @param view the decoded message
+ * @return int 1 if the message is malformed or unknown, 0 otherwise
  */
-int tcp_check_err(char *reply, char **display_name, char **message)
+int tcp_decode(char *line, size_t len, ipk_view *view)
 {
-    char *token;
-
-    token = strtok(reply, " ");
-    if (token == NULL || strcasecmp(token, "ERR") != 0) return 1;
+    char *cursor = line;
+    char *end = line + len;
+    size_t length;
 
-    token = strtok(NULL, " ");
-    if (token == NULL || strcasecmp(token, "FROM") != 0) return 1;
+    memset(view, 0, sizeof(*view));
 
-    token = strtok(NULL, " ");
-    if (token == NULL) return 1;
+    char *word = tcp_word(&cursor, end, SCAN_ANY, &length);
+    if (word == NULL) return 1;
 
-    *display_name = token;
-
-    token = strtok(NULL, " ");
-    if (token == NULL || strcasecmp(token, "IS") != 0) return 1;
-
-    token = strtok(NULL, "\r\n");
-    if (token == NULL) return 1;
-
-    *message = token;
-
-    return 0;
+    IPK_TEXT_MESSAGES(TCP_DECODE_CASE)
+    return 1;
 }
 
 /**
- * @brief Checks whether the BYE message from the server is in the correct form
+ * @brief MSG without building it: the cached "MSG FROM <DisplayName> IS ", the tag of a chunk,
+ * the content where it already is and "\r\n", sent together by sendmsg. The prefix is built
+ * when its length is 0. The content was checked by check_message.
  *
- * @param reply message from the server
- * @return int 1 if the shape is wrong, 0 otherwise
+ * @param prefix per session cache
+ * @param display_name
+ * @param tag "[i/n] " or ""
+ * @param tag_len
+ * @param content not zero terminated
+ * @param length
+ * @param iov at least 4
+ * @return int number of iovecs, 0 if the display name is not allowed
  */
-int tcp_check_bye(char *reply)
+int tcp_frame_msg(ipk_prefix *prefix, const char *display_name, const char *tag, size_t tag_len, const char *content, size_t length, struct iovec *iov)
 {
-    char *token;
+    static char crlf[] = "\r\n";
+    int count = 0;
 
-    token = strtok(reply, "\r\n");
-    if (token == NULL || strcasecmp(token, "BYE") != 0) return 1;
-
-    token = strtok(NULL, "\r\n");
-    if (token != NULL && strlen(token) > 0) return 1;
+    STATS_MESSAGE(STATS_TX, IPK_MSG);
+    if (prefix->length == 0)
+    {
+        if (display_name == NULL || !scan_valid(display_name, strlen(display_name), SCAN_DNAME))
+        {
+            fprintf(stderr, "ERR: Invalid display_name in MSG!\n");
+            return 0;
+        }
+        prefix->length = snprintf(prefix->buff, sizeof(prefix->buff), "MSG FROM %s IS ", display_name);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    iov[count++] = (struct iovec) {.iov_base = prefix->buff, .iov_len = prefix->length};
+    if (tag_len > 0) iov[count++] = (struct iovec) {.iov_base = (char *) tag, .iov_len = tag_len};
+    iov[count++] = (struct iovec) {.iov_base = (char *) content, .iov_len = length};
+    iov[count++] = (struct iovec) {.iov_base = crlf, .iov_len = 2};
+    return count;
+}
@@ -1,13 +1,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/uio.h>
+#include "scan.h"
+#include "arena.h"
+#include "ipk_schema.h"
+#include "stats.h"
 
-int content_auth(char **content, char *username, char *display_name, char *secret);
-int content_join(char **content, char *display_name, char *channel_id);
-int content_message(char **content, char *username, char *message);
-int content_bye(char **content);
-int content_err(char **content, char *username, char *message);
-int tcp_check_msg(char *reply, char **display_name, char **message);
-int tcp_check_reply(char *reply, char **res_succ, char **message);
-int tcp_check_err(char *reply, char **display_name, char **message);
-int tcp_check_bye(char *reply);
\ No newline at end of file
+// tcp_encode_auth(arena, buff, username, display_name, secret), ... see ipk_schema.h
+#define TCP_ENCODER(NAME, name, code, keyword) int tcp_encode_##name(ipk_arena *arena, char **buff IPK_FIELDS_##NAME(IPK_PARAM));
+IPK_TEXT_MESSAGES(TCP_ENCODER)
+
+int tcp_decode(char *line, size_t len, ipk_view *view);
+int tcp_frame_msg(ipk_prefix *prefix, const char *display_name, const char *tag, size_t tag_len, const char *content, size_t length, struct iovec *iov);
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include "trace.h"
+
+int trace_on = 0;
+
+// the client has one thread, so one ring; everything is static, the probes run after arena_seal
+static ipk_trace_event trace_ring[TRACE_RING];
+static unsigned long trace_count = 0;      // events recorded, the ring holds the last TRACE_RING
+static uint32_t trace_ids[TRACE_IDS];      // MessageID -> lifecycle, 0 if none
+static uint32_t trace_next_id = 1;
+static uint32_t trace_awaiting = 0;        // lifecycle waiting for REPLY
+static int trace_awaiting_msg = -1;
+static long long trace_start = 0;
+static long long trace_line_at = 0;        // when the last console line was read, 0 before the first
+static FILE *trace_file = NULL;
+static char trace_buffer[BUFSIZ];
+
+static const char *trace_names[TRACE_STAGES] = {"message", "read", "enqueue", "encode", "send", "retransmit",
+                                                "confirm", "reply", "recv", "message"};
+
+/**
+ * @brief Puts an event into the ring
+ *
+ * @param ts us, absolute
+ * @param id lifecycle
+ * @param stage TraceStage
+ * @param msg_id MessageID, -1 if not known
+ */
+static void trace_record(long long ts, uint32_t id, int stage, int msg_id)
+{
+    ipk_trace_event *event = &trace_ring[trace_count++ % TRACE_RING];
+    event->ts = ts - trace_start;
+    event->id = id;
+    event->msg_id = msg_id;
+    event->stage = stage;
+}
+
+/**
+ * @brief Writes the ring as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev), every
+ * lifecycle is one async slice with its stages as instant steps, at exit
+ */
+static void trace_write()
+{
+    unsigned long first = trace_count > TRACE_RING ? trace_count - TRACE_RING : 0;
+
+    fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(trace_file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"ipk24chat-client\"}}");
+    for (unsigned long i = first; i < trace_count; i++)
+    {
+        ipk_trace_event *event = &trace_ring[i % TRACE_RING];
+        const char *ph = event->stage == TRACE_BEGIN ? "b" : event->stage == TRACE_DONE ? "e" : "n";
+
+        if (event->stage == TRACE_RECV)
+        {
+            fprintf(trace_file, ",\n{\"name\":\"recv\",\"cat\":\"ipk\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":1,\"tid\":1",
+                    event->ts);
+        }
+        else
+        {
+            fprintf(trace_file, ",\n{\"name\":\"%s\",\"cat\":\"ipk\",\"ph\":\"%s\",\"id\":%u,\"ts\":%lld,\"pid\":1,\"tid\":1",
+                    trace_names[event->stage], ph, event->id, event->ts);
+        }
+        if (event->msg_id >= 0) fprintf(trace_file, ",\"args\":{\"msg_id\":%d}", event->msg_id);
+        fprintf(trace_file, "}");
+    }
+    fprintf(trace_file, "\n]}\n");
+    fclose(trace_file);
+}
+
+/**
+ * @brief Turns the tracing on, the file is written when the process exits
+ *
+ * @param path
+ * @return int 1 if the file can not be created, 0 otherwise
+ */
+int trace_open(const char *path)
+{
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL)
+    {
+        fprintf(stderr, "ERR: Can't create trace file %s!\n", path);
+        return 1;
+    }
+    setvbuf(trace_file, trace_buffer, _IOFBF, sizeof(trace_buffer));
+    trace_start = ipk_now_us();
+    trace_on = 1;
+    atexit(trace_write);
+    return 0;
+}
+
+/**
+ * @brief A console line was read, the lifecycles begun for it start here
+ */
+void trace_line()
+{
+    trace_line_at = ipk_now_us();
+}
+
+/**
+ * @brief Starts a lifecycle at the last console line, the chunks of a long message get one each
+ *
+ * @return uint32_t the lifecycle
+ */
+uint32_t trace_begin()
+{
+    uint32_t id = trace_next_id++;
+    long long at = trace_line_at != 0 ? trace_line_at : ipk_now_us();
+
+    if (trace_next_id == 0) trace_next_id = 1;
+    trace_record(at, id, TRACE_BEGIN, -1);
+    if (trace_line_at != 0) trace_record(at, id, TRACE_READ, -1);
+    return id;
+}
+
+/**
+ * @brief Records a stage of a lifecycle
+ *
+ * @param id lifecycle, 0 is ignored
+ * @param stage TraceStage
+ * @param msg_id MessageID, -1 if not known
+ */
+void trace_event(uint32_t id, int stage, int msg_id)
+{
+    if (id == 0) return;
+    trace_record(ipk_now_us(), id, stage, msg_id);
+}
+
+/**
+ * @brief The message of a lifecycle was built with its MessageID, the confirmation layer
+ * finds it by the ID from now on
+ *
+ * @param id lifecycle
+ * @param msg_id
+ */
+void trace_bind(uint32_t id, uint16_t msg_id)
+{
+    if (id == 0) return;
+    trace_ids[msg_id] = id;
+    if (id == trace_awaiting) trace_awaiting_msg = msg_id;
+    trace_record(ipk_now_us(), id, TRACE_ENCODE, msg_id);
+}
+
+/**
+ * @brief Records a stage of the message with the MessageID, CONFIRM ends the lifecycle
+ * unless it still waits for REPLY
+ *
+ * @param stage TraceStage
+ * @param msg_id
+ */
+void trace_msg(int stage, uint16_t msg_id)
+{
+    uint32_t id = trace_ids[msg_id];
+    if (id == 0) return;
+
+    long long now = ipk_now_us();
+    trace_record(now, id, stage, msg_id);
+    if (stage == TRACE_CONFIRM && id != trace_awaiting)
+    {
+        trace_record(now, id, TRACE_DONE, msg_id);
+        trace_ids[msg_id] = 0;
+    }
+}
+
+/**
+ * @brief The lifecycle ends with the REPLY (AUTH, JOIN)
+ *
+ * @param id lifecycle
+ */
+void trace_await(uint32_t id)
+{
+    trace_awaiting = id;
+    trace_awaiting_msg = -1;
+}
+
+/**
+ * @brief REPLY arrived, ends the lifecycle that waited for it
+ */
+void trace_reply()
+{
+    if (trace_awaiting == 0) return;
+
+    long long now = ipk_now_us();
+    trace_record(now, trace_awaiting, TRACE_REPLY, trace_awaiting_msg);
+    trace_record(now, trace_awaiting, TRACE_DONE, trace_awaiting_msg);
+    if (trace_awaiting_msg >= 0) trace_ids[trace_awaiting_msg] = 0;
+    trace_awaiting = 0;
+    trace_awaiting_msg = -1;
+}
+
+/**
+ * @brief A message from the server was printed
+ *
+ * @param msg_id MessageID, -1 on TCP
+ */
+void trace_recv(int msg_id)
+{
+    trace_record(ipk_now_us(), 0, TRACE_RECV, msg_id);
+}
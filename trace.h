@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "monotonic.h"
+
+#define TRACE_RING 65536                // events kept, the oldest are overwritten
+#define TRACE_IDS 65536                 // MessageIDs mapped to their lifecycle
+
+// what happened to a message, one event each
+enum TraceStage
+{
+    TRACE_BEGIN = 0,                    // the lifecycle starts (the console line was read)
+    TRACE_READ,                         // console line read
+    TRACE_ENQUEUE,                      // put into the FIFO (UDP)
+    TRACE_ENCODE,                       // the message was built
+    TRACE_SEND,
+    TRACE_RETRANSMIT,                   // sent again after the CONFIRM timeout (UDP)
+    TRACE_CONFIRM,                      // CONFIRM arrived (UDP)
+    TRACE_REPLY,                        // REPLY to AUTH or JOIN arrived
+    TRACE_RECV,                         // a message from the server was printed
+    TRACE_DONE,                         // the lifecycle ends
+    TRACE_STAGES
+};
+
+// one event in the ring
+typedef struct ipk_trace_event
+{
+    long long ts;                       // us since trace_open
+    uint32_t id;                        // lifecycle
+    int32_t msg_id;                     // MessageID, -1 if not known
+    int stage;                          // TraceStage
+} ipk_trace_event;
+
+extern int trace_on;
+
+int trace_open(const char *path);
+void trace_line();
+uint32_t trace_begin();
+void trace_event(uint32_t id, int stage, int msg_id);
+void trace_bind(uint32_t id, uint16_t msg_id);
+void trace_msg(int stage, uint16_t msg_id);
+void trace_await(uint32_t id);
+void trace_reply();
+void trace_recv(int msg_id);
+
+/*
+ * The probes at the lifecycle sites (--trace). Disabled each one is a single branch on trace_on,
+ * a lifecycle id of 0 is not traced.
+ */
+#define TRACE_LINE() do { if (trace_on) trace_line(); } while (0)
+#define TRACE_BEGIN(id) do { if (trace_on) (id) = trace_begin(); } while (0)
+#define TRACE(id, stage) do { if (trace_on) trace_event(id, stage, -1); } while (0)
+#define TRACE_BIND(id, msg_id) do { if (trace_on) { trace_bind(id, msg_id); (id) = 0; } } while (0)
+#define TRACE_MSG(stage, msg_id) do { if (trace_on) trace_msg(stage, msg_id); } while (0)
+#define TRACE_AWAIT(id) do { if (trace_on) trace_await(id); } while (0)
+#define TRACE_REPLIED() do { if (trace_on) trace_reply(); } while (0)
+#define TRACE_RECEIVED(msg_id) do { if (trace_on) trace_recv(msg_id); } while (0)
+
+#endif
@@ -1,207 +1,215 @@
 #include "udp.h"
 
 /**
-  * @brief Constructs a CONFIRM message and executes it in the buff variable
-  *
-  * @param content message
-  * @param length pointer to the total length of the string, which is initially 0
-  * @param lsb least significant bit
-  * @param msb the most significant bit
-  * @return int 1 if an allocation error occurred, 0 otherwise
-  */
-int confirm(char **content, size_t *length, uint8_t *lsb, uint8_t *msb)
+ * @brief Appends a zero terminated parameter, the value is checked first
+ *
+ * @param p end of the message
+ * @param value the parameter
+ * @param cls what the parameter is
+ * @return char* new end of the message, NULL if the value is not allowed
+ */
+static char *udp_put_word(char *p, const char *value, enum ScanClass cls)
 {
-    *length = 3;
-    *content = (char *) malloc(*length + 1);
+    size_t length;
 
-    if (*content == NULL)
-    {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
-    }
+    if (value == NULL || !scan_valid(value, length = strlen(value), cls)) return NULL;
 
-    snprintf(*content, *length + 1, "%c%c%c", 0x00, *msb, *lsb);
-    return 0;
+    memcpy(p, value, length + 1);
+    return p + length + 1;
 }
 
 /**
- * @brief Builds an AUTH message and stores it in the buff variable
+ * @brief Appends a 16 bit number in network byte order
  *
- * @param content the message
- * @param length pointer to the total length of the string, which is initially 0
- * @param lsb least significant bit
- * @param msb most significant bit
- * @param username the login name
- * @param display_name the name to be represented by
- * @param secret secret password/key
- * @return int 1 if an allocation error occurred, 0 otherwise
+ * @param p end of the message
+ * @param value
+ * @return char* new end of the message
  */
-int auth(char **content, size_t *length, uint8_t *lsb, uint8_t *msb, char *username, char *display_name, char *secret)
+static char *udp_put_u16(char *p, uint16_t value)
 {
-    *length = strlen(username) + strlen(display_name) + strlen(secret) + 6;
-    *content = (char *) malloc(*length + 1);
+    *p++ = (char) (value >> 8);
+    *p++ = (char) (value & 0xFF);
+    return p;
+}
 
-    if (*content == NULL)
-    {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
+#define UDP_PUT_WORD(p, field, cls) udp_put_word(p, field, cls)
+#define UDP_PUT_TEXT(p, field, cls) udp_put_word(p, field, cls)
+#define UDP_PUT_RESULT(p, field, cls) (*p = (char) (field != 0), p + 1)
+#define UDP_PUT_REF(p, field, cls) udp_put_u16(p, field)
+#define UDP_PUT_FIELD(NAME, field, keyword, kind, cls) \
+    if ((p = UDP_PUT_##kind(p, field, cls)) == NULL) \
+    { \
+        fprintf(stderr, "ERR: Invalid " #field " in " #NAME "!\n"); \
+        return 1; \
     }
 
-    snprintf(*content, *length, "%c%c%c%s%c%s%c%s%c", 0x02, *msb, *lsb, username, '\0', display_name, '\0', secret, '\0');
-    return 0;
+/*
+ * Builds the message and stores it in the buff variable, the buffer has the maximum
+ * size of the message (IPK_BIN_MAX_*), so no length is computed beforehand.
+ * length is set to the number of bytes to send, lsb and msb are the MessageID.
+ * Returns 1 if the arena is full or a parameter is not allowed, 0 otherwise.
+ */
+#define UDP_ENCODER_BODY(NAME, name, code, keyword) \
+int udp_encode_##name(ipk_arena *arena, char **buff, size_t *length, uint8_t *lsb, uint8_t *msb IPK_FIELDS_##NAME(IPK_PARAM)) \
+{ \
+    STATS_MESSAGE(STATS_TX, code); \
+    char *p = *buff = (char *) arena_alloc(arena, IPK_BIN_MAX_##NAME); \
+    if (p == NULL) \
+    { \
+        fprintf(stderr, "ERR: Memory allocation failed!\n"); \
+        return 1; \
+    } \
+    STATS_ALLOC(IPK_BIN_MAX_##NAME); \
+    *p++ = (char) code; \
+    *p++ = (char) *msb; \
+    *p++ = (char) *lsb; \
+    IPK_FIELDS_##NAME(UDP_PUT_FIELD) \
+    *length = p - *buff; \
+    return 0; \
 }
+IPK_MESSAGES(UDP_ENCODER_BODY)
 
 /**
- * @brief Builds a JOIN message and stores it in the buff variable
+ * @brief Increments the ID by 1
  *
- * @param content the message
- * @param length pointer to the total length of the string, which is initially 0
  * @param lsb least significant bit
  * @param msb most significant bit
- * @param channel_id the new channel
- * @param display_name the name to be represented by
- * @return int 1 if an allocation error occurred, 0 otherwise
  */
-int join(char **content, size_t *length, uint8_t *lsb, uint8_t *msb, char *channel_id, char *display_name)
+void message_id_increase(uint8_t *lsb, uint8_t *msb)
 {
-    *length = strlen(channel_id) + strlen(display_name) + 5;
-    *content = (char *) malloc(*length + 1);
-
-    if (*content == NULL)
+    if (*msb == 0xFF && *lsb == 0xFF)
+        *msb = *lsb = 0x00;
+    else if (*lsb == 0xFF)
     {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
+        *lsb = 0x00;
+        (*msb)++;
     }
-
-    snprintf(*content, *length + 1, "%c%c%c%s%c%s%c", 0x03, *msb, *lsb, channel_id, 0x00, display_name, 0x00);
-    return 0;
+    else (*lsb)++;
 }
 
 /**
- * @brief Builds an MSG message and stores it in the buff variable
+ * @brief Checks one zero terminated parameter of a message
  *
- * @param content the message
- * @param length pointer to the total length of the string, which is initially 0
- * @param lsb least significant bit
- * @param msb most significant bit
- * @param display_name the name to be represented by
- * @param message_contents the message specified by the user
- * @return int 1 if an allocation error occurred, 0 otherwise
+ * @param buf the message
+ * @param start beginning of the parameter
+ * @param len size of the message
+ * @param cls what the parameter is
+ * @param field set to the parameter
+ * @param field_len set to the length of the parameter without the zero byte
+ * @return size_t position behind the zero byte, 0 if the parameter is invalid
  */
-int msg(char **content, size_t *length, uint8_t *lsb, uint8_t *msb, char *display_name, char *message_contents)
+static size_t udp_get_word(char *buf, size_t start, size_t len, enum ScanClass cls, char **field, size_t *field_len)
 {
-    *length = strlen(display_name) + strlen(message_contents) + 5;
-    *content = (char *) malloc(*length);
+    int valid;
 
-    if (*content == NULL)
-    {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
-    }
+    if (start >= len) return 0;
 
-    snprintf(*content, *length, "%c%c%c%s%c%s%c", 0x04, *msb, *lsb, display_name, 0x00, message_contents, 0x00);
-    return 0;
+    size_t length = scan_field(buf + start, len - start, 0x00, cls, &valid);
+    if (!valid || length == 0 || length > scan_max(cls) || start + length >= len) return 0;
+
+    *field = buf + start;
+    *field_len = length;
+    return start + length + 1;
 }
 
+#define UDP_GET_WORD(field, cls) (pos = udp_get_word(buf, pos, len, cls, &view->field, &view->field##_len)) == 0
+#define UDP_GET_TEXT(field, cls) UDP_GET_WORD(field, cls)
+#define UDP_GET_RESULT(field, cls) pos >= len || bytes[pos] > 1 || (view->field = bytes[pos++], 0)
+#define UDP_GET_REF(field, cls) pos + 2 > len || (view->field = (uint16_t) (bytes[pos] << 8 | bytes[pos + 1]), pos += 2, 0)
+#define UDP_GET_FIELD(NAME, field, keyword, kind, cls) \
+    if (UDP_GET_##kind(field, cls)) return 1;
+#define UDP_DECODE_CASE(NAME, name, code, keyword) \
+    case code: \
+        IPK_FIELDS_##NAME(UDP_GET_FIELD) \
+        break;
+
 /**
- * @brief Builds an MSG message and stores it in the buff variable
+ * @brief Reads only the header of a datagram, type, MessageID and Ref_MessageID of REPLY,
+ * enough to decide if it is confirmed before it is decoded
  *
- * @param content the message
- * @param length pointer to the total length of the string, which is initially 0
- * @param lsb least significant bit
- * @param msb most significant bit
- * @param display_name the name to be represented by
- * @param message_contents the error message
- * @return int 1 if an allocation error occurred, 0 otherwise
+ * @param buf received datagram
+ * @param len number of received bytes
+ * @param view type, id and ref_id of REPLY are filled in
+ * @return int 1 if the datagram is shorter than the header (6 bytes for REPLY, 3 otherwise), 0 otherwise
  */
-int err(char **content, size_t *length, uint8_t *lsb, uint8_t *msb, char *display_name, char *message_contents)
+int udp_peek(const char *buf, size_t len, ipk_view *view)
 {
-    *length = strlen(display_name) + strlen(message_contents) + 5;
-    *content = (char *) malloc(*length);
+    const uint8_t *bytes = (const uint8_t *) buf;
 
-    if (*content == NULL)
-    {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
-    }
+    if (len < 3 || (bytes[0] == IPK_REPLY && len < 6)) return 1;
 
-    snprintf(*content, *length, "%c%c%c%s%c%s%c", 0xFE, *msb, *lsb, display_name, 0x00, message_contents, 0x00);
+    view->type = bytes[0];
+    view->id = (uint16_t) (bytes[1] << 8 | bytes[2]);
+    view->ref_id = view->type == IPK_REPLY ? (uint16_t) (bytes[4] << 8 | bytes[5]) : 0;
     return 0;
 }
 
 /**
- * @brief Builds a BYE message and stores it in the buff variable
+ * @brief Decodes a datagram from the server without copying it. The parameters of the view
+ * point into buf and are zero terminated, their characters are checked
+ * (DisplayName 0x21-7E, MessageContent 0x20-7E).
+ * Unknown types are not malformed, only the type and the ID are filled in.
  *
- * @param content the message
- * @param length pointer to the total length of the string, which is initially 0
- * @param lsb least significant bit
- * @param msb most significant bit
- * @return int 1 if an allocation error occurred, 0 otherwise
+ * @param buf received datagram
+ * @param len number of received bytes
+ * @param view the decoded message, type and id are valid whenever len >= 3
+ * @return int 1 if the message is malformed, 0 otherwise
  */
-int bye(char **content, size_t *length, uint8_t *lsb, uint8_t *msb)
+int udp_decode(char *buf, size_t len, ipk_view *view)
 {
-    *length = 3;
-    *content = (char *) malloc(*length + 1);
+    const uint8_t *bytes = (const uint8_t *) buf;
+    size_t pos = 3;
 
-    if (*content == NULL)
-    {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
-    }
+    memset(view, 0, sizeof(*view));
+    if (len < 3) return 1;
 
-    snprintf(*content, *length + 1, "%c%c%c", 0xFF, *msb, *lsb);
-    return 0;
-}
+    view->type = bytes[0];
+    view->id = (uint16_t) (bytes[1] << 8 | bytes[2]);
+    STATS_MESSAGE(STATS_RX, view->type);
 
-/**
- * @brief Increments the ID by 1
- *
- * @param lsb least significant bit
- * @param msb most significant bit
- */
-void message_id_increase(uint8_t *lsb, uint8_t *msb)
-{
-    if (*msb == 0xFF && *lsb == 0xFF)
-        *msb = *lsb = 0x00;
-    else if (*lsb == 0xFF)
+    switch (view->type)
     {
-        *lsb = 0x00;
-        (*msb)++;
+        IPK_MESSAGES(UDP_DECODE_CASE)
+        default:
+            return 0;
     }
-    else (*lsb)++;
-}
 
+    // nothing may follow the last parameter
+    return pos != len;
+}
 /**
- * @brief Helper function to get a parameter like name, message, etc.
- * Loops through the entire string and splits it using 0x00
+ * @brief MSG without building it: the cached 0x04 | MessageID | DisplayName 0x00 and the content
+ * where it already is (with its zero). Only the ID is written into the prefix, the prefix is built
+ * when its length is 0. The content was checked by check_param.
  *
- * @param input The input string
- * @param output Output is one string
- * @param start the beginning of the predicted string
- * @param input_size size of the input string
- * @return int 1 if an allocation error occurred, 0 otherwise
+ * @param prefix per session cache
+ * @param display_name
+ * @param lsb
+ * @param msb
+ * @param content zero terminated
+ * @param length without the zero
+ * @param iov at least 2
+ * @return int number of iovecs, 0 if the display name is not allowed
  */
-int udp_message_next(char input[], char **output, int start, size_t input_size)
+int udp_frame_msg(ipk_prefix *prefix, const char *display_name, uint8_t lsb, uint8_t msb, const char *content, size_t length, struct iovec *iov)
 {
-    int i = start;
-
-    while (i < (int) input_size && input[i] != 0x00)
-        i++;
-
-    *output = (char *) malloc((i - start + 1) * sizeof(char));
-    if (*output == NULL)
+    STATS_MESSAGE(STATS_TX, IPK_MSG);
+    if (prefix->length == 0)
     {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        return 1;
+        size_t name_len;
+        if (display_name == NULL || !scan_valid(display_name, name_len = strlen(display_name), SCAN_DNAME))
+        {
+            fprintf(stderr, "ERR: Invalid display_name in MSG!\n");
+            return 0;
+        }
+        prefix->buff[0] = (char) IPK_MSG;
+        memcpy(prefix->buff + 3, display_name, name_len + 1);
+        prefix->length = name_len + 4;
     }
 
-    i = start;
-    while (i < (int) input_size && input[i] != 0x00)
-    {
-        (*output)[i - start] = input[i];
-        i++;
-    }
-
-    (*output)[i - start] = '\0';
-    return 0;
+    prefix->buff[1] = (char) msb;
+    prefix->buff[2] = (char) lsb;
+    iov[0] = (struct iovec) {.iov_base = prefix->buff, .iov_len = prefix->length};
+    iov[1] = (struct iovec) {.iov_base = (char *) content, .iov_len = length + 1};
+    return 2;
 }
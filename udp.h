@@ -3,12 +3,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <sys/uio.h>
+#include "scan.h"
+#include "arena.h"
+#include "ipk_schema.h"
+#include "stats.h"
+
+// udp_encode_auth(arena, buff, length, lsb, msb, username, display_name, secret), ... see ipk_schema.h
+#define UDP_ENCODER(NAME, name, code, keyword) int udp_encode_##name(ipk_arena *arena, char **buff, size_t *length, uint8_t *lsb, uint8_t *msb IPK_FIELDS_##NAME(IPK_PARAM));
+IPK_MESSAGES(UDP_ENCODER)
 
-int confirm(char **content, size_t *length, uint8_t *lsb, uint8_t *msb);
-int auth(char **content, size_t *length, uint8_t *lsb, uint8_t *msb, char *username, char *display_name, char *secret);
-int join(char **content, size_t *length, uint8_t *lsb, uint8_t *msb, char *channel_id, char *display_name);
-int msg(char **content, size_t *length, uint8_t *lsb, uint8_t *msb, char *display_name, char *message_contents);
-int err(char **content, size_t *length, uint8_t *lsb, uint8_t *msb, char *display_name, char *message_contents);
-int bye(char **content, size_t *length, uint8_t *lsb, uint8_t *msb);
 void message_id_increase(uint8_t *lsb, uint8_t *msb);
-int udp_message_next(char input[], char **output, int start, size_t input_size);
\ No newline at end of file
+int udp_peek(const char *buf, size_t len, ipk_view *view);
+int udp_decode(char *buf, size_t len, ipk_view *view);
+int udp_frame_msg(ipk_prefix *prefix, const char *display_name, uint8_t lsb, uint8_t msb, const char *content, size_t length, struct iovec *iov);
\ No newline at end of file
@@ -1,43 +1,116 @@
 #include "udp_fifo.h"
 
+// released nodes, create_node takes them, the heap is not touched after fifo_pool_init
+static ipk_list *fifo_pool = NULL;
+static int fifo_used = 0;       // nodes queued or waiting for CONFIRM, the ipk:queue probe
+static int fifo_pooled = 0;     // nodes in fifo_pool
+
 /**
- * @brief Create a node object
+ * @brief Allocates the nodes once at startup, so queueing a message does not need malloc
  * 
- * @param input console message
- * @return ipk_list* 
+ * @param count number of nodes
  */
-ipk_list* create_node(char *input)
+void fifo_pool_init(int count)
 {
-    ipk_list *new_node = (ipk_list*)malloc(sizeof(ipk_list));
-    if (new_node == NULL)
+    for (int i = 0; i < count; i++)
     {
-        fprintf(stderr, "ERR: Memory allocation failed!\n");
-        exit(1);
+        ipk_list *node = (ipk_list*)malloc(sizeof(ipk_list));
+        if (node == NULL)
+        {
+            fprintf(stderr, "ERR: Memory allocation failed!\n");
+            exit(1);
+        }
+        STATS_MALLOC(sizeof(ipk_list));
+        node->next = fifo_pool;
+        fifo_pool = node;
+        fifo_pooled++;
     }
-    new_node->input = strdup(input);
+}
+
+/**
+ * @brief free memmory of the released nodes
+ * 
+ */
+void fifo_pool_free()
+{
+    while (fifo_pool != NULL)
+    {
+        ipk_list *temp = fifo_pool;
+        fifo_pool = fifo_pool->next;
+        free(temp);
+    }
+    fifo_pooled = 0;
+}
+
+/**
+ * @brief Number of nodes create_node can take, the input is read only
+ * while there are enough of them
+ * 
+ * @return int nodes in the pool
+ */
+int fifo_available()
+{
+    return fifo_pooled;
+}
+
+/**
+ * @brief Create a node object from the pool, the FIFO never grows past FIFO_POOL_SIZE
+ * 
+ * @param input console message
+ * @return ipk_list* NULL if the pool is empty
+ */
+ipk_list* create_node(char *input)
+{
+    ipk_list *new_node = fifo_pool;
+    if (new_node == NULL) return NULL;
+
+    fifo_pool = new_node->next;
+    fifo_pooled--;
+    STATS_ALLOC(sizeof(ipk_list));
+    if (snprintf(new_node->data, sizeof(new_node->data), "%s", input) >= (int) sizeof(new_node->data))
+        fprintf(stderr, "ERR: Input is too long, only its first %d characters are sent!\n", FIFO_INPUT_MAX - 1);
+    new_node->input = new_node->data;
+    new_node->pipelined = 0;
+    new_node->sent_at = 0;
+    new_node->raw = 0;
+    new_node->id = -1;
+    new_node->trace = 0;
     new_node->next = NULL;
+    fifo_used++;
+    USDT1(queue, fifo_used);
     return new_node;
 }
 
 /**
- * @brief insert new message at the end
+ * @brief give the node back to the pool
+ * 
+ * @param node 
+ */
+void release_node(ipk_list *node)
+{
+    TRACE(node->trace, TRACE_DONE);     // a line that was not sent, a sent one moved to its MessageID
+    node->trace = 0;
+    node->next = fifo_pool;
+    fifo_pool = node;
+    fifo_pooled++;
+    fifo_used--;
+    USDT1(queue, fifo_used);
+}
+
+/**
+ * @brief insert message at the beginning, it will be processed first
  * 
  * @param head 
  * @param input console message
+ * @return int 0 if it was inserted, 1 if the pool is empty
  */
-void insert_at_end(ipk_list **head, char *input)
+int insert_at_front(ipk_list **head, char *input)
 {
     ipk_list *new_node = create_node(input);
-    if (*head == NULL)
-    {
-        *head = new_node;
-        return;
-    }
-    ipk_list *temp = *head;
-    while (temp->next != NULL)
-        temp = temp->next;
-
-    temp->next = new_node;
+    if (new_node == NULL) return 1;
+    new_node->next = *head;
+    *head = new_node;
+    return 0;
 }
 
 /**
@@ -55,7 +128,27 @@ ipk_list* remove_from_front(ipk_list **head)
 }
 
 /**
- * @brief free memmory
+ * @brief remove the message with the given ID
+ * 
+ * @param head 
+ * @param id MessageID
+ * @return ipk_list* NULL if there is no such message
+ */
+ipk_list* remove_by_id(ipk_list **head, int id)
+{
+    for (ipk_list **temp = head; *temp != NULL; temp = &(*temp)->next)
+    {
+        if ((*temp)->id != id) continue;
+
+        ipk_list *found = *temp;
+        *temp = found->next;
+        return found;
+    }
+    return NULL;
+}
+
+/**
+ * @brief give all nodes back to the pool
  * 
  * @param head 
  */
@@ -65,7 +158,160 @@ void free_fifo(ipk_list *head)
     {
         ipk_list *temp = head;
         head = head->next;
-        free(temp->input);
-        free(temp);
+        release_node(temp);
+    }
+}
+
+/**
+ * @brief empty lanes
+ * 
+ * @param lanes 
+ */
+void lanes_init(ipk_lanes *lanes)
+{
+    for (int i = 0; i < LANE_COUNT; i++) lanes->head[i] = lanes->tail[i] = NULL;
+    lanes->burst = 0;
+}
+
+/**
+ * @brief append a node to the end of a lane
+ * 
+ * @param lanes 
+ * @param lane LANE_CONTROL or LANE_CHAT
+ * @param node 
+ */
+static void lanes_append(ipk_lanes *lanes, int lane, ipk_list *node)
+{
+    if (lanes->tail[lane] == NULL) lanes->head[lane] = node;
+    else lanes->tail[lane]->next = node;
+    lanes->tail[lane] = node;
+    TRACE_BEGIN(node->trace);
+    TRACE(node->trace, TRACE_ENQUEUE);
+}
+
+/**
+ * @brief insert the input at the end of its lane, a command goes to LANE_CONTROL,
+ * a pipelined message always goes to LANE_CHAT even if it starts with '/'
+ * 
+ * @param lanes 
+ * @param input console message
+ * @param pipelined 1 if it is a chunk of a long message or a -f message, it does not wait for the previous CONFIRM
+ * @return int 0 if it was queued, 1 if the pool is empty
+ */
+int lanes_push(ipk_lanes *lanes, char *input, int pipelined)
+{
+    ipk_list *node = create_node(input);
+    if (node == NULL) return 1;
+    node->pipelined = pipelined;
+    lanes_append(lanes, input[0] == '/' && !pipelined ? LANE_CONTROL : LANE_CHAT, node);
+    return 0;
+}
+
+/**
+ * @brief insert a message that is not a console line at the end of LANE_CHAT,
+ * it is sent as MSG as it is even if it starts with '/'
+ * 
+ * @param lanes 
+ * @param content MessageContent
+ * @return int 0 if it was queued, 1 if the pool is empty
+ */
+int lanes_push_raw(ipk_lanes *lanes, char *content)
+{
+    ipk_list *node = create_node(content);
+    if (node == NULL) return 1;
+    node->raw = 1;
+    lanes_append(lanes, LANE_CHAT, node);
+    return 0;
+}
+
+/**
+ * @brief insert a command at the front of LANE_CONTROL, it is taken before everything queued
+ * 
+ * @param lanes 
+ * @param input command
+ * @return int 0 if it was queued, 1 if the pool is empty
+ */
+int lanes_push_front(ipk_lanes *lanes, char *input)
+{
+    if (insert_at_front(&lanes->head[LANE_CONTROL], input)) return 1;
+    if (lanes->tail[LANE_CONTROL] == NULL) lanes->tail[LANE_CONTROL] = lanes->head[LANE_CONTROL];
+    return 0;
+}
+
+/**
+ * @brief put messages back at the front of LANE_CHAT in their order (the ones that waited for CONFIRM)
+ * 
+ * @param lanes 
+ * @param list 
+ */
+void lanes_requeue(ipk_lanes *lanes, ipk_list *list)
+{
+    if (list == NULL) return;
+
+    ipk_list *last = list;
+    while (last->next != NULL)
+        last = last->next;
+    last->next = lanes->head[LANE_CHAT];
+    lanes->head[LANE_CHAT] = list;
+    if (lanes->tail[LANE_CHAT] == NULL) lanes->tail[LANE_CHAT] = last;
+}
+
+/**
+ * @brief remove the next input, commands first, but after LANE_CONTROL_BURST commands
+ * in a row one waiting message goes, so messages are not starved
+ * 
+ * @param lanes 
+ * @return ipk_list* NULL if both lanes are empty
+ */
+ipk_list* lanes_pop(ipk_lanes *lanes)
+{
+    int lane = LANE_CONTROL;
+
+    if (lanes->head[LANE_CHAT] == NULL) lanes->burst = 0;
+    else if (lanes->head[LANE_CONTROL] == NULL || lanes->burst >= LANE_CONTROL_BURST)
+    {
+        lanes->burst = 0;
+        lane = LANE_CHAT;
+    }
+    else lanes->burst++;
+
+    ipk_list *node = remove_from_front(&lanes->head[lane]);
+    if (lanes->head[lane] == NULL) lanes->tail[lane] = NULL;
+    return node;
+}
+
+/**
+ * @brief check if nothing is queued
+ * 
+ * @param lanes 
+ * @return int 1 if both lanes are empty, 0 otherwise
+ */
+int lanes_empty(ipk_lanes *lanes)
+{
+    return lanes->head[LANE_CONTROL] == NULL && lanes->head[LANE_CHAT] == NULL;
+}
+
+/**
+ * @brief check if lanes_pop would return a pipelined message, it can go before the previous CONFIRM
+ * 
+ * @param lanes 
+ * @return int 1 if no command waits and the next message is pipelined, 0 otherwise
+ */
+int lanes_next_pipelined(ipk_lanes *lanes)
+{
+    return lanes->head[LANE_CONTROL] == NULL && lanes->head[LANE_CHAT] != NULL && lanes->head[LANE_CHAT]->pipelined;
+}
+
+/**
+ * @brief give all nodes of both lanes back to the pool
+ * 
+ * @param lanes 
+ */
+void lanes_free(ipk_lanes *lanes)
+{
+    for (int i = 0; i < LANE_COUNT; i++)
+    {
+        free_fifo(lanes->head[i]);
+        lanes->head[i] = lanes->tail[i] = NULL;
     }
 }
\ No newline at end of file
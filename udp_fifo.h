@@ -1,14 +1,53 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "stats.h"
+#include "trace.h"
+#include "usdt.h"
+
+#define FIFO_INPUT_MAX 1401     // the longest console line with '\0'
+#define FIFO_POOL_SIZE 128      // nodes allocated at startup, the input is not read when they run out
+#define FIFO_RESERVE 2          // nodes kept for AUTH and JOIN replayed after a reconnect
+#define LANE_CONTROL 0          // commands (/auth, /join, /rename, /help)
+#define LANE_CHAT 1             // messages
+#define LANE_COUNT 2
+#define LANE_CONTROL_BURST 4    // commands taken in a row while a message waits, then one message
 
 typedef struct ipk_list
 {
     char *input;
+    int pipelined;              // a chunk of a long message or a -f message, sent without waiting for the previous CONFIRM
+    int raw;                    // MessageContent from --ring, never taken as a command
+    int id;                     // MessageID while it waits for CONFIRM, -1 otherwise
+    long long sent_at;          // -f, when the MSG was sent, us
+    uint32_t trace;             // lifecycle of --trace until the message is built, 0 if none
     struct ipk_list *next;
+    char data[FIFO_INPUT_MAX];  // input points here
 } ipk_list;
 
+// the FIFO split by priority, commands overtake queued messages
+typedef struct ipk_lanes
+{
+    ipk_list *head[LANE_COUNT];
+    ipk_list *tail[LANE_COUNT];     // the last node of each lane, appending does not walk the lane
+    int burst;                  // commands taken in a row while a message waited
+} ipk_lanes;
+
+void fifo_pool_init(int count);
+void fifo_pool_free();
+int fifo_available();
 ipk_list* create_node(char *input);
-void insert_at_end(ipk_list **head, char *input);
+void release_node(ipk_list *node);
+int insert_at_front(ipk_list **head, char *input);
 ipk_list* remove_from_front(ipk_list **head);
-void free_fifo(ipk_list *head);
\ No newline at end of file
+ipk_list* remove_by_id(ipk_list **head, int id);
+void free_fifo(ipk_list *head);
+void lanes_init(ipk_lanes *lanes);
+int lanes_push(ipk_lanes *lanes, char *input, int pipelined);
+int lanes_push_raw(ipk_lanes *lanes, char *content);
+int lanes_push_front(ipk_lanes *lanes, char *input);
+void lanes_requeue(ipk_lanes *lanes, ipk_list *list);
+ipk_list* lanes_pop(ipk_lanes *lanes);
+int lanes_empty(ipk_lanes *lanes);
+int lanes_next_pipelined(ipk_lanes *lanes);
+void lanes_free(ipk_lanes *lanes);
\ No newline at end of file
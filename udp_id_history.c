@@ -1,26 +1,47 @@
 #include "udp_id_history.h"
 
 /**
- * @brief add new ID to node
+ * @brief create empty ID history
  * 
- * @param head 
- * @param id 
+ * @return Node* 
  */
-void add_node(Node **head, int id)
+Node *create_list()
 {
-    Node *newNode = (Node *) malloc(sizeof(Node));
-    if (newNode == NULL)
+    Node *head = (Node *) calloc(1, sizeof(Node));
+    if (head == NULL)
     {
         fprintf(stderr, "ERR: Memory allocation failed\n");
         exit(1);
     }
-    newNode->data.id = id;
-    newNode->next = *head;
-    *head = newNode;
+    STATS_MALLOC(sizeof(Node));
+    return head;
 }
 
 /**
- * @brief search ID in Node list
+ * @brief forget all IDs
+ * 
+ * @param head 
+ */
+void clear_list(Node *head)
+{
+    memset(head->seen, 0, sizeof(head->seen));
+}
+
+/**
+ * @brief add new ID to history
+ * 
+ * @param head 
+ * @param id 
+ */
+void add_node(Node **head, int id)
+{
+    if (*head == NULL) *head = create_list();
+    id &= ID_COUNT - 1;
+    (*head)->seen[id >> 3] |= (unsigned char) (1 << (id & 7));
+}
+
+/**
+ * @brief search ID in history
  * 
  * @param head 
  * @param id 
@@ -28,47 +49,22 @@ void add_node(Node **head, int id)
  */
 Node *search_node(Node *head, int id)
 {
-    Node *current = head;
-    while (current != NULL)
-    {
-        if (current->data.id == id) 
-        {
-            return current;
-        }
-        current = current->next;
-    }
-    return NULL;
+    if (head == NULL) return NULL;
+    id &= ID_COUNT - 1;
+    return (head->seen[id >> 3] & (1 << (id & 7))) ? head : NULL;
 }
 
 /**
- * @brief delete Node with ID
+ * @brief delete ID from history
  * 
  * @param head 
  * @param id 
  */
 void delete_node(Node **head, int id)
 {
-    Node *current = *head;
-    Node *prev = NULL;
-
-    while (current != NULL && current->data.id != id)
-    {
-        prev = current;
-        current = current->next;
-    }
-
-    if (current != NULL)
-    {
-        if (prev == NULL)
-        {
-            *head = current->next;
-        }
-        else
-        {
-            prev->next = current->next;
-        }
-        free(current);
-    }
+    if (*head == NULL) return;
+    id &= ID_COUNT - 1;
+    (*head)->seen[id >> 3] &= (unsigned char) ~(1 << (id & 7));
 }
 
 /**
@@ -78,11 +74,5 @@ void delete_node(Node **head, int id)
  */
 void free_list(Node *head)
 {
-    Node *current = head;
-    while (current != NULL)
-    {
-        Node *temp = current;
-        current = current->next;
-        free(temp);
-    }
+    free(head);
 }
@@ -1,18 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "stats.h"
 
-typedef struct
-{
-    int id;
-} Data;
+#define ID_COUNT 65536      // MessageID is uint16
 
+// one bit for every MessageID, allocated once instead of a node per message
 typedef struct Node
 {
-    Data data;
-    struct Node *next;
+    unsigned char seen[ID_COUNT / 8];
 } Node;
 
+Node *create_list();
+void clear_list(Node *head);
 void add_node(Node **head, int id);
 Node *search_node(Node *head, int id);
 void delete_node(Node **head, int id);
-void free_list(Node *head);
+void free_list(Node *head);
\ No newline at end of file
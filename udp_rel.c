@@ -0,0 +1,477 @@
+#include "udp_rel.h"
+#include "udp_id_history.h"
+
+/**
+ * @brief The real clock for ipk_clock, ipk_now_us in milliseconds
+ *
+ * @param ctx unused
+ * @return long long milliseconds
+ */
+long long rel_monotonic(void *ctx)
+{
+    (void) ctx;
+    return ipk_now_us() / 1000;
+}
+
+/**
+ * @brief send or sendto on the UDP socket
+ *
+ * @param ctx pointer to the socket, it changes after a reconnect
+ * @param buff
+ * @param length
+ * @param addr NULL on a connected socket
+ * @param addr_len
+ * @return ssize_t result of send or sendto
+ */
+ssize_t rel_socket_send(void *ctx, const char *buff, size_t length, const struct sockaddr *addr, socklen_t addr_len)
+{
+    if (addr == NULL) return send(*(int *) ctx, buff, length, 0);
+    return sendto(*(int *) ctx, buff, length, 0, addr, addr_len);
+}
+
+/**
+ * @brief recvfrom on the UDP socket
+ *
+ * @param ctx pointer to the socket
+ * @param buff
+ * @param size
+ * @param addr sender of the datagram
+ * @param addr_len
+ * @return ssize_t result of recvfrom
+ */
+ssize_t rel_socket_recv(void *ctx, char *buff, size_t size, struct sockaddr *addr, socklen_t *addr_len)
+{
+    return recvfrom(*(int *) ctx, buff, size, 0, addr, addr_len);
+}
+
+/**
+ * @brief sendmsg on the UDP socket, the datagram is gathered by the kernel
+ *
+ * @param ctx pointer to the socket
+ * @param iov
+ * @param count
+ * @param addr NULL on a connected socket
+ * @param addr_len
+ * @return ssize_t result of sendmsg
+ */
+ssize_t rel_socket_sendv(void *ctx, const struct iovec *iov, int count, const struct sockaddr *addr, socklen_t addr_len)
+{
+    struct msghdr msg = {.msg_name = (void *) addr, .msg_namelen = addr != NULL ? addr_len : 0, .msg_iov = (struct iovec *) iov, .msg_iovlen = count};
+    return sendmsg(*(int *) ctx, &msg, 0);
+}
+
+/**
+ * @brief connect on the UDP socket, see udp_connect
+ *
+ * @param ctx pointer to the socket
+ * @param addr
+ * @param addr_len
+ * @return int 1 if connect failed, 0 otherwise
+ */
+int rel_socket_connect(void *ctx, const struct sockaddr *addr, socklen_t addr_len)
+{
+    return udp_connect(*(int *) ctx, addr, addr_len);
+}
+
+/**
+ * @brief Sends a datagram to the server, a connected transport already knows where
+ *
+ * @param rel
+ * @param buff
+ * @param length
+ * @return ssize_t result of the transport
+ */
+static ssize_t rel_transmit(ipk_rel *rel, const char *buff, size_t length)
+{
+    return STATS_CALL(STATS_SEND, rel->transport.send(rel->transport.ctx, buff, length, rel->connected ? NULL : rel->server, rel->server_len));
+}
+
+/**
+ * @brief Sends the message of a slot, a gathered one with the gathered send of the transport
+ *
+ * @param rel
+ * @param slot
+ * @return ssize_t result of the transport
+ */
+static ssize_t rel_transmit_slot(ipk_rel *rel, ipk_rel_slot *slot)
+{
+    if (slot->iov_count == 0) return rel_transmit(rel, slot->buff, slot->length);
+    return STATS_CALL(STATS_SEND, rel->transport.sendv(rel->transport.ctx, slot->iov, slot->iov_count, rel->connected ? NULL : rel->server, rel->server_len));
+}
+
+/**
+ * @brief Takes a free slot for a message, it waits for CONFIRM from now on
+ *
+ * @param rel
+ * @param slot
+ * @param length
+ * @param id
+ */
+static void rel_hold(ipk_rel *rel, ipk_rel_slot *slot, size_t length, uint16_t id)
+{
+    slot->length = length;
+    slot->id = id;
+    slot->retx_left = rel->max_retx;
+    slot->deadline = rel->clock.now(rel->clock.ctx) + rel->conf_timeout;
+    rel->waiting++;
+    rel->sent++;
+}
+
+/**
+ * @brief Sets up the layer, nothing waits for CONFIRM
+ *
+ * @param rel
+ * @param clock
+ * @param transport
+ * @param server address of the server, the port is changed in place by rel_switch_port
+ * @param server_len
+ * @param conf_timeout time to wait for CONFIRM in ms
+ * @param max_retx retransmissions before giving up
+ * @param seen udp id history
+ */
+void rel_init(ipk_rel *rel, ipk_clock clock, ipk_transport transport, struct sockaddr *server, socklen_t server_len, int conf_timeout, int max_retx, struct Node *seen)
+{
+    memset(rel, 0, sizeof(*rel));
+    rel->clock = clock;
+    rel->transport = transport;
+    rel->server = server;
+    rel->server_len = server_len;
+    rel->conf_timeout = conf_timeout;
+    rel->max_retx = max_retx > 0 ? max_retx : 0;
+    rel->seen = seen;
+    rel->rtt = -1;
+    rel_reset(rel);
+}
+
+/**
+ * @brief Forgets the messages waiting for CONFIRM, e.g. after a reconnect
+ *
+ * @param rel
+ */
+void rel_reset(ipk_rel *rel)
+{
+    for (int i = 0; i < REL_WINDOW; i++) rel->slots[i].id = -1;
+    rel->waiting = 0;
+}
+
+/**
+ * @brief The slot the next rel_send uses
+ *
+ * @param rel
+ * @return ipk_rel_slot* NULL if the window is full
+ */
+static ipk_rel_slot *rel_free_slot(ipk_rel *rel)
+{
+    for (int i = 0; i < REL_WINDOW; i++)
+        if (rel->slots[i].id == -1) return &rel->slots[i];
+    return NULL;
+}
+
+/**
+ * @brief Buffer of the slot the next rel_send uses, a message built right there is not copied again
+ *
+ * @param rel
+ * @return char* REL_SLOT_SIZE bytes, NULL if the window is full
+ */
+char *rel_buffer(ipk_rel *rel)
+{
+    ipk_rel_slot *slot = rel_free_slot(rel);
+    return slot != NULL ? slot->buff : NULL;
+}
+
+/**
+ * @brief Sends a message that has to be confirmed, a copy is kept for the retransmissions
+ *
+ * @param rel
+ * @param buff the message, it may already be in the slot (rel_buffer)
+ * @param length
+ * @param id its MessageID
+ * @return int 1 if the window is full or sending failed, 0 otherwise
+ */
+int rel_send(ipk_rel *rel, const char *buff, size_t length, uint16_t id)
+{
+    ipk_rel_slot *slot = rel_free_slot(rel);
+
+    if (slot == NULL || length > REL_SLOT_SIZE)
+    {
+        fprintf(stderr, "ERR: Can't send message!\n");
+        return 1;
+    }
+
+    if (buff != slot->buff) memcpy(slot->buff, buff, length);
+    slot->iov_count = 0;
+    rel_hold(rel, slot, length, id);
+
+    if (rel_transmit(rel, buff, length) < 0)
+    {
+        fprintf(stderr, "ERR: Can't send message!\n");
+        return 1;
+    }
+    USDT3(send, (uint8_t) slot->buff[0], id, length);
+    TRACE_MSG(TRACE_SEND, id);
+    return 0;
+}
+
+/**
+ * @brief rel_send of a message in parts (udp_frame_msg). The header is copied into the slot,
+ * the rest is sent from where it is, so it must stay there until CONFIRM (rel_ack or rel_reset).
+ * A transport without the gathered send gets a copy of the whole message.
+ *
+ * @param rel
+ * @param iov the header first
+ * @param count at most REL_IOV
+ * @param id its MessageID
+ * @return int 1 if the window is full or sending failed, 0 otherwise
+ */
+int rel_sendv(ipk_rel *rel, const struct iovec *iov, int count, uint16_t id)
+{
+    ipk_rel_slot *slot = rel_free_slot(rel);
+    size_t length = 0;
+
+    for (int i = 0; i < count; i++) length += iov[i].iov_len;
+    if (slot == NULL || count > REL_IOV || length > REL_SLOT_SIZE)
+    {
+        fprintf(stderr, "ERR: Can't send message!\n");
+        return 1;
+    }
+
+    // the header always (the caller's prefix changes with the next message), the rest only for a transport
+    // that can't gather
+    size_t pos = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (i == 0 || rel->transport.sendv == NULL) memcpy(slot->buff + pos, iov[i].iov_base, iov[i].iov_len);
+        slot->iov[i] = iov[i];
+        pos += iov[i].iov_len;
+    }
+    slot->iov[0].iov_base = slot->buff;
+    slot->iov_count = rel->transport.sendv != NULL ? count : 0;
+    rel_hold(rel, slot, length, id);
+
+    if (rel_transmit_slot(rel, slot) < 0)
+    {
+        fprintf(stderr, "ERR: Can't send message!\n");
+        return 1;
+    }
+    USDT3(send, (uint8_t) slot->buff[0], id, length);
+    TRACE_MSG(TRACE_SEND, id);
+    return 0;
+}
+
+/**
+ * @brief Sends CONFIRM (or anything else that is not confirmed), once
+ *
+ * @param rel
+ * @param buff
+ * @param length
+ * @return int 1 if sending failed, 0 otherwise
+ */
+int rel_confirm(ipk_rel *rel, const char *buff, size_t length)
+{
+    if (rel_transmit(rel, buff, length) < 0)
+    {
+        fprintf(stderr, "ERR: Can't send message!\n");
+        return 1;
+    }
+    USDT3(send, (uint8_t) buff[0], length >= 3 ? (uint8_t) buff[1] << 8 | (uint8_t) buff[2] : -1, length);
+    return 0;
+}
+
+/**
+ * @brief Receives one datagram
+ *
+ * @param rel
+ * @param buff
+ * @param size
+ * @param from sender, its port is used by rel_switch_port
+ * @param from_len
+ * @return ssize_t number of bytes, -1 on error
+ */
+ssize_t rel_recv(ipk_rel *rel, char *buff, size_t size, struct sockaddr *from, socklen_t *from_len)
+{
+    return STATS_CALL(STATS_RECV, rel->transport.recv(rel->transport.ctx, buff, size, from, from_len));
+}
+
+/**
+ * @brief CONFIRM arrived, checks it against the messages waiting for it
+ *
+ * @param rel
+ * @param id MessageID of the CONFIRM
+ * @return int 1 if it confirms a waiting message, 0 otherwise (late or duplicate CONFIRM)
+ */
+int rel_ack(ipk_rel *rel, uint16_t id)
+{
+    for (int i = 0; i < REL_WINDOW; i++)
+    {
+        if (rel->slots[i].id != id) continue;
+
+        // Karn, a retransmitted message gives no sample, its CONFIRM may be for either copy
+        if (rel->slots[i].retx_left == rel->max_retx)
+            rel->rtt = rel->clock.now(rel->clock.ctx) - (rel->slots[i].deadline - rel->conf_timeout);
+        USDT2(confirm, id, rel->max_retx - rel->slots[i].retx_left);
+        rel->slots[i].id = -1;
+        rel->waiting--;
+        TRACE_MSG(TRACE_CONFIRM, id);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Check if nothing waits for CONFIRM
+ *
+ * @param rel
+ * @return int 1 if no message waits, 0 otherwise
+ */
+int rel_idle(ipk_rel *rel)
+{
+    return rel->waiting == 0;
+}
+
+/**
+ * @brief Check if the window is full
+ *
+ * @param rel
+ * @return int 1 if REL_WINDOW messages wait for CONFIRM, 0 otherwise
+ */
+int rel_full(ipk_rel *rel)
+{
+    return rel->waiting == REL_WINDOW;
+}
+
+/**
+ * @brief Check if a message waits for CONFIRM
+ *
+ * @param rel
+ * @param id MessageID
+ * @return int 1 if it waits, 0 otherwise
+ */
+int rel_waiting(ipk_rel *rel, uint16_t id)
+{
+    for (int i = 0; i < REL_WINDOW; i++)
+        if (rel->slots[i].id == id) return 1;
+    return 0;
+}
+
+/**
+ * @brief How long poll can wait before a retransmission is due
+ *
+ * @param rel
+ * @return int milliseconds until the earliest deadline, -1 if nothing waits for CONFIRM
+ */
+int rel_wait(ipk_rel *rel)
+{
+    long long left = -1;
+    long long now = rel->clock.now(rel->clock.ctx);
+
+    for (int i = 0; i < REL_WINDOW; i++)
+    {
+        if (rel->slots[i].id == -1) continue;
+
+        long long slot_left = rel->slots[i].deadline - now;
+        if (slot_left < 0) slot_left = 0;
+        if (left == -1 || slot_left < left) left = slot_left;
+    }
+    return (int) left;
+}
+
+/**
+ * @brief Sends the waiting messages again when their CONFIRM did not come in time
+ *
+ * @param rel
+ * @return int 1 if something was sent again, 0 if nothing was due, -1 if the retransmissions
+ * of a message ran out, -2 if sending failed
+ */
+int rel_timeout(ipk_rel *rel)
+{
+    long long now = rel->clock.now(rel->clock.ctx);
+    int resent = 0;
+
+    for (int i = 0; i < REL_WINDOW; i++)
+    {
+        ipk_rel_slot *slot = &rel->slots[i];
+        if (slot->id == -1 || now < slot->deadline) continue;
+
+        if (slot->retx_left == 0) return -1;
+
+        slot->retx_left--;
+        slot->deadline = now + rel->conf_timeout;
+        rel->retransmits++;
+        resent = 1;
+        // the retransmission is charged to its message type, the wakeup was for it
+        STATS_MESSAGE(STATS_TX, (uint8_t) slot->buff[0]);
+        USDT2(retransmit, slot->id, slot->retx_left);
+        TRACE_MSG(TRACE_RETRANSMIT, (uint16_t) slot->id);
+        if (rel_transmit_slot(rel, slot) < 0)
+        {
+            fprintf(stderr, "ERR: Can't send message!\n");
+            return -2;
+        }
+    }
+    return resent;
+}
+
+/**
+ * @brief Check if a message from the server already arrived, without recording its ID
+ * (rel_duplicate does that once the message is handled)
+ *
+ * @param rel
+ * @param id MessageID
+ * @return int 1 if it is a retransmission, 0 otherwise
+ */
+int rel_seen(ipk_rel *rel, uint16_t id)
+{
+    if (search_node(rel->seen, id) == NULL) return 0;
+
+    USDT1(duplicate, id);
+    rel->duplicates++;
+    return 1;
+}
+
+/**
+ * @brief Records the ID of a message from the server
+ *
+ * @param rel
+ * @param id MessageID
+ * @return int 1 if the message already arrived (a retransmission), 0 otherwise
+ */
+int rel_duplicate(ipk_rel *rel, uint16_t id)
+{
+    if (search_node(rel->seen, id) != NULL)
+    {
+        USDT1(duplicate, id);
+        rel->duplicates++;
+        return 1;
+    }
+
+    add_node(&rel->seen, id);
+    return 0;
+}
+
+/**
+ * @brief The server answers from a new port, everything else goes there. The transport is connected
+ * to it if it can be, so datagrams from anyone else are dropped and an unreachable server is reported
+ * right away, without the retransmissions.
+ *
+ * @param rel
+ * @param from sender of the first REPLY
+ */
+void rel_switch_port(ipk_rel *rel, struct sockaddr *from)
+{
+    sockaddr_set_port(rel->server, sockaddr_get_port(from));
+
+    if (rel->transport.connect == NULL) return;
+
+    rel->connected = rel->transport.connect(rel->transport.ctx, rel->server, rel->server_len) == 0;
+    if (!rel->connected) fprintf(stderr, "ERR: Can't connect the socket to the server, it stays unconnected!\n");
+}
+
+/**
+ * @brief A new socket after a reconnect is not connected, it sends to the server address again
+ *
+ * @param rel
+ */
+void rel_disconnect(ipk_rel *rel)
+{
+    rel->connected = 0;
+}
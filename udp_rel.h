@@ -0,0 +1,97 @@
+#ifndef UDP_REL_H
+#define UDP_REL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "monotonic.h"
+#include "net_connect.h"
+#include "stats.h"
+#include "trace.h"
+#include "usdt.h"
+
+struct Node;
+
+#define REL_WINDOW 8            // messages waiting for CONFIRM at the same time
+#define REL_SLOT_SIZE 1500      // the longest datagram
+#define REL_IOV 2               // header and content of a gathered MSG
+
+// where the time comes from, CLOCK_MONOTONIC or the virtual clock of the simulation
+typedef struct ipk_clock
+{
+    long long (*now)(void *ctx);    // milliseconds
+    void *ctx;
+} ipk_clock;
+
+// how datagrams move, the UDP socket or the simulated network
+typedef struct ipk_transport
+{
+    ssize_t (*send)(void *ctx, const char *buff, size_t length, const struct sockaddr *addr, socklen_t addr_len);
+    ssize_t (*recv)(void *ctx, char *buff, size_t size, struct sockaddr *addr, socklen_t *addr_len);
+    int (*connect)(void *ctx, const struct sockaddr *addr, socklen_t addr_len);    // NULL if it can't connect
+    void *ctx;
+    // gathered send, NULL if the transport has none (a gathered message is then copied into its slot)
+    ssize_t (*sendv)(void *ctx, const struct iovec *iov, int count, const struct sockaddr *addr, socklen_t addr_len);
+} ipk_transport;
+
+// a message waiting for CONFIRM
+typedef struct ipk_rel_slot
+{
+    char buff[REL_SLOT_SIZE];       // copy of the message, of the header of a gathered one
+    size_t length;
+    struct iovec iov[REL_IOV];      // a gathered message, the content stays with the caller until CONFIRM
+    int iov_count;                  // 0 if the whole message is in buff
+    int id;                         // its MessageID, -1 if the slot is free
+    int retx_left;
+    long long deadline;             // when it is sent again, ms
+} ipk_rel_slot;
+
+// the reliability layer of the UDP variant: the messages waiting for CONFIRM (usually one, the chunks
+// of a long message share a window), their retransmissions, the server port switch and the IDs
+// of the messages that already arrived
+typedef struct ipk_rel
+{
+    ipk_clock clock;
+    ipk_transport transport;
+    struct sockaddr *server;        // destination, its port changes with the first REPLY
+    socklen_t server_len;
+    int connected;                  // the transport is connected to server, it sends without the address
+    int conf_timeout;               // ms
+    int max_retx;                   // retransmissions before giving up
+    struct Node *seen;              // udp id history
+    ipk_rel_slot slots[REL_WINDOW];
+    int waiting;                    // used slots
+    unsigned long sent;             // messages sent with rel_send
+    unsigned long retransmits;
+    unsigned long duplicates;       // messages that arrived again, their CONFIRM was lost
+    long long rtt;                  // ms, CONFIRM of the last message that was not sent again, -1 when taken
+} ipk_rel;
+
+long long rel_monotonic(void *ctx);
+ssize_t rel_socket_send(void *ctx, const char *buff, size_t length, const struct sockaddr *addr, socklen_t addr_len);
+ssize_t rel_socket_recv(void *ctx, char *buff, size_t size, struct sockaddr *addr, socklen_t *addr_len);
+ssize_t rel_socket_sendv(void *ctx, const struct iovec *iov, int count, const struct sockaddr *addr, socklen_t addr_len);
+int rel_socket_connect(void *ctx, const struct sockaddr *addr, socklen_t addr_len);
+void rel_init(ipk_rel *rel, ipk_clock clock, ipk_transport transport, struct sockaddr *server, socklen_t server_len, int conf_timeout, int max_retx, struct Node *seen);
+void rel_reset(ipk_rel *rel);
+char *rel_buffer(ipk_rel *rel);
+int rel_send(ipk_rel *rel, const char *buff, size_t length, uint16_t id);
+int rel_sendv(ipk_rel *rel, const struct iovec *iov, int count, uint16_t id);
+int rel_confirm(ipk_rel *rel, const char *buff, size_t length);
+ssize_t rel_recv(ipk_rel *rel, char *buff, size_t size, struct sockaddr *from, socklen_t *from_len);
+int rel_ack(ipk_rel *rel, uint16_t id);
+int rel_idle(ipk_rel *rel);
+int rel_full(ipk_rel *rel);
+int rel_waiting(ipk_rel *rel, uint16_t id);
+int rel_wait(ipk_rel *rel);
+int rel_timeout(ipk_rel *rel);
+int rel_seen(ipk_rel *rel, uint16_t id);
+int rel_duplicate(ipk_rel *rel, uint16_t id);
+void rel_switch_port(ipk_rel *rel, struct sockaddr *from);
+void rel_disconnect(ipk_rel *rel);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef USDT_H
+#define USDT_H
+
+/*
+ * USDT probes (provider ipk) for bpftrace and perf, see bpftrace/. With <sys/sdt.h> (systemtap-sdt-dev)
+ * a probe is a nop in the code and a note in the ELF, a tracer patches it in when it attaches.
+ * Without the header (or with make USDT=0) the probes are nothing.
+ *
+ *   ipk:recv(type, id, len)       datagram or line received and decoded, id -1 on TCP
+ *   ipk:send(type, id, len)       message handed to the kernel, type and id -1 on TCP
+ *   ipk:confirm(id, retransmits)  CONFIRM matched a waiting message
+ *   ipk:retransmit(id, left)      a message sent again after its CONFIRM timeout
+ *   ipk:duplicate(id)             a message from the server that already arrived
+ *   ipk:state(from, to)           state of the session loop changed
+ *   ipk:queue(depth)              FIFO nodes queued or waiting for CONFIRM
+ */
+#if !defined(IPK_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define USDT_ENABLED 1
+#endif
+#endif
+
+#ifdef USDT_ENABLED
+#define USDT1(probe, a) DTRACE_PROBE1(ipk, probe, a)
+#define USDT2(probe, a, b) DTRACE_PROBE2(ipk, probe, a, b)
+#define USDT3(probe, a, b, c) DTRACE_PROBE3(ipk, probe, a, b, c)
+#else
+#define USDT_ENABLED 0
+#define USDT1(probe, a) ((void) 0)
+#define USDT2(probe, a, b) ((void) 0)
+#define USDT3(probe, a, b, c) ((void) 0)
+#endif
+
+// fires ipk:state when the state differs from the last one seen, at the top of a session loop
+#define USDT_STATE(seen, now) \
+    do { if (USDT_ENABLED && (int) (now) != (seen)) { USDT2(state, seen, now); (seen) = (int) (now); } } while (0)
+
+#endif